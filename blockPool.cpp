@@ -0,0 +1,142 @@
+/*
+ * Block Pool Class
+ *
+ * A lock-free pool of fixed size blocks. Allocating and releasing never
+ * disables interrupts or takes a lock, so both are safe from ISRs and from
+ * any number of threads at once.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "blockPool.hpp"
+#include "collectionCommon.hpp"
+
+void* BlockPool::allocate() {
+    uint32_t oldHead = core_util_atomic_load_u32(&this->head);
+    uint32_t newHead;
+    uint32_t index;
+
+    do {
+        index = oldHead & 0xFFFF;
+        if (!index) {
+            //Free list is empty, taking a block that has never been used instead
+            uint32_t unused = core_util_atomic_load_u32(&this->fresh);
+            do {
+                if (unused >= (uint32_t) this->blockCount) {
+                    core_util_atomic_incr_u32(&this->failures, 1);
+                    return nullptr;
+                }
+            } while (!core_util_atomic_cas_u32(&this->fresh, &unused, unused + 1));
+
+            index = unused + 1;
+            break;
+        }
+
+        //If another context took this block first the tag will have changed and the swap fails
+        newHead = ((oldHead + 0x10000) & 0xFFFF0000) | this->links[index - 1];
+    } while (!core_util_atomic_cas_u32(&this->head, &oldHead, newHead));
+
+    uint32_t used = core_util_atomic_incr_u32(&this->inUse, 1);
+    uint32_t peak = core_util_atomic_load_u32(&this->highWater);
+    while (used > peak && !core_util_atomic_cas_u32(&this->highWater, &peak, used));
+
+    return this->storage + (index - 1) * this->blockSize;
+}
+
+void BlockPool::release(void* block) {
+    uint32_t index = ((uint8_t*) block - this->storage) / this->blockSize + 1;
+    uint32_t oldHead = core_util_atomic_load_u32(&this->head);
+    uint32_t newHead;
+
+    do {
+        this->links[index - 1] = oldHead & 0xFFFF;
+        newHead = ((oldHead + 0x10000) & 0xFFFF0000) | index;
+    } while (!core_util_atomic_cas_u32(&this->head, &oldHead, newHead));
+
+    core_util_atomic_decr_u32(&this->inUse, 1);
+}
+
+//Size classes sized for display commands, which are 2 to 16 bytes
+MBED_ALIGN(4) static uint8_t pool8Storage[16 * 8];
+MBED_ALIGN(4) static uint8_t pool16Storage[16 * 16];
+MBED_ALIGN(4) static uint8_t pool32Storage[8 * 32];
+static uint16_t pool8Links[16];
+static uint16_t pool16Links[16];
+static uint16_t pool32Links[8];
+
+static BlockPool pools[] = {
+    BlockPool(pool8Storage, pool8Links, 8, 16),
+    BlockPool(pool16Storage, pool16Links, 16, 16),
+    BlockPool(pool32Storage, pool32Links, 32, 8)
+};
+
+static const int poolCount = sizeof(pools) / sizeof(pools[0]);
+
+static volatile uint32_t heapFallbacks = 0;
+
+//Heap blocks freed from an ISR, chained through their own first word until a thread frees them
+static void* volatile deferredFrees = nullptr;
+
+static void freeDeferred() {
+    void* ptr = core_util_atomic_exchange_ptr(&deferredFrees, nullptr);
+
+    while (ptr) {
+        void* next = *(void**) ptr;
+        free(ptr);
+        ptr = next;
+    }
+}
+
+const BlockPool* getBlockPools(int* count) {
+    *count = poolCount;
+    return pools;
+}
+
+int getHeapFallbacks() {
+    return heapFallbacks;
+}
+
+void* malloc_safe(size_t size) {
+    for (int i = 0; poolCount > i; i++) {
+        if (size <= (size_t) pools[i].getBlockSize()) {
+            void* ret = pools[i].allocate();
+            if (ret) {
+                return ret;
+            }
+        }
+    }
+
+    if (core_util_is_isr_active()) {
+        //The heap can not be touched from an ISR
+        return nullptr;
+    }
+
+    freeDeferred();
+    core_util_atomic_incr_u32(&heapFallbacks, 1);
+    return malloc(size);
+}
+
+void free_safe(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    for (int i = 0; poolCount > i; i++) {
+        if (pools[i].owns(ptr)) {
+            pools[i].release(ptr);
+            return;
+        }
+    }
+
+    if (core_util_is_isr_active()) {
+        //Deferring to the next thread that allocates or frees
+        void* oldHead = deferredFrees;
+        do {
+            *(void**) ptr = oldHead;
+        } while (!core_util_atomic_cas_ptr(&deferredFrees, &oldHead, ptr));
+        return;
+    }
+
+    freeDeferred();
+    free(ptr);
+}
@@ -0,0 +1,90 @@
+/*
+ * Block Pool Class
+ *
+ * A lock-free pool of fixed size blocks. Allocating and releasing never
+ * disables interrupts or takes a lock, so both are safe from ISRs and from
+ * any number of threads at once. Blocks are tracked by index with a tag that
+ * changes on every update, which stops an ISR that interrupts a thread
+ * mid-update from corrupting the free list.
+ *
+ * The constructor is constexpr so global pools are ready before any static
+ * constructor runs, blocks are handed out in order until each has been used once.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_BLOCK_POOL_INCLUDED
+#define COLLECTION_BLOCK_POOL_INCLUDED
+
+#include <mbed.h>
+#include <stdint.h>
+
+class BlockPool {
+    private:
+
+    uint8_t* storage;
+    uint16_t* links; //Index + 1 of the next free block, 0 ends the list
+    int blockSize;
+    int blockCount;
+
+    volatile uint32_t head; //Tag in the upper half, index + 1 of the first free block in the lower half
+    volatile uint32_t fresh; //Number of blocks that have never been allocated, they are not in the free list
+    volatile uint32_t inUse;
+    volatile uint32_t highWater;
+    volatile uint32_t failures;
+
+    public:
+
+    /**
+     * @param storage Memory for the blocks, at least blockSize * blockCount bytes and word aligned
+     * @param links Bookkeeping memory, one entry per block
+     * @param blockSize The size of every block in bytes, a multiple of 4
+     * @param blockCount The number of blocks, up to 65535
+     */
+    constexpr BlockPool(uint8_t* storage, uint16_t* links, int blockSize, int blockCount) :
+        storage(storage), links(links), blockSize(blockSize), blockCount(blockCount),
+        head(0), fresh(0), inUse(0), highWater(0), failures(0) {}
+
+    /**
+     * Takes a block from the pool. Safe to call from an ISR.
+     * @return the block, nullptr if the pool is exhausted
+     */
+    void* allocate();
+
+    /**
+     * Returns a block to the pool. Safe to call from an ISR.
+     * @param block A block previously returned by allocate()
+     */
+    void release(void* block);
+
+    /** Returns true if the pointer is a block from this pool */
+    inline bool owns(const void* ptr) const {
+        return (const uint8_t*) ptr >= this->storage && (const uint8_t*) ptr < this->storage + this->blockSize * this->blockCount;
+    }
+
+    inline int getBlockSize() const { return this->blockSize; }
+
+    inline int getBlockCount() const { return this->blockCount; }
+
+    /** Returns the number of blocks currently allocated */
+    inline int getInUse() const { return this->inUse; }
+
+    /** Returns the largest number of blocks that have been allocated at once */
+    inline int getHighWater() const { return this->highWater; }
+
+    /** Returns the number of allocations that failed because the pool was exhausted */
+    inline int getFailures() const { return this->failures; }
+};
+
+/**
+ * Returns the pools behind malloc_safe, ordered from smallest to largest block size
+ * @param count Set to the number of pools
+ */
+const BlockPool* getBlockPools(int* count);
+
+/**
+ * Returns the number of malloc_safe calls that went to the heap because no pool could serve them
+ */
+int getHeapFallbacks();
+
+#endif // COLLECTION_BLOCK_POOL_INCLUDED
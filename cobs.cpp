@@ -0,0 +1,169 @@
+/*
+ * COBS Functions
+ *
+ * Consistent Overhead Byte Stuffing removes every zero byte from a frame so
+ * that a single zero can mark the end of each frame on the wire. The overhead
+ * is one byte per 254 bytes of payload.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "cobs.hpp"
+
+int cobsEncode(const void* src, int size, uint8_t* dst) {
+    CobsSpan in;
+    in.data = (const uint8_t*) src;
+    in.size = size;
+
+    return cobsEncode(&in, 1, dst);
+}
+
+int cobsEncode(const CobsSpan* in, int inCount, uint8_t* dst) {
+    int codeIndex = 0;
+    int out = 1;
+    uint8_t code = 1;
+
+    for (int s = 0; inCount > s; s++) {
+        const uint8_t* bytes = in[s].data;
+
+        for (int i = 0; in[s].size > i; i++) {
+            if (bytes[i] == 0) {
+                //Zeros are replaced by the distance to the next zero
+                dst[codeIndex] = code;
+                codeIndex = out++;
+                code = 1;
+            } else {
+                dst[out++] = bytes[i];
+                code++;
+
+                if (code == 0xFF) {
+                    //Block is full, starting a new one without an implied zero
+                    dst[codeIndex] = code;
+                    codeIndex = out++;
+                    code = 1;
+                }
+            }
+        }
+    }
+
+    dst[codeIndex] = code;
+    return out;
+}
+
+int cobsEncodeSpans(const CobsSpan* in, int inCount, uint8_t* codes, CobsSpan* out, int maxOut) {
+    int outCount = 0;
+    int codeCount = 0;
+    int codeIndex = 0;
+    int dataSpan = -1; //Output span that the current run of data is being added to
+    uint8_t code = 1;
+
+    if (maxOut < 1) {
+        return -1;
+    }
+
+    //The first block's code byte
+    codeIndex = codeCount++;
+    out[outCount].data = &codes[codeIndex];
+    out[outCount++].size = 1;
+
+    for (int s = 0; inCount > s; s++) {
+        for (int i = 0; in[s].size > i; i++) {
+            const uint8_t* p = &in[s].data[i];
+
+            if (*p != 0) {
+                if (dataSpan >= 0 && out[dataSpan].data + out[dataSpan].size == p) {
+                    out[dataSpan].size++;
+                } else {
+                    if (outCount == maxOut) {
+                        return -1;
+                    }
+                    dataSpan = outCount++;
+                    out[dataSpan].data = p;
+                    out[dataSpan].size = 1;
+                }
+
+                code++;
+                if (code != 0xFF) {
+                    continue;
+                }
+            }
+
+            //Either a zero or a full block, both end the current block
+            codes[codeIndex] = code;
+            code = 1;
+            dataSpan = -1;
+
+            if (outCount == maxOut) {
+                return -1;
+            }
+            codeIndex = codeCount++;
+            out[outCount].data = &codes[codeIndex];
+            out[outCount++].size = 1;
+        }
+    }
+
+    codes[codeIndex] = code;
+    return outCount;
+}
+
+CobsDecoder::CobsDecoder(void* buffer, int capacity) {
+    this->buffer = (uint8_t*) buffer;
+    this->capacity = capacity;
+    this->reset();
+}
+
+void CobsDecoder::reset() {
+    this->length = 0;
+    this->remaining = 0;
+    this->code = 0xFF;
+    this->started = false;
+    this->completed = false;
+    this->overflow = false;
+    this->malformed = false;
+}
+
+int CobsDecoder::feed(const uint8_t* data, int size, bool* complete) {
+    *complete = false;
+
+    if (this->completed) {
+        //The previous frame has been handed out, starting over
+        this->reset();
+    }
+
+    for (int i = 0; size > i; i++) {
+        uint8_t b = data[i];
+
+        if (b == 0) {
+            //End of frame, it is only well formed if the last block was complete
+            this->malformed = this->malformed || this->remaining != 0;
+            this->completed = true;
+            *complete = true;
+            return i + 1;
+        }
+
+        if (this->remaining == 0) {
+            //Code byte, the block before it ended in a zero unless it was full
+            if (this->started && this->code != 0xFF) {
+                if (this->length < this->capacity) {
+                    this->buffer[this->length++] = 0;
+                } else {
+                    this->overflow = true;
+                }
+            }
+
+            this->started = true;
+            this->code = b;
+            this->remaining = b - 1;
+            continue;
+        }
+
+        if (this->length < this->capacity) {
+            this->buffer[this->length++] = b;
+        } else {
+            this->overflow = true;
+        }
+        this->remaining--;
+    }
+
+    return size;
+}
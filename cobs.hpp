@@ -0,0 +1,112 @@
+/*
+ * COBS Functions
+ *
+ * Consistent Overhead Byte Stuffing removes every zero byte from a frame so
+ * that a single zero can mark the end of each frame on the wire. The overhead
+ * is one byte per 254 bytes of payload.
+ *
+ * The encoder can either copy into an output buffer or produce a list of
+ * spans that point back into the payload for scatter-gather transmission.
+ * The decoder is incremental and can be fed any number of bytes at a time.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_COBS_INCLUDED
+#define COLLECTION_COBS_INCLUDED
+
+#include <stdint.h>
+
+/**
+ * A contiguous region of bytes used as input or output of the encoder
+ */
+struct CobsSpan {
+    const uint8_t* data;
+    int size;
+};
+
+/**
+ * Returns the largest possible encoded size of a payload, not including the frame delimiter
+ */
+inline int cobsMaxEncodedSize(int size) { return size + size / 254 + 1; }
+
+/**
+ * Encodes a payload into the output buffer. No frame delimiter is appended.
+ * @param src The payload to encode
+ * @param size The size of the payload in bytes
+ * @param dst The output buffer, must be at least cobsMaxEncodedSize(size) bytes
+ * @return the number of bytes written to dst
+ */
+int cobsEncode(const void* src, int size, uint8_t* dst);
+
+/**
+ * Encodes a payload made of several spans into the output buffer. No frame delimiter is appended.
+ * @param in The spans making up the payload, in order
+ * @param inCount The number of input spans
+ * @param dst The output buffer, must be at least cobsMaxEncodedSize(total) bytes
+ * @return the number of bytes written to dst
+ */
+int cobsEncode(const CobsSpan* in, int inCount, uint8_t* dst);
+
+/**
+ * Encodes a payload made of several spans without copying it. The output is a list
+ * of spans alternating between the code bytes, which are stored in codes, and runs of
+ * non-zero bytes in the original payload. No frame delimiter is appended.
+ * @param in The spans making up the payload, in order
+ * @param inCount The number of input spans
+ * @param codes Storage for code bytes, one per zero in the payload plus one per 254 byte block plus one
+ * @param out The list of output spans
+ * @param maxOut The capacity of out
+ * @return the number of output spans, -1 if more than maxOut would be needed
+ */
+int cobsEncodeSpans(const CobsSpan* in, int inCount, uint8_t* codes, CobsSpan* out, int maxOut);
+
+/**
+ * Incremental decoder that collects one frame at a time into a buffer
+ */
+class CobsDecoder {
+    private:
+
+    uint8_t* buffer;
+    int capacity;
+    int length;
+    int remaining; //Data bytes left in the current block, 0 when a code byte is expected next
+    uint8_t code;
+    bool started;
+    bool completed;
+    bool overflow;
+    bool malformed;
+
+    public:
+
+    /**
+     * @param buffer The buffer to decode frames into
+     * @param capacity The size of the buffer in bytes, frames longer than this are dropped
+     */
+    CobsDecoder(void* buffer, int capacity);
+
+    /**
+     * Decodes bytes until the end of a frame is reached or the input runs out.
+     * @param data The encoded bytes
+     * @param size The number of encoded bytes
+     * @param complete Set to true if a frame delimiter was reached
+     * @return the number of bytes consumed, including the delimiter
+     */
+    int feed(const uint8_t* data, int size, bool* complete);
+
+    /**
+     * Discards the frame in progress
+     */
+    void reset();
+
+    /** Returns the decoded frame, valid once feed() reports a complete frame */
+    inline const uint8_t* frame() { return this->buffer; }
+
+    /** Returns the length of the decoded frame */
+    inline int frameLength() { return this->length; }
+
+    /** Returns true if the completed frame was decoded without overflowing or being truncated */
+    inline bool valid() { return !this->overflow && !this->malformed; }
+};
+
+#endif // COLLECTION_COBS_INCLUDED
@@ -6,20 +6,13 @@
 #include <mbed.h>
 
 //A safer version of malloc, free
-//Originally intended to protect against heap corruption from an ISR, but
-//due to the operation of new and delete this isn't very effective.
-inline void* malloc_safe(size_t size) {
-    //__disable_irq();
-    void* ret = malloc(size);
-    //__enable_irq();
-    return ret;
-}
-
-inline void free_safe(void* ptr) {
-    //__disable_irq();
-    free(ptr);
-    //__enable_irq();
-}
+//Small allocations come from lock-free fixed size block pools (see blockPool.hpp), which are safe
+//to use from an ISR. Larger allocations fall back to the heap, which is only possible outside of an ISR,
+//so malloc_safe returns nullptr from an ISR once the pools are exhausted. Heap blocks passed to
+//free_safe from an ISR are queued and freed by the next thread that calls either function.
+void* malloc_safe(size_t size);
+
+void free_safe(void* ptr);
 
 //#define printMalloc(ptr) printfdbg("m: %p %s:%d\n", ptr, __FILE__, __LINE__)
 
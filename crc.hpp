@@ -0,0 +1,34 @@
+/*
+ * CRC Functions
+ *
+ * Table driven CRC16 and CRC32 checksums. Both functions can be called
+ * incrementally by passing the result of the previous call back in.
+ * The tables are const so they stay in flash.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_CRC_INCLUDED
+#define COLLECTION_CRC_INCLUDED
+
+#include <stdint.h>
+
+/**
+ * CRC-16/CCITT-FALSE (polynomial 0x1021, not reflected)
+ * @param data The bytes to checksum
+ * @param size The number of bytes
+ * @param crc The previous result to continue from, 0xFFFF to start a new checksum
+ * @return the updated checksum
+ */
+uint16_t crc16(const void* data, int size, uint16_t crc = 0xFFFF);
+
+/**
+ * CRC-32 as used by ethernet and zlib (polynomial 0x04C11DB7, reflected)
+ * @param data The bytes to checksum
+ * @param size The number of bytes
+ * @param crc The previous result to continue from, 0 to start a new checksum
+ * @return the updated checksum
+ */
+uint32_t crc32(const void* data, int size, uint32_t crc = 0);
+
+#endif // COLLECTION_CRC_INCLUDED
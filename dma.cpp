@@ -12,6 +12,7 @@
 
 char dmaInit = 0;
 char dmaAlloced = 0;
+static void (*releaseHandler)() = nullptr;
 
 void initDMA() {
     dmaInit = 1;
@@ -29,58 +30,23 @@ void initDMA() {
     LPC_GPDMA->DMACConfig = 0x1; //enabling DMA and setting it to little endian mode
 }
 
+static LPC_GPDMACH_TypeDef* const dmaChannels[8] = {
+    LPC_GPDMACH0, LPC_GPDMACH1, LPC_GPDMACH2, LPC_GPDMACH3,
+    LPC_GPDMACH4, LPC_GPDMACH5, LPC_GPDMACH6, LPC_GPDMACH7
+};
+
 /**
  * Allocates from highest priority to lowest, so plan calls accordingly
  */
 DMA_CHANNEL* allocateDMA() {
-    if (!dmaInit) initDMA();
-
-    //Getting current DMA enabled channels
-    unsigned long int channels = LPC_GPDMA->DMACEnbldChns | dmaAlloced;
-
-    DMA_CHANNEL* ret = (DMA_CHANNEL*) malloc(sizeof(DMA_CHANNEL));
+    DMA_CHANNEL* ret = createDMA();
 
-    //There are 8 channels that can be used
-    if (!(channels & 0x1)) {
-        //Channel 0 available
-        ret->dmaCH = LPC_GPDMACH0;
-        ret->dmaCHNum = 0;
-    } else if (!(channels & 0x2)) {
-        //Channel 1 available
-        ret->dmaCH = LPC_GPDMACH1;
-        ret->dmaCHNum = 1;
-    } else if (!(channels & 0x4)) {
-        //Channel 2 available
-        ret->dmaCH = LPC_GPDMACH2;
-        ret->dmaCHNum = 2;
-    } else if (!(channels & 0x8)) {
-        //Channel 3 available
-        ret->dmaCH = LPC_GPDMACH3;
-        ret->dmaCHNum = 3;
-    } else if (!(channels & 0x10)) {
-        //Channel 4 available
-        ret->dmaCH = LPC_GPDMACH4;
-        ret->dmaCHNum = 4;
-    } else if (!(channels & 0x20)) {
-        //Channel 5 available
-        ret->dmaCH = LPC_GPDMACH5;
-        ret->dmaCHNum = 5;
-    } else if (!(channels & 0x40)) {
-        //Channel 6 available
-        ret->dmaCH = LPC_GPDMACH6;
-        ret->dmaCHNum = 6;
-    } else if (!(channels & 0x80)) {
-        //Channel 7 available
-        ret->dmaCH = LPC_GPDMACH7;
-        ret->dmaCHNum = 7;
-    } else {
+    if (!claimDMA(ret)) {
         //No available channels
         free(ret);
         return nullptr;
     }
 
-    dmaAlloced |= 1 << ret->dmaCHNum;
-
     //Returns with all those other fields uninitialized
     //so it is mandatory that the implementing driver initialize all fields.
     return ret;
@@ -90,8 +56,74 @@ DMA_CHANNEL* allocateDMA() {
  * De-allocates a DMA channel
  */
 void deallocateDMA(DMA_CHANNEL* ch) {
-    stopDMA(ch);
-    dmaAlloced &= ~(0x1 << ch->dmaCHNum);
+    releaseDMA(ch);
+}
+
+/**
+ * Creates a DMA channel object without a hardware channel
+ */
+DMA_CHANNEL* createDMA() {
+    if (!dmaInit) initDMA();
+
+    DMA_CHANNEL* ret = (DMA_CHANNEL*) malloc(sizeof(DMA_CHANNEL));
+    ret->dmaCH = nullptr;
+    ret->dmaCHNum = -1;
+
+    return ret;
+}
+
+/**
+ * Claims the highest priority free hardware channel
+ */
+char claimDMA(DMA_CHANNEL* ch) {
+    if (ch->dmaCH) {
+        //Already holding one
+        return 1;
+    }
+
+    core_util_critical_section_enter();
+
+    //Getting current DMA enabled channels
+    unsigned long int channels = LPC_GPDMA->DMACEnbldChns | dmaAlloced;
+
+    //There are 8 channels that can be used
+    for (int i = 0; 8 > i; i++) {
+        if (!(channels & (0x1 << i))) {
+            ch->dmaCH = dmaChannels[i];
+            ch->dmaCHNum = i;
+            dmaAlloced |= 1 << i;
+            break;
+        }
+    }
+
+    core_util_critical_section_exit();
+
+    return ch->dmaCH != nullptr;
+}
+
+/**
+ * Stops and gives back the hardware channel
+ */
+void releaseDMA(DMA_CHANNEL* ch) {
+    core_util_critical_section_enter();
+
+    bool released = ch->dmaCH != nullptr;
+    if (released) {
+        stopDMA(ch);
+        dmaAlloced &= ~(0x1 << ch->dmaCHNum);
+        ch->dmaCH = nullptr;
+        ch->dmaCHNum = -1;
+    }
+
+    core_util_critical_section_exit();
+
+    if (released && releaseHandler) {
+        releaseHandler();
+    }
+}
+
+void attachDMARelease(void (*handler)()) {
+    releaseHandler = handler;
 }
 
 /**
@@ -183,6 +215,133 @@ void startDMA(DMA_CHANNEL* ch) {
     ch->dmaCH->DMACCConfig = config;
 }
 
+/**
+ * Starts a circular DMA transfer that never completes on its own.
+ * transferSize is the length of the ring in transfer transactions.
+ */
+void startDMACircular(DMA_CHANNEL* ch, unsigned long int start) {
+    unsigned long int config = 0x0 | ((ch->source & 0xF) << 1) | ((ch->destination & 0xF) << 6) | ((ch->transferType) << 11) | (0x3 << 14);
+
+    ch->dmaCH->DMACCConfig = config;
+
+    unsigned int sourceByteWidth = 1;
+    unsigned int destByteWidth = 1;
+
+    if (ch->sourceWidth == TRANSFER_WIDTH_WORD) {
+        sourceByteWidth = 4;
+    } else if (ch->sourceWidth == TRANSFER_WIDTH_HALF_WORD) {
+        sourceByteWidth = 2;
+    }
+
+    if (ch->destWidth == TRANSFER_WIDTH_WORD) {
+        destByteWidth = 4;
+    } else if (ch->destWidth == TRANSFER_WIDTH_HALF_WORD) {
+        destByteWidth = 2;
+    }
+
+    //Every element of the ring lives in the linked list, the last one pointing back to the first
+    unsigned int remainingSize = ch->transferSize;
+    unsigned int currentSource = ch->sourceAddr;
+    unsigned int currentDest = ch->destAddr;
+    int numElements = remainingSize % 4092 == 0 ? remainingSize / 4092 : remainingSize / 4092 + 1;
+
+    if (ch->transferSize > DMA_MAX_CIRCULAR_SIZE) {
+        numElements = 16;
+        remainingSize = DMA_MAX_CIRCULAR_SIZE;
+    }
+
+    for (int i = 0; numElements > i; i++) {
+        unsigned int elementSize = remainingSize > 4092 ? 4092 : remainingSize;
+        remainingSize -= elementSize;
+
+        ch->list[i].startAddr = currentSource;
+        ch->list[i].destAddr = currentDest;
+        ch->list[i].nextLLI = ch->list + ((i + 1) % numElements);
+        ch->list[i].control = (elementSize) | ((ch->sourceBurst & 0x7) << 12) |
+                          ((ch->destBurst & 0x7) << 15) | ((ch->sourceWidth & 0x3) << 18) |
+                          ((ch->destWidth & 0x3) << 21) | ((ch->sourceMode & 0x1) << 26) |
+                          ((ch->destMode & 0x1) << 27);
+
+        currentSource += ch->sourceMode == DMA_ADDRESS_INCREMENT ? elementSize * sourceByteWidth : 0;
+        currentDest += ch->destMode == DMA_ADDRESS_INCREMENT ? elementSize * destByteWidth : 0;
+    }
+
+    //The channel registers start out as what is left of the element holding the start
+    int first = start / 4092 < (unsigned int) numElements ? start / 4092 : numElements - 1;
+    unsigned int skipped = start - first * 4092;
+    unsigned int firstSize = (ch->list[first].control & 0xFFF) - skipped;
+
+    ch->dmaCH->DMACCSrcAddr = ch->list[first].startAddr + (ch->sourceMode == DMA_ADDRESS_INCREMENT ? skipped * sourceByteWidth : 0);
+    ch->dmaCH->DMACCDestAddr = ch->list[first].destAddr + (ch->destMode == DMA_ADDRESS_INCREMENT ? skipped * destByteWidth : 0);
+    ch->dmaCH->DMACCLLI = ((unsigned long int)ch->list[first].nextLLI) & 0xFFFFFFFC;
+    ch->dmaCH->DMACCControl = (ch->list[first].control & ~0xFFF) | firstSize;
+
+    config |= 0x1;
+    ch->dmaCH->DMACCConfig = config;
+}
+
+/**
+ * Starts a scatter-gather DMA transfer over several memory segments, chained through the linked list.
+ */
+char startDMAGather(DMA_CHANNEL* ch, const DMA_SEGMENT* segments, int count) {
+    //Empty segments are skipped, so counting what is actually going to be sent
+    int used = 0;
+    for (int i = 0; count > i; i++) {
+        if (segments[i].size > 4092) {
+            return 0;
+        }
+        if (segments[i].size) {
+            used++;
+        }
+    }
+
+    if (used > DMA_MAX_SEGMENTS) {
+        return 0;
+    }
+
+    unsigned long int config = 0x0 | ((ch->source & 0xF) << 1) | ((ch->destination & 0xF) << 6) | ((ch->transferType) << 11) | (0x3 << 14);
+
+    ch->dmaCH->DMACCConfig = config;
+
+    if (!used) {
+        return 1;
+    }
+
+    int element = -1;
+    for (int i = 0; count > i; i++) {
+        if (!segments[i].size) {
+            continue;
+        }
+
+        unsigned long int source = ch->sourceMode == DMA_ADDRESS_INCREMENT ? segments[i].addr : ch->sourceAddr;
+        unsigned long int dest = ch->destMode == DMA_ADDRESS_INCREMENT ? segments[i].addr : ch->destAddr;
+        unsigned long int control = (segments[i].size & 0xFFF) | ((ch->sourceBurst & 0x7) << 12) |
+                                  ((ch->destBurst & 0x7) << 15) | ((ch->sourceWidth & 0x3) << 18) |
+                                  ((ch->destWidth & 0x3) << 21) | ((ch->sourceMode & 0x1) << 26) |
+                                  ((ch->destMode & 0x1) << 27);
+
+        if (element < 0) {
+            //First segment goes straight into the channel registers
+            ch->dmaCH->DMACCSrcAddr = source;
+            ch->dmaCH->DMACCDestAddr = dest;
+            ch->dmaCH->DMACCControl = control;
+            ch->dmaCH->DMACCLLI = used > 1 ? ((unsigned long int)ch->list) & 0xFFFFFFFC : 0;
+        } else {
+            ch->list[element].startAddr = source;
+            ch->list[element].destAddr = dest;
+            ch->list[element].control = control;
+            ch->list[element].nextLLI = element + 2 < used ? ch->list + element + 1 : nullptr;
+        }
+
+        element++;
+    }
+
+    config |= 0x1;
+    ch->dmaCH->DMACCConfig = config;
+
+    return 1;
+}
+
 void stopDMA(DMA_CHANNEL* ch) {
     //Just disables dma
     unsigned long int config = 0x0 | ((ch->source & 0xF) << 1) | ((ch->destination & 0xF) << 6) | ((ch->transferType) << 11) | (0x3 << 14);
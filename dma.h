@@ -68,6 +68,20 @@ typedef struct DMA_LINKED_LIST_S {
     unsigned long int control;
 } DMA_LINKED_LIST;
 
+/**
+ * One piece of memory in a scatter-gather transfer
+ */
+typedef struct {
+    unsigned long int addr;
+    unsigned long int size; //Measured in transfer transactions, up to 4092
+} DMA_SEGMENT;
+
+//One segment is loaded into the channel registers, the rest use the linked list
+#define DMA_MAX_SEGMENTS 17
+
+//The longest ring startDMACircular can build, one linked list element per 4092 transfers
+#define DMA_MAX_CIRCULAR_SIZE (16 * 4092)
+
 /**
  * DMA Channels represent the hardware DMA channel that performs
  * transfers independently of other DMA channels.
@@ -109,6 +123,39 @@ DMA_CHANNEL* allocateDMA();
  */
 void deallocateDMA(DMA_CHANNEL* ch);
 
+/**
+ * Creates a DMA channel object without claiming a hardware channel. Used by drivers that
+ * only hold a hardware channel while a transfer is pending, see claimDMA and releaseDMA.
+ * The configuration fields are uninitialized like with allocateDMA.
+ */
+DMA_CHANNEL* createDMA();
+
+/**
+ * Claims a free hardware channel for a channel object, keeping its configuration.
+ * Safe to call from an ISR.
+ * Returns 1 if the object holds a hardware channel
+ * Returns 0 if all channels are in use
+ */
+char claimDMA(DMA_CHANNEL* ch);
+
+/**
+ * Stops the transfer and gives the hardware channel back so others can claim it.
+ * The channel object keeps its configuration. Safe to call from an ISR.
+ */
+void releaseDMA(DMA_CHANNEL* ch);
+
+/**
+ * Sets a function called whenever releaseDMA gives a hardware channel back, so a driver
+ * that had to do without one can claim it. Called from whatever context released the
+ * channel, possibly an ISR. There is one handler, nullptr removes it.
+ */
+void attachDMARelease(void (*handler)());
+
+/**
+ * Returns 1 if the channel object currently holds a hardware channel
+ */
+inline char isDMAClaimed(DMA_CHANNEL* ch) { return ch->dmaCH != nullptr; }
+
 /**
  * Starts a DMA transfer
  * Expects that the channel's configuration is already set by writing straight to the
@@ -116,6 +163,26 @@ void deallocateDMA(DMA_CHANNEL* ch);
  */
 void startDMA(DMA_CHANNEL* ch);
 
+/**
+ * Starts a circular DMA transfer that never completes on its own.
+ * transferSize is the length of the ring in transfer transactions. When the
+ * destination (or source) reaches the end of the ring the linked list loops back
+ * to the start. The ring is limited to DMA_MAX_CIRCULAR_SIZE transfers, a longer
+ * transferSize only uses that much of it.
+ * Use getDMADestAddr to find how far the channel has progressed into the ring.
+ * @param start Transfers into the ring to begin at, so a ring partly filled some other way carries on
+ */
+void startDMACircular(DMA_CHANNEL* ch, unsigned long int start = 0);
+
+/**
+ * Starts a scatter-gather DMA transfer over several memory segments, chained through the linked list.
+ * The segments replace the address of whichever side is incrementing, so a memory to peripheral
+ * transfer gathers from the segments and a peripheral to memory transfer scatters into them.
+ * Returns 1 if the transfer was started
+ * Returns 0 if there are more than DMA_MAX_SEGMENTS segments or one is larger than 4092 transfers
+ */
+char startDMAGather(DMA_CHANNEL* ch, const DMA_SEGMENT* segments, int count);
+
 void stopDMA(DMA_CHANNEL* ch);
 
 unsigned long int getDMADestAddr(DMA_CHANNEL* ch);
@@ -0,0 +1,743 @@
+/*
+ * Goldelox Emulator
+ *
+ * Decodes the 4DGL serial commands uLCD sends and draws them into a
+ * framebuffer. Text uses the 5x7 font from TileRaster in the display's
+ * 7x8 cells, so screens match the panel in layout rather than pixel for pixel.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "goldeloxEmulator.hpp"
+#include "crc.hpp"
+#include "tileRaster.hpp"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define GOLDELOX_ACK 0x06
+#define GOLDELOX_NAK 0x15
+#define GOLDELOX_VERSION 0x0105
+
+GoldeloxEmulator::GoldeloxEmulator(int fd, Timing timing) {
+    this->fd = fd;
+    this->timing = timing;
+    this->commandCount = 0;
+    this->nakCount = 0;
+    this->busy_us = 0;
+
+    memset(this->framebuffer, 0, sizeof(this->framebuffer));
+    this->textColor = 0xFFFF;
+    this->textBackground = 0x0000;
+    this->fontWidth = 1;
+    this->fontHeight = 1;
+    this->bold = false;
+    this->italic = false;
+    this->inverted = false;
+    this->underline = false;
+    this->column = 0;
+    this->row = 0;
+    this->outlineColor = 0x0000;
+    this->clipping = false;
+    this->clip[0] = 0;
+    this->clip[1] = 0;
+    this->clip[2] = GOLDELOX_SIZE - 1;
+    this->clip[3] = GOLDELOX_SIZE - 1;
+    this->cardAddress = 0;
+    this->garbled = false;
+
+    this->thread.start(callback(this, &GoldeloxEmulator::run));
+}
+
+GoldeloxEmulator::~GoldeloxEmulator() {
+    shutdown(this->fd, SHUT_RDWR);
+    this->thread.join();
+    close(this->fd);
+}
+
+GoldeloxEmulator::Timing GoldeloxEmulator::defaultTiming() {
+    Timing timing;
+    timing.command_us = 100;
+    timing.pixel_ns = 250;
+    timing.char_us = 40;
+    timing.boot_ms = 0;
+    timing.max_baud = 0;
+    return timing;
+}
+
+void GoldeloxEmulator::join() {
+    this->thread.join();
+}
+
+bool GoldeloxEmulator::readBytes(uint8_t* buffer, int size) {
+    while (size > 0) {
+        int count = ::read(this->fd, buffer, size);
+        if (count <= 0) {
+            return false;
+        }
+        buffer += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool GoldeloxEmulator::readWords(int* words, int count) {
+    uint8_t buffer[16];
+    if (!this->readBytes(buffer, count * 2)) {
+        return false;
+    }
+
+    //Words are big-endian and signed, like uLCD::addIntToBuf writes them
+    for (int i = 0; count > i; i++) {
+        words[i] = (int16_t)((buffer[i * 2] << 8) | buffer[i * 2 + 1]);
+    }
+    return true;
+}
+
+void GoldeloxEmulator::respond(uint8_t status, int extraBytes, int value) {
+    uint8_t response[3];
+    response[0] = status;
+    response[1] = value >> 8;
+    response[2] = value;
+
+    //Sampled at the wrong rate every byte arrives as something else
+    if (this->garbled) {
+        for (int i = 0; 3 > i; i++) {
+            response[i] ^= 0x5A;
+        }
+    }
+
+    if (::write(this->fd, response, 1 + extraBytes) < 0) {
+        std::perror("goldelox: write");
+    }
+}
+
+void GoldeloxEmulator::plot(int x, int y, uint16_t color) {
+    if (x < 0 || y < 0 || x >= GOLDELOX_SIZE || y >= GOLDELOX_SIZE) {
+        return;
+    }
+    if (this->clipping && (x < this->clip[0] || y < this->clip[1] || x > this->clip[2] || y > this->clip[3])) {
+        return;
+    }
+
+    this->framebuffer[y * GOLDELOX_SIZE + x] = color;
+    this->pixelsDrawn++;
+}
+
+void GoldeloxEmulator::fill(int x1, int y1, int x2, int y2, uint16_t color) {
+    //Vertices may be given in any order
+    if (x1 > x2) {
+        int t = x1;
+        x1 = x2;
+        x2 = t;
+    }
+    if (y1 > y2) {
+        int t = y1;
+        y1 = y2;
+        y2 = t;
+    }
+
+    for (int y = y1; y2 >= y; y++) {
+        for (int x = x1; x2 >= x; x++) {
+            this->plot(x, y, color);
+        }
+    }
+}
+
+void GoldeloxEmulator::line(int x1, int y1, int x2, int y2, uint16_t color) {
+    int dx = x2 > x1 ? x2 - x1 : x1 - x2;
+    int dy = y2 > y1 ? y1 - y2 : y2 - y1;
+    int sx = x2 > x1 ? 1 : -1;
+    int sy = y2 > y1 ? 1 : -1;
+    int error = dx + dy;
+
+    while (true) {
+        this->plot(x1, y1, color);
+        if (x1 == x2 && y1 == y2) {
+            break;
+        }
+
+        int e2 = error * 2;
+        if (e2 >= dy) {
+            error += dy;
+            x1 += sx;
+        }
+        if (e2 <= dx) {
+            error += dx;
+            y1 += sy;
+        }
+    }
+}
+
+void GoldeloxEmulator::circle(int x, int y, int radius, uint16_t color, bool filled) {
+    int dx = radius;
+    int dy = 0;
+    int error = 1 - radius;
+
+    //Midpoint circle, one octant mirrored eight ways
+    while (dx >= dy) {
+        if (filled) {
+            this->fill(x - dx, y + dy, x + dx, y + dy, color);
+            this->fill(x - dx, y - dy, x + dx, y - dy, color);
+            this->fill(x - dy, y + dx, x + dy, y + dx, color);
+            this->fill(x - dy, y - dx, x + dy, y - dx, color);
+        } else {
+            this->plot(x + dx, y + dy, color);
+            this->plot(x - dx, y + dy, color);
+            this->plot(x + dx, y - dy, color);
+            this->plot(x - dx, y - dy, color);
+            this->plot(x + dy, y + dx, color);
+            this->plot(x - dy, y + dx, color);
+            this->plot(x + dy, y - dx, color);
+            this->plot(x - dy, y - dx, color);
+        }
+
+        dy++;
+        if (error < 0) {
+            error += 2 * dy + 1;
+        } else {
+            dx--;
+            error += 2 * (dy - dx) + 1;
+        }
+    }
+}
+
+void GoldeloxEmulator::putChar(char c) {
+    this->charsDrawn++;
+
+    if (c == '\n') {
+        this->column = 0;
+        this->row++;
+        return;
+    }
+
+    uint16_t foreground = this->inverted ? this->textBackground : this->textColor;
+    uint16_t background = this->inverted ? this->textColor : this->textBackground;
+    int left = this->column * 7 * this->fontWidth;
+    int top = this->row * 8 * this->fontHeight;
+    const uint8_t* glyph = c >= ' ' && c <= '~' ? &rasterFont[(c - ' ') * 5] : nullptr;
+
+    //The glyph sits one column into its 7x8 cell, which is drawn opaque
+    for (int py = 0; 8 > py; py++) {
+        int slant = this->italic ? (7 - py) / 3 : 0;
+
+        for (int px = 0; 7 > px; px++) {
+            int gx = px - 1 - slant;
+            bool on = false;
+
+            if (glyph && py < 7) {
+                on = gx >= 0 && gx < 5 && (glyph[gx] >> py & 1);
+                on = on || (this->bold && gx >= 1 && gx <= 5 && (glyph[gx - 1] >> py & 1));
+            }
+            on = on || (this->underline && py == 7);
+
+            this->fill(left + px * this->fontWidth, top + py * this->fontHeight,
+                left + (px + 1) * this->fontWidth - 1, top + (py + 1) * this->fontHeight - 1,
+                on ? foreground : background);
+        }
+    }
+
+    this->column++;
+}
+
+bool GoldeloxEmulator::loadCard(const char* path) {
+    FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    std::vector<uint8_t> card;
+    uint8_t chunk[4096];
+    size_t count;
+    while ((count = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        card.insert(card.end(), chunk, chunk + count);
+    }
+    std::fclose(file);
+
+    this->lock.lock();
+    this->card.swap(card);
+    this->lock.unlock();
+    return true;
+}
+
+bool GoldeloxEmulator::drawCardImage(uint32_t address, int x, int y, int width, int height) {
+    if (address + (uint64_t) width * height * 2 > this->card.size()) {
+        return false;
+    }
+
+    //Pixels are stored in wire order, like a BLIT
+    const uint8_t* pixels = &this->card[address];
+    for (int row = 0; height > row; row++) {
+        for (int column = 0; width > column; column++) {
+            const uint8_t* p = &pixels[(row * width + column) * 2];
+            this->plot(x + column, y + row, (p[0] << 8) | p[1]);
+        }
+    }
+    return true;
+}
+
+int GoldeloxEmulator::process(int command, int& extraBytes, int& value) {
+    int args[6];
+    extraBytes = 0;
+    value = 0;
+
+    //Arguments are read before the framebuffer is locked, so a slow sender never blocks readers
+    switch (command) {
+    case 0xFFD7: //cls
+        this->lock.lock();
+        for (int i = 0; GOLDELOX_SIZE * GOLDELOX_SIZE > i; i++) {
+            this->framebuffer[i] = 0x0000;
+        }
+        this->pixelsDrawn += GOLDELOX_SIZE * GOLDELOX_SIZE;
+        this->column = 0;
+        this->row = 0;
+        this->lock.unlock();
+        return 1;
+
+    case 0x000B: { //baud, only checked against the fastest rate the link survives
+        if (!this->readWords(args, 1)) {
+            return 0;
+        }
+        int baud = 3000000 / (args[0] + 1);
+        this->garbled = this->timing.max_baud && baud > this->timing.max_baud * 21 / 20;
+        return 1;
+    }
+
+    case 0x0008: //version
+        extraBytes = 2;
+        value = GOLDELOX_VERSION;
+        return 1;
+
+    case 0xFF7F: //text color
+    case 0xFF7E: //text background
+    case 0xFF67: { //outline color
+        uint8_t color[2];
+        if (!this->readBytes(color, 2)) {
+            return 0;
+        }
+        uint16_t& field = command == 0xFF7F ? this->textColor : command == 0xFF7E ? this->textBackground : this->outlineColor;
+        extraBytes = 2;
+        value = field;
+        field = (color[0] << 8) | color[1];
+        return 1;
+    }
+
+    case 0xFF7C: //font width
+    case 0xFF7B: //font height
+    case 0xFF76: //bold
+    case 0xFF75: //italic
+    case 0xFF74: //inverted
+    case 0xFF73: { //underline
+        if (!this->readWords(args, 1)) {
+            return 0;
+        }
+        extraBytes = 2;
+
+        if (command == 0xFF7C || command == 0xFF7B) {
+            int& field = command == 0xFF7C ? this->fontWidth : this->fontHeight;
+            value = field;
+            field = args[0] < 1 ? 1 : args[0] > 16 ? 16 : args[0];
+        } else {
+            bool& field = command == 0xFF76 ? this->bold : command == 0xFF75 ? this->italic :
+                command == 0xFF74 ? this->inverted : this->underline;
+            value = field;
+            field = args[0] != 0;
+        }
+        return 1;
+    }
+
+    case 0xFFE4: //locate, the line comes first
+        if (!this->readWords(args, 2)) {
+            return 0;
+        }
+        this->row = args[0];
+        this->column = args[1];
+        return 1;
+
+    case 0xFFFE: //character
+    case 0x0006: { //string
+        std::vector<char> text;
+        if (command == 0xFFFE) {
+            if (!this->readWords(args, 1)) {
+                return 0;
+            }
+            text.push_back((char) args[0]);
+        } else {
+            uint8_t c;
+            do {
+                if (!this->readBytes(&c, 1)) {
+                    return 0;
+                }
+                text.push_back((char) c);
+            } while (c);
+            text.pop_back();
+
+            extraBytes = 2;
+            value = (int) text.size();
+        }
+
+        this->lock.lock();
+        for (char c : text) {
+            this->putChar(c);
+        }
+        this->lock.unlock();
+
+        //Text attributes only last for one print
+        this->bold = false;
+        this->italic = false;
+        this->inverted = false;
+        this->underline = false;
+        return 1;
+    }
+
+    case 0xFFCB: //pixel
+    case 0xFFCD: //circle
+    case 0xFFCC: //filled circle
+    case 0xFFD2: //line
+    case 0xFFCF: //rectangle
+    case 0xFFCE: //filled rectangle
+    case 0xFFC9: { //triangle
+        int count = command == 0xFFCB ? 2 : command == 0xFFCD || command == 0xFFCC ? 3 : command == 0xFFC9 ? 6 : 4;
+        uint8_t color[2];
+        if (!this->readWords(args, count) || !this->readBytes(color, 2)) {
+            return 0;
+        }
+        uint16_t c = (color[0] << 8) | color[1];
+
+        this->lock.lock();
+        switch (command) {
+        case 0xFFCB:
+            this->plot(args[0], args[1], c);
+            break;
+        case 0xFFCD:
+            this->circle(args[0], args[1], args[2], c, false);
+            break;
+        case 0xFFCC:
+            this->circle(args[0], args[1], args[2], c, true);
+            if (this->outlineColor) {
+                this->circle(args[0], args[1], args[2], this->outlineColor, false);
+            }
+            break;
+        case 0xFFD2:
+            this->line(args[0], args[1], args[2], args[3], c);
+            break;
+        case 0xFFCF:
+            this->line(args[0], args[1], args[2], args[1], c);
+            this->line(args[2], args[1], args[2], args[3], c);
+            this->line(args[2], args[3], args[0], args[3], c);
+            this->line(args[0], args[3], args[0], args[1], c);
+            break;
+        case 0xFFCE:
+            this->fill(args[0], args[1], args[2], args[3], c);
+            if (this->outlineColor) {
+                uint16_t o = this->outlineColor;
+                this->line(args[0], args[1], args[2], args[1], o);
+                this->line(args[2], args[1], args[2], args[3], o);
+                this->line(args[2], args[3], args[0], args[3], o);
+                this->line(args[0], args[3], args[0], args[1], o);
+            }
+            break;
+        case 0xFFC9:
+            this->line(args[0], args[1], args[2], args[3], c);
+            this->line(args[2], args[3], args[4], args[5], c);
+            this->line(args[4], args[5], args[0], args[1], c);
+            break;
+        }
+        this->lock.unlock();
+        return 1;
+    }
+
+    case 0x000A: { //BLIT
+        if (!this->readWords(args, 4)) {
+            return 0;
+        }
+        int width = args[2] > 0 ? args[2] : 0;
+        int height = args[3] > 0 ? args[3] : 0;
+        std::vector<uint8_t> pixels(width * height * 2);
+        if (!this->readBytes(pixels.data(), (int) pixels.size())) {
+            return 0;
+        }
+
+        this->lock.lock();
+        for (int y = 0; height > y; y++) {
+            for (int x = 0; width > x; x++) {
+                const uint8_t* p = &pixels[(y * width + x) * 2];
+                this->plot(args[0] + x, args[1] + y, (p[0] << 8) | p[1]);
+            }
+        }
+        this->lock.unlock();
+        return 1;
+    }
+
+    case 0xFF6C: //clipping on or off
+        if (!this->readWords(args, 1)) {
+            return 0;
+        }
+        this->clipping = args[0] != 0;
+        return 1;
+
+    case 0xFFBF: //clipping window
+        if (!this->readWords(args, 4)) {
+            return 0;
+        }
+        memcpy(this->clip, args, sizeof(this->clip));
+        return 1;
+
+    case 0xFFB1: //media init
+        extraBytes = 2;
+        value = !this->card.empty();
+        return 1;
+
+    case 0xFFB8: //media sector
+    case 0xFFB9: //media byte address
+        if (!this->readWords(args, 2)) {
+            return 0;
+        }
+        this->cardAddress = ((uint32_t)(uint16_t) args[0] << 16) | (uint16_t) args[1];
+        if (command == 0xFFB8) {
+            this->cardAddress *= 512;
+        }
+        return 1;
+
+    case 0xFFB3: //media image
+    case 0xFFBB: //media video
+    case 0xFFBA: { //media video frame
+        if (!this->readWords(args, command == 0xFFBA ? 3 : 2)) {
+            return 0;
+        }
+
+        //Images have a 6 byte header and videos an 8 byte one, see tools/mediaPack
+        uint32_t address = this->cardAddress;
+        if (address + 8 > this->card.size()) {
+            return -1;
+        }
+        const uint8_t* header = &this->card[address];
+        int width = (header[0] << 8) | header[1];
+        int height = (header[2] << 8) | header[3];
+        int delay_ms = header[5];
+        int frames = (header[6] << 8) | header[7];
+        uint32_t frameBytes = width * height * 2;
+
+        bool drawn = true;
+        this->lock.lock();
+        if (command == 0xFFB3) {
+            drawn = this->drawCardImage(address + 6, args[0], args[1], width, height);
+        } else if (command == 0xFFBA) {
+            drawn = args[2] >= 0 && args[2] < frames &&
+                this->drawCardImage(address + 8 + args[2] * frameBytes, args[0], args[1], width, height);
+        } else {
+            for (int frame = 0; frames > frame && drawn; frame++) {
+                drawn = this->drawCardImage(address + 8 + frame * frameBytes, args[0], args[1], width, height);
+            }
+        }
+        this->lock.unlock();
+
+        if (command == 0xFFBB) {
+            wait_us(frames * delay_ms * 1000);
+        }
+        return drawn ? 1 : -1;
+    }
+
+    default:
+        return -1;
+    }
+}
+
+void GoldeloxEmulator::run() {
+    uint8_t bytes[2];
+
+    //Booting, whatever arrives meanwhile is never seen
+    if (this->timing.boot_ms) {
+        wait_us(this->timing.boot_ms * 1000);
+        while (recv(this->fd, bytes, sizeof(bytes), MSG_DONTWAIT) > 0);
+    }
+
+    while (this->readBytes(bytes, 2)) {
+        int command = (bytes[0] << 8) | bytes[1];
+        int extraBytes;
+        int value;
+
+        this->pixelsDrawn = 0;
+        this->charsDrawn = 0;
+        int result = this->process(command, extraBytes, value);
+        if (!result) {
+            return;
+        }
+
+        int delay_us = this->timing.command_us + this->charsDrawn * this->timing.char_us +
+            (int)((int64_t) this->pixelsDrawn * this->timing.pixel_ns / 1000);
+        wait_us(delay_us);
+
+        this->lock.lock();
+        this->commandCount++;
+        this->busy_us += delay_us;
+        if (result < 0) {
+            this->nakCount++;
+        }
+        this->lock.unlock();
+
+        if (result < 0) {
+            std::fprintf(stderr, "goldelox: unknown command %04X, or media beyond the card\n", command);
+            this->respond(GOLDELOX_NAK, 0, 0);
+        } else {
+            this->respond(GOLDELOX_ACK, extraBytes, value);
+        }
+    }
+}
+
+uint16_t GoldeloxEmulator::getPixel(int x, int y) const {
+    if (x < 0 || y < 0 || x >= GOLDELOX_SIZE || y >= GOLDELOX_SIZE) {
+        return 0;
+    }
+
+    this->lock.lock();
+    uint16_t color = this->framebuffer[y * GOLDELOX_SIZE + x];
+    this->lock.unlock();
+    return color;
+}
+
+uint32_t GoldeloxEmulator::getChecksum() const {
+    uint32_t crc = 0;
+    uint8_t row[GOLDELOX_SIZE * 2];
+
+    //Big-endian like the wire, so the checksum doesn't depend on the host
+    this->lock.lock();
+    for (int y = 0; GOLDELOX_SIZE > y; y++) {
+        for (int x = 0; GOLDELOX_SIZE > x; x++) {
+            uint16_t color = this->framebuffer[y * GOLDELOX_SIZE + x];
+            row[x * 2] = color >> 8;
+            row[x * 2 + 1] = color;
+        }
+        crc = crc32(row, sizeof(row), crc);
+    }
+    this->lock.unlock();
+
+    return crc;
+}
+
+/**
+ * Expands the framebuffer to 8 bit RGB, optionally with a PNG filter byte before every row
+ */
+static std::vector<uint8_t> toRGB888(const uint16_t* framebuffer, bool filterBytes) {
+    std::vector<uint8_t> image;
+    image.reserve(GOLDELOX_SIZE * (GOLDELOX_SIZE * 3 + 1));
+
+    for (int y = 0; GOLDELOX_SIZE > y; y++) {
+        if (filterBytes) {
+            image.push_back(0);
+        }
+        for (int x = 0; GOLDELOX_SIZE > x; x++) {
+            uint16_t color = framebuffer[y * GOLDELOX_SIZE + x];
+            int r = color >> 11;
+            int g = (color >> 5) & 0x3F;
+            int b = color & 0x1F;
+            image.push_back((r << 3) | (r >> 2));
+            image.push_back((g << 2) | (g >> 4));
+            image.push_back((b << 3) | (b >> 2));
+        }
+    }
+
+    return image;
+}
+
+bool GoldeloxEmulator::writePPM(const char* path) const {
+    this->lock.lock();
+    std::vector<uint8_t> image = toRGB888(this->framebuffer, false);
+    this->lock.unlock();
+
+    FILE* file = std::fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    std::fprintf(file, "P6\n%d %d\n255\n", GOLDELOX_SIZE, GOLDELOX_SIZE);
+    bool written = std::fwrite(image.data(), 1, image.size(), file) == image.size();
+    return std::fclose(file) == 0 && written;
+}
+
+static void putBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void putChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    putBigEndian(out, (uint32_t) data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    putBigEndian(out, crc32(&out[start], (int)(out.size() - start)));
+}
+
+bool GoldeloxEmulator::writePNG(const char* path) const {
+    this->lock.lock();
+    std::vector<uint8_t> image = toRGB888(this->framebuffer, true);
+    this->lock.unlock();
+
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+    std::vector<uint8_t> header;
+    putBigEndian(header, GOLDELOX_SIZE);
+    putBigEndian(header, GOLDELOX_SIZE);
+    header.push_back(8); //Bits per channel
+    header.push_back(2); //RGB
+    header.push_back(0); //Deflate
+    header.push_back(0); //Adaptive filtering
+    header.push_back(0); //Not interlaced
+    putChunk(png, "IHDR", header);
+
+    //A zlib stream of stored deflate blocks, so no compressor is needed
+    std::vector<uint8_t> data = {0x78, 0x01};
+    for (size_t offset = 0; image.size() > offset; offset += 0xFFFF) {
+        size_t length = image.size() - offset < 0xFFFF ? image.size() - offset : 0xFFFF;
+        data.push_back(offset + length == image.size());
+        data.push_back(length);
+        data.push_back(length >> 8);
+        data.push_back(~length);
+        data.push_back(~length >> 8);
+        data.insert(data.end(), image.begin() + offset, image.begin() + offset + length);
+    }
+
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (uint8_t byte : image) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBigEndian(data, (b << 16) | a);
+    putChunk(png, "IDAT", data);
+    putChunk(png, "IEND", std::vector<uint8_t>());
+
+    FILE* file = std::fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool written = std::fwrite(png.data(), 1, png.size(), file) == png.size();
+    return std::fclose(file) == 0 && written;
+}
+
+int GoldeloxEmulator::getCommandCount() const {
+    this->lock.lock();
+    int count = this->commandCount;
+    this->lock.unlock();
+    return count;
+}
+
+int GoldeloxEmulator::getNakCount() const {
+    this->lock.lock();
+    int count = this->nakCount;
+    this->lock.unlock();
+    return count;
+}
+
+int64_t GoldeloxEmulator::getBusyTime() const {
+    this->lock.lock();
+    int64_t busy = this->busy_us;
+    this->lock.unlock();
+    return busy;
+}
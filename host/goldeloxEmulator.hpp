@@ -0,0 +1,143 @@
+/*
+ * Goldelox Emulator
+ *
+ * Stands in for a 128x128 Goldelox display on the other end of a host
+ * serial link. The commands uLCD sends are decoded and drawn into a
+ * framebuffer, and every command is answered like the display would, after
+ * a delay that depends on how much the command draws. The framebuffer can
+ * be saved as a PPM or PNG image, or reduced to a checksum, so screens can
+ * be compared between runs.
+ *
+ * A microSD card image made by tools/mediaPack can be loaded for the media
+ * commands.
+ *
+ * Commands the emulator doesn't know are answered with a NAK, after which
+ * the byte stream can't be followed any more.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_HOST_GOLDELOX_INCLUDED
+#define COLLECTION_HOST_GOLDELOX_INCLUDED
+
+#include "mbed.h"
+#include <vector>
+
+#define GOLDELOX_SIZE 128
+
+class GoldeloxEmulator {
+    public:
+
+    /**
+     * How long the display takes to process a command before it answers
+     */
+    struct Timing {
+        int command_us; //Every command
+        int pixel_ns; //Every pixel a command draws
+        int char_us; //Every character of text
+        int boot_ms; //From construction until commands are read, bytes sent before are lost
+        int max_baud; //Fastest baud the link survives, responses at a faster one are garbled. 0 for any
+    };
+
+    private:
+
+    int fd;
+    Timing timing;
+    Thread thread;
+    mutable Mutex lock; //Guards the framebuffer and the counters
+
+    uint16_t framebuffer[GOLDELOX_SIZE * GOLDELOX_SIZE]; //RGB565
+    int commandCount;
+    int nakCount;
+    int64_t busy_us; //Total processing time modelled
+
+    //Display state, like after a reset
+    uint16_t textColor;
+    uint16_t textBackground;
+    int fontWidth;
+    int fontHeight;
+    bool bold;
+    bool italic;
+    bool inverted;
+    bool underline;
+    int column;
+    int row;
+    uint16_t outlineColor;
+    bool clipping;
+    int clip[4];
+    std::vector<uint8_t> card;
+    uint32_t cardAddress;
+    bool garbled; //The baud is above timing.max_baud
+    int pixelsDrawn; //By the command being processed, for its timing
+    int charsDrawn;
+
+    void run();
+
+    bool readBytes(uint8_t* buffer, int size);
+
+    bool readWords(int* words, int count);
+
+    int process(int command, int& extraBytes, int& value);
+
+    void respond(uint8_t status, int extraBytes, int value);
+
+    void plot(int x, int y, uint16_t color);
+
+    void fill(int x1, int y1, int x2, int y2, uint16_t color);
+
+    void line(int x1, int y1, int x2, int y2, uint16_t color);
+
+    void circle(int x, int y, int radius, uint16_t color, bool filled);
+
+    void putChar(char c);
+
+    bool drawCardImage(uint32_t address, int x, int y, int width, int height);
+
+    public:
+
+    /**
+     * Starts answering on a descriptor, e.g. one end of a socket pair bound to the uLCD's tx pin
+     * with hostSerialBind()
+     * @param fd The descriptor, closed by the destructor
+     * @param timing The processing delays, see defaultTiming()
+     */
+    GoldeloxEmulator(int fd, Timing timing = defaultTiming());
+
+    ~GoldeloxEmulator();
+
+    /** Processing delays in the range observed on a uLCD-144-G2 */
+    static Timing defaultTiming();
+
+    /** Waits until the other end of the link is closed and every command before that is processed */
+    void join();
+
+    /**
+     * Inserts a microSD card, read by the media commands
+     * @param path The raw card image
+     * @return false if the file can't be read
+     */
+    bool loadCard(const char* path);
+
+    /** Returns a pixel as RGB565 */
+    uint16_t getPixel(int x, int y) const;
+
+    /** Returns the CRC32 of the framebuffer, for comparing screens between runs */
+    uint32_t getChecksum() const;
+
+    /** Saves the framebuffer as a binary PPM image, returns false if the file can't be written */
+    bool writePPM(const char* path) const;
+
+    /** Saves the framebuffer as an uncompressed PNG image, returns false if the file can't be written */
+    bool writePNG(const char* path) const;
+
+    /** Returns the number of commands processed */
+    int getCommandCount() const;
+
+    /** Returns the number of commands answered with a NAK */
+    int getNakCount() const;
+
+    /** Returns the total processing time modelled so far in microseconds */
+    int64_t getBusyTime() const;
+};
+
+#endif // COLLECTION_HOST_GOLDELOX_INCLUDED
@@ -0,0 +1,33 @@
+/*
+ * Host Serial Bindings
+ *
+ * Controls where the host SerialAsync stand-in sends its bytes. By default
+ * each SerialAsync opens a pseudo-terminal and prints the name of the slave
+ * side so another program (or a terminal) can connect to it. Tests and tools
+ * can bind a pin to any file descriptor instead, such as one end of a
+ * socketpair serviced by an emulator thread.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_HOST_SERIAL_INCLUDED
+#define COLLECTION_HOST_SERIAL_INCLUDED
+
+#include "mbed.h"
+
+/**
+ * Makes the next SerialAsync constructed with this tx pin use the descriptor instead of a pty.
+ * The SerialAsync takes ownership of the descriptor and closes it when destroyed.
+ * @param tx The tx pin the SerialAsync will be constructed with
+ * @param fd A connected, blocking file descriptor
+ */
+void hostSerialBind(PinName tx, int fd);
+
+/**
+ * Sets whether transmissions take as long as they would on the wire at the configured baud.
+ * On by default, so throughput and latency measurements reflect the real link.
+ * @param enable True to hold each transfer for its wire time
+ */
+void hostSerialEmulateBaud(bool enable);
+
+#endif // COLLECTION_HOST_SERIAL_INCLUDED
@@ -0,0 +1,324 @@
+/*
+ * Host Stand-in for Mbed OS
+ *
+ * Just enough of the Mbed OS API for the drivers above the hardware to build
+ * and run on Linux. Interrupt context is emulated: Timeout callbacks and
+ * serial receive events run on background threads while holding a global
+ * interrupt lock, which core_util_critical_section_enter() also takes, so
+ * critical sections keep excluding "ISRs" like they do on the board.
+ *
+ * Build host programs from the repository root with this directory on the
+ * include path, replacing serialAsync.cpp and dma.cpp with the host versions:
+ *     g++ -std=gnu++14 -I. -Ihost program.cpp uLCD.cpp uLCDTrace.cpp blockPool.cpp host/mbedHost.cpp host/serialAsyncHost.cpp -pthread
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_HOST_MBED_INCLUDED
+#define COLLECTION_HOST_MBED_INCLUDED
+
+#define COLLECTION_HOST 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <type_traits>
+
+#define MBED_ALIGN(x) __attribute__((aligned(x)))
+
+#define osWaitForever 0xFFFFFFFFU
+#define osFlagsError 0x80000000U
+#define osFlagsErrorTimeout 0xFFFFFFFEU
+
+typedef enum {
+    p5 = 5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20,
+    p21, p22, p23, p24, p25, p26, p27, p28, p29, p30,
+    USBTX, USBRX,
+    NC = -1
+} PinName;
+
+typedef enum {
+    PullNone,
+    PullUp,
+    PullDown
+} PinMode;
+
+typedef enum {
+    ParityNone,
+    ParityOdd,
+    ParityEven,
+    ParityForced1,
+    ParityForced0
+} SerialParity;
+
+typedef enum {
+    FlowControlNone,
+    FlowControlRTS,
+    FlowControlCTS,
+    FlowControlRTSCTS
+} FlowControl;
+
+typedef enum {
+    osPriorityLow = 8,
+    osPriorityBelowNormal = 16,
+    osPriorityNormal = 24,
+    osPriorityAboveNormal = 32,
+    osPriorityHigh = 40,
+    osPriorityRealtime = 48
+} osPriority;
+
+//The dma layer's channel registers only appear behind pointers above the hardware drivers
+typedef struct LPC_GPDMACH_TypeDef LPC_GPDMACH_TypeDef;
+
+template <typename F>
+class Callback;
+
+/**
+ * Same construction forms as the Mbed Callback, backed by std::function
+ */
+template <typename R, typename... Args>
+class Callback<R(Args...)> {
+    private:
+
+    std::function<R(Args...)> function;
+
+    public:
+
+    Callback() {}
+
+    Callback(std::nullptr_t) {}
+
+    Callback(R (*function)(Args...)) {
+        if (function) {
+            this->function = function;
+        }
+    }
+
+    template <typename T, typename U>
+    Callback(U* obj, R (T::*method)(Args...)) {
+        this->function = [obj, method](Args... args) { return (obj->*method)(args...); };
+    }
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Callback>::value &&
+        !std::is_pointer<typename std::decay<F>::type>::value>::type>
+    Callback(F f) : function(f) {}
+
+    R operator()(Args... args) const { return this->function(args...); }
+
+    R call(Args... args) const { return this->function(args...); }
+
+    explicit operator bool() const { return (bool) this->function; }
+};
+
+template <typename T, typename U, typename R, typename... Args>
+Callback<R(Args...)> callback(U* obj, R (T::*method)(Args...)) {
+    return Callback<R(Args...)>(obj, method);
+}
+
+template <typename R, typename... Args>
+Callback<R(Args...)> callback(R (*function)(Args...)) {
+    return Callback<R(Args...)>(function);
+}
+
+//Interrupt emulation
+
+void core_util_critical_section_enter();
+void core_util_critical_section_exit();
+bool core_util_is_isr_active();
+
+/**
+ * Runs a function as if it were an ISR: with the interrupt lock held and
+ * core_util_is_isr_active() returning true. Used by the host drivers.
+ */
+void hostRunAsIsr(const Callback<void()>& function);
+
+inline void __disable_irq() { core_util_critical_section_enter(); }
+inline void __enable_irq() { core_util_critical_section_exit(); }
+
+//Atomics
+
+inline bool core_util_atomic_cas_u32(volatile uint32_t* ptr, uint32_t* expected, uint32_t desired) {
+    return __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+inline bool core_util_atomic_cas_ptr(void* volatile* ptr, void** expected, void* desired) {
+    return __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+inline uint32_t core_util_atomic_incr_u32(volatile uint32_t* ptr, uint32_t delta) {
+    return __atomic_add_fetch(ptr, delta, __ATOMIC_SEQ_CST);
+}
+
+inline uint32_t core_util_atomic_decr_u32(volatile uint32_t* ptr, uint32_t delta) {
+    return __atomic_sub_fetch(ptr, delta, __ATOMIC_SEQ_CST);
+}
+
+inline uint32_t core_util_atomic_load_u32(const volatile uint32_t* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+inline void core_util_atomic_store_u32(volatile uint32_t* ptr, uint32_t value) {
+    __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+inline void* core_util_atomic_exchange_ptr(void* volatile* ptr, void* desired) {
+    return __atomic_exchange_n(ptr, desired, __ATOMIC_SEQ_CST);
+}
+
+//Time
+
+void wait_us(int us);
+
+namespace ThisThread {
+    void sleep_for(uint32_t ms);
+    void sleep_for(std::chrono::milliseconds ms);
+    void yield();
+}
+
+class Timer {
+    private:
+
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::duration accumulated;
+    bool running;
+
+    public:
+
+    Timer();
+
+    void start();
+    void stop();
+    void reset();
+    int read_us();
+    float read();
+    std::chrono::microseconds elapsed_time();
+};
+
+/**
+ * Calls a function once after a delay, from emulated interrupt context
+ */
+class Timeout {
+    private:
+
+    uint64_t id; //Identifies the pending call so detach and re-attach can cancel it
+
+    public:
+
+    Timeout();
+    ~Timeout();
+
+    void attach(Callback<void()> function, float seconds);
+    void attach(Callback<void()> function, std::chrono::microseconds delay);
+    void attach_us(Callback<void()> function, uint64_t us);
+    void detach();
+};
+
+//RTOS
+
+class EventFlags {
+    private:
+
+    struct State;
+    State* state;
+
+    public:
+
+    EventFlags();
+    ~EventFlags();
+
+    uint32_t set(uint32_t flags);
+    uint32_t clear(uint32_t flags = 0x7FFFFFFF);
+    uint32_t get() const;
+    uint32_t wait_any(uint32_t flags, uint32_t millisec = osWaitForever, bool clear = true);
+    uint32_t wait_all(uint32_t flags, uint32_t millisec = osWaitForever, bool clear = true);
+};
+
+class Mutex {
+    private:
+
+    struct State;
+    State* state;
+
+    public:
+
+    Mutex();
+    ~Mutex();
+
+    void lock();
+    bool trylock();
+    void unlock();
+};
+
+class Semaphore {
+    private:
+
+    struct State;
+    State* state;
+
+    public:
+
+    Semaphore(int32_t count = 0);
+    ~Semaphore();
+
+    void acquire();
+    bool try_acquire();
+    bool try_acquire_for(uint32_t millisec);
+    void release();
+};
+
+class Thread {
+    private:
+
+    std::thread thread;
+
+    public:
+
+    Thread(osPriority priority = osPriorityNormal, uint32_t stack_size = 0, unsigned char* stack_mem = nullptr, const char* name = nullptr);
+    ~Thread();
+
+    void start(Callback<void()> task);
+    void join();
+};
+
+//Pins, which only remember their value on a host
+
+class DigitalOut {
+    private:
+
+    int value;
+
+    public:
+
+    DigitalOut(PinName pin, int value = 0) : value(value) { (void) pin; }
+
+    void write(int value) { this->value = value; }
+    int read() { return this->value; }
+    DigitalOut& operator=(int value) { this->write(value); return *this; }
+    operator int() { return this->read(); }
+};
+
+class DigitalIn {
+    private:
+
+    int value;
+
+    public:
+
+    DigitalIn(PinName pin) : value(0) { (void) pin; }
+
+    int read() { return this->value; }
+    void mode(PinMode mode) { (void) mode; }
+    operator int() { return this->read(); }
+
+    /** Host only, sets the level the pin reads */
+    void hostSet(int value) { this->value = value; }
+};
+
+#endif // COLLECTION_HOST_MBED_INCLUDED
@@ -0,0 +1,364 @@
+/*
+ * Host Stand-in for Mbed OS
+ *
+ * Implements the timing, interrupt emulation and RTOS pieces of host/mbed.h
+ * with the C++ standard library.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "mbed.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+using std::chrono::steady_clock;
+
+//Interrupt emulation
+
+static std::recursive_mutex& interruptLock() {
+    static std::recursive_mutex* lock = new std::recursive_mutex();
+    return *lock;
+}
+
+static thread_local int isrDepth = 0;
+
+void core_util_critical_section_enter() {
+    interruptLock().lock();
+}
+
+void core_util_critical_section_exit() {
+    interruptLock().unlock();
+}
+
+bool core_util_is_isr_active() {
+    return isrDepth > 0;
+}
+
+void hostRunAsIsr(const Callback<void()>& function) {
+    std::lock_guard<std::recursive_mutex> guard(interruptLock());
+    isrDepth++;
+    function();
+    isrDepth--;
+}
+
+//Time
+
+void wait_us(int us) {
+    if (us <= 0) {
+        return;
+    }
+
+    steady_clock::time_point end = steady_clock::now() + std::chrono::microseconds(us);
+
+    //Sleeping is too coarse for short waits, so those spin like they would on the board
+    if (us > 2000) {
+        std::this_thread::sleep_until(end - std::chrono::microseconds(1000));
+    }
+    while (steady_clock::now() < end);
+}
+
+void ThisThread::sleep_for(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void ThisThread::sleep_for(std::chrono::milliseconds ms) {
+    std::this_thread::sleep_for(ms);
+}
+
+void ThisThread::yield() {
+    std::this_thread::yield();
+}
+
+Timer::Timer() : accumulated(0), running(false) {
+}
+
+void Timer::start() {
+    if (!this->running) {
+        this->started = steady_clock::now();
+        this->running = true;
+    }
+}
+
+void Timer::stop() {
+    if (this->running) {
+        this->accumulated += steady_clock::now() - this->started;
+        this->running = false;
+    }
+}
+
+void Timer::reset() {
+    this->accumulated = steady_clock::duration(0);
+    this->started = steady_clock::now();
+}
+
+std::chrono::microseconds Timer::elapsed_time() {
+    steady_clock::duration total = this->accumulated;
+    if (this->running) {
+        total += steady_clock::now() - this->started;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(total);
+}
+
+int Timer::read_us() {
+    return (int) this->elapsed_time().count();
+}
+
+float Timer::read() {
+    return this->elapsed_time().count() / 1000000.0f;
+}
+
+/**
+ * One thread runs every pending Timeout in order of expiry
+ */
+struct TimeoutService {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::multimap<steady_clock::time_point, uint64_t> queue;
+    std::map<uint64_t, std::pair<steady_clock::time_point, Callback<void()>>> pending;
+    uint64_t nextId = 1;
+
+    TimeoutService() {
+        std::thread(&TimeoutService::run, this).detach();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> guard(this->lock);
+
+        while (true) {
+            if (this->queue.empty()) {
+                this->changed.wait(guard);
+                continue;
+            }
+
+            auto first = this->queue.begin();
+            if (first->first > steady_clock::now()) {
+                this->changed.wait_until(guard, first->first);
+                continue;
+            }
+
+            uint64_t id = first->second;
+            this->queue.erase(first);
+
+            auto entry = this->pending.find(id);
+            if (entry == this->pending.end()) {
+                continue;
+            }
+            Callback<void()> function = entry->second.second;
+            this->pending.erase(entry);
+
+            guard.unlock();
+            hostRunAsIsr(function);
+            guard.lock();
+        }
+    }
+
+    uint64_t add(Callback<void()> function, std::chrono::microseconds delay) {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        uint64_t id = this->nextId++;
+        steady_clock::time_point when = steady_clock::now() + delay;
+        this->pending[id] = std::make_pair(when, function);
+        this->queue.insert(std::make_pair(when, id));
+        this->changed.notify_one();
+
+        return id;
+    }
+
+    void remove(uint64_t id) {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        auto entry = this->pending.find(id);
+        if (entry == this->pending.end()) {
+            return;
+        }
+
+        auto range = this->queue.equal_range(entry->second.first);
+        for (auto it = range.first; it != range.second; it++) {
+            if (it->second == id) {
+                this->queue.erase(it);
+                break;
+            }
+        }
+        this->pending.erase(entry);
+    }
+};
+
+static TimeoutService& timeoutService() {
+    //Never destroyed, the thread outlives static destructors
+    static TimeoutService* service = new TimeoutService();
+    return *service;
+}
+
+Timeout::Timeout() : id(0) {
+}
+
+Timeout::~Timeout() {
+    this->detach();
+}
+
+void Timeout::attach(Callback<void()> function, std::chrono::microseconds delay) {
+    this->detach();
+    this->id = timeoutService().add(function, delay);
+}
+
+void Timeout::attach(Callback<void()> function, float seconds) {
+    this->attach(function, std::chrono::microseconds((int64_t)(seconds * 1000000.0f)));
+}
+
+void Timeout::attach_us(Callback<void()> function, uint64_t us) {
+    this->attach(function, std::chrono::microseconds(us));
+}
+
+void Timeout::detach() {
+    if (this->id) {
+        timeoutService().remove(this->id);
+        this->id = 0;
+    }
+}
+
+//RTOS
+
+struct EventFlags::State {
+    std::mutex lock;
+    std::condition_variable changed;
+    uint32_t flags = 0;
+};
+
+EventFlags::EventFlags() : state(new State()) {
+}
+
+EventFlags::~EventFlags() {
+    delete this->state;
+}
+
+uint32_t EventFlags::set(uint32_t flags) {
+    std::lock_guard<std::mutex> guard(this->state->lock);
+    this->state->flags |= flags;
+    this->state->changed.notify_all();
+    return this->state->flags;
+}
+
+uint32_t EventFlags::clear(uint32_t flags) {
+    std::lock_guard<std::mutex> guard(this->state->lock);
+    uint32_t old = this->state->flags;
+    this->state->flags &= ~flags;
+    return old;
+}
+
+uint32_t EventFlags::get() const {
+    std::lock_guard<std::mutex> guard(this->state->lock);
+    return this->state->flags;
+}
+
+static uint32_t waitFlags(std::mutex& lock, std::condition_variable& changed, uint32_t& current,
+                          uint32_t flags, uint32_t millisec, bool clear, bool all) {
+    std::unique_lock<std::mutex> guard(lock);
+
+    auto ready = [&]() { return all ? (current & flags) == flags : (current & flags) != 0; };
+
+    if (millisec == osWaitForever) {
+        changed.wait(guard, ready);
+    } else if (!changed.wait_for(guard, std::chrono::milliseconds(millisec), ready)) {
+        return osFlagsErrorTimeout;
+    }
+
+    uint32_t ret = current;
+    if (clear) {
+        current &= ~flags;
+    }
+    return ret;
+}
+
+uint32_t EventFlags::wait_any(uint32_t flags, uint32_t millisec, bool clear) {
+    return waitFlags(this->state->lock, this->state->changed, this->state->flags, flags, millisec, clear, false);
+}
+
+uint32_t EventFlags::wait_all(uint32_t flags, uint32_t millisec, bool clear) {
+    return waitFlags(this->state->lock, this->state->changed, this->state->flags, flags, millisec, clear, true);
+}
+
+struct Mutex::State {
+    std::recursive_mutex lock;
+};
+
+Mutex::Mutex() : state(new State()) {
+}
+
+Mutex::~Mutex() {
+    delete this->state;
+}
+
+void Mutex::lock() {
+    this->state->lock.lock();
+}
+
+bool Mutex::trylock() {
+    return this->state->lock.try_lock();
+}
+
+void Mutex::unlock() {
+    this->state->lock.unlock();
+}
+
+struct Semaphore::State {
+    std::mutex lock;
+    std::condition_variable changed;
+    int32_t count;
+};
+
+Semaphore::Semaphore(int32_t count) : state(new State()) {
+    this->state->count = count;
+}
+
+Semaphore::~Semaphore() {
+    delete this->state;
+}
+
+void Semaphore::acquire() {
+    std::unique_lock<std::mutex> guard(this->state->lock);
+    this->state->changed.wait(guard, [this]() { return this->state->count > 0; });
+    this->state->count--;
+}
+
+bool Semaphore::try_acquire() {
+    return this->try_acquire_for(0);
+}
+
+bool Semaphore::try_acquire_for(uint32_t millisec) {
+    std::unique_lock<std::mutex> guard(this->state->lock);
+    if (!this->state->changed.wait_for(guard, std::chrono::milliseconds(millisec), [this]() { return this->state->count > 0; })) {
+        return false;
+    }
+    this->state->count--;
+    return true;
+}
+
+void Semaphore::release() {
+    std::lock_guard<std::mutex> guard(this->state->lock);
+    this->state->count++;
+    this->state->changed.notify_one();
+}
+
+Thread::Thread(osPriority priority, uint32_t stack_size, unsigned char* stack_mem, const char* name) {
+    (void) priority;
+    (void) stack_size;
+    (void) stack_mem;
+    (void) name;
+}
+
+Thread::~Thread() {
+    if (this->thread.joinable()) {
+        this->thread.detach();
+    }
+}
+
+void Thread::start(Callback<void()> task) {
+    this->thread = std::thread([task]() { task(); });
+}
+
+void Thread::join() {
+    if (this->thread.joinable()) {
+        this->thread.join();
+    }
+}
@@ -0,0 +1,534 @@
+/*
+ * Serial Async Class, host stand-in
+ *
+ * Implements the SerialAsync interface on top of a file descriptor. A
+ * transmit thread plays the part of the tx dma channel: writes return
+ * immediately and the thread pushes the bytes out, taking as long as the
+ * configured baud would. A receive thread plays the part of the rx dma
+ * channel, filling the receive ring and raising receive events from
+ * emulated interrupt context.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "serialAsync.hpp"
+#include "hostSerial.hpp"
+#include "collectionCommon.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+using std::chrono::steady_clock;
+
+static std::mutex bindingLock;
+static std::map<int, int> bindings; //tx pin to descriptor
+static std::atomic<bool> emulateBaud(true);
+
+void hostSerialBind(PinName tx, int fd) {
+    std::lock_guard<std::mutex> guard(bindingLock);
+    bindings[(int) tx] = fd;
+}
+
+void hostSerialEmulateBaud(bool enable) {
+    emulateBaud = enable;
+}
+
+struct SerialAsync::HostLink {
+    int fd;
+    std::atomic<int> baud;
+    std::atomic<int> frameBits;
+    std::atomic<bool> stopping;
+
+    //Transmit, the spans are only touched by the transmit thread while busy is set
+    std::thread txThread;
+    std::mutex txLock;
+    std::condition_variable txChanged;
+    std::vector<Span> txSpans;
+    std::vector<uint8_t> txCopy; //Holds gathered spans so callers can reuse their span array
+    bool txBusy;
+    volatile void* transmitBuffer;
+    int paceChunk;
+    int paceGap;
+
+    //Receive
+    std::thread rxThread;
+    std::mutex rxLock;
+    volatile uint8_t* ring;
+    int ringLength;
+    std::atomic<int> head;
+    volatile int tail;
+
+    EventFlags flags;
+    Callback<void(int)> callback;
+    int eventCount;
+    int eventIdleChars;
+    int eventDelimiter;
+    int scannedHead;
+    int idleHead;
+    bool idleArmed;
+    steady_clock::time_point idleDeadline;
+
+    int available() {
+        if (!this->ring) {
+            return 0;
+        }
+        int count = this->head - this->tail;
+        return count < 0 ? count + this->ringLength : count;
+    }
+
+    int charTime_us() {
+        return this->frameBits * 1000000 / this->baud + 1;
+    }
+
+    /**
+     * Same rules as the uart interrupt on the board. Called with the interrupt lock held.
+     */
+    void checkEvents() {
+        if (!this->ring) {
+            return;
+        }
+
+        int current = this->head;
+        int events = 0;
+
+        if (this->eventCount > 0 && this->available() >= this->eventCount) {
+            events |= RX_EVENT_COUNT;
+        }
+
+        if (this->eventDelimiter >= 0) {
+            for (int i = this->scannedHead; i != current; i = i + 1 == this->ringLength ? 0 : i + 1) {
+                if (this->ring[i] == (uint8_t) this->eventDelimiter) {
+                    events |= RX_EVENT_DELIMITER;
+                    break;
+                }
+            }
+            this->scannedHead = current;
+        }
+
+        if (this->eventIdleChars > 0 && current != this->idleHead) {
+            this->idleHead = current;
+            this->idleArmed = true;
+            this->idleDeadline = steady_clock::now() + std::chrono::microseconds(this->eventIdleChars * this->charTime_us());
+        }
+
+        if (events) {
+            this->signal(events);
+        }
+    }
+
+    void signal(int events) {
+        this->flags.set(events);
+        if (this->callback) {
+            this->callback(events);
+        }
+    }
+
+    void transmitLoop() {
+        std::unique_lock<std::mutex> guard(this->txLock);
+
+        while (!this->stopping) {
+            if (!this->txBusy) {
+                this->txChanged.wait(guard);
+                continue;
+            }
+
+            guard.unlock();
+
+            //Scheduling against the start so sleep overshoot doesn't accumulate
+            steady_clock::time_point start = steady_clock::now();
+            int64_t sent = 0;
+            int64_t gaps_us = 0;
+
+            for (const Span& span : this->txSpans) {
+                int offset = 0;
+                while (span.size > offset) {
+                    int chunk = span.size - offset;
+                    if (this->paceChunk && chunk > this->paceChunk) {
+                        chunk = this->paceChunk;
+                    }
+
+                    if (emulateBaud) {
+                        //About a millisecond of bytes at a time, each released once its wire time has passed
+                        int perMs = this->baud / this->frameBits / 1000;
+                        if (chunk > perMs) {
+                            chunk = perMs > 0 ? perMs : 1;
+                        }
+                        int64_t wire_us = (sent + chunk) * this->frameBits * 1000000 / this->baud + gaps_us;
+                        std::this_thread::sleep_until(start + std::chrono::microseconds(wire_us));
+                    }
+
+                    int written = ::write(this->fd, span.data + offset, chunk);
+                    if (written <= 0) {
+                        if (written < 0 && errno == EINTR) {
+                            continue;
+                        }
+                        //Other end went away, dropping the rest like a disconnected wire
+                        offset = span.size;
+                        break;
+                    }
+
+                    offset += written;
+                    sent += written;
+
+                    if (emulateBaud && this->paceChunk && (sent % this->paceChunk) == 0) {
+                        gaps_us += this->paceGap;
+                    }
+                }
+            }
+
+            guard.lock();
+            this->txBusy = false;
+            this->txChanged.notify_all();
+        }
+    }
+
+    void receiveLoop() {
+        uint8_t buffer[256];
+
+        while (!this->stopping) {
+            int timeout_ms = 20;
+            if (this->idleArmed) {
+                int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(this->idleDeadline - steady_clock::now()).count();
+                timeout_ms = left < 0 ? 0 : (left < timeout_ms ? (int) left : timeout_ms);
+            }
+
+            if (!this->ring) {
+                //Without a receive buffer bytes stay in the descriptor for read() to fetch
+                std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+                continue;
+            }
+
+            struct pollfd pfd;
+            pfd.fd = this->fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            int ready = ::poll(&pfd, 1, timeout_ms);
+
+            std::lock_guard<std::mutex> guard(this->rxLock);
+
+            if (ready > 0 && (pfd.revents & (POLLIN | POLLHUP | POLLERR)) && this->ring) {
+                int count = ::read(this->fd, buffer, sizeof(buffer));
+                if (count <= 0) {
+                    if (count == 0 || errno != EINTR) {
+                        //Closed, nothing more will ever arrive
+                        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+                    }
+                    continue;
+                }
+
+                //Like the dma channel, the ring is overwritten if the reader falls behind
+                int position = this->head;
+                for (int i = 0; count > i; i++) {
+                    this->ring[position] = buffer[i];
+                    position = position + 1 == this->ringLength ? 0 : position + 1;
+                }
+                this->head = position;
+
+                hostRunAsIsr(Callback<void()>([this]() { this->checkEvents(); }));
+                continue;
+            }
+
+            if (this->idleArmed && steady_clock::now() >= this->idleDeadline) {
+                this->idleArmed = false;
+                hostRunAsIsr(Callback<void()>([this]() {
+                    if (this->available() > 0) {
+                        this->signal(RX_EVENT_IDLE);
+                    }
+                }));
+            }
+        }
+    }
+};
+
+SerialAsync::SerialAsync(PinName tx, PinName rx) : SerialAsync(tx, rx, 9600) {
+    // defaults to baud rate of 9600
+}
+
+SerialAsync::SerialAsync(PinName tx, PinName rx, int baudrate) : SerialAsync(tx, rx, baudrate, DMA_DEDICATED) {
+}
+
+SerialAsync::SerialAsync(PinName tx, PinName rx, int baudrate, DMAMode mode) {
+    (void) rx;
+    (void) mode; //There are no dma channels to share on a host
+
+    this->host = new HostLink();
+    HostLink* link = this->host;
+
+    link->fd = -1;
+    {
+        std::lock_guard<std::mutex> guard(bindingLock);
+        auto binding = bindings.find((int) tx);
+        if (binding != bindings.end()) {
+            link->fd = binding->second;
+            bindings.erase(binding);
+        }
+    }
+
+    if (link->fd < 0) {
+        //Nothing bound, so exposing the uart as a pseudo-terminal
+        link->fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (link->fd < 0 || grantpt(link->fd) || unlockpt(link->fd)) {
+            std::perror("SerialAsync: unable to open a pty");
+            std::exit(1);
+        }
+        std::fprintf(stderr, "SerialAsync: pin %d is connected to %s\n", (int) tx, ptsname(link->fd));
+    }
+
+    link->baud = baudrate;
+    link->frameBits = 10;
+    link->stopping = false;
+    link->txBusy = false;
+    link->transmitBuffer = nullptr;
+    link->paceChunk = 0;
+    link->paceGap = 0;
+    link->ring = nullptr;
+    link->ringLength = 0;
+    link->head = 0;
+    link->tail = 0;
+    link->eventCount = 0;
+    link->eventIdleChars = 0;
+    link->eventDelimiter = -1;
+    link->scannedHead = 0;
+    link->idleHead = 0;
+    link->idleArmed = false;
+
+    link->txThread = std::thread(&HostLink::transmitLoop, link);
+    link->rxThread = std::thread(&HostLink::receiveLoop, link);
+}
+
+SerialAsync::~SerialAsync() {
+    this->checkBufferFree();
+
+    {
+        std::lock_guard<std::mutex> guard(this->host->txLock);
+        this->host->stopping = true;
+        this->host->txChanged.notify_all();
+    }
+    this->host->txThread.join();
+    this->host->rxThread.join();
+
+    ::close(this->host->fd);
+    delete this->host;
+}
+
+void SerialAsync::setBaud(int baudrate) {
+    this->sync();
+    this->host->baud = baudrate;
+}
+
+void SerialAsync::sync() {
+    std::unique_lock<std::mutex> guard(this->host->txLock);
+    this->host->txChanged.wait(guard, [this]() { return !this->host->txBusy; });
+}
+
+int SerialAsync::read(void* buffer, int size) {
+    int ret = 0;
+
+    if (this->host->ring) {
+        Span spans[2];
+        this->peek(spans);
+
+        for (int i = 0; 2 > i && size > ret; i++) {
+            int length = spans[i].size < size - ret ? spans[i].size : size - ret;
+            std::memcpy((uint8_t*) buffer + ret, spans[i].data, length);
+            ret += length;
+        }
+
+        this->consume(ret);
+        return ret;
+    }
+
+    //No receive buffer, so taking what is waiting up to the size of the fifo on the board
+    struct pollfd pfd;
+    pfd.fd = this->host->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (::poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+        ret = ::read(this->host->fd, buffer, size < 16 ? size : 16);
+    }
+
+    return ret < 0 ? 0 : ret;
+}
+
+int SerialAsync::available() {
+    return this->host->available();
+}
+
+int SerialAsync::peek(Span spans[2]) {
+    HostLink* link = this->host;
+
+    spans[0].data = nullptr;
+    spans[0].size = 0;
+    spans[1].data = nullptr;
+    spans[1].size = 0;
+
+    if (!link->ring) {
+        return 0;
+    }
+
+    int head = link->head;
+    int tail = link->tail;
+
+    spans[0].data = (const uint8_t*) link->ring + tail;
+    if (head >= tail) {
+        spans[0].size = head - tail;
+    } else {
+        spans[0].size = link->ringLength - tail;
+        spans[1].data = (const uint8_t*) link->ring;
+        spans[1].size = head;
+    }
+
+    return spans[0].size + spans[1].size;
+}
+
+void SerialAsync::consume(int size) {
+    int count = this->available();
+    if (size > count) {
+        size = count;
+    }
+    if (size <= 0) {
+        return;
+    }
+
+    int tail = this->host->tail + size;
+    this->host->tail = tail >= this->host->ringLength ? tail - this->host->ringLength : tail;
+}
+
+void SerialAsync::setReceiveBuffer(void* buffer, int size) {
+    HostLink* link = this->host;
+    std::lock_guard<std::mutex> guard(link->rxLock);
+    core_util_critical_section_enter();
+
+    link->ring = (!buffer || size <= 0) ? nullptr : (volatile uint8_t*) buffer;
+    link->ringLength = link->ring ? (size < DMA_MAX_CIRCULAR_SIZE ? size : DMA_MAX_CIRCULAR_SIZE) : 0; //As long as the dma ring can be
+    link->head = 0;
+    link->tail = 0;
+    link->scannedHead = 0;
+    link->idleHead = 0;
+    link->idleArmed = false;
+
+    core_util_critical_section_exit();
+}
+
+void SerialAsync::setReceiveEvents(int count, int idleChars, int delimiter) {
+    core_util_critical_section_enter();
+    this->host->eventCount = count;
+    this->host->eventIdleChars = idleChars;
+    this->host->eventDelimiter = delimiter;
+    this->host->scannedHead = this->host->head;
+    core_util_critical_section_exit();
+}
+
+void SerialAsync::attachReceive(Callback<void(int)> cb) {
+    core_util_critical_section_enter();
+    this->host->callback = cb;
+    core_util_critical_section_exit();
+}
+
+int SerialAsync::waitForReceive(int events, uint32_t timeout_ms) {
+    this->host->flags.clear(RX_EVENT_COUNT);
+
+    core_util_critical_section_enter();
+    this->host->checkEvents();
+    core_util_critical_section_exit();
+
+    uint32_t flags = this->host->flags.wait_any(events, timeout_ms);
+    if (flags & osFlagsError) {
+        return 0;
+    }
+
+    return flags & events;
+}
+
+void SerialAsync::setControl(SerialParity parity, StopBits stop, WordLength bits) {
+    this->sync();
+    this->host->frameBits = 1 + ((int)bits + 5) + (parity != ParityNone ? 1 : 0) + ((int)stop + 1);
+}
+
+void SerialAsync::setFlowControl(FlowControl type, PinName rts, PinName cts) {
+    //A descriptor never overruns, so there is nothing to do
+    (void) type;
+    (void) rts;
+    (void) cts;
+}
+
+void SerialAsync::setPacing(int chunkSize, int gap_us) {
+    this->sync();
+    this->host->paceChunk = chunkSize > 0 ? chunkSize : 0;
+    this->host->paceGap = gap_us > 0 ? gap_us : 0;
+}
+
+void SerialAsync::write(void* buffer, int size) {
+    this->checkBufferFree();
+
+    Span span;
+    span.data = (const uint8_t*) buffer;
+    span.size = size;
+
+    std::lock_guard<std::mutex> guard(this->host->txLock);
+    this->host->txSpans.assign(1, span);
+    this->host->txBusy = size > 0;
+    this->host->txChanged.notify_all();
+}
+
+void SerialAsync::writeAndFree(void* buffer, int size) {
+    this->write(buffer, size);
+    this->host->transmitBuffer = buffer;
+}
+
+bool SerialAsync::writeGather(const Span* spans, int count) {
+    if (count > DMA_MAX_SEGMENTS || this->host->paceChunk) {
+        return false;
+    }
+
+    this->checkBufferFree();
+
+    std::lock_guard<std::mutex> guard(this->host->txLock);
+    int size = 0;
+    for (int i = 0; count > i; i++) {
+        size += spans[i].size;
+    }
+    this->host->txSpans.assign(spans, spans + count);
+    this->host->txBusy = size > 0;
+    this->host->txChanged.notify_all();
+
+    return true;
+}
+
+void SerialAsync::flushReceiving() {
+    if (this->host->ring) {
+        core_util_critical_section_enter();
+        this->host->tail = this->host->head;
+        this->host->scannedHead = this->host->tail;
+        core_util_critical_section_exit();
+        return;
+    }
+
+    //Throwing away whatever is waiting in the descriptor
+    uint8_t discard[64];
+    struct pollfd pfd;
+    pfd.fd = this->host->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    while (::poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+        if (::read(this->host->fd, discard, sizeof(discard)) <= 0) {
+            break;
+        }
+    }
+}
+
+void SerialAsync::checkBufferFree() {
+    this->sync();
+    if (this->host->transmitBuffer) {
+        free_safe((void*)this->host->transmitBuffer);
+        this->host->transmitBuffer = nullptr;
+    }
+}
@@ -1,5 +1,10 @@
 #include "mbed.h"
 #include "uLCD.hpp"
+#include "uLCDScene.hpp"
+#include "uLCDAsync.hpp"
+#include "uLCDDigits.hpp"
+#include "uLCDText.hpp"
+#include "uLCDTrace.hpp"
 #include "Motor.h"
 #include <stdio.h>
 #include "ultrasonic.h"
@@ -20,7 +25,16 @@ DigitalOut red(p13);
 PinName tx(p28);
 PinName rx(p27);
 PinName reset(p29);
-uLCD lcd(tx, rx, reset, uLCD::BAUD_9600);
+uLCD lcd(tx, rx, reset, uLCD::BAUD_AUTO);
+//The alarm and sonar threads draw through the display thread instead of sharing lcd
+uLCDAsync display(lcd);
+
+//Uncomment to record the display commands of each round and print them once it ends, for tools/traceReplay
+//#define TRACE_DISPLAY
+#ifdef TRACE_DISPLAY
+uint8_t traceBuffer[8192];
+uLCDTrace trace(traceBuffer, sizeof(traceBuffer));
+#endif
 int hours = 0;
 int hoursSelected = 1;
 int minutes = 0;
@@ -41,24 +55,32 @@ Motor right(p26, p25, p24); // pwm, fwd, rev
 Motor left(p23, p22, p30); // left
 
 void draw_grid() {
+    //Collected first so the display can choose between pixels and BLITs per band
+    static uLCD::Point points[26 * 26];
+    int count = 0;
     for (int i = 0; i < 128; i+=5) {
         for (int j = 0; j < 128; j += 5) {
-            lcd.setPixel(i, j, 0xFFFF);
+            points[count].x = i;
+            points[count].y = j;
+            count++;
         }
     }
+    lcd.drawPixels(points, count, 0xFFFF, 0x0000);
 }
 
 void set_time() {
     lcd.cls();
     wait_us(200000);
+
+    //Only the digits and underline that changed are redrawn after each press
+    uLCDScene scene(lcd);
+    int clock = scene.addText(1, 0, 2, 2, 0xFFFF, 0x0000);
+    int underline = scene.addRectangle(10, 15, 30, 15, 0xFFFF);
+
     while (1) {
         if (hours == 0 && minutes == 0 && seconds == 0) {
             seconds = 1;
         }
-        lcd.cls();
-        lcd.locate(1, 0);
-        lcd.setFontSize(2, 2);
-        lcd.setTextColor(0xFFFF);
         sprintf(hourString, "%d", hours);
         if (hours < 10) {
             sprintf(hourString, "0%d", hours);
@@ -71,16 +93,18 @@ void set_time() {
         if (seconds < 10) {
             sprintf(secondString, "0%d", seconds);
         }
-        lcd.printf("%s:%s:%s\n", hourString, minuteString, secondString);
+        scene.setTextf(clock, "%s:%s:%s", hourString, minuteString, secondString);
         if (hoursSelected) {
-            lcd.drawRectangleFilled(10, 15, 30, 15, 0xFFFF);
+            scene.setRectangle(underline, 10, 15, 30, 15, 0xFFFF);
         } 
         else if (minutesSelected) {
-            lcd.drawRectangleFilled(52, 15, 72, 15, 0xFFFF);
+            scene.setRectangle(underline, 52, 15, 72, 15, 0xFFFF);
         }
         else {
-            lcd.drawRectangleFilled(94, 15, 114, 15, 0xFFFF);
+            scene.setRectangle(underline, 94, 15, 114, 15, 0xFFFF);
         }
+        scene.update();
+        lcd.traceFrame();
         while (1) {
             if (bDown == 0 && hoursSelected) {
                 hours = (hours + 1) % 24;
@@ -153,11 +177,11 @@ void set_time() {
     }
 }
 
-uint16_t red_color = uLCD::get4DGLColor("0xFF0000");
-uint16_t green_color = uLCD::get4DGLColor("0x00FF00");
-uint16_t blue_color = uLCD::get4DGLColor("0x0000FF");
-uint16_t purple_color = uLCD::get4DGLColor("0xA020F0");
-uint16_t yellow_color = uLCD::get4DGLColor("0xFFFF00");
+constexpr uint16_t red_color = 0xFF0000_4dgl;
+constexpr uint16_t green_color = 0x00FF00_4dgl;
+constexpr uint16_t blue_color = 0x0000FF_4dgl;
+constexpr uint16_t purple_color = 0xA020F0_4dgl;
+constexpr uint16_t yellow_color = 0xFFFF00_4dgl;
 
 
 void set_simon_difficulty() {
@@ -185,6 +209,7 @@ void set_simon_difficulty() {
         if (hardSelected) {
             lcd.drawCircleFilled(70, 72, 5, 0xFFFF);
         }
+        lcd.traceFrame();
 
         while (1) {
             if (bUp == 0) {
@@ -234,6 +259,11 @@ void countdown() {
     int hoursLeft = hours;
     int minutesLeft = minutes;
     int secondsLeft = seconds;
+
+    //A tick only redraws the cells that changed, as segments or printed, whichever is cheaper
+    lcd.cls();
+    uLCDDigits clock(lcd, 14, 48, "88:88:88", 12, 24, 2, 0xFFFF, 0x0, true);
+
     while (1) {
         struct timeval start, end;
         gettimeofday(&start, NULL);
@@ -249,23 +279,9 @@ void countdown() {
         if (hoursLeft < 0) {
             return;
         }
-        lcd.cls();
-        lcd.locate(1, 3);
-        lcd.setFontSize(2, 2);
-        lcd.setTextColor(0xFFFF);
-        sprintf(hourString, "%d", hoursLeft);
-        if (hoursLeft < 10) {
-            sprintf(hourString, "0%d", hoursLeft);
-        }
-        sprintf(minuteString, "%d", minutesLeft);
-        if (minutesLeft < 10) {
-            sprintf(minuteString, "0%d", minutesLeft);
-        }
-        sprintf(secondString, "%d", secondsLeft);
-        if (secondsLeft < 10) {
-            sprintf(secondString, "0%d", secondsLeft);
-        }
-        lcd.printf("%s:%s:%s\n", hourString, minuteString, secondString);
+        clock.setTextf("%02d:%02d:%02d", hoursLeft, minutesLeft, secondsLeft);
+        clock.update();
+        lcd.traceFrame();
         gettimeofday(&end, NULL);
         int elapsed_usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
         wait_us(1000000 - elapsed_usec);
@@ -274,7 +290,7 @@ void countdown() {
 }
 volatile int done = 0;
 void alarm() {
-    lcd.cls();
+    display.cls();
     // User view- left:yellow, up:green, right:red, down:blue
     // bLeft:red, bUp:blue, bRight:yellow, bDown:green
     int patternLength = 4;
@@ -291,13 +307,13 @@ void alarm() {
     }
 
     while (1) {
-        lcd.cls();
-        lcd.drawRectangleFilled(0, 0, 128, 128, yellow_color);
-        lcd.locate(0, 3);
-        lcd.setTextColor(blue_color);
-        lcd.setTextBackground(yellow_color);
-        lcd.setFontSize(3, 4);
-        lcd.printf("good\nMORNING\n>:D");
+        display.cls();
+        display.drawRectangleFilled(0, 0, 128, 128, yellow_color);
+        display.locate(0, 3);
+        display.setTextColor(blue_color);
+        display.setTextBackground(yellow_color);
+        display.setFontSize(3, 4);
+        display.printf("good\nMORNING\n>:D");
         for (int i = 0; i < patternLength; i++) {
             switch (pattern[i]) {
                 case 0:
@@ -357,13 +373,13 @@ void alarm() {
                 }
             }
             if (pattern[p] != a) {
-                lcd.cls();
-                lcd.drawRectangleFilled(0, 0, 128, 128, red_color);
-                lcd.locate(1, 6);
-                lcd.setFontSize(3, 3);
-                lcd.setTextColor(0xFFFF);
-                lcd.setTextBackground(red_color);
-                lcd.printf("WRONG");
+                display.cls();
+                display.drawRectangleFilled(0, 0, 128, 128, red_color);
+                display.locate(1, 6);
+                display.setFontSize(3, 3);
+                display.setTextColor(0xFFFF);
+                display.setTextBackground(red_color);
+                display.printf("WRONG");
                 wait_us(1000000);
                 break;
             }
@@ -386,27 +402,26 @@ void alarm() {
 
 void title_screen() {
     lcd.cls();
-    lcd.locate(2, 2);
-    lcd.setFontSize(2, 3);
     lcd.setTextBackground(0x0000);
     lcd.setTextColor(purple_color);
-    lcd.printf("WAKEBOT\n");
+    TextBox title = {0, 1, getTextColumns(2), 1, 2, 3};
+    drawText(lcd, "WAKEBOT", title, TEXT_CENTER);
     lcd.setTextColor(green_color);
-    lcd.setFontSize(1, 1);
-    lcd.printf("\n  Edan Eyal\n\n Will Griffin\n");
+    TextBox names = {0, 7, getTextColumns(1), 2, 1, 1};
+    drawText(lcd, "Edan Eyal\nWill Griffin", names, TEXT_CENTER);
+    TextBox prompt = {0, 11, getTextColumns(1), 1, 1, 1};
     int blink = 0;
     while (1) {
         if (bCenter == 0) {
             return;
         }
         if (blink) {
-            lcd.locate(2, 11);
-            lcd.setFontSize(1, 1);
             lcd.setTextColor(0xFFFF);
-            lcd.printf("Press to Start");
+            drawText(lcd, "Press to Start", prompt, TEXT_CENTER);
         } else {
             lcd.drawRectangleFilled(0, 80, 120, 120, 0x0000);
         }
+        lcd.traceFrame();
         blink = !blink;
         if (bCenter == 0) {
             return;
@@ -430,11 +445,11 @@ void sound() {
 int lastDistance;
 void motor(int distance) {
     distance /= 10;
-    /*lcd.cls();
-    lcd.locate(0, 0);
-    lcd.setTextColor(0xFFFF);
-    lcd.setTextBackground(0x0);
-    lcd.printf("%d", distance);*/
+    /*display.cls();
+    display.locate(0, 0);
+    display.setTextColor(0xFFFF);
+    display.setTextBackground(0x0);
+    display.printf("%d", distance);*/
     if (distance < 10 || lastDistance == distance) {
         left.speed(0);
         right.speed(-1);
@@ -463,10 +478,16 @@ int main()
     bDown.mode(PullUp);
     bRight.mode(PullUp);
     bCenter.mode(PullUp);
+    printf("Display ready in %d ms at %d baud\n", lcd.getStartupTime() / 1000, lcd.getBaudRate());
+    display.start();
     while (true) {
         Thread sonarThread;
         Thread alarmThread;
         Thread soundThread;
+#ifdef TRACE_DISPLAY
+        trace.clear();
+        lcd.setTrace(&trace);
+#endif
         title_screen();
         config_mode();
         countdown();
@@ -479,6 +500,12 @@ int main()
                 alarmThread.terminate();
                 sonarThread.terminate();
                 soundThread.terminate();
+                //Back to drawing on lcd directly from this thread
+                display.fence();
+#ifdef TRACE_DISPLAY
+                lcd.setTrace(nullptr);
+                trace.dump(stdout);
+#endif
                 speaker = 0;
                 left.speed(0);
                 right.speed(0);
@@ -0,0 +1,133 @@
+/*
+ * Packet Serial Class
+ *
+ * Sends and receives framed packets over a SerialAsync link. Every packet is
+ * followed by a CRC16 and COBS encoded, with a zero byte marking the end of
+ * each frame so the receiver can resynchronize after corruption.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "packetSerial.hpp"
+#include "crc.hpp"
+#include "collectionCommon.hpp"
+
+PacketSerial::PacketSerial(SerialAsync& serial, int maxPayload) :
+    serial(serial),
+    frameBuffer((uint8_t*) malloc_safe(maxPayload + 2)),
+    decoder(frameBuffer, maxPayload + 2) {
+    
+    this->maxPayload = maxPayload;
+    this->encodeBuffer = (uint8_t*) malloc_safe(cobsMaxEncodedSize(maxPayload + 2) + 1);
+    printMalloc(this->frameBuffer);
+    printMalloc(this->encodeBuffer);
+
+    this->packetsSent = 0;
+    this->packetsCopied = 0;
+    this->packetsReceived = 0;
+    this->packetsDropped = 0;
+
+    //Waking receivers on every frame delimiter
+    this->serial.setReceiveEvents(0, 0, 0x00);
+}
+
+PacketSerial::~PacketSerial() {
+    this->serial.sync();
+    free_safe(this->frameBuffer);
+    free_safe(this->encodeBuffer);
+    printFree(this->frameBuffer);
+    printFree(this->encodeBuffer);
+}
+
+bool PacketSerial::send(const void* payload, int size) {
+    if (size > this->maxPayload || size < 0) {
+        return false;
+    }
+
+    //The previous packet may still be using the code bytes and trailer
+    this->serial.sync();
+
+    uint16_t crc = crc16(payload, size);
+    this->trailer[0] = crc >> 8;
+    this->trailer[1] = crc;
+
+    static const uint8_t delimiter = 0x00;
+
+    CobsSpan in[2];
+    in[0].data = (const uint8_t*) payload;
+    in[0].size = size;
+    in[1].data = this->trailer;
+    in[1].size = 2;
+
+    //Leaving room for the delimiter at the end
+    CobsSpan out[DMA_MAX_SEGMENTS];
+    int count = cobsEncodeSpans(in, 2, this->codes, out, DMA_MAX_SEGMENTS - 1);
+
+    if (count > 0) {
+        out[count].data = &delimiter;
+        out[count++].size = 1;
+
+        //CobsSpan and SerialAsync::Span share a layout but are kept as separate types
+        SerialAsync::Span spans[DMA_MAX_SEGMENTS];
+        for (int i = 0; count > i; i++) {
+            spans[i].data = out[i].data;
+            spans[i].size = out[i].size;
+        }
+
+        if (this->serial.writeGather(spans, count)) {
+            this->packetsSent++;
+            return true;
+        }
+    }
+
+    //Too many zeros to describe in place, so copying into the encode buffer instead
+    int length = cobsEncode(in, 2, this->encodeBuffer);
+    this->encodeBuffer[length++] = 0;
+
+    this->serial.write(this->encodeBuffer, length);
+    this->packetsSent++;
+    this->packetsCopied++;
+    return true;
+}
+
+int PacketSerial::receive(uint32_t timeout_ms) {
+    for (int attempt = 0; 2 > attempt; attempt++) {
+        SerialAsync::Span spans[2];
+
+        while (this->serial.peek(spans)) {
+            for (int i = 0; 2 > i && spans[i].size; i++) {
+                bool complete = false;
+                int used = this->decoder.feed(spans[i].data, spans[i].size, &complete);
+                this->serial.consume(used);
+
+                if (!complete) {
+                    continue;
+                }
+
+                int length = this->decoder.frameLength();
+                if (length == 0) {
+                    //Back to back delimiters, nothing was lost
+                    break;
+                }
+
+                const uint8_t* frame = this->decoder.frame();
+                if (!this->decoder.valid() || length < 2 ||
+                    crc16(frame, length - 2) != (uint16_t)((frame[length - 2] << 8) | frame[length - 1])) {
+                    this->packetsDropped++;
+                    break;
+                }
+
+                this->packetsReceived++;
+                return length - 2;
+            }
+        }
+
+        if (!timeout_ms || attempt) {
+            break;
+        }
+
+        this->serial.waitForReceive(SerialAsync::RX_EVENT_DELIMITER, timeout_ms);
+    }
+
+    return 0;
+}
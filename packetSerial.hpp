@@ -0,0 +1,84 @@
+/*
+ * Packet Serial Class
+ *
+ * Sends and receives framed packets over a SerialAsync link. Every packet is
+ * followed by a CRC16 and COBS encoded, with a zero byte marking the end of
+ * each frame so the receiver can resynchronize after corruption.
+ *
+ * Packets are encoded for transmission without copying when the payload has
+ * few enough zeros to be described to the DMA as a scatter-gather list.
+ * Received packets are decoded directly out of the DMA receive ring.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_PACKET_SERIAL_INCLUDED
+#define COLLECTION_PACKET_SERIAL_INCLUDED
+
+#include "mbed.h"
+#include "serialAsync.hpp"
+#include "cobs.hpp"
+
+class PacketSerial {
+    private:
+
+    SerialAsync& serial;
+    uint8_t* frameBuffer;
+    CobsDecoder decoder;
+    uint8_t* encodeBuffer; //Used when a packet has too many zeros for a scatter-gather transmit
+    int maxPayload;
+
+    //Scatter-gather state, must stay untouched until the transmit completes
+    uint8_t codes[DMA_MAX_SEGMENTS];
+    uint8_t trailer[2];
+
+    int packetsSent;
+    int packetsCopied;
+    int packetsReceived;
+    int packetsDropped;
+
+    public:
+
+    /**
+     * The serial link should already have a receive buffer set for receiving packets.
+     * @param serial The link to send packets over
+     * @param maxPayload The largest packet payload in bytes that can be sent or received
+     */
+    PacketSerial(SerialAsync& serial, int maxPayload);
+
+    ~PacketSerial();
+
+    /**
+     * Sends a packet asynchronously.
+     * NOTE: The payload is transmitted in place, it must stay valid until the serial link is synced.
+     * @param payload The bytes to send
+     * @param size The size of the payload in bytes, at most maxPayload
+     * @return true if the packet was queued
+     */
+    bool send(const void* payload, int size);
+
+    /**
+     * Decodes received bytes until a complete valid packet is found.
+     * Frames that fail the CRC check or are too long are dropped.
+     * @param timeout_ms Time to sleep waiting for a frame delimiter if none is complete yet, 0 to return immediately
+     * @return the payload size of the received packet, 0 if none is available
+     */
+    int receive(uint32_t timeout_ms = 0);
+
+    /** Returns the payload of the last packet returned by receive(), valid until the next call */
+    inline const uint8_t* packet() { return this->decoder.frame(); }
+
+    /** Returns the number of packets sent */
+    inline int getPacketsSent() { return this->packetsSent; }
+
+    /** Returns the number of sent packets that had to be copied because of too many zeros */
+    inline int getPacketsCopied() { return this->packetsCopied; }
+
+    /** Returns the number of valid packets received */
+    inline int getPacketsReceived() { return this->packetsReceived; }
+
+    /** Returns the number of received frames dropped for a bad CRC, bad encoding or length */
+    inline int getPacketsDropped() { return this->packetsDropped; }
+};
+
+#endif // COLLECTION_PACKET_SERIAL_INCLUDED
@@ -0,0 +1,238 @@
+/*
+ * Pixel Conversion Functions
+ *
+ * Every path truncates each channel after an optional saturating add of the
+ * dither threshold, so they agree bit for bit with the reference.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "pixelConvert.hpp"
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PIXEL_CONVERT_NEON
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define PIXEL_CONVERT_SSSE3
+#endif
+
+//4x4 Bayer matrix, 0 to 15
+static const uint8_t bayer[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5}
+};
+
+/**
+ * The dither thresholds of a row: red and blue lose three bits, green loses two
+ */
+struct RowThresholds {
+    uint8_t redBlue[4];
+    uint8_t green[4];
+};
+
+static void rowThresholds(int y, bool dither, RowThresholds& thresholds) {
+    for (int x = 0; 4 > x; x++) {
+        thresholds.redBlue[x] = dither ? bayer[y & 3][x] >> 1 : 0;
+        thresholds.green[x] = dither ? bayer[y & 3][x] >> 2 : 0;
+    }
+}
+
+static inline uint8_t addSaturated(uint8_t a, uint8_t b) {
+    int sum = a + b;
+    return sum > 255 ? 255 : sum;
+}
+
+/**
+ * Four saturating byte adds in one word, the M3 has no SIMD instructions for it
+ */
+static inline uint32_t addSaturated(uint32_t a, uint32_t b) {
+    uint32_t sum = (a & 0x7F7F7F7F) + (b & 0x7F7F7F7F);
+    uint32_t result = sum ^ ((a ^ b) & 0x80808080);
+    uint32_t overflow = ((a & b) | ((a | b) & ~result)) & 0x80808080;
+    return result | ((overflow >> 7) * 0xFF);
+}
+
+/**
+ * RGB565 with its bytes swapped, the same as uLCD::get4DGLColor()
+ */
+static inline uint16_t pack4DGL(uint32_t red, uint32_t green, uint32_t blue) {
+    return (red & 0xF8) | (green >> 5) | ((green & 0x1C) << 11) | ((blue & 0xF8) << 5);
+}
+
+static inline uint16_t convertPixel(const uint8_t* source, bool rgb, const RowThresholds& thresholds, int x) {
+    uint8_t red = addSaturated(source[rgb ? 0 : 2], thresholds.redBlue[x & 3]);
+    uint8_t green = addSaturated(source[1], thresholds.green[x & 3]);
+    uint8_t blue = addSaturated(source[rgb ? 2 : 0], thresholds.redBlue[x & 3]);
+    return pack4DGL(red, green, blue);
+}
+
+/**
+ * Converts pixels from x = 0 until fewer than 4 remain, returns how many were converted
+ */
+static int convertWords(const uint8_t* source, uint16_t* pixels, int count, bool rgb, const RowThresholds& thresholds) {
+    //Four pixels are three words, and the thresholds repeat every four pixels, so three words of them
+    const uint8_t* rb = thresholds.redBlue;
+    const uint8_t* g = thresholds.green;
+    uint8_t pattern[12] = {
+        rb[0], g[0], rb[0], rb[1],
+        g[1], rb[1], rb[2], g[2],
+        rb[2], rb[3], g[3], rb[3]
+    };
+    uint32_t t[3];
+    memcpy(t, pattern, sizeof(t));
+    bool dither = t[0] || t[1] || t[2];
+
+    int x = 0;
+    for (; count - x >= 4; x += 4) {
+        //Little-endian, so the first byte in memory is the low byte of each word
+        uint32_t w[3];
+        memcpy(w, &source[x * 3], sizeof(w));
+        if (dither) {
+            w[0] = addSaturated(w[0], t[0]);
+            w[1] = addSaturated(w[1], t[1]);
+            w[2] = addSaturated(w[2], t[2]);
+        }
+
+        uint32_t packed[4] = {w[0], w[0] >> 24 | w[1] << 8, w[1] >> 16 | w[2] << 16, w[2] >> 8};
+        uint16_t converted[4];
+        for (int i = 0; 4 > i; i++) {
+            uint32_t a = packed[i] & 0xFF;
+            uint32_t b = (packed[i] >> 8) & 0xFF;
+            uint32_t c = (packed[i] >> 16) & 0xFF;
+            converted[i] = rgb ? pack4DGL(a, b, c) : pack4DGL(c, b, a);
+        }
+        memcpy(&pixels[x], converted, sizeof(converted));
+    }
+
+    return x;
+}
+
+#if defined(PIXEL_CONVERT_NEON)
+
+static int convertVector(const uint8_t* source, uint16_t* pixels, int count, bool rgb, const RowThresholds& thresholds) {
+    uint8_t rb[8];
+    uint8_t g[8];
+    memcpy(rb, thresholds.redBlue, 4);
+    memcpy(&rb[4], thresholds.redBlue, 4);
+    memcpy(g, thresholds.green, 4);
+    memcpy(&g[4], thresholds.green, 4);
+    uint8x8_t rbThreshold = vld1_u8(rb);
+    uint8x8_t gThreshold = vld1_u8(g);
+
+    int x = 0;
+    for (; count - x >= 8; x += 8) {
+        uint8x8x3_t channels = vld3_u8(&source[x * 3]);
+        uint8x8_t red = vqadd_u8(channels.val[rgb ? 0 : 2], rbThreshold);
+        uint8x8_t green = vqadd_u8(channels.val[1], gThreshold);
+        uint8x8_t blue = vqadd_u8(channels.val[rgb ? 2 : 0], rbThreshold);
+
+        uint16x8_t value = vshll_n_u8(vand_u8(red, vdup_n_u8(0xF8)), 8);
+        value = vorrq_u16(value, vshll_n_u8(vand_u8(green, vdup_n_u8(0xFC)), 3));
+        value = vorrq_u16(value, vmovl_u8(vshr_n_u8(blue, 3)));
+
+        vst1q_u8((uint8_t*) &pixels[x], vrev16q_u8(vreinterpretq_u8_u16(value)));
+    }
+
+    return x;
+}
+
+#elif defined(PIXEL_CONVERT_SSSE3)
+
+/**
+ * Four pixels from the first 12 bytes of a vector, as RGB565 in 32 bit lanes
+ */
+static inline __m128i unpackRGB565(__m128i bytes, __m128i shuffle) {
+    __m128i value = _mm_shuffle_epi8(bytes, shuffle); //Red << 16 | green << 8 | blue
+    __m128i red = _mm_and_si128(_mm_srli_epi32(value, 8), _mm_set1_epi32(0xF800));
+    __m128i green = _mm_and_si128(_mm_srli_epi32(value, 5), _mm_set1_epi32(0x07E0));
+    __m128i blue = _mm_and_si128(_mm_srli_epi32(value, 3), _mm_set1_epi32(0x001F));
+    return _mm_or_si128(_mm_or_si128(red, green), blue);
+}
+
+static int convertVector(const uint8_t* source, uint16_t* pixels, int count, bool rgb, const RowThresholds& thresholds) {
+    const uint8_t* rb = thresholds.redBlue;
+    const uint8_t* g = thresholds.green;
+    __m128i threshold = _mm_setr_epi8(rb[0], g[0], rb[0], rb[1], g[1], rb[1], rb[2], g[2],
+        rb[2], rb[3], g[3], rb[3], 0, 0, 0, 0);
+    __m128i shuffle = rgb ?
+        _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+        _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+    //Picking the bytes of each 16 bit value in swapped order
+    __m128i low = _mm_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m128i high = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 1, 0, 5, 4, 9, 8, 13, 12);
+
+    int x = 0;
+
+    //The second load reads 16 bytes from the fifth pixel, past the eighth
+    for (; count - x >= 10; x += 8) {
+        const uint8_t* bytes = &source[x * 3];
+        __m128i first = _mm_adds_epu8(_mm_loadu_si128((const __m128i*) bytes), threshold);
+        __m128i second = _mm_adds_epu8(_mm_loadu_si128((const __m128i*) &bytes[12]), threshold);
+
+        __m128i value = _mm_or_si128(_mm_shuffle_epi8(unpackRGB565(first, shuffle), low),
+            _mm_shuffle_epi8(unpackRGB565(second, shuffle), high));
+        _mm_storeu_si128((__m128i*) &pixels[x], value);
+    }
+
+    return x;
+}
+
+#endif
+
+static void convertRow(const uint8_t* source, uint16_t* pixels, int count, bool rgb, const RowThresholds& thresholds) {
+    int x = 0;
+
+#if defined(PIXEL_CONVERT_NEON) || defined(PIXEL_CONVERT_SSSE3)
+    x = convertVector(source, pixels, count, rgb, thresholds);
+#endif
+
+    //Always whole groups of four, so the thresholds stay in phase
+    x += convertWords(&source[x * 3], &pixels[x], count - x, rgb, thresholds);
+
+    for (; count > x; x++) {
+        pixels[x] = convertPixel(&source[x * 3], rgb, thresholds, x);
+    }
+}
+
+void convertTo4DGL(const uint8_t* source, uint16_t* pixels, int count, PixelFormat format) {
+    RowThresholds thresholds;
+    rowThresholds(0, false, thresholds);
+    convertRow(source, pixels, count, format == PIXEL_RGB888, thresholds);
+}
+
+void convertImageTo4DGL(const uint8_t* source, uint16_t* pixels, int width, int height, int sourceStride,
+    PixelFormat format, bool dither) {
+    RowThresholds thresholds;
+
+    for (int y = 0; height > y; y++) {
+        rowThresholds(y, dither, thresholds);
+        convertRow(&source[y * sourceStride], &pixels[y * width], width, format == PIXEL_RGB888, thresholds);
+    }
+}
+
+void convertImageTo4DGLReference(const uint8_t* source, uint16_t* pixels, int width, int height, int sourceStride,
+    PixelFormat format, bool dither) {
+    RowThresholds thresholds;
+
+    for (int y = 0; height > y; y++) {
+        rowThresholds(y, dither, thresholds);
+        for (int x = 0; width > x; x++) {
+            pixels[y * width + x] = convertPixel(&source[y * sourceStride + x * 3], format == PIXEL_RGB888, thresholds, x);
+        }
+    }
+}
+
+const char* getConvertPath() {
+#if defined(PIXEL_CONVERT_NEON)
+    return "neon";
+#elif defined(PIXEL_CONVERT_SSSE3)
+    return "ssse3";
+#else
+    return "word";
+#endif
+}
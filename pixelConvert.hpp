@@ -0,0 +1,56 @@
+/*
+ * Pixel Conversion Functions
+ *
+ * Converts 24 bit RGB images, like camera frames or decoded bitmaps, to the
+ * 4DGL color format uLCD::BLIT sends, optionally with 4x4 ordered dithering
+ * so gradients don't band at 16 bits. The same results as converting each
+ * pixel with uLCD::get4DGLColor() are produced by every path:
+ *     - NEON or SSSE3 on hosts that have them, 8 pixels at a time
+ *     - Otherwise, including the M3, 4 pixels from 3 word loads at a time
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_PIXEL_CONVERT_INCLUDED
+#define COLLECTION_PIXEL_CONVERT_INCLUDED
+
+#include <stdint.h>
+
+//Byte order of the source pixels
+enum PixelFormat {
+    PIXEL_RGB888,
+    PIXEL_BGR888
+};
+
+/**
+ * Converts a run of pixels to 4DGL colors without dithering
+ * @param source The pixels, three bytes each
+ * @param pixels Filled with count 4DGL colors
+ * @param count The number of pixels
+ * @param format The byte order of the source pixels
+ */
+void convertTo4DGL(const uint8_t* source, uint16_t* pixels, int count, PixelFormat format = PIXEL_RGB888);
+
+/**
+ * Converts an image to 4DGL colors, ready for uLCD::BLIT
+ * @param source The top left pixel, three bytes each
+ * @param pixels Filled with width * height 4DGL colors, row by row
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param sourceStride The bytes from the start of one source row to the next, at least width * 3
+ * @param format The byte order of the source pixels
+ * @param dither Whether to apply 4x4 ordered dithering, anchored at the image's top left corner
+ */
+void convertImageTo4DGL(const uint8_t* source, uint16_t* pixels, int width, int height, int sourceStride,
+    PixelFormat format = PIXEL_RGB888, bool dither = false);
+
+/**
+ * The same as convertImageTo4DGL() one pixel at a time, for checking the fast paths against
+ */
+void convertImageTo4DGLReference(const uint8_t* source, uint16_t* pixels, int width, int height, int sourceStride,
+    PixelFormat format = PIXEL_RGB888, bool dither = false);
+
+/** Returns the name of the path convertImageTo4DGL() uses on this target: "neon", "ssse3" or "word" */
+const char* getConvertPath();
+
+#endif // COLLECTION_PIXEL_CONVERT_INCLUDED
@@ -3,18 +3,33 @@
 #include "serialAsync.hpp"
 #include <cstdint>
 #include <stdint.h>
+#include <cstring>
 #include "collectionCommon.hpp"
 
+SerialAsync* SerialAsync::instances[4] = {nullptr, nullptr, nullptr, nullptr};
+
 SerialAsync::SerialAsync(PinName tx, PinName rx) : SerialAsync(tx, rx, 9600) {
     // defaults to baud rate of 9600
 }
     
-SerialAsync::SerialAsync(PinName tx, PinName rx, int baudrate) {
+SerialAsync::SerialAsync(PinName tx, PinName rx, int baudrate) : SerialAsync(tx, rx, baudrate, DMA_DEDICATED) {
+}
+
+SerialAsync::SerialAsync(PinName tx, PinName rx, int baudrate, DMAMode mode) {
     serial_init(&this->serial, tx, rx);
     serial_baud(&this->serial, baudrate);
 
-    this->rxDma = allocateDMA();
-    this->txDma = allocateDMA();
+    this->onDemand = mode == DMA_ON_DEMAND;
+    this->softHead = 0;
+
+    this->rxDma = createDMA();
+    this->txDma = createDMA();
+    if (!this->onDemand && !(claimDMA(this->rxDma) && claimDMA(this->txDma))) {
+        //Not enough free channels to dedicate two, so sharing them like DMA_ON_DEMAND does
+        releaseDMA(this->rxDma);
+        releaseDMA(this->txDma);
+        this->onDemand = true;
+    }
     //configuring dmas
     this->rxDma->transferType = TRANSFER_PERIPHERAL_TO_MEMORY;
     this->rxDma->destination = DMA_MEMORY;
@@ -43,24 +58,82 @@ SerialAsync::SerialAsync(PinName tx, PinName rx, int baudrate) {
 
     this->transmitBuffer = nullptr;
     this->receiveBuffer = nullptr;
+    this->receiveBufferLength = 0;
+    this->receiveTail = 0;
+
+    this->eventCount = 0;
+    this->eventIdleChars = 0;
+    this->eventDelimiter = -1;
+    this->scannedHead = 0;
+    this->idleHead = 0;
+    this->baud = baudrate;
+    this->frameBits = 10;
+
+    this->ctsSignal = nullptr;
+    this->rtsSignal = nullptr;
+    this->paceData = nullptr;
+    this->paceRemaining = 0;
+    this->paceChunk = 0;
+    this->paceGap = 0;
+    this->queuedData = nullptr;
+    this->queuedSize = 0;
+    this->queuedFree = false;
+
+    instances[this->serial.index] = this;
+    attachDMARelease(&SerialAsync::dmaReleased);
 }
 
 SerialAsync::~SerialAsync() {
+    this->serial.uart->IER &= ~0x1;
+    this->idleTimeout.detach();
+    this->paceTimeout.detach();
+    this->releaseTimeout.detach();
+    this->retryTimeout.detach();
+    instances[this->serial.index] = nullptr;
+
+    delete this->ctsSignal;
+    delete this->rtsSignal;
+
     // deallocating DMA
     deallocateDMA(this->rxDma);
     deallocateDMA(this->txDma);
+    free(this->rxDma);
+    free(this->txDma);
 }
 
 void SerialAsync::setBaud(int baudrate) {
     this->sync(); //Ensuring nothing is being transmitted
     serial_baud(&this->serial, baudrate);
+    this->baud = baudrate;
 }
 
 /**
     * Waits for any outstanding transmissions to complete. A blocking function.
     */
 void SerialAsync::sync() {
-    while(!isDMAFinished(this->txDma) || !(this->serial.uart->LSR & 0x40));
+    this->waitTransmit();
+
+    if (this->queuedSize) {
+        //A write queued from an ISR goes out once what it was waiting behind is done
+        this->sendQueued();
+        this->waitTransmit();
+    }
+
+    if (this->onDemand) {
+        this->releaseTimeout.detach();
+        releaseDMA(this->txDma);
+    }
+}
+
+void SerialAsync::waitTransmit() {
+    while(this->transmitBusy() || !(this->serial.uart->LSR & 0x40));
+}
+
+/**
+ * Returns whether a transfer is still being handed to the uart
+ */
+bool SerialAsync::transmitBusy() {
+    return this->paceRemaining || (isDMAClaimed(this->txDma) && !isDMAFinished(this->txDma));
 }
 
 /**
@@ -72,59 +145,337 @@ void SerialAsync::sync() {
     * @return the number of bytes read
     */
 int SerialAsync::read(void* buffer, int size) {
-    //Temporarily pausing dma
-    stopDMA(this->rxDma);
-
     int ret = 0;
 
-    //Getting the dma buffer position and data
     if (this->receiveBuffer) {
-        int dmaRxBufSize = getDMADestAddr(this->rxDma) - (unsigned long int) this->receiveBuffer;
-
-        for (int i = 0; (this->receiveBufferLength > i) && (size > i) && (dmaRxBufSize > i); i++) {
-            ((uint8_t*) buffer)[ret++] = ((uint8_t*) this->receiveBuffer)[i];
+        //Copying straight out of the ring, the dma channel keeps running
+        Span spans[2];
+        this->peek(spans);
+
+        for (int i = 0; 2 > i && size > ret; i++) {
+            int length = spans[i].size < size - ret ? spans[i].size : size - ret;
+            memcpy((uint8_t*) buffer + ret, spans[i].data, length);
+            ret += length;
         }
 
-        //Shifting buffer down
-        for (int i = 0; dmaRxBufSize - ret > i; i++) {
-            ((uint8_t*) this->receiveBuffer)[i] = ((uint8_t*) this->receiveBuffer)[i + ret];
-        }
+        this->consume(ret);
+        return ret;
+    }
 
-        //Setting new dma start address and size
-        this->rxDma->destAddr = ((unsigned long int) this->receiveBuffer) + (dmaRxBufSize - ret);
-        this->rxDma->transferSize = this->receiveBufferLength - (dmaRxBufSize - ret);
+    //No receive buffer, so fetching anything left in the receive holding buffer
+    for (int i = 0; (16 > i) && (ret < size) && (this->serial.uart->LSR & 0x1); i++) {
+        ((uint8_t*) buffer)[ret++] = this->serial.uart->RBR;
     }
 
-    //Now fetching anything left in the receive holding buffer
-    if (ret < size) {
-        //There is still some room in the provided buffer
-        for (int i = 0; (16 > i) && (ret < size) && (this->serial.uart->LSR & 0x1); i++) {
-            ((uint8_t*) buffer)[ret++] = this->serial.uart->RBR;
-        }
+    return ret;
+}
+
+int SerialAsync::receiveHead() {
+    if (!isDMAClaimed(this->rxDma)) {
+        //Ring is filled by the receive interrupt
+        return this->softHead;
     }
 
-    //Resuming dma if buffer is provided
-    if (this->receiveBuffer) {
-        startDMA(this->rxDma);
+    //The dma destination address is the write index of the ring
+    int head = getDMADestAddr(this->rxDma) - (unsigned long int) this->receiveBuffer;
+    return head >= this->receiveBufferLength ? head - this->receiveBufferLength : head;
+}
+
+int SerialAsync::available() {
+    if (!this->receiveBuffer) {
+        return 0;
     }
 
-    return ret;
+    int count = this->receiveHead() - this->receiveTail;
+    return count < 0 ? count + this->receiveBufferLength : count;
+}
+
+int SerialAsync::peek(Span spans[2]) {
+    spans[0].data = nullptr;
+    spans[0].size = 0;
+    spans[1].data = nullptr;
+    spans[1].size = 0;
+
+    if (!this->receiveBuffer) {
+        return 0;
+    }
+
+    int head = this->receiveHead();
+    int tail = this->receiveTail;
+
+    spans[0].data = (const uint8_t*) this->receiveBuffer + tail;
+    if (head >= tail) {
+        spans[0].size = head - tail;
+    } else {
+        //Unread data wraps around the end of the ring
+        spans[0].size = this->receiveBufferLength - tail;
+        spans[1].data = (const uint8_t*) this->receiveBuffer;
+        spans[1].size = head;
+    }
+
+    return spans[0].size + spans[1].size;
+}
+
+void SerialAsync::consume(int size) {
+    int count = this->available();
+    if (size > count) {
+        size = count;
+    }
+    if (size <= 0) {
+        return;
+    }
+
+    int tail = this->receiveTail + size;
+    this->receiveTail = tail >= this->receiveBufferLength ? tail - this->receiveBufferLength : tail;
+
+    this->updateRts();
 }
 
 /**
-    * Sets the recieve buffer to be filled with data when it arrives
-    * @param buffer A pointer to the first byte of the buffer to use for asynchronous receciving
-    * @param size The size of the provided buffer in bytes
+    * Sets the recieve buffer to be filled with data when it arrives.
+    * The buffer is used as a ring, the DMA channel wraps back to the start and is never stopped.
+    * It must be large enough to be drained before the sender laps it, otherwise old data is overwritten.
+    * @param buffer A pointer to the first byte of the buffer to use for asynchronous receciving, nullptr to stop
+    * @param size The size of the provided buffer in bytes. Only the first DMA_MAX_CIRCULAR_SIZE (65472) bytes are used
     */
 void SerialAsync::setReceiveBuffer(void* buffer, int size) {
-    this->receiveBuffer = buffer;
+    //Keeping a released channel from being claimed for the old ring
+    this->receiveBuffer = nullptr;
+
+    if (this->onDemand) {
+        releaseDMA(this->rxDma);
+    } else if (isDMAClaimed(this->rxDma)) {
+        stopDMA(this->rxDma);
+    }
+
+    if (size > DMA_MAX_CIRCULAR_SIZE) {
+        //The dma ring can't be made any longer, so the end of the buffer goes unused
+        size = DMA_MAX_CIRCULAR_SIZE;
+    }
+
+    this->receiveBuffer = (volatile uint8_t*) buffer;
     this->receiveBufferLength = size;
+    this->receiveTail = 0;
+    this->scannedHead = 0;
+    this->idleHead = 0;
+    this->softHead = 0;
+
+    if (!buffer || size <= 0) {
+        this->receiveBuffer = nullptr;
+        this->updateReceiveInterrupt();
+        return;
+    }
+
+    if (!claimDMA(this->rxDma)) {
+        //Every channel is busy, the receive interrupt fills the ring instead
+        this->updateReceiveInterrupt();
+        return;
+    }
 
-    //Configuring receive dma
+    //Configuring receive dma as a ring
     this->rxDma->transferSize = size;
     this->rxDma->destAddr = (unsigned long int)buffer;
 
-    startDMA(this->rxDma);
+    startDMACircular(this->rxDma);
+
+    this->updateReceiveInterrupt();
+}
+
+void SerialAsync::setReceiveEvents(int count, int idleChars, int delimiter) {
+    core_util_critical_section_enter();
+    this->eventCount = count;
+    this->eventIdleChars = idleChars;
+    this->eventDelimiter = delimiter;
+    this->scannedHead = this->receiveBuffer ? this->receiveHead() : 0;
+    core_util_critical_section_exit();
+
+    this->updateReceiveInterrupt();
+}
+
+void SerialAsync::attachReceive(Callback<void(int)> cb) {
+    core_util_critical_section_enter();
+    this->receiveCallback = cb;
+    core_util_critical_section_exit();
+}
+
+int SerialAsync::waitForReceive(int events, uint32_t timeout_ms) {
+    //The count event reflects the current level, so it is re-evaluated rather than remembered
+    this->receiveFlags.clear(RX_EVENT_COUNT);
+
+    core_util_critical_section_enter();
+    this->checkReceiveEvents();
+    core_util_critical_section_exit();
+
+    uint32_t flags = this->receiveFlags.wait_any(events, timeout_ms);
+    if (flags & osFlagsError) {
+        return 0;
+    }
+
+    return flags & events;
+}
+
+void SerialAsync::updateReceiveInterrupt() {
+    IRQn_Type irq = (IRQn_Type)((int)UART0_IRQn + this->serial.index);
+
+    bool needed = this->eventCount || this->eventIdleChars || this->eventDelimiter >= 0 || this->rtsSignal || !isDMAClaimed(this->rxDma);
+
+    if (!this->receiveBuffer || !needed) {
+        this->serial.uart->IER &= ~0x1;
+        this->idleTimeout.detach();
+        return;
+    }
+
+    switch (this->serial.index) {
+    case 0:
+        NVIC_SetVector(irq, (uint32_t)&SerialAsync::uart0Irq);
+        break;
+    case 1:
+        NVIC_SetVector(irq, (uint32_t)&SerialAsync::uart1Irq);
+        break;
+    case 2:
+        NVIC_SetVector(irq, (uint32_t)&SerialAsync::uart2Irq);
+        break;
+    case 3:
+        NVIC_SetVector(irq, (uint32_t)&SerialAsync::uart3Irq);
+        break;
+    }
+
+    //The receive data interrupt also enables the character timeout interrupt, which fires
+    //once the fifo holds data and the line has been quiet for 3.5 to 4.5 character times
+    this->serial.uart->IER |= 0x1;
+    NVIC_EnableIRQ(irq);
+}
+
+/**
+ * Evaluates the receive events against the ring. Must be called with interrupts disabled or from an ISR.
+ */
+void SerialAsync::checkReceiveEvents() {
+    if (!this->receiveBuffer) {
+        return;
+    }
+
+    int head = this->receiveHead();
+    int events = 0;
+
+    this->updateRts();
+
+    if (this->eventCount > 0 && this->available() >= this->eventCount) {
+        events |= RX_EVENT_COUNT;
+    }
+
+    if (this->eventDelimiter >= 0) {
+        for (int i = this->scannedHead; i != head; i = i + 1 == this->receiveBufferLength ? 0 : i + 1) {
+            if (this->receiveBuffer[i] == (uint8_t) this->eventDelimiter) {
+                events |= RX_EVENT_DELIMITER;
+                break;
+            }
+        }
+        this->scannedHead = head;
+    }
+
+    //The dma request and this interrupt are raised together, so a count that comes up short may
+    //only be waiting on the channel to empty the fifo, which raises no interrupt of its own
+    bool countShort = this->eventCount > 0 && !(events & RX_EVENT_COUNT) && isDMAClaimed(this->rxDma);
+
+    if ((this->eventIdleChars > 0 && head != this->idleHead) || countShort) {
+        //New data arrived, restarting the idle countdown, or checking the count again after a character
+        this->idleHead = head;
+        int chars = this->eventIdleChars > 0 ? this->eventIdleChars : 1;
+        int idle_us = (int) ((int64_t) chars * this->frameBits * 1000000 / this->baud);
+        this->idleTimeout.attach(callback(this, &SerialAsync::receiveIdle), idle_us / 1000000.0f); // µs to seconds
+    }
+
+    if (events) {
+        this->signalReceive(events);
+    }
+}
+
+void SerialAsync::receiveIdle() {
+    if (this->receiveHead() != this->idleHead) {
+        //More data showed up without an interrupt reaching us yet
+        this->checkReceiveEvents();
+        return;
+    }
+
+    if (this->eventIdleChars > 0 && this->available() > 0) {
+        this->signalReceive(RX_EVENT_IDLE);
+    }
+}
+
+void SerialAsync::signalReceive(int events) {
+    this->receiveFlags.set(events);
+
+    if (this->receiveCallback) {
+        this->receiveCallback(events);
+    }
+}
+
+void SerialAsync::receiveInterrupt() {
+    if (this->receiveBuffer && !isDMAClaimed(this->rxDma)) {
+        //No dma channel, so emptying the fifo into the ring here
+        this->fillFromFifo();
+    }
+
+    this->checkReceiveEvents();
+}
+
+void SerialAsync::fillFromFifo() {
+    int head = this->softHead;
+    while (this->serial.uart->LSR & 0x1) {
+        this->receiveBuffer[head] = this->serial.uart->RBR;
+        head = head + 1 == this->receiveBufferLength ? 0 : head + 1;
+    }
+    this->softHead = head;
+}
+
+/**
+ * Moves a ring filled by the receive interrupt over to a dma channel if one is free
+ */
+void SerialAsync::claimReceive() {
+    core_util_critical_section_enter();
+
+    bool claimed = false;
+    if (this->receiveBuffer && !isDMAClaimed(this->rxDma) && claimDMA(this->rxDma)) {
+        //The channel carries on from where the interrupt left off, after whatever is in the fifo
+        this->fillFromFifo();
+        this->rxDma->transferSize = this->receiveBufferLength;
+        this->rxDma->destAddr = (unsigned long int) this->receiveBuffer;
+        startDMACircular(this->rxDma, this->softHead);
+        claimed = true;
+    }
+
+    core_util_critical_section_exit();
+
+    if (claimed) {
+        this->updateReceiveInterrupt();
+    }
+}
+
+void SerialAsync::dmaReleased() {
+    for (int i = 0; 4 > i; i++) {
+        if (instances[i]) instances[i]->claimReceive();
+    }
+}
+
+void SerialAsync::uart0Irq() {
+    //Reading IIR acknowledges the interrupt, the dma channel empties the fifo itself
+    (void) LPC_UART0->IIR;
+    if (instances[0]) instances[0]->receiveInterrupt();
+}
+
+void SerialAsync::uart1Irq() {
+    (void) LPC_UART1->IIR;
+    if (instances[1]) instances[1]->receiveInterrupt();
+}
+
+void SerialAsync::uart2Irq() {
+    (void) LPC_UART2->IIR;
+    if (instances[2]) instances[2]->receiveInterrupt();
+}
+
+void SerialAsync::uart3Irq() {
+    (void) LPC_UART3->IIR;
+    if (instances[3]) instances[3]->receiveInterrupt();
 }
 
 /**
@@ -136,13 +487,262 @@ void SerialAsync::setReceiveBuffer(void* buffer, int size) {
 void SerialAsync::setControl(SerialParity parity, StopBits stop, WordLength bits) {
     this->sync(); //Ensuring nothing is being transmitted
     serial_format(&this->serial, (int)bits + 5, parity, (int)stop + 1);
+
+    //Start bit, data bits, optional parity bit and stop bits
+    this->frameBits = 1 + ((int)bits + 5) + (parity != ParityNone ? 1 : 0) + ((int)stop + 1);
+}
+
+void SerialAsync::setFlowControl(FlowControl type, PinName rts, PinName cts) {
+    this->sync();
+
+    delete this->ctsSignal;
+    delete this->rtsSignal;
+    this->ctsSignal = nullptr;
+    this->rtsSignal = nullptr;
+
+    bool useRts = (type == FlowControlRTS || type == FlowControlRTSCTS) && rts != NC;
+    bool useCts = (type == FlowControlCTS || type == FlowControlRTSCTS) && cts != NC;
+
+#if DEVICE_SERIAL_FC
+    if (this->serial.index == 1) {
+        //UART1 has auto-RTS and auto-CTS, which work with dma without any help
+        serial_set_flow_control(&this->serial, type, rts, cts);
+
+        //The hal reconfigures the fifo and receive interrupt for its own use, restoring ours
+        this->serial.uart->FCR = 0x89;
+        this->updateReceiveInterrupt();
+        return;
+    }
+#endif
+
+    if (useCts) {
+        this->ctsSignal = new DigitalIn(cts);
+    }
+
+    if (useRts) {
+        this->rtsSignal = new DigitalOut(rts, 0);
+        this->updateReceiveInterrupt();
+    }
+}
+
+void SerialAsync::setPacing(int chunkSize, int gap_us) {
+    this->sync();
+    this->paceChunk = chunkSize > 0 ? chunkSize : 0;
+    this->paceGap = gap_us > 0 ? gap_us : 0;
+}
+
+/**
+ * Deasserts the emulated RTS line while the receive buffer is more than three quarters full
+ */
+void SerialAsync::updateRts() {
+    if (!this->rtsSignal || !this->receiveBuffer) {
+        return;
+    }
+
+    int space = this->receiveBufferLength - this->available();
+    this->rtsSignal->write(space < this->receiveBufferLength / 4 ? 1 : 0);
+}
+
+/**
+ * Makes sure the transmit dma object holds a hardware channel
+ */
+bool SerialAsync::claimTransmit() {
+    if (!this->onDemand) {
+        return isDMAClaimed(this->txDma);
+    }
+
+    //The release timeout must not fire between claiming and starting the transfer
+    this->releaseTimeout.detach();
+    return claimDMA(this->txDma);
+}
+
+/**
+ * Gives the transmit channel back once it is done, otherwise checks again later
+ */
+void SerialAsync::releaseTransmit() {
+    if (!this->onDemand || !isDMAClaimed(this->txDma)) {
+        return;
+    }
+
+    if (this->paceRemaining) {
+        //The pacing timeout will schedule the release after the last chunk
+        return;
+    }
+
+    if (isDMAFinished(this->txDma)) {
+        releaseDMA(this->txDma);
+        return;
+    }
+
+    //Everything left fits in the fifo in one character time per byte
+    int charTime_us = this->frameBits * 1000000 / this->baud + 1;
+    this->releaseTimeout.attach(callback(this, &SerialAsync::releaseTransmit), charTime_us * 16 / 1000000.0f); // µs to seconds
+}
+
+/**
+ * Writes straight into the fifo without dma, blocking until everything is in the fifo
+ */
+void SerialAsync::writeDirect(const uint8_t* buffer, int size) {
+    for (int i = 0; size > i; i++) {
+        serial_putc(&this->serial, buffer[i]);
+    }
+}
+
+void SerialAsync::writeCommon(void* buffer, int size, bool freeable) {
+    if (core_util_is_isr_active()) {
+        if (this->queuedSize || this->transmitBusy() || !this->claimTransmit()) {
+            //An ISR can't wait for the transfer in flight or write byte by byte, so queueing the write
+            this->queueWrite((const uint8_t*) buffer, size, freeable);
+            return;
+        }
+    } else {
+        this->sync();
+    }
+
+    this->holdBuffer(buffer, freeable);
+
+    if (!this->startTransmit((const uint8_t*) buffer, size)) {
+        this->writeDirect((const uint8_t*) buffer, size);
+    }
+}
+
+/**
+ * Frees the buffer of the previous write if it was freeable and keeps track of this one
+ */
+void SerialAsync::holdBuffer(void* buffer, bool freeable) {
+    if (this->transmitBuffer) {
+        free_safe((void*)this->transmitBuffer);
+    }
+    this->transmitBuffer = freeable ? buffer : nullptr;
+}
+
+/**
+ * Keeps a write made from an ISR for the retry timeout or the next sync(). There is room for one,
+ * a second write made before it is sent is dropped.
+ */
+void SerialAsync::queueWrite(const uint8_t* buffer, int size, bool freeable) {
+    if (this->queuedSize) {
+        if (freeable) {
+            free_safe((void*) buffer);
+        }
+        return;
+    }
+
+    this->queuedData = buffer;
+    this->queuedFree = freeable;
+    this->queuedSize = size;
+
+    int charTime_us = this->frameBits * 1000000 / this->baud + 1;
+    this->retryTimeout.attach(callback(this, &SerialAsync::retryQueued), charTime_us * 16 / 1000000.0f); // µs to seconds
 }
 
-void SerialAsync::writeCommon(void* buffer, int size) {
+/**
+ * Starts a transfer on the transmit channel
+ * @return false if no dma channel could be claimed
+ */
+bool SerialAsync::startTransmit(const uint8_t* buffer, int size) {
+    if (!this->claimTransmit()) {
+        return false;
+    }
+
+    if (this->paceChunk || this->ctsSignal) {
+        //Handing the transfer to the pacing timeout one chunk at a time
+        this->paceData = buffer;
+        this->paceRemaining = size;
+        this->writeChunk();
+        return true;
+    }
+
     this->txDma->transferSize = size;
     this->txDma->sourceAddr = (unsigned long int)buffer;
 
     startDMA(this->txDma);
+
+    if (this->onDemand) {
+        int charTime_us = this->frameBits * 1000000 / this->baud + 1;
+        this->releaseTimeout.attach(callback(this, &SerialAsync::releaseTransmit), size * charTime_us / 1000000.0f); // µs to seconds
+    }
+    return true;
+}
+
+/**
+ * Starts the queued write if the transmitter is idle and a channel is free
+ * @return false if it is still queued
+ */
+bool SerialAsync::startQueued() {
+    if (this->transmitBusy() || !this->claimTransmit()) {
+        return false;
+    }
+
+    this->holdBuffer((void*) this->queuedData, this->queuedFree);
+    this->startTransmit(this->queuedData, this->queuedSize);
+    this->queuedSize = 0;
+    return true;
+}
+
+/**
+ * Tries the queued write again from the retry timeout
+ */
+void SerialAsync::retryQueued() {
+    if (!this->queuedSize || this->startQueued()) {
+        return;
+    }
+
+    int charTime_us = this->frameBits * 1000000 / this->baud + 1;
+    this->retryTimeout.attach(callback(this, &SerialAsync::retryQueued), charTime_us * 16 / 1000000.0f); // µs to seconds
+}
+
+/**
+ * Sends the queued write from a thread once the transmitter is idle, writing it directly if no channel is free
+ */
+void SerialAsync::sendQueued() {
+    this->retryTimeout.detach();
+
+    core_util_critical_section_enter();
+    bool started = !this->queuedSize || this->startQueued();
+    core_util_critical_section_exit();
+    if (started) {
+        return;
+    }
+
+    this->holdBuffer((void*) this->queuedData, this->queuedFree);
+    this->writeDirect(this->queuedData, this->queuedSize);
+    this->queuedSize = 0;
+}
+
+/**
+ * Starts the next paced chunk. Called from the thread for the first chunk and from the pace timeout after.
+ */
+void SerialAsync::writeChunk() {
+    int charTime_us = this->frameBits * 1000000 / this->baud + 1;
+
+    if (this->ctsSignal && this->ctsSignal->read()) {
+        //Other side is not ready, checking again after a character time
+        this->paceTimeout.attach(callback(this, &SerialAsync::writeChunk), charTime_us / 1000000.0f); // µs to seconds
+        return;
+    }
+
+    //Emulated CTS can only stop what hasn't been loaded into the 16 byte fifo yet
+    int chunk = this->paceChunk ? this->paceChunk : 16;
+    if (this->ctsSignal && chunk > 16) {
+        chunk = 16;
+    }
+    int size = this->paceRemaining < chunk ? this->paceRemaining : chunk;
+
+    this->txDma->transferSize = size;
+    this->txDma->sourceAddr = (unsigned long int)this->paceData;
+    startDMA(this->txDma);
+
+    this->paceData += size;
+    this->paceRemaining -= size;
+
+    if (this->paceRemaining > 0) {
+        //Next chunk goes out once this one has left the wire and the gap has passed
+        int delay_us = size * charTime_us + (this->paceChunk ? this->paceGap : 0);
+        this->paceTimeout.attach(callback(this, &SerialAsync::writeChunk), delay_us / 1000000.0f); // µs to seconds
+    } else if (this->onDemand) {
+        this->releaseTimeout.attach(callback(this, &SerialAsync::releaseTransmit), size * charTime_us / 1000000.0f); // µs to seconds
+    }
 }
 
 /**
@@ -152,14 +752,7 @@ void SerialAsync::writeCommon(void* buffer, int size) {
     * @param size The size of the buffer in bytes
     */
 void SerialAsync::write(void* buffer, int size) {
-    this->sync();
-    
-    if (this->transmitBuffer) {
-        free_safe((void*)this->transmitBuffer);
-        this->transmitBuffer = nullptr;
-    }
-
-    this->writeCommon(buffer, size);
+    this->writeCommon(buffer, size, false);
 }
 
 /**
@@ -169,13 +762,43 @@ void SerialAsync::write(void* buffer, int size) {
     * @param size The size of the buffer in bytes
     */
 void SerialAsync::writeAndFree(void* buffer, int size) {
-    this->sync();
-    if (this->transmitBuffer) {
-        free_safe((void*)this->transmitBuffer);
+    this->writeCommon(buffer, size, true);
+}
+
+bool SerialAsync::writeGather(const Span* spans, int count) {
+    if (count > DMA_MAX_SEGMENTS || this->paceChunk || this->ctsSignal) {
+        //Empty spans are dropped by the dma layer, but that many is never reasonable
+        return false;
+    }
+
+    this->checkBufferFree();
+
+    DMA_SEGMENT segments[DMA_MAX_SEGMENTS];
+    int size = 0;
+    for (int i = 0; count > i; i++) {
+        segments[i].addr = (unsigned long int) spans[i].data;
+        segments[i].size = spans[i].size;
+        size += spans[i].size;
+    }
+
+    if (!this->claimTransmit()) {
+        for (int i = 0; count > i; i++) {
+            this->writeDirect(spans[i].data, spans[i].size);
+        }
+        return true;
     }
-    this->transmitBuffer = buffer;
 
-    this->writeCommon(buffer, size);
+    if (!startDMAGather(this->txDma, segments, count)) {
+        this->releaseTransmit();
+        return false;
+    }
+
+    if (this->onDemand) {
+        int charTime_us = this->frameBits * 1000000 / this->baud + 1;
+        this->releaseTimeout.attach(callback(this, &SerialAsync::releaseTransmit), size * charTime_us / 1000000.0f); // µs to seconds
+    }
+
+    return true;
 }
 
 /**
@@ -185,10 +808,11 @@ void SerialAsync::flushReceiving() {
     this->serial.uart->FCR = 0x8B;
 
     if (this->receiveBuffer) {
-        stopDMA(this->rxDma);
-        this->rxDma->transferSize = this->receiveBufferLength;
-        this->rxDma->destAddr = (unsigned long int) this->receiveBuffer;
-        startDMA(this->rxDma);
+        //Everything written so far is considered read
+        core_util_critical_section_enter();
+        this->receiveTail = this->receiveHead();
+        this->scannedHead = this->receiveTail;
+        core_util_critical_section_exit();
     }
 }
 
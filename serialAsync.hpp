@@ -4,6 +4,9 @@
  * This UART driver allows for asynchronous serial communication using
  * hardware DMA channels. Asynchronous writing and reading is supported.
  *
+ * When built against the host stand-in in host/ the same interface is
+ * backed by a pseudo-terminal or any other file descriptor instead.
+ *
  * (c) Daniel Cooper
  */
 
@@ -17,18 +20,131 @@ class SerialAsync {
 
     private:
 
+#ifdef COLLECTION_HOST
+    //On a host the uart is a file descriptor serviced by threads, see host/serialAsyncHost.cpp
+    struct HostLink;
+    HostLink* host;
+#else
     serial_t serial;
     DMA_CHANNEL* txDma;
     DMA_CHANNEL* rxDma;
+    bool onDemand; //Hardware dma channels are only held while they are needed
+    Timeout releaseTimeout;
+    volatile int softHead; //Ring write index when the receive interrupt fills the ring instead of dma
 
-    volatile void* receiveBuffer;
+    volatile uint8_t* receiveBuffer; //Ring buffer continuously filled by the rx dma channel
     int receiveBufferLength;
+    volatile int receiveTail; //Index of the next unread byte in the ring
     volatile void* transmitBuffer; //If not nullptr implies it should free the address
 
-    void writeCommon(void* buffer, int size);
+    //Receive event state, evaluated from the uart interrupt and the idle timeout
+    EventFlags receiveFlags;
+    Callback<void(int)> receiveCallback;
+    Timeout idleTimeout;
+    int eventCount;
+    int eventIdleChars;
+    int eventDelimiter;
+    volatile int scannedHead; //Index up to which the ring was searched for the delimiter
+    volatile int idleHead; //Ring head when the idle timeout was last armed
+    int baud;
+    int frameBits;
+
+    //Flow control and pacing state for uarts without hardware flow control
+    DigitalIn* ctsSignal;
+    DigitalOut* rtsSignal;
+    Timeout paceTimeout;
+    const uint8_t* volatile paceData;
+    volatile int paceRemaining;
+    int paceChunk;
+    int paceGap;
+
+    //A write made from an ISR while every dma channel was busy, sent by the retry timeout or sync()
+    Timeout retryTimeout;
+    const uint8_t* volatile queuedData;
+    volatile int queuedSize;
+    volatile bool queuedFree;
+
+    static SerialAsync* instances[4];
+
+    void writeCommon(void* buffer, int size, bool freeable);
+
+    void holdBuffer(void* buffer, bool freeable);
+
+    bool startTransmit(const uint8_t* buffer, int size);
+
+    bool transmitBusy();
+
+    void waitTransmit();
+
+    void queueWrite(const uint8_t* buffer, int size, bool freeable);
+
+    bool startQueued();
+
+    void retryQueued();
+
+    void sendQueued();
+
+    void writeChunk();
+
+    bool claimTransmit();
+
+    void releaseTransmit();
+
+    void writeDirect(const uint8_t* buffer, int size);
+
+    void updateRts();
+
+    int receiveHead();
+
+    void checkReceiveEvents();
+
+    void receiveInterrupt();
+
+    void fillFromFifo();
+
+    void claimReceive();
+
+    static void dmaReleased();
+
+    void receiveIdle();
+
+    void signalReceive(int events);
+
+    void updateReceiveInterrupt();
+
+    static void uart0Irq();
+    static void uart1Irq();
+    static void uart2Irq();
+    static void uart3Irq();
+#endif
 
     public:
 
+    /**
+     * Conditions that can signal received data. May be combined as a mask.
+     */
+    enum ReceiveEvent {
+        RX_EVENT_COUNT = 0x1, //At least the configured number of unread bytes are waiting
+        RX_EVENT_IDLE = 0x2, //No byte arrived for the configured number of character times
+        RX_EVENT_DELIMITER = 0x4 //The delimiter byte was received
+    };
+
+    /**
+     * How the uart uses the eight shared hardware dma channels
+     */
+    enum DMAMode {
+        DMA_DEDICATED, //Claims a transmit and a receive channel for the lifetime of the object, or acts as DMA_ON_DEMAND if two aren't free
+        DMA_ON_DEMAND //Claims the transmit channel per transfer and the receive channel only while a receive buffer is set
+    };
+
+    /**
+     * A contiguous region of bytes. Returned by peek() to point directly into the receive ring.
+     */
+    struct Span {
+        const uint8_t* data;
+        int size;
+    };
+
     enum StopBits {
         StopBitOne,
         StopBitsTwo
@@ -45,6 +161,14 @@ class SerialAsync {
     
     SerialAsync(PinName tx, PinName rx, int baudrate);
 
+    /**
+     * In DMA_ON_DEMAND mode a transmit that finds every dma channel busy is written directly
+     * to the uart instead, blocking until it is in the fifo. From an ISR it is queued instead, see
+     * write(), and retried until a channel is free or written out by the next sync(). A receive buffer
+     * that can't get a channel is filled from the receive interrupt until one is released.
+     */
+    SerialAsync(PinName tx, PinName rx, int baudrate, DMAMode mode);
+
     ~SerialAsync();
 
     void setBaud(int baudrate);
@@ -65,12 +189,60 @@ class SerialAsync {
     int read(void* buffer, int size);
 
     /**
-     * Sets the recieve buffer to be filled with data when it arrives
-     * @param buffer A pointer to the first byte of the buffer to use for asynchronous receciving
-     * @param size The size of the provided buffer in bytes
+     * Returns the number of unread bytes waiting in the receive buffer.
+     * Always zero if no receive buffer is set.
+     */
+    int available();
+
+    /**
+     * Gives direct access to the unread bytes in the receive buffer without copying.
+     * Unread data that wraps around the end of the ring is split across two spans,
+     * otherwise the second span is empty. The data stays valid until consume() is called.
+     * @param spans Filled with up to two regions of unread bytes, in order
+     * @return the total number of unread bytes
+     */
+    int peek(Span spans[2]);
+
+    /**
+     * Marks bytes previously returned by peek() as read, making room for new data.
+     * @param size The number of bytes to release, clamped to the number of unread bytes
+     */
+    void consume(int size);
+
+    /**
+     * Sets the recieve buffer to be filled with data when it arrives.
+     * The buffer is used as a ring, the DMA channel wraps back to the start and is never stopped.
+     * It must be large enough to be drained before the sender laps it, otherwise old data is overwritten.
+     * @param buffer A pointer to the first byte of the buffer to use for asynchronous receciving, nullptr to stop
+     * @param size The size of the provided buffer in bytes. Only the first DMA_MAX_CIRCULAR_SIZE (65472) bytes are used
      */
     void setReceiveBuffer(void* buffer, int size);
 
+    /**
+     * Configures which conditions raise receive events. Events require a receive buffer.
+     * The uart receive timeout interrupt is used to notice data, so no polling is needed.
+     * @param count Raise RX_EVENT_COUNT once this many bytes are unread, 0 to disable
+     * @param idleChars Raise RX_EVENT_IDLE once the line is quiet for this many character times, 0 to disable
+     * @param delimiter Raise RX_EVENT_DELIMITER when this byte arrives, -1 to disable
+     */
+    void setReceiveEvents(int count, int idleChars, int delimiter);
+
+    /**
+     * Attaches a function called with the mask of raised events.
+     * NOTE: The function is called from an ISR.
+     * @param cb The function to call, nullptr to detach
+     */
+    void attachReceive(Callback<void(int)> cb);
+
+    /**
+     * Puts the calling thread to sleep until one of the given events is raised.
+     * Events raised since the last wait are returned immediately. May NOT be called from an ISR.
+     * @param events The mask of ReceiveEvent values to wait for
+     * @param timeout_ms The maximum time to wait in milliseconds
+     * @return the mask of raised events, 0 on timeout
+     */
+    int waitForReceive(int events, uint32_t timeout_ms = osWaitForever);
+
     /**
      * Sets the control paramaters for the UART channel
      * @param parity The parity mode to use
@@ -79,9 +251,33 @@ class SerialAsync {
      */
     void setControl(SerialParity parity, StopBits stop, WordLength bits);
 
+    /**
+     * Enables RTS/CTS hardware flow control. UART1 supports both lines in hardware, so with
+     * DEVICE_SERIAL_FC the pins must be its RTS1 and CTS1 pins. The other uarts, and UART1
+     * without DEVICE_SERIAL_FC, emulate them on any pins: CTS is checked before
+     * each transmitted chunk of up to 16 bytes, and RTS is deasserted when the receive buffer
+     * is less than a quarter empty, which requires a receive buffer.
+     * @param type The lines to use
+     * @param rts The RTS pin (output, low when ready to receive), NC if unused
+     * @param cts The CTS pin (input, low when the other side is ready), NC if unused
+     */
+    void setFlowControl(FlowControl type, PinName rts, PinName cts);
+
+    /**
+     * Paces transmissions for receivers that can't keep up and have no flow control lines.
+     * Every write is sent in chunks with an idle gap after each one.
+     * NOTE: writeGather is not available while pacing or emulated CTS is enabled.
+     * @param chunkSize The bytes sent back to back, 0 to disable pacing
+     * @param gap_us The idle time in microseconds between chunks
+     */
+    void setPacing(int chunkSize, int gap_us);
+
     /**
      * Writes the data in the buffer asynchronously
      * NOTE: This function is non-blocking and will return immediately
+     * NOTE: From an ISR a write that would have to wait for the transfer in flight, paced or not,
+     * or for a dma channel is queued and sent as soon as it can be. One write can be queued,
+     * another one from an ISR before it is sent is dropped.
      * @param buffer The buffer to transmit
      * @param size The size of the buffer in bytes
      */
@@ -89,12 +285,22 @@ class SerialAsync {
 
     /**
      * Writes the data in the buffer asynchronously and frees the data when complete with the transfer.
-     * NOTE: This function is non-blocking and will return immediately.
+     * NOTE: This function is non-blocking and will return immediately. From an ISR it queues like write().
      * @param buffer The buffer to transmit
      * @param size The size of the buffer in bytes
      */
     void writeAndFree(void* buffer, int size);
 
+    /**
+     * Writes several buffers back to back as one asynchronous transfer without copying them.
+     * NOTE: This function is non-blocking and will return immediately. The buffers must stay
+     * valid until the transfer completes.
+     * @param spans The buffers to transmit, in order. Each may be at most 4092 bytes
+     * @param count The number of buffers, at most DMA_MAX_SEGMENTS non-empty ones
+     * @return true if the transfer was started, false if the buffers could not be described to the DMA
+     */
+    bool writeGather(const Span* spans, int count);
+
     /**
      * Flushes the receiving buffer, all data in it will be lost.
      */
@@ -0,0 +1,444 @@
+/*
+ * Tile Raster Class
+ *
+ * Renders a display list into tiles and sends them with uLCD::BLIT.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "tileRaster.hpp"
+#include <cstring>
+
+#include "collectionCommon.hpp"
+
+const uint8_t rasterFont[95 * 5] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, //' '
+    0x00, 0x00, 0x5F, 0x00, 0x00, //'!'
+    0x00, 0x07, 0x00, 0x07, 0x00, //'"'
+    0x14, 0x7F, 0x14, 0x7F, 0x14, //'#'
+    0x24, 0x2A, 0x7F, 0x2A, 0x12, //'$'
+    0x23, 0x13, 0x08, 0x64, 0x62, //'%'
+    0x36, 0x49, 0x56, 0x20, 0x50, //'&'
+    0x00, 0x08, 0x07, 0x03, 0x00, //'''
+    0x00, 0x1C, 0x22, 0x41, 0x00, //'('
+    0x00, 0x41, 0x22, 0x1C, 0x00, //')'
+    0x2A, 0x1C, 0x7F, 0x1C, 0x2A, //'*'
+    0x08, 0x08, 0x3E, 0x08, 0x08, //'+'
+    0x00, 0x80, 0x70, 0x30, 0x00, //','
+    0x08, 0x08, 0x08, 0x08, 0x08, //'-'
+    0x00, 0x00, 0x60, 0x60, 0x00, //'.'
+    0x20, 0x10, 0x08, 0x04, 0x02, //'/'
+    0x3E, 0x51, 0x49, 0x45, 0x3E, //'0'
+    0x00, 0x42, 0x7F, 0x40, 0x00, //'1'
+    0x72, 0x49, 0x49, 0x49, 0x46, //'2'
+    0x21, 0x41, 0x49, 0x4D, 0x33, //'3'
+    0x18, 0x14, 0x12, 0x7F, 0x10, //'4'
+    0x27, 0x45, 0x45, 0x45, 0x39, //'5'
+    0x3C, 0x4A, 0x49, 0x49, 0x31, //'6'
+    0x41, 0x21, 0x11, 0x09, 0x07, //'7'
+    0x36, 0x49, 0x49, 0x49, 0x36, //'8'
+    0x46, 0x49, 0x49, 0x29, 0x1E, //'9'
+    0x00, 0x00, 0x14, 0x00, 0x00, //':'
+    0x00, 0x40, 0x34, 0x00, 0x00, //';'
+    0x00, 0x08, 0x14, 0x22, 0x41, //'<'
+    0x14, 0x14, 0x14, 0x14, 0x14, //'='
+    0x00, 0x41, 0x22, 0x14, 0x08, //'>'
+    0x02, 0x01, 0x59, 0x09, 0x06, //'?'
+    0x3E, 0x41, 0x5D, 0x59, 0x4E, //'@'
+    0x7C, 0x12, 0x11, 0x12, 0x7C, //'A'
+    0x7F, 0x49, 0x49, 0x49, 0x36, //'B'
+    0x3E, 0x41, 0x41, 0x41, 0x22, //'C'
+    0x7F, 0x41, 0x41, 0x41, 0x3E, //'D'
+    0x7F, 0x49, 0x49, 0x49, 0x41, //'E'
+    0x7F, 0x09, 0x09, 0x09, 0x01, //'F'
+    0x3E, 0x41, 0x41, 0x51, 0x73, //'G'
+    0x7F, 0x08, 0x08, 0x08, 0x7F, //'H'
+    0x00, 0x41, 0x7F, 0x41, 0x00, //'I'
+    0x20, 0x40, 0x41, 0x3F, 0x01, //'J'
+    0x7F, 0x08, 0x14, 0x22, 0x41, //'K'
+    0x7F, 0x40, 0x40, 0x40, 0x40, //'L'
+    0x7F, 0x02, 0x1C, 0x02, 0x7F, //'M'
+    0x7F, 0x04, 0x08, 0x10, 0x7F, //'N'
+    0x3E, 0x41, 0x41, 0x41, 0x3E, //'O'
+    0x7F, 0x09, 0x09, 0x09, 0x06, //'P'
+    0x3E, 0x41, 0x51, 0x21, 0x5E, //'Q'
+    0x7F, 0x09, 0x19, 0x29, 0x46, //'R'
+    0x26, 0x49, 0x49, 0x49, 0x32, //'S'
+    0x03, 0x01, 0x7F, 0x01, 0x03, //'T'
+    0x3F, 0x40, 0x40, 0x40, 0x3F, //'U'
+    0x1F, 0x20, 0x40, 0x20, 0x1F, //'V'
+    0x3F, 0x40, 0x38, 0x40, 0x3F, //'W'
+    0x63, 0x14, 0x08, 0x14, 0x63, //'X'
+    0x03, 0x04, 0x78, 0x04, 0x03, //'Y'
+    0x61, 0x59, 0x49, 0x4D, 0x43, //'Z'
+    0x00, 0x7F, 0x41, 0x41, 0x41, //'['
+    0x02, 0x04, 0x08, 0x10, 0x20, //backslash
+    0x00, 0x41, 0x41, 0x41, 0x7F, //']'
+    0x04, 0x02, 0x01, 0x02, 0x04, //'^'
+    0x40, 0x40, 0x40, 0x40, 0x40, //'_'
+    0x00, 0x03, 0x07, 0x08, 0x00, //'`'
+    0x20, 0x54, 0x54, 0x78, 0x40, //'a'
+    0x7F, 0x28, 0x44, 0x44, 0x38, //'b'
+    0x38, 0x44, 0x44, 0x44, 0x28, //'c'
+    0x38, 0x44, 0x44, 0x28, 0x7F, //'d'
+    0x38, 0x54, 0x54, 0x54, 0x18, //'e'
+    0x00, 0x08, 0x7E, 0x09, 0x02, //'f'
+    0x18, 0xA4, 0xA4, 0x9C, 0x78, //'g'
+    0x7F, 0x08, 0x04, 0x04, 0x78, //'h'
+    0x00, 0x44, 0x7D, 0x40, 0x00, //'i'
+    0x20, 0x40, 0x40, 0x3D, 0x00, //'j'
+    0x7F, 0x10, 0x28, 0x44, 0x00, //'k'
+    0x00, 0x41, 0x7F, 0x40, 0x00, //'l'
+    0x7C, 0x04, 0x78, 0x04, 0x78, //'m'
+    0x7C, 0x08, 0x04, 0x04, 0x78, //'n'
+    0x38, 0x44, 0x44, 0x44, 0x38, //'o'
+    0xFC, 0x18, 0x24, 0x24, 0x18, //'p'
+    0x18, 0x24, 0x24, 0x18, 0xFC, //'q'
+    0x7C, 0x08, 0x04, 0x04, 0x08, //'r'
+    0x48, 0x54, 0x54, 0x54, 0x24, //'s'
+    0x04, 0x04, 0x3F, 0x44, 0x24, //'t'
+    0x3C, 0x40, 0x40, 0x20, 0x7C, //'u'
+    0x1C, 0x20, 0x40, 0x20, 0x1C, //'v'
+    0x3C, 0x40, 0x30, 0x40, 0x3C, //'w'
+    0x44, 0x28, 0x10, 0x28, 0x44, //'x'
+    0x4C, 0x90, 0x90, 0x90, 0x7C, //'y'
+    0x44, 0x64, 0x54, 0x4C, 0x44, //'z'
+    0x00, 0x08, 0x36, 0x41, 0x00, //'{'
+    0x00, 0x00, 0x77, 0x00, 0x00, //'|'
+    0x00, 0x41, 0x36, 0x08, 0x00, //'}'
+    0x02, 0x01, 0x02, 0x04, 0x02, //'~'
+};
+
+static int clampInt(int v, int low, int high) {
+    return v < low ? low : (v > high ? high : v);
+}
+
+//Largest r such that r * r <= v
+static int isqrt(int v) {
+    int r = 0;
+    int bit = 1 << 14;
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+TileRaster::TileRaster(int tileSize) {
+    this->tileSize = clampInt(tileSize, 8, RASTER_SCREEN_SIZE);
+    this->background = 0x0;
+    this->tilesSent = 0;
+    this->reset();
+}
+
+void TileRaster::clear(uint16_t color) {
+    this->reset();
+    this->background = color;
+    this->cleared = true;
+}
+
+void TileRaster::reset() {
+    this->primitiveCount = 0;
+    this->textUsed = 0;
+    this->cleared = false;
+    this->resumeTile = 0;
+}
+
+TileRaster::Primitive* TileRaster::addPrimitive(PrimitiveType type, int x1, int y1, int x2, int y2, uint16_t color) {
+    if (this->primitiveCount >= RASTER_MAX_PRIMITIVES) {
+        return nullptr;
+    }
+
+    //The new primitive may touch tiles a failed flush already sent
+    this->resumeTile = 0;
+
+    Primitive* p = &this->primitives[this->primitiveCount++];
+    p->type = type;
+    p->scale = 1;
+    p->color = color;
+    p->bounds[0] = x1 < x2 ? x1 : x2;
+    p->bounds[1] = y1 < y2 ? y1 : y2;
+    p->bounds[2] = x1 < x2 ? x2 : x1;
+    p->bounds[3] = y1 < y2 ? y2 : y1;
+    return p;
+}
+
+void TileRaster::drawRectangleFilled(int x1, int y1, int x2, int y2, uint16_t color) {
+    this->addPrimitive(PRIMITIVE_RECTANGLE, x1, y1, x2, y2, color);
+}
+
+void TileRaster::drawLine(int x1, int y1, int x2, int y2, uint16_t color) {
+    Primitive* p = this->addPrimitive(PRIMITIVE_LINE, x1, y1, x2, y2, color);
+    if (p) {
+        p->a = x1;
+        p->b = y1;
+        p->c = x2;
+        p->d = y2;
+    }
+}
+
+void TileRaster::drawCircle(int x, int y, int radius, uint16_t color) {
+    Primitive* p = this->addPrimitive(PRIMITIVE_CIRCLE, x - radius, y - radius, x + radius, y + radius, color);
+    if (p) {
+        p->a = x;
+        p->b = y;
+        p->c = radius;
+    }
+}
+
+void TileRaster::drawCircleFilled(int x, int y, int radius, uint16_t color) {
+    Primitive* p = this->addPrimitive(PRIMITIVE_CIRCLE_FILLED, x - radius, y - radius, x + radius, y + radius, color);
+    if (p) {
+        p->a = x;
+        p->b = y;
+        p->c = radius;
+    }
+}
+
+bool TileRaster::drawText(int x, int y, const char* text, uint16_t color, int scale) {
+    int length = strlen(text);
+    if (!length) {
+        return true;
+    }
+    if (this->textUsed + length + 1 > RASTER_TEXT_POOL) {
+        return false;
+    }
+
+    scale = clampInt(scale, 1, 16);
+    Primitive* p = this->addPrimitive(PRIMITIVE_TEXT, x, y,
+        x + length * RASTER_CHAR_WIDTH * scale - 1, y + RASTER_CHAR_HEIGHT * scale - 1, color);
+    if (!p) {
+        return false;
+    }
+
+    p->a = x;
+    p->b = y;
+    p->c = this->textUsed;
+    p->d = length;
+    p->scale = scale;
+    memcpy(&this->textPool[this->textUsed], text, length + 1);
+    this->textUsed += length + 1;
+    return true;
+}
+
+void TileRaster::renderPrimitive(const Primitive& p, int tileX, int tileY, uint16_t* pixels) {
+    int size = this->tileSize;
+    int tileX2 = tileX + size - 1;
+    int tileY2 = tileY + size - 1;
+
+    //Sets a pixel given in screen coordinates if it's in the tile
+    auto plot = [&](int x, int y) {
+        if (x >= tileX && x <= tileX2 && y >= tileY && y <= tileY2) {
+            pixels[(y - tileY) * size + (x - tileX)] = p.color;
+        }
+    };
+
+    //Fills a run of a row given in screen coordinates, clipped to the tile
+    auto span = [&](int x1, int x2, int y) {
+        if (y < tileY || y > tileY2) {
+            return;
+        }
+        x1 = x1 < tileX ? tileX : x1;
+        x2 = x2 > tileX2 ? tileX2 : x2;
+        uint16_t* row = &pixels[(y - tileY) * size];
+        for (int x = x1; x2 >= x; x++) {
+            row[x - tileX] = p.color;
+        }
+    };
+
+    switch (p.type) {
+    case PRIMITIVE_RECTANGLE: {
+        int y1 = p.bounds[1] < tileY ? tileY : p.bounds[1];
+        int y2 = p.bounds[3] > tileY2 ? tileY2 : p.bounds[3];
+        for (int y = y1; y2 >= y; y++) {
+            span(p.bounds[0], p.bounds[2], y);
+        }
+        break;
+    }
+
+    case PRIMITIVE_LINE: {
+        //Bresenham, over the whole line since lines are short on this screen
+        int x = p.a;
+        int y = p.b;
+        int dx = p.c > p.a ? p.c - p.a : p.a - p.c;
+        int dy = p.d > p.b ? p.b - p.d : p.d - p.b;
+        int sx = p.a < p.c ? 1 : -1;
+        int sy = p.b < p.d ? 1 : -1;
+        int error = dx + dy;
+
+        while (true) {
+            plot(x, y);
+            if (x == p.c && y == p.d) {
+                break;
+            }
+            int e2 = 2 * error;
+            if (e2 >= dy) {
+                error += dy;
+                x += sx;
+            }
+            if (e2 <= dx) {
+                error += dx;
+                y += sy;
+            }
+        }
+        break;
+    }
+
+    case PRIMITIVE_CIRCLE: {
+        //Midpoint circle, one octant mirrored
+        int x = p.c;
+        int y = 0;
+        int error = 1 - x;
+
+        while (x >= y) {
+            plot(p.a + x, p.b + y);
+            plot(p.a + y, p.b + x);
+            plot(p.a - y, p.b + x);
+            plot(p.a - x, p.b + y);
+            plot(p.a - x, p.b - y);
+            plot(p.a - y, p.b - x);
+            plot(p.a + y, p.b - x);
+            plot(p.a + x, p.b - y);
+
+            y++;
+            if (error < 0) {
+                error += 2 * y + 1;
+            } else {
+                x--;
+                error += 2 * (y - x) + 1;
+            }
+        }
+        break;
+    }
+
+    case PRIMITIVE_CIRCLE_FILLED: {
+        int y1 = p.bounds[1] < tileY ? tileY : p.bounds[1];
+        int y2 = p.bounds[3] > tileY2 ? tileY2 : p.bounds[3];
+        for (int y = y1; y2 >= y; y++) {
+            int dy = y - p.b;
+            int half = isqrt(p.c * p.c - dy * dy);
+            span(p.a - half, p.a + half, y);
+        }
+        break;
+    }
+
+    case PRIMITIVE_TEXT: {
+        const char* text = &this->textPool[p.c];
+        int scale = p.scale;
+        int advance = RASTER_CHAR_WIDTH * scale;
+
+        //Only the characters that overlap the tile
+        int first = (tileX - p.a) / advance;
+        int last = (tileX2 - p.a) / advance;
+        first = first < 0 ? 0 : first;
+        last = last >= p.d ? p.d - 1 : last;
+
+        for (int i = first; last >= i; i++) {
+            int c = (uint8_t) text[i];
+            if (c < 32 || c > 126) {
+                c = '?';
+            }
+            const uint8_t* glyph = &rasterFont[(c - 32) * 5];
+            int left = p.a + i * advance;
+
+            for (int column = 0; 5 > column; column++) {
+                uint8_t bits = glyph[column];
+                for (int row = 0; bits; row++, bits >>= 1) {
+                    if (!(bits & 1)) {
+                        continue;
+                    }
+                    int x = left + column * scale;
+                    int y = p.b + row * scale;
+                    for (int sy = 0; scale > sy; sy++) {
+                        span(x, x + scale - 1, y + sy);
+                    }
+                }
+            }
+        }
+        break;
+    }
+    }
+}
+
+void TileRaster::renderTile(int tileX, int tileY, uint16_t* pixels) {
+    int size = this->tileSize;
+    for (int i = 0; size * size > i; i++) {
+        pixels[i] = this->background;
+    }
+
+    for (int i = 0; this->primitiveCount > i; i++) {
+        const Primitive& p = this->primitives[i];
+        if (p.bounds[2] < tileX || p.bounds[0] > tileX + size - 1 ||
+            p.bounds[3] < tileY || p.bounds[1] > tileY + size - 1) {
+            continue;
+        }
+        this->renderPrimitive(p, tileX, tileY, pixels);
+    }
+}
+
+int TileRaster::flush(uLCD& lcd) {
+    int size = this->tileSize;
+    int sent = 0;
+    int tile = 0;
+
+    for (int tileY = 0; RASTER_SCREEN_SIZE > tileY; tileY += size) {
+        for (int tileX = 0; RASTER_SCREEN_SIZE > tileX; tileX += size, tile++) {
+            if (tile < this->resumeTile) {
+                continue;
+            }
+
+            bool touched = this->cleared;
+            for (int i = 0; this->primitiveCount > i && !touched; i++) {
+                const Primitive& p = this->primitives[i];
+                touched = p.bounds[2] >= tileX && p.bounds[0] <= tileX + size - 1 &&
+                    p.bounds[3] >= tileY && p.bounds[1] <= tileY + size - 1;
+            }
+            if (!touched) {
+                continue;
+            }
+
+            //Each tile is its own buffer, the BLIT frees it once it's sent
+            uint16_t* pixels = (uint16_t*) malloc_safe(size * size * 2);
+            printMalloc(pixels);
+            if (!pixels) {
+                //Keep the display list, so the caller can flush again once memory is free
+                this->tilesSent += sent;
+                this->resumeTile = tile;
+                return -1;
+            }
+            this->renderTile(tileX, tileY, pixels);
+
+            //Tiles on the right and bottom edges may hang off the screen
+            int width = RASTER_SCREEN_SIZE - tileX < size ? RASTER_SCREEN_SIZE - tileX : size;
+            int height = RASTER_SCREEN_SIZE - tileY < size ? RASTER_SCREEN_SIZE - tileY : size;
+            if (width != size) {
+                for (int row = 1; height > row; row++) {
+                    memmove(&pixels[row * width], &pixels[row * size], width * 2);
+                }
+            }
+
+            lcd.BLIT(tileX, tileY, width, height, pixels, true);
+            sent++;
+        }
+    }
+
+    this->tilesSent += sent;
+    this->reset();
+    return sent;
+}
+
+int TileRaster::getTilesSent() {
+    return this->tilesSent;
+}
+
+int TileRaster::getPrimitiveCount() {
+    return this->primitiveCount;
+}
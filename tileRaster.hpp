@@ -0,0 +1,135 @@
+/*
+ * Tile Raster Class
+ *
+ * Draws into RAM instead of sending Goldelox primitives. Drawing calls are
+ * recorded in a display list, then flush() renders the screen one small
+ * tile at a time and sends every touched tile with uLCD::BLIT, so only a
+ * tile's worth of pixels is ever held in SRAM.
+ *
+ * Pixels use the 4DGL color format that uLCD::get4DGLColor() returns, which
+ * is already in the byte order the display expects.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_TILE_RASTER_INCLUDED
+#define COLLECTION_TILE_RASTER_INCLUDED
+
+#include "mbed.h"
+#include "uLCD.hpp"
+
+#define RASTER_SCREEN_SIZE 128
+#define RASTER_MAX_PRIMITIVES 64
+#define RASTER_TEXT_POOL 256 //Bytes shared by all text primitives in the display list
+
+//Size of a character of the built in 5x7 font, including spacing, at a scale of 1
+#define RASTER_CHAR_WIDTH 6
+#define RASTER_CHAR_HEIGHT 8
+
+//The built in font: five columns for each printable ASCII character, least significant bit at the top
+extern const uint8_t rasterFont[95 * 5];
+
+class TileRaster {
+    private:
+
+    enum PrimitiveType {
+        PRIMITIVE_RECTANGLE,
+        PRIMITIVE_LINE,
+        PRIMITIVE_CIRCLE,
+        PRIMITIVE_CIRCLE_FILLED,
+        PRIMITIVE_TEXT
+    };
+
+    struct Primitive {
+        uint8_t type;
+        uint8_t scale; //Text only
+        int16_t a; //x1, or the center x
+        int16_t b; //y1, or the center y
+        int16_t c; //x2, or the radius, or the text offset
+        int16_t d; //y2
+        int16_t bounds[4]; //Inclusive pixel bounds x1, y1, x2, y2
+        uint16_t color;
+    };
+
+    Primitive primitives[RASTER_MAX_PRIMITIVES];
+    int primitiveCount;
+    char textPool[RASTER_TEXT_POOL];
+    int textUsed;
+    uint16_t background;
+    bool cleared; //Whether every tile must be sent, not only the touched ones
+    int tileSize;
+    int tilesSent;
+    int resumeTile; //The tile a failed flush stopped at, counted row by row
+
+    Primitive* addPrimitive(PrimitiveType type, int x1, int y1, int x2, int y2, uint16_t color);
+
+    void renderPrimitive(const Primitive& p, int tileX, int tileY, uint16_t* pixels);
+
+    public:
+
+    /**
+     * @param tileSize The width and height of a tile in pixels, a tile takes tileSize * tileSize * 2 bytes
+     */
+    TileRaster(int tileSize = 32);
+
+    /**
+     * Empties the display list and fills the whole screen with a color on the next flush
+     * @param color The 4DGL color
+     */
+    void clear(uint16_t color);
+
+    /**
+     * Empties the display list without sending anything. The background is kept, but
+     * only tiles touched after this are sent. A failed flush is forgotten.
+     */
+    void reset();
+
+    /** Draws a filled rectangle between two vertices */
+    void drawRectangleFilled(int x1, int y1, int x2, int y2, uint16_t color);
+
+    /** Draws a line between the two vertices */
+    void drawLine(int x1, int y1, int x2, int y2, uint16_t color);
+
+    /** Draws a circle with no fill centered at (x, y) */
+    void drawCircle(int x, int y, int radius, uint16_t color);
+
+    /** Draws a filled circle centered at (x, y) */
+    void drawCircleFilled(int x, int y, int radius, uint16_t color);
+
+    /**
+     * Draws text with the built in 5x7 font, on a transparent background
+     * @param x The x pixel coordinate of the top left corner
+     * @param y The y pixel coordinate of the top left corner
+     * @param text The null-terminated string, printable ASCII only
+     * @param color The 4DGL color of the text
+     * @param scale The integral scalar for the font
+     * @return false if the display list or its text pool is full
+     */
+    bool drawText(int x, int y, const char* text, uint16_t color, int scale = 1);
+
+    /**
+     * Renders one tile of the screen from the display list
+     * @param tileX The x pixel coordinate of the tile's top left corner
+     * @param tileY The y pixel coordinate of the tile's top left corner
+     * @param pixels Filled with tileSize * tileSize pixels, row by row
+     */
+    void renderTile(int tileX, int tileY, uint16_t* pixels);
+
+    /**
+     * Renders every tile the display list touches and sends each with a BLIT,
+     * then empties the display list. If a tile's buffer can't be allocated, the
+     * display list is kept and the next flush resumes from that tile, or from the
+     * first tile if something was drawn in between.
+     * @param lcd The display to send to
+     * @return the number of tiles sent, or -1 if a tile couldn't be sent
+     */
+    int flush(uLCD& lcd);
+
+    /** Returns the number of tiles sent by every flush so far */
+    int getTilesSent();
+
+    /** Returns the number of recorded primitives waiting for a flush */
+    int getPrimitiveCount();
+};
+
+#endif // COLLECTION_TILE_RASTER_INCLUDED
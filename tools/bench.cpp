@@ -0,0 +1,1649 @@
+/*
+ * Host Benchmarks
+ *
+ * Throughput benchmarks for the parts of the collection that run without the board.
+ * Every result is printed on its own line as comma separated values so runs can be
+ * compared automatically:
+ *     suite,case,metric,value
+ *
+ * Suites that need the drivers run them on the host stand-in in host/. Build from
+ * the repository root:
+ *     g++ -O2 -std=gnu++14 -I. -Ihost tools/bench.cpp cobs.cpp crc.cpp blockPool.cpp uLCD.cpp \
+ *         uLCDScene.cpp tileRaster.cpp host/mbedHost.cpp host/serialAsyncHost.cpp \
+ *         host/goldeloxEmulator.cpp pixelConvert.cpp uLCDSprite.cpp uLCDAsync.cpp \
+ *         uLCDDigits.cpp uLCDText.cpp uLCDTrace.cpp -pthread -o bench
+ *
+ * Add -mssse3 or -march=native to measure the SIMD pixel conversion path.
+ *
+ * Run all suites with ./bench, or name the suites to run, e.g. ./bench framing
+ *
+ * Checks of correctness are reported as 1 or 0. A failed check is also named on stderr,
+ * and the exit status is non-zero if any failed.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mbed.h"
+#include "cobs.hpp"
+#include "crc.hpp"
+#include "collectionCommon.hpp"
+#include "blockPool.hpp"
+#include "serialAsync.hpp"
+#include "uLCD.hpp"
+#include "tileRaster.hpp"
+#include "pixelConvert.hpp"
+#include "uLCDSprite.hpp"
+#include "uLCDScene.hpp"
+#include "uLCDAsync.hpp"
+#include "uLCDDigits.hpp"
+#include "uLCDText.hpp"
+#include "uLCDTrace.hpp"
+#include "host/goldeloxEmulator.hpp"
+#include "host/hostSerial.hpp"
+#include "tools/spriteEncoder.hpp"
+
+static volatile uint32_t benchSink; //Keeps results alive so the optimizer can't drop the work
+
+static int failedChecks; //Checks that didn't hold, main() exits non-zero if there are any
+
+static void report(const char* suite, const char* name, const char* metric, double value) {
+    std::printf("%s,%s,%s,%.6g\n", suite, name, metric, value);
+}
+
+/**
+ * Reports a check as 1 or 0, and counts it and names it on stderr when it fails
+ */
+static void check(const char* suite, const char* name, const char* metric, bool passed) {
+    report(suite, name, metric, passed);
+    if (!passed) {
+        std::fprintf(stderr, "FAILED %s,%s,%s\n", suite, name, metric);
+        failedChecks++;
+    }
+}
+
+/**
+ * Reports a value that must be exactly the expected one, and counts it when it isn't
+ */
+static void checkEqual(const char* suite, const char* name, const char* metric, int value, int expected) {
+    report(suite, name, metric, value);
+    if (value != expected) {
+        std::fprintf(stderr, "FAILED %s,%s,%s: %d, expected %d\n", suite, name, metric, value, expected);
+        failedChecks++;
+    }
+}
+
+/**
+ * Runs fn repeatedly for at least minSeconds and returns the average seconds per call
+ */
+template <typename F>
+static double timeIt(F fn, double minSeconds = 0.2) {
+    using clock = std::chrono::steady_clock;
+
+    long iterations = 0;
+    auto start = clock::now();
+    double elapsed = 0;
+
+    do {
+        for (int i = 0; 64 > i; i++) {
+            fn();
+        }
+        iterations += 64;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < minSeconds);
+
+    return elapsed / iterations;
+}
+
+/**
+ * Random payload with roughly one zero in every zeroEvery bytes, like packed telemetry
+ */
+static std::vector<uint8_t> makePayload(int size, int zeroEvery) {
+    std::vector<uint8_t> payload(size);
+    for (int i = 0; size > i; i++) {
+        payload[i] = std::rand() % zeroEvery == 0 ? 0 : 1 + std::rand() % 255;
+    }
+    return payload;
+}
+
+/**
+ * Returns the p-th percentile (0 to 1) of the samples, sorting them in place
+ */
+static double percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[(size_t)(p * (samples.size() - 1) + 0.5)];
+}
+
+/**
+ * CPU time used by the calling thread in seconds, excludes time spent asleep
+ */
+static double threadCpuSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double wallSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * A uLCD talking to an emulated display over a socketpair, with the wire time of every
+ * transfer emulated. The uLCD is destroyed first, which closes the link so the emulator
+ * thread sees it end before the emulator is destroyed.
+ */
+class EmulatorFixture {
+    private:
+
+    /** Binds a socketpair to the pin the uLCD is constructed with, returning the display's end */
+    static int connect() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+            std::perror("socketpair");
+            std::exit(1);
+        }
+        hostSerialEmulateBaud(true);
+        hostSerialBind(p9, fds[0]);
+        return fds[1];
+    }
+
+    public:
+
+    GoldeloxEmulator display;
+    uLCD lcd;
+
+    /**
+     * @param baud The baud the uLCD is constructed with
+     * @param timing How fast the display answers
+     * @param cardPath If not null, a card image loaded for the media commands
+     */
+    explicit EmulatorFixture(uLCD::uLCDBaud baud, GoldeloxEmulator::Timing timing = GoldeloxEmulator::defaultTiming(),
+        const char* cardPath = nullptr) : display(connect(), timing), lcd(p9, p10, p11, baud) {
+        if (cardPath && !this->display.loadCard(cardPath)) {
+            std::perror(cardPath);
+            std::exit(1);
+        }
+    }
+};
+
+static void benchFraming() {
+    const int sizes[] = {32, 256, 1024};
+
+    for (int size : sizes) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "payload%d", size);
+
+        std::vector<uint8_t> payload = makePayload(size, 16);
+        std::vector<uint8_t> encoded(cobsMaxEncodedSize(size) + 1);
+        std::vector<uint8_t> decoded(size);
+        std::vector<uint8_t> codes(size + 2);
+        std::vector<CobsSpan> spans(2 * size + 2);
+
+        double t = timeIt([&]() {
+            benchSink += cobsEncode(payload.data(), size, encoded.data());
+        });
+        report("framing", name, "cobs_encode_MBps", size / t / 1e6);
+
+        CobsSpan in = {payload.data(), size};
+        t = timeIt([&]() {
+            benchSink += cobsEncodeSpans(&in, 1, codes.data(), spans.data(), (int)spans.size());
+        });
+        report("framing", name, "cobs_encode_spans_MBps", size / t / 1e6);
+
+        int length = cobsEncode(payload.data(), size, encoded.data());
+        encoded[length++] = 0;
+        CobsDecoder decoder(decoded.data(), size);
+        t = timeIt([&]() {
+            bool complete = false;
+            benchSink += decoder.feed(encoded.data(), length, &complete);
+        });
+        if (decoder.frameLength() != size || std::memcmp(decoded.data(), payload.data(), size)) {
+            std::fprintf(stderr, "framing: decoded frame does not match payload\n");
+            std::exit(1);
+        }
+        report("framing", name, "cobs_decode_MBps", size / t / 1e6);
+
+        t = timeIt([&]() {
+            benchSink += crc16(payload.data(), size);
+        });
+        report("framing", name, "crc16_MBps", size / t / 1e6);
+
+        t = timeIt([&]() {
+            benchSink += crc32(payload.data(), size);
+        });
+        report("framing", name, "crc32_MBps", size / t / 1e6);
+    }
+}
+
+/**
+ * Runs producer threads that allocate from one pool as fast as they can against a consumer
+ * that frees the blocks later in batches, like a uart freeing sent commands, so the pool runs
+ * dry and refills over and over. Every block carries its producer and sequence number, and a
+ * flag per block catches a block handed out twice. Once everything is freed the whole pool
+ * must be allocatable again, each block once.
+ * @param blockSize The block size, at least 8 bytes
+ * @param blockCount The number of blocks
+ */
+static void stressPool(int blockSize, int blockCount) {
+    const int producers = 4;
+    const int allocations = 50000; //Per producer
+    const int batch = blockCount / 2; //Blocks the consumer holds before freeing them
+
+    std::vector<uint32_t> storage(blockSize * blockCount / 4);
+    std::vector<uint16_t> links(blockCount);
+    BlockPool pool((uint8_t*) storage.data(), links.data(), blockSize, blockCount);
+
+    std::unique_ptr<std::atomic<bool>[]> handedOut(new std::atomic<bool>[blockCount]);
+    for (int i = 0; blockCount > i; i++) {
+        handedOut[i] = false;
+    }
+    std::atomic<int> doubleHandouts(0);
+    std::atomic<int> corrupted(0);
+    std::atomic<int> produced(0);
+    std::atomic<int> producing(producers);
+    std::mutex lock;
+    std::deque<uint32_t*> sent;
+
+    double start = wallSeconds();
+    std::vector<std::thread> threads;
+    for (int p = 0; producers > p; p++) {
+        threads.emplace_back([&, p]() {
+            for (uint32_t sequence = 0; allocations > (int) sequence;) {
+                uint32_t* block = (uint32_t*) pool.allocate();
+                if (!block) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                int index = ((uint8_t*) block - (uint8_t*) storage.data()) / blockSize;
+                if (handedOut[index].exchange(true)) {
+                    doubleHandouts++;
+                }
+                block[0] = p;
+                block[1] = sequence++;
+
+                std::lock_guard<std::mutex> guard(lock);
+                sent.push_back(block);
+                produced++;
+            }
+            producing--;
+        });
+    }
+
+    //Freeing in batches, so producers find the pool empty between them
+    int freed = 0;
+    std::vector<uint32_t*> held;
+    std::vector<uint32_t> lastSequence(producers, 0);
+    std::vector<bool> seen(producers, false);
+    while (producing || freed < produced) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            while (!sent.empty()) {
+                held.push_back(sent.front());
+                sent.pop_front();
+            }
+        }
+        if ((int) held.size() < batch && producing) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        for (uint32_t* block : held) {
+            //Blocks of one producer arrive in order, anything else was overwritten by another
+            uint32_t producer = block[0];
+            if (producer >= (uint32_t) producers || (seen[producer] && block[1] <= lastSequence[producer])) {
+                corrupted++;
+            } else {
+                seen[producer] = true;
+                lastSequence[producer] = block[1];
+            }
+
+            int index = ((uint8_t*) block - (uint8_t*) storage.data()) / blockSize;
+            handedOut[index] = false;
+            pool.release(block);
+            freed++;
+        }
+        held.clear();
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double elapsed = wallSeconds() - start;
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "pool_%dx%d", blockSize, blockCount);
+    report("pools", name, "Mops", 2.0 * produced / elapsed / 1e6);
+    checkEqual("pools", name, "double_handouts", doubleHandouts, 0);
+    checkEqual("pools", name, "corrupted", corrupted, 0);
+    check("pools", name, "exhausted", pool.getFailures() > 0 && pool.getHighWater() == blockCount);
+    checkEqual("pools", name, "in_use_after", pool.getInUse(), 0);
+
+    //Recovered: every block can be taken again, each exactly once, then the pool is empty
+    std::vector<bool> taken(blockCount, false);
+    std::vector<void*> blocks;
+    bool distinct = true;
+    for (int i = 0; blockCount > i; i++) {
+        void* block = pool.allocate();
+        if (!block) {
+            distinct = false;
+            break;
+        }
+        int index = ((uint8_t*) block - (uint8_t*) storage.data()) / blockSize;
+        distinct = distinct && !taken[index];
+        taken[index] = true;
+        blocks.push_back(block);
+    }
+    check("pools", name, "all_returned", distinct && !pool.allocate());
+    for (void* block : blocks) {
+        pool.release(block);
+    }
+}
+
+/**
+ * Stresses a pool like each of the ones behind malloc_safe
+ */
+static void benchPools() {
+    int count;
+    const BlockPool* pools = getBlockPools(&count);
+    for (int i = 0; count > i; i++) {
+        stressPool(pools[i].getBlockSize(), pools[i].getBlockCount());
+    }
+}
+
+/**
+ * Two SerialAsync objects joined by a socket pair, standing in for a uart wired back to itself
+ */
+struct SerialLoopback {
+    SerialAsync* sender;
+    SerialAsync* receiver;
+    uint8_t ring[4096];
+
+    SerialLoopback(int baud) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+            std::perror("serial: socketpair");
+            std::exit(1);
+        }
+
+        hostSerialBind(p9, fds[0]);
+        hostSerialBind(p13, fds[1]);
+        this->sender = new SerialAsync(p9, p10, baud);
+        this->receiver = new SerialAsync(p13, p14, baud);
+        this->receiver->setReceiveBuffer(this->ring, sizeof(this->ring));
+    }
+
+    ~SerialLoopback() {
+        delete this->sender;
+        delete this->receiver;
+    }
+
+    /**
+     * Blocks until size bytes are unread on the receiving side
+     */
+    void awaitReceived(int size) {
+        this->receiver->setReceiveEvents(size, 0, -1);
+        while (this->receiver->available() < size) {
+            this->receiver->waitForReceive(SerialAsync::RX_EVENT_COUNT, 1000);
+        }
+    }
+};
+
+/**
+ * Times single writes on an idle link: how long the call takes to return and how long
+ * until the last byte has arrived on the other side.
+ */
+template <typename F>
+static void benchSerialLatency(const char* name, int baud, int writeSize, int writes, F writeFn) {
+    SerialLoopback link(baud);
+    std::vector<uint8_t> payload = makePayload(writeSize, 16);
+    std::vector<double> call;
+    std::vector<double> delivery;
+
+    for (int i = 0; writes > i; i++) {
+        double start = wallSeconds();
+        writeFn(link.sender, payload.data(), writeSize);
+        double returned = wallSeconds();
+        link.awaitReceived(writeSize);
+        double arrived = wallSeconds();
+
+        link.receiver->consume(writeSize);
+        call.push_back((returned - start) * 1e6);
+        delivery.push_back((arrived - start) * 1e6);
+    }
+
+    report("serial", name, "call_p50_us", percentile(call, 0.5));
+    report("serial", name, "call_p99_us", percentile(call, 0.99));
+    report("serial", name, "delivery_p50_us", percentile(delivery, 0.5));
+    report("serial", name, "delivery_p99_us", percentile(delivery, 0.99));
+}
+
+/**
+ * Streams writes back to back while a second thread drains the receiver with read().
+ * CPU time is taken per thread, so sleeping in sync() or waitForReceive() isn't counted.
+ */
+template <typename F>
+static void benchSerialStream(const char* name, int baud, int writeSize, int total, F writeFn, bool reportRead) {
+    SerialLoopback link(baud);
+    std::vector<uint8_t> payload = makePayload(writeSize, 16);
+    link.receiver->setReceiveEvents(writeSize, 2, -1);
+
+    volatile int received = 0;
+    double readCpu = 0;
+    double finished = 0;
+
+    Thread reader;
+    reader.start([&]() {
+        uint8_t buffer[256];
+        double cpuStart = threadCpuSeconds();
+        int count = 0;
+        while (total > count) {
+            int size = link.receiver->read(buffer, sizeof(buffer));
+            if (!size) {
+                link.receiver->waitForReceive(SerialAsync::RX_EVENT_COUNT | SerialAsync::RX_EVENT_IDLE, 1000);
+            }
+            count += size;
+        }
+        readCpu = threadCpuSeconds() - cpuStart;
+        finished = wallSeconds();
+        received = count;
+    });
+
+    double start = wallSeconds();
+    double cpuStart = threadCpuSeconds();
+    for (int sent = 0; total > sent; sent += writeSize) {
+        writeFn(link.sender, payload.data(), writeSize);
+    }
+    double writeCpu = threadCpuSeconds() - cpuStart;
+    reader.join();
+
+    report("serial", name, "bytes_per_s", received / (finished - start));
+    report("serial", name, "wire_efficiency", received / (finished - start) / (baud / 10.0));
+    report("serial", name, "write_cpu_ns_per_byte", writeCpu / received * 1e9);
+    if (reportRead) {
+        report("serial", name, "read_cpu_ns_per_byte", readCpu / received * 1e9);
+    }
+}
+
+static void serialWrite(SerialAsync* serial, const uint8_t* data, int size) {
+    serial->write((void*) data, size);
+}
+
+static void serialWriteAndFree(SerialAsync* serial, const uint8_t* data, int size) {
+    void* copy = malloc_safe(size);
+    std::memcpy(copy, data, size);
+    serial->writeAndFree(copy, size);
+}
+
+/**
+ * Streams several laps of a receive buffer larger than the dma ring can be, checking every
+ * byte on the way out. The reader keeps up, so nothing may be lost or overwritten, and the
+ * part of the buffer past DMA_MAX_CIRCULAR_SIZE must never be written.
+ */
+static void benchSerialRing() {
+    const int total = 4 * DMA_MAX_CIRCULAR_SIZE + 1000;
+    const int writeSize = 4000;
+    const uint8_t unused = 0xA5;
+
+    hostSerialEmulateBaud(false);
+
+    SerialLoopback link(1500000);
+    std::vector<uint8_t> ring(DMA_MAX_CIRCULAR_SIZE + 4096, unused);
+    link.receiver->setReceiveBuffer(ring.data(), ring.size());
+    link.receiver->setReceiveEvents(1, 0, -1);
+
+    //A prime period so the pattern never lines up with the ring
+    std::vector<uint8_t> stream(total);
+    for (int i = 0; total > i; i++) {
+        stream[i] = (uint8_t) (i % 251);
+    }
+
+    std::atomic<int> consumed(0);
+    int mismatched = 0;
+
+    Thread reader;
+    reader.start([&]() {
+        uint8_t buffer[1024];
+        double lastProgress = wallSeconds();
+        while (total > consumed && 2 > wallSeconds() - lastProgress) {
+            int size = link.receiver->read(buffer, sizeof(buffer));
+            if (!size) {
+                link.receiver->waitForReceive(SerialAsync::RX_EVENT_COUNT, 100);
+                continue;
+            }
+
+            for (int i = 0; size > i && total > consumed + i; i++) {
+                mismatched += buffer[i] != stream[consumed + i] ? 1 : 0;
+            }
+            consumed += size;
+            lastProgress = wallSeconds();
+        }
+    });
+
+    double start = wallSeconds();
+    for (int sent = 0; total > sent; sent += writeSize) {
+        //Staying half a ring ahead of the reader at most
+        while (sent - consumed > DMA_MAX_CIRCULAR_SIZE / 2 && 2 > wallSeconds() - start) {
+            wait_us(100);
+        }
+        link.sender->write(&stream[sent], std::min(writeSize, total - sent));
+        link.sender->sync();
+    }
+    reader.join();
+
+    int unusedTouched = 0;
+    for (size_t i = DMA_MAX_CIRCULAR_SIZE; ring.size() > i; i++) {
+        unusedTouched += ring[i] != unused ? 1 : 0;
+    }
+
+    report("serial", "ring_wrap", "bytes_per_s", consumed / (wallSeconds() - start));
+    checkEqual("serial", "ring_wrap", "received", consumed, total);
+    checkEqual("serial", "ring_wrap", "mismatched", mismatched, 0);
+    checkEqual("serial", "ring_wrap", "past_ring", unusedTouched, 0);
+
+    hostSerialEmulateBaud(true);
+}
+
+static void benchSerial() {
+    //The rates uLCD::uLCDBaud can select
+    const int bauds[] = {9600, 56000, 115200, 128000, 300000, 600000, 1000000, 1500000};
+    const int writeSize = 64;
+
+    hostSerialEmulateBaud(true);
+
+    for (int baud : bauds) {
+        //Roughly a quarter second of wire time per case whatever the rate
+        int total = std::max(baud / 10 / 4 / writeSize, 4) * writeSize;
+        int writes = std::min(std::max(total / writeSize, 4), 200);
+        char name[32];
+
+        std::snprintf(name, sizeof(name), "write_%d", baud);
+        benchSerialLatency(name, baud, writeSize, writes, serialWrite);
+        benchSerialStream(name, baud, writeSize, total, serialWrite, false);
+
+        std::snprintf(name, sizeof(name), "writeAndFree_%d", baud);
+        benchSerialLatency(name, baud, writeSize, writes, serialWriteAndFree);
+        benchSerialStream(name, baud, writeSize, total, serialWriteAndFree, false);
+
+        std::snprintf(name, sizeof(name), "read_%d", baud);
+        benchSerialStream(name, baud, writeSize, total, serialWrite, true);
+    }
+
+    //Fixed costs with nothing in flight, which every command pays
+    SerialLoopback link(115200);
+    uint8_t buffer[16];
+    report("serial", "idle", "sync_us", timeIt([&]() { link.sender->sync(); }) * 1e6);
+    report("serial", "idle", "read_empty_us", timeIt([&]() { benchSink += link.receiver->read(buffer, sizeof(buffer)); }) * 1e6);
+    report("serial", "idle", "available_us", timeIt([&]() { benchSink += link.receiver->available(); }) * 1e6);
+
+    benchSerialRing();
+}
+
+/**
+ * Sends a putstr command the way uLCD::printf used to: one transfer per byte, with a fixed
+ * delay between bytes for longer strings
+ */
+static void textPerByte(SerialAsync* serial, const char* command, int size) {
+    int length = size - 3;
+    for (int i = 0; size > i; i++) {
+        serial->write((void*)(command + i), 1);
+        if (length > 14) wait_us(40);
+    }
+}
+
+/**
+ * Sends a putstr command the way uLCD::printf does now: one transfer, paced for the display
+ */
+static void textBlock(SerialAsync* serial, const char* command, int size, int baud) {
+    int gap = uLCD::getTextGap(baud);
+    serial->setPacing(gap ? ULCD_TEXT_CHUNK : 0, gap);
+    serial->write((void*) command, size);
+}
+
+static void benchText() {
+    const int bauds[] = {9600, 115200, 600000, 1500000};
+    const int lengths[] = {8, 32, 128};
+
+    hostSerialEmulateBaud(true);
+
+    for (int baud : bauds) {
+        for (int length : lengths) {
+            SerialLoopback link(baud);
+            std::vector<char> command(length + 3, 'A');
+            command[0] = 0x0;
+            command[1] = 0x6;
+            command[length + 2] = 0x0;
+            int size = length + 3;
+
+            //Roughly a quarter second of wire time per case
+            int repeats = std::max(baud / 10 / 4 / size, 2);
+            char name[32];
+            std::snprintf(name, sizeof(name), "%d_chars_%d", length, baud);
+
+            double start = wallSeconds();
+            for (int i = 0; repeats > i; i++) {
+                textPerByte(link.sender, command.data(), size);
+                link.awaitReceived(size);
+                link.receiver->consume(size);
+            }
+            report("text", name, "per_byte_chars_per_s", repeats * length / (wallSeconds() - start));
+
+            start = wallSeconds();
+            for (int i = 0; repeats > i; i++) {
+                textBlock(link.sender, command.data(), size, baud);
+                link.awaitReceived(size);
+                link.receiver->consume(size);
+            }
+            report("text", name, "block_chars_per_s", repeats * length / (wallSeconds() - start));
+        }
+    }
+}
+
+/**
+ * Checks the uLCD cost model against measured timings: the model is calibrated, then the
+ * prediction for each workload is compared with the time it actually takes to acknowledge.
+ */
+static void benchCost() {
+    const int bauds[] = {115200, 600000, 1500000};
+    const uLCD::uLCDBaud codes[] = {uLCD::BAUD_115200, uLCD::BAUD_600000, uLCD::BAUD_1500000};
+
+    for (int b = 0; 3 > b; b++) {
+        EmulatorFixture fixture(codes[b]);
+        uLCD& lcd = fixture.lcd;
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "calibrate_%d", bauds[b]);
+        report("cost", name, "overhead_us", lcd.calibrate(64));
+
+        //A sparse grid, a dense block, and the draw_grid pattern
+        std::vector<uLCD::Point> sparse, dense, grid;
+        for (int i = 0; 128 > i; i += 32) {
+            for (int j = 0; 128 > j; j += 32) {
+                sparse.push_back({(uint8_t) i, (uint8_t) j});
+            }
+        }
+        for (int i = 0; 128 > i; i++) {
+            for (int j = 0; 8 > j; j++) {
+                dense.push_back({(uint8_t) i, (uint8_t) j});
+            }
+        }
+        for (int i = 0; 128 > i; i += 5) {
+            for (int j = 0; 128 > j; j += 5) {
+                grid.push_back({(uint8_t) i, (uint8_t) j});
+            }
+        }
+
+        struct Workload {
+            const char* name;
+            std::vector<uLCD::Point>* points;
+        } workloads[] = {{"sparse", &sparse}, {"dense", &dense}, {"grid", &grid}};
+
+        for (Workload& workload : workloads) {
+            std::snprintf(name, sizeof(name), "%s_%d", workload.name, bauds[b]);
+
+            lcd.fence();
+            double start = wallSeconds();
+            int predicted = lcd.drawPixels(workload.points->data(), (int) workload.points->size(), 0xFFFF, 0x0000);
+            lcd.fence();
+            double measured = (wallSeconds() - start) * 1e6;
+
+            report("cost", name, "predicted_us", predicted);
+            report("cost", name, "measured_us", measured);
+            report("cost", name, "error_pct", (predicted - measured) / measured * 100);
+        }
+    }
+}
+
+/**
+ * Renders every tile of a screen from the raster's display list, like a flush without the BLITs
+ */
+static void renderScreen(TileRaster& raster, int tileSize, uint16_t* pixels) {
+    for (int y = 0; RASTER_SCREEN_SIZE > y; y += tileSize) {
+        for (int x = 0; RASTER_SCREEN_SIZE > x; x += tileSize) {
+            raster.renderTile(x, y, pixels);
+            benchSink += pixels[0];
+        }
+    }
+}
+
+static void benchRaster() {
+    const int tileSizes[] = {16, 32, 64};
+    const int pixels = RASTER_SCREEN_SIZE * RASTER_SCREEN_SIZE;
+
+    struct Workload {
+        const char* name;
+        void (*draw)(TileRaster& raster);
+    } workloads[] = {
+        {"clear", [](TileRaster& raster) {
+            raster.clear(0x0);
+        }},
+        {"lines", [](TileRaster& raster) {
+            raster.clear(0x0);
+            for (int i = 0; 32 > i; i++) {
+                raster.drawLine(0, i * 4, 127, 127 - i * 4, 0xFFFF);
+            }
+        }},
+        {"circles", [](TileRaster& raster) {
+            raster.clear(0x0);
+            for (int i = 0; 8 > i; i++) {
+                raster.drawCircle(64, 64, 8 + i * 7, 0xFFFF);
+                raster.drawCircleFilled(16 + i * 14, 16, 6, 0x1F00);
+            }
+        }},
+        {"rectangles", [](TileRaster& raster) {
+            raster.clear(0x0);
+            for (int i = 0; 16 > i; i++) {
+                raster.drawRectangleFilled(i * 4, i * 4, 127 - i * 4, 127 - i * 4, i & 1 ? 0xFFFF : 0xE007);
+            }
+        }},
+        {"text", [](TileRaster& raster) {
+            raster.clear(0x0);
+            for (int i = 0; 16 > i; i++) {
+                raster.drawText(0, i * 8, "12:34:56 ALARM 99", 0xFFFF, 1);
+            }
+        }},
+        {"clock", [](TileRaster& raster) {
+            //What set_time() draws
+            raster.clear(0x0);
+            raster.drawText(7, 0, "12:34:56", 0xFFFF, 2);
+            raster.drawRectangleFilled(10, 15, 30, 15, 0xFFFF);
+        }},
+    };
+
+    for (int tileSize : tileSizes) {
+        std::vector<uint16_t> buffer(tileSize * tileSize);
+        TileRaster raster(tileSize);
+
+        for (Workload& workload : workloads) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%s_tile%d", workload.name, tileSize);
+
+            workload.draw(raster);
+            double t = timeIt([&]() {
+                renderScreen(raster, tileSize, buffer.data());
+            });
+            report("raster", name, "Mpixels_per_s", pixels / t / 1e6);
+            report("raster", name, "frames_per_s", 1 / t);
+        }
+    }
+}
+
+/**
+ * Formats the time shown by set_time() for a tick
+ */
+static void clockText(int tick, char* text, int size) {
+    std::snprintf(text, size, "%02d:%02d:%02d", (tick / 3600) % 24, (tick / 60) % 60, tick % 60);
+}
+
+/**
+ * Times the clock screen against the emulated display, redrawn from scratch every tick and
+ * through uLCDScene, and checks that both leave the same screen.
+ */
+static void benchFrame() {
+    const int bauds[] = {115200, 600000, 1500000};
+    const uLCD::uLCDBaud codes[] = {uLCD::BAUD_115200, uLCD::BAUD_600000, uLCD::BAUD_1500000};
+    const int ticks = 20;
+
+    for (int b = 0; 3 > b; b++) {
+        EmulatorFixture fixture(codes[b]);
+        GoldeloxEmulator& display = fixture.display;
+        uLCD& lcd = fixture.lcd;
+
+        char name[32];
+        char text[16];
+
+        //Everything cleared and reprinted, like set_time() before the scene
+        lcd.fence();
+        double start = wallSeconds();
+        for (int tick = 0; ticks > tick; tick++) {
+            clockText(tick, text, sizeof(text));
+            lcd.cls();
+            lcd.setFontSize(2, 2);
+            lcd.setTextColor(0xFFFF);
+            lcd.setTextBackground(0x0000);
+            lcd.locate(1, 0);
+            lcd.print(text);
+            lcd.drawRectangleFilled(94, 15, 114, 15, 0xFFFF);
+        }
+        lcd.fence();
+        std::snprintf(name, sizeof(name), "redraw_%d", bauds[b]);
+        report("frame", name, "frame_ms", (wallSeconds() - start) * 1000 / ticks);
+        uint32_t redrawn = display.getChecksum();
+
+        //Only the changed digits
+        lcd.cls();
+        uLCDScene scene(lcd);
+        int clock = scene.addText(1, 0, 2, 2, 0xFFFF, 0x0000);
+        scene.addRectangle(94, 15, 114, 15, 0xFFFF);
+
+        lcd.fence();
+        start = wallSeconds();
+        for (int tick = 0; ticks > tick; tick++) {
+            clockText(tick, text, sizeof(text));
+            scene.setText(clock, text);
+            scene.update();
+        }
+        lcd.fence();
+        std::snprintf(name, sizeof(name), "scene_%d", bauds[b]);
+        report("frame", name, "frame_ms", (wallSeconds() - start) * 1000 / ticks);
+        check("frame", name, "matches_redraw", display.getChecksum() == redrawn);
+    }
+}
+
+/**
+ * Checks every conversion path against the per-pixel reference and uLCD::get4DGLColor(), on
+ * widths that leave every kind of remainder, then measures throughput on a full screen.
+ */
+static void benchConvert() {
+    bool exact = true;
+
+    for (uint32_t color = 0; 0x1000000 > color && exact; color += 0x10101) {
+        uint8_t rgb[3] = {(uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t) color};
+        uint16_t pixel;
+        convertTo4DGL(rgb, &pixel, 1);
+        exact = pixel == uLCD::get4DGLColor(color);
+    }
+
+    for (int width = 1; 40 > width && exact; width++) {
+        int stride = width * 3 + width % 5;
+        int height = 7;
+        std::vector<uint8_t> source = makePayload(stride * height, 16);
+        std::vector<uint16_t> fast(width * height);
+        std::vector<uint16_t> reference(width * height);
+
+        for (int format = PIXEL_RGB888; PIXEL_BGR888 >= format; format++) {
+            for (int dither = 0; 2 > dither; dither++) {
+                convertImageTo4DGL(source.data(), fast.data(), width, height, stride, (PixelFormat) format, dither);
+                convertImageTo4DGLReference(source.data(), reference.data(), width, height, stride, (PixelFormat) format, dither);
+                exact = exact && fast == reference;
+            }
+        }
+    }
+    check("convert", getConvertPath(), "bit_exact", exact);
+
+    const int size = 128;
+    std::vector<uint8_t> image = makePayload(size * size * 3, 256);
+    std::vector<uint16_t> pixels(size * size);
+
+    struct Case {
+        const char* name;
+        bool reference;
+        bool dither;
+    } cases[] = {
+        {"reference", true, false},
+        {"reference_dither", true, true},
+        {getConvertPath(), false, false},
+        {"dither", false, true},
+    };
+
+    for (Case& c : cases) {
+        double t = timeIt([&]() {
+            if (c.reference) {
+                convertImageTo4DGLReference(image.data(), pixels.data(), size, size, size * 3, PIXEL_RGB888, c.dither);
+            } else {
+                convertImageTo4DGL(image.data(), pixels.data(), size, size, size * 3, PIXEL_RGB888, c.dither);
+            }
+            benchSink += pixels[size * size - 1];
+        });
+        report("convert", c.name, "Mpixels_per_s", size * size / t / 1e6);
+    }
+}
+
+/**
+ * A full screen gradient, converted from RGB888 one chunk of rows at a time like a decoder would
+ */
+static void gradientRows(int row, int count, uint16_t* pixels) {
+    uint8_t rgb[128 * 3];
+    for (int r = 0; count > r; r++) {
+        for (int x = 0; 128 > x; x++) {
+            rgb[x * 3] = x * 2;
+            rgb[x * 3 + 1] = (row + r) * 2;
+            rgb[x * 3 + 2] = 255 - x - (row + r);
+        }
+        convertTo4DGL(rgb, &pixels[r * 128], 128);
+    }
+}
+
+/**
+ * Times a full screen image sent from one 32 kB buffer against BLITStream() with small chunks,
+ * and checks that both leave the same screen.
+ */
+static void benchStream() {
+    const int bauds[] = {600000, 1500000};
+    const uLCD::uLCDBaud codes[] = {uLCD::BAUD_600000, uLCD::BAUD_1500000};
+
+    for (int b = 0; 2 > b; b++) {
+        EmulatorFixture fixture(codes[b]);
+        GoldeloxEmulator& display = fixture.display;
+        uLCD& lcd = fixture.lcd;
+        char name[32];
+
+        lcd.fence();
+        double start = wallSeconds();
+        uint16_t* image = (uint16_t*) malloc_safe(128 * 128 * 2);
+        gradientRows(0, 128, image);
+        lcd.BLIT(0, 0, 128, 128, image, true);
+        lcd.fence();
+        std::snprintf(name, sizeof(name), "whole_%d", bauds[b]);
+        report("stream", name, "frame_ms", (wallSeconds() - start) * 1000);
+        report("stream", name, "buffer_bytes", 128 * 128 * 2);
+        uint32_t whole = display.getChecksum();
+
+        const int chunks[] = {1, 4, 16};
+        for (int chunkRows : chunks) {
+            lcd.cls();
+            lcd.fence();
+            start = wallSeconds();
+            lcd.BLITStream(0, 0, 128, 128, callback(gradientRows), chunkRows);
+            lcd.fence();
+            std::snprintf(name, sizeof(name), "rows%d_%d", chunkRows, bauds[b]);
+            report("stream", name, "frame_ms", (wallSeconds() - start) * 1000);
+            report("stream", name, "buffer_bytes", 2 * chunkRows * 128 * 2);
+            check("stream", name, "matches_whole", display.getChecksum() == whole);
+        }
+    }
+}
+
+/**
+ * Measures sprite compression, decoding, and both ways of drawing against the emulated display
+ */
+static void benchSprite() {
+    const uint16_t background = 0x0000;
+    const uint16_t transparent = 0x1F00;
+
+    struct Sample {
+        const char* name;
+        int width;
+        int height;
+        bool transparent;
+        std::vector<uint16_t> pixels;
+        EncodedSprite encoded;
+    } samples[] = {
+        {"icon", 32, 32, false, {}, {}},
+        {"icon_transparent", 32, 32, true, {}, {}},
+        {"banded_screen", 128, 128, false, {}, {}},
+        {"noise", 48, 48, false, {}, {}},
+    };
+    const uint16_t colors[4] = {0xFFFF, 0x00F8, 0xE007, 0xE0FF};
+
+    for (Sample& sample : samples) {
+        sample.pixels.resize(sample.width * sample.height);
+        for (int y = 0; sample.height > y; y++) {
+            for (int x = 0; sample.width > x; x++) {
+                uint16_t& pixel = sample.pixels[y * sample.width + x];
+                int dx = x - 16;
+                int dy = y - 16;
+                int d = dx * dx + dy * dy;
+
+                if (!std::strcmp(sample.name, "banded_screen")) {
+                    pixel = uLCD::get4DGLColor((uint32_t)(y / 8 * 16) << 8);
+                } else if (!std::strcmp(sample.name, "noise")) {
+                    pixel = uLCD::get4DGLColor((uint32_t)(std::rand() % 16) * 0x111111);
+                } else {
+                    pixel = d < 36 ? colors[0] : d < 100 ? colors[1] : d < 196 ? colors[2] : d < 225 ? colors[3] :
+                        sample.transparent ? transparent : background;
+                }
+            }
+        }
+
+        encodeSprite(sample.pixels.data(), sample.width, sample.height, sample.transparent ? &transparent : nullptr, sample.encoded);
+        int raw = sample.width * sample.height * 2;
+        int compressed = (int)(sample.encoded.data.size() + sample.encoded.palette.size() * 2);
+        report("sprite", sample.name, "compression_ratio", (double) raw / compressed);
+
+        uLCDSprite sprite = sample.encoded.sprite();
+        std::vector<uint16_t> decoded(sample.width * sample.height);
+        double t = timeIt([&]() {
+            SpriteDecoder decoder(sprite);
+            decoder.decode(decoded.data(), (int) decoded.size());
+            benchSink += decoded[0];
+        });
+        report("sprite", sample.name, "decode_Mpixels_per_s", decoded.size() / t / 1e6);
+        check("sprite", sample.name, "decodes_exactly", decoded == sample.pixels);
+    }
+
+    EmulatorFixture fixture(uLCD::BAUD_600000);
+    GoldeloxEmulator& display = fixture.display;
+    uLCD& lcd = fixture.lcd;
+    lcd.calibrate(32);
+
+    for (Sample& sample : samples) {
+        uLCDSprite sprite = sample.encoded.sprite();
+        int rectangles = countSpriteRectangles(sprite);
+        report("sprite", sample.name, "rectangles", rectangles);
+        report("sprite", sample.name, "predicted_rectangles_us", lcd.estimateCost(rectangles * 12, rectangles));
+        report("sprite", sample.name, "predicted_blit_us", lcd.estimateBLITCost(sprite.width, sprite.height));
+
+        const SpriteMode modes[] = {SPRITE_RECTANGLES, SPRITE_BLIT, SPRITE_AUTO};
+        const char* metrics[] = {"rectangles_us", "blit_us", "auto_us"};
+        uint32_t screens[3];
+
+        for (int m = 0; 3 > m; m++) {
+            lcd.cls();
+            lcd.fence();
+            double start = wallSeconds();
+            SpriteMode used = drawSprite(lcd, sprite, 0, 0, modes[m]);
+            lcd.fence();
+            report("sprite", sample.name, metrics[m], (wallSeconds() - start) * 1e6);
+            screens[m] = display.getChecksum();
+
+            if (modes[m] == SPRITE_AUTO) {
+                report("sprite", sample.name, "auto_chose_blit", used == SPRITE_BLIT);
+            }
+        }
+
+        //A BLIT paints transparent pixels, so only opaque sprites have to match
+        if (!sample.transparent) {
+            check("sprite", sample.name, "modes_match", screens[0] == screens[1] && screens[1] == screens[2]);
+        }
+    }
+}
+
+/**
+ * Times a full screen splash drawn by the display from its microSD card against the BLIT it
+ * replaces, at the baud main.cpp uses. The card holds one image in the tools/mediaPack layout.
+ */
+static void benchMedia() {
+    std::vector<uint16_t> pixels(128 * 128);
+    gradientRows(0, 128, pixels.data());
+
+    std::vector<uint8_t> card(512, 0);
+    const uint8_t header[6] = {0, 128, 0, 128, 0x10, 0};
+    card.insert(card.end(), header, header + 6);
+    for (uint16_t pixel : pixels) {
+        card.push_back(pixel);
+        card.push_back(pixel >> 8);
+    }
+
+    char path[] = "/tmp/benchCardXXXXXX";
+    int cardFd = mkstemp(path);
+    if (cardFd < 0 || ::write(cardFd, card.data(), card.size()) != (ssize_t) card.size()) {
+        std::perror("media: card");
+        std::exit(1);
+    }
+    close(cardFd);
+
+    EmulatorFixture fixture(uLCD::BAUD_9600, GoldeloxEmulator::defaultTiming(), path);
+    GoldeloxEmulator& display = fixture.display;
+    uLCD& lcd = fixture.lcd;
+
+    check("media", "init", "card_found", lcd.mediaInit());
+
+    double start = wallSeconds();
+    lcd.mediaSetSector(1);
+    lcd.mediaImage(0, 0);
+    lcd.fence();
+    report("media", "splash_9600", "media_ms", (wallSeconds() - start) * 1000);
+    report("media", "splash_9600", "predicted_blit_ms", lcd.estimateBLITCost(128, 128) / 1000.0);
+
+    //The framebuffer holds RGB565, the card the same bytes as a BLIT
+    bool matches = true;
+    for (int i = 0; 128 * 128 > i && matches; i++) {
+        matches = display.getPixel(i % 128, i / 128) == (uint16_t)(pixels[i] << 8 | pixels[i] >> 8);
+    }
+    check("media", "splash_9600", "matches_image", matches);
+
+    unlink(path);
+}
+
+/**
+ * Draws one producer's share of the async screen, a column of bars in its own part of the screen
+ * so the result doesn't depend on how the producers interleave.
+ * @param draw Called with each rectangle, returns once the command is queued or sent
+ * @param samples Set to how long each call took the producer, in us
+ */
+template <typename F>
+static void asyncProducer(int producer, int commands, int pause_us, F draw, std::vector<double>& samples) {
+    for (int i = 0; commands > i; i++) {
+        int x = producer * 40 + (i % 4) * 10;
+        int y = (i / 4) * 12 % 120;
+        double start = wallSeconds();
+        draw(x, y, x + 8, y + 10, (uint16_t)(0x1111 * (producer + 1) + i));
+        samples.push_back((wallSeconds() - start) * 1e6);
+        if (pause_us) {
+            wait_us(pause_us);
+        }
+    }
+}
+
+/**
+ * Times how long three producer threads are held up drawing through uLCDAsync against sharing the
+ * uLCD behind a mutex, paced like the alarm and sonar threads and as one burst that fills the queue.
+ * Both leave the same screen.
+ */
+static void benchAsync() {
+    const int producers = 3;
+    const int commands = 40;
+    const int pauses[] = {12000, 0};
+    const char* names[] = {"paced", "burst"};
+
+    for (int p = 0; 2 > p; p++) {
+        EmulatorFixture fixture(uLCD::BAUD_115200);
+        GoldeloxEmulator& display = fixture.display;
+        uLCD& lcd = fixture.lcd;
+        char name[32];
+
+        //Every producer takes the lock for each command
+        Mutex lock;
+        std::vector<double> samples[producers];
+        lcd.cls();
+        lcd.fence();
+        double start = wallSeconds();
+        std::vector<std::thread> threads;
+        for (int t = 0; producers > t; t++) {
+            threads.emplace_back([&, t]() {
+                asyncProducer(t, commands, pauses[p], [&](int x1, int y1, int x2, int y2, uint16_t color) {
+                    lock.lock();
+                    lcd.drawRectangleFilled(x1, y1, x2, y2, color);
+                    lock.unlock();
+                }, samples[t]);
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        lcd.fence();
+        double elapsed = wallSeconds() - start;
+
+        std::vector<double> all;
+        for (int t = 0; producers > t; t++) {
+            all.insert(all.end(), samples[t].begin(), samples[t].end());
+        }
+        std::snprintf(name, sizeof(name), "mutex_%s", names[p]);
+        report("async", name, "call_p50_us", percentile(all, 0.5));
+        report("async", name, "call_p99_us", percentile(all, 0.99));
+        report("async", name, "total_ms", elapsed * 1000);
+        uint32_t locked = display.getChecksum();
+
+        //The same through the queue
+        uLCDAsync async(lcd);
+        async.start();
+        async.cls();
+        async.fence();
+        async.resetCounters();
+        threads.clear();
+        all.clear();
+        start = wallSeconds();
+        for (int t = 0; producers > t; t++) {
+            samples[t].clear();
+            threads.emplace_back([&, t]() {
+                asyncProducer(t, commands, pauses[p], [&](int x1, int y1, int x2, int y2, uint16_t color) {
+                    async.drawRectangleFilled(x1, y1, x2, y2, color);
+                }, samples[t]);
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        async.fence();
+        elapsed = wallSeconds() - start;
+
+        for (int t = 0; producers > t; t++) {
+            all.insert(all.end(), samples[t].begin(), samples[t].end());
+        }
+        std::snprintf(name, sizeof(name), "queue_%s", names[p]);
+        report("async", name, "call_p50_us", percentile(all, 0.5));
+        report("async", name, "call_p99_us", percentile(all, 0.99));
+        report("async", name, "total_ms", elapsed * 1000);
+        report("async", name, "max_depth", async.getMaxQueueDepth());
+        report("async", name, "stalls", async.getStallCount());
+        report("async", name, "latency_avg_us", async.getAverageLatency());
+        report("async", name, "latency_max_us", async.getMaxLatency());
+        check("async", name, "matches_mutex", display.getChecksum() == locked);
+        async.stop();
+    }
+}
+
+/**
+ * Times construction of a uLCD, from reset to the first cleared screen, against a display that
+ * takes a second to boot. Once at a fixed baud, then with BAUD_AUTO on a link that carries any
+ * rate and on one that garbles everything above 600000.
+ */
+static void benchStartup() {
+    const char* names[] = {"fixed_9600", "auto", "auto_max_600000"};
+    const uLCD::uLCDBaud codes[] = {uLCD::BAUD_9600, uLCD::BAUD_AUTO, uLCD::BAUD_AUTO};
+    const int limits[] = {0, 0, 600000};
+
+    //Only a display that wakes in the middle of a probe rejects anything, the NAK that shows it and the one to
+    //the pad byte. A probe is 2 ms on the wire out of a period of about 60 ms, so few boots may cost any
+    int boots = 0;
+    int bootNaks = 0;
+    int nakedBoots = 0;
+
+    for (int c = 0; 3 > c; c++) {
+        GoldeloxEmulator::Timing timing = GoldeloxEmulator::defaultTiming();
+        timing.boot_ms = 1000;
+        timing.max_baud = limits[c];
+        EmulatorFixture fixture(codes[c], timing);
+        GoldeloxEmulator& display = fixture.display;
+        uLCD& lcd = fixture.lcd;
+
+        report("startup", names[c], "first_frame_ms", lcd.getStartupTime() / 1000.0);
+        report("startup", names[c], "baud", lcd.getBaudRate());
+
+        //Drawing after the negotiation must work at the rate it chose
+        int naks = display.getNakCount();
+        boots++;
+        bootNaks += naks;
+        nakedBoots += naks ? 1 : 0;
+        lcd.drawRectangleFilled(10, 10, 20, 20, 0xF800);
+        lcd.fence();
+        check("startup", names[c], "draws", display.getNakCount() == naks && display.getPixel(15, 15) == 0x00F8);
+    }
+
+    //Boot times a millisecond apart cover a whole probe period, so some wake in the middle of a probe
+    int desynced = 0;
+    for (int boot_ms = 60; 120 > boot_ms; boot_ms++) {
+        GoldeloxEmulator::Timing timing = GoldeloxEmulator::defaultTiming();
+        timing.boot_ms = boot_ms;
+        EmulatorFixture fixture(uLCD::BAUD_9600, timing);
+        GoldeloxEmulator& display = fixture.display;
+        uLCD& lcd = fixture.lcd;
+
+        int naks = display.getNakCount();
+        boots++;
+        bootNaks += naks;
+        nakedBoots += naks ? 1 : 0;
+        lcd.drawRectangleFilled(10, 10, 20, 20, 0xF800);
+        lcd.fence();
+        if (display.getNakCount() != naks || display.getPixel(15, 15) != 0x00F8) {
+            desynced++;
+        }
+    }
+    checkEqual("startup", "wake_sweep", "desynced", desynced, 0);
+
+    report("startup", "boot", "naks", bootNaks);
+    report("startup", "boot", "boots_with_naks", nakedBoots);
+    check("startup", "boot", "naks_rare", nakedBoots * 10 <= boots && bootNaks <= 2 * nakedBoots);
+}
+
+/**
+ * Times a countdown clock tick, reprinted as text through uLCDScene against drawn as seven-segment
+ * digits by uLCDDigits, counting the commands each tick sends. The digits left by the ticks are
+ * checked against the final time drawn from scratch.
+ */
+static void benchDigits() {
+    const int bauds[] = {9600, 115200, 1500000};
+    const uLCD::uLCDBaud codes[] = {uLCD::BAUD_9600, uLCD::BAUD_115200, uLCD::BAUD_1500000};
+    const int ticks = 30;
+    const int first = 3600 + 5; //Counting down through a change of minute
+
+    for (int b = 0; 3 > b; b++) {
+        EmulatorFixture fixture(codes[b]);
+        GoldeloxEmulator& display = fixture.display;
+        uLCD& lcd = fixture.lcd;
+
+        char name[32];
+        char text[16];
+
+        //The countdown as it was first written, the screen cleared and the whole string printed
+        lcd.fence();
+        int commands = display.getCommandCount();
+        double start = wallSeconds();
+        for (int tick = 1; ticks > tick; tick++) {
+            clockText(first - tick, text, sizeof(text));
+            lcd.cls();
+            lcd.locate(1, 3);
+            lcd.setFontSize(2, 2);
+            lcd.setTextColor(0xFFFF);
+            lcd.printf("%s", text);
+        }
+        lcd.fence();
+        std::snprintf(name, sizeof(name), "redraw_%d", bauds[b]);
+        report("digits", name, "tick_ms", (wallSeconds() - start) * 1000 / (ticks - 1));
+        report("digits", name, "commands_per_tick", (double)(display.getCommandCount() - commands) / (ticks - 1));
+
+        //Every changed character reprinted
+        lcd.cls();
+        uLCDScene scene(lcd);
+        int clock = scene.addText(1, 3, 2, 2, 0xFFFF, 0x0000);
+        clockText(first, text, sizeof(text));
+        scene.setText(clock, text);
+        scene.update();
+        lcd.fence();
+
+        commands = display.getCommandCount();
+        start = wallSeconds();
+        for (int tick = 1; ticks > tick; tick++) {
+            clockText(first - tick, text, sizeof(text));
+            scene.setText(clock, text);
+            scene.update();
+        }
+        lcd.fence();
+        std::snprintf(name, sizeof(name), "scene_%d", bauds[b]);
+        report("digits", name, "tick_ms", (wallSeconds() - start) * 1000 / (ticks - 1));
+        report("digits", name, "commands_per_tick", (double)(display.getCommandCount() - commands) / (ticks - 1));
+
+        //Only the segments that changed
+        lcd.cls();
+        uLCDDigits digits(lcd, 10, 40, "88:88:88", 14, 24, 2, 0xFFFF);
+        clockText(first, text, sizeof(text));
+        digits.setText(text);
+        digits.update();
+        lcd.fence();
+
+        commands = display.getCommandCount();
+        start = wallSeconds();
+        for (int tick = 1; ticks > tick; tick++) {
+            clockText(first - tick, text, sizeof(text));
+            digits.setText(text);
+            digits.update();
+        }
+        lcd.fence();
+        std::snprintf(name, sizeof(name), "digits_%d", bauds[b]);
+        report("digits", name, "tick_ms", (wallSeconds() - start) * 1000 / (ticks - 1));
+        report("digits", name, "commands_per_tick", (double)(display.getCommandCount() - commands) / (ticks - 1));
+        uint32_t ticked = display.getChecksum();
+
+        lcd.cls();
+        uLCDDigits fresh(lcd, 10, 40, "88:88:88", 14, 24, 2, 0xFFFF);
+        fresh.setText(text);
+        fresh.update();
+        lcd.fence();
+        check("digits", name, "matches_fresh", display.getChecksum() == ticked);
+
+        //On the text grid, printing the changed cells when the cost model says it's cheaper
+        lcd.cls();
+        uLCDDigits glyphs(lcd, 14, 48, "88:88:88", 12, 24, 2, 0xFFFF, 0x0, true);
+        check("digits", "glyphs", "on_grid", glyphs.hasGlyphs());
+        clockText(first, text, sizeof(text));
+        glyphs.setText(text);
+        glyphs.update();
+        lcd.fence();
+
+        commands = display.getCommandCount();
+        int rectangles = glyphs.getRectanglesSent();
+        start = wallSeconds();
+        for (int tick = 1; ticks > tick; tick++) {
+            clockText(first - tick, text, sizeof(text));
+            glyphs.setText(text);
+            glyphs.update();
+        }
+        lcd.fence();
+        std::snprintf(name, sizeof(name), "glyphs_%d", bauds[b]);
+        report("digits", name, "tick_ms", (wallSeconds() - start) * 1000 / (ticks - 1));
+        report("digits", name, "commands_per_tick", (double)(display.getCommandCount() - commands) / (ticks - 1));
+        report("digits", name, "rectangles", glyphs.getRectanglesSent() - rectangles);
+        ticked = display.getChecksum();
+
+        lcd.cls();
+        uLCDDigits freshGlyphs(lcd, 14, 48, "88:88:88", 12, 24, 2, 0xFFFF, 0x0, true);
+        freshGlyphs.setText(text);
+        freshGlyphs.update();
+        lcd.fence();
+        check("digits", name, "matches_fresh", display.getChecksum() == ticked);
+
+        //A lone 1 is one rectangle, much cheaper than the style, a locate and a character
+        lcd.cls();
+        uLCDDigits single(lcd, 14, 48, "8", 12, 24, 2, 0xFFFF, 0x0, true);
+        single.setText("1");
+        checkEqual("digits", name, "picks_rectangles", single.update(), 1);
+        lcd.fence();
+    }
+}
+
+/** Reports whether a laid out line is the expected text at the expected cell */
+static void checkLine(const char* name, const TextLine& line, const char* text, int column, int row) {
+    bool same = line.length == (int)std::strlen(text) && !std::strncmp(line.text, text, line.length) &&
+        line.column == column && line.row == row;
+    check("layout", name, "correct", same);
+}
+
+/**
+ * Checks the layout against hand worked cases, then draws a paragraph with drawText() against
+ * a locate and print for every line of the same layout, counting the commands each sends and
+ * checking both leave the same screen.
+ */
+static void benchLayout() {
+    TextLine lines[ULCD_TEXT_MAX_LINES];
+    bool clipped;
+    int count;
+
+    TextBox narrow = {0, 0, 10, 8, 1, 1};
+    count = layoutText("the quick brown fox jumps", narrow, TEXT_LEFT, lines, ULCD_TEXT_MAX_LINES);
+    checkEqual("layout", "wrap", "lines", count, 3);
+    checkLine("wrap_1", lines[0], "the quick", 0, 0);
+    checkLine("wrap_2", lines[1], "brown fox", 0, 1);
+    checkLine("wrap_3", lines[2], "jumps", 0, 2);
+
+    TextBox small = {2, 3, 4, 8, 1, 1};
+    count = layoutText("abcdefghij", small, TEXT_LEFT, lines, ULCD_TEXT_MAX_LINES);
+    checkEqual("layout", "split", "lines", count, 3);
+    checkLine("split_3", lines[2], "ij", 2, 5);
+
+    count = layoutText("ab", narrow, TEXT_CENTER, lines, ULCD_TEXT_MAX_LINES);
+    checkLine("center", lines[0], "ab", 4, 0);
+    count = layoutText("ab", narrow, TEXT_RIGHT, lines, ULCD_TEXT_MAX_LINES);
+    checkLine("right", lines[0], "ab", 8, 0);
+
+    count = layoutText("a\n\nb", narrow, TEXT_LEFT, lines, ULCD_TEXT_MAX_LINES);
+    checkEqual("layout", "blank_line", "lines", count, 3);
+    checkLine("blank_line_2", lines[1], "", 0, 1);
+
+    TextBox shallow = {0, 0, 10, 2, 1, 1};
+    count = layoutText("one\ntwo\nthree", shallow, TEXT_LEFT, lines, ULCD_TEXT_MAX_LINES, &clipped);
+    checkEqual("layout", "clip", "lines", count, 2);
+    check("layout", "clip", "clipped", clipped);
+
+    //The box is clipped to the 5 columns left on the screen at 3x
+    TextBox edge = {1, 0, 20, 4, 3, 4};
+    count = layoutText("good morning", edge, TEXT_LEFT, lines, ULCD_TEXT_MAX_LINES);
+    checkLine("screen_edge_1", lines[0], "good", 1, 0);
+    checkLine("screen_edge_2", lines[1], "morni", 1, 1);
+
+    int width;
+    int height;
+    measureText("good\nMORNING\n>:D", 3, 4, &width, &height);
+    checkEqual("layout", "measure", "width", width, 147);
+    checkEqual("layout", "measure", "height", height, 96);
+
+    const char* paragraph = "The collection draws text locally, so layout never has to be tried on the panel. "
+        "Words wrap at spaces and long lines are split.";
+    const int bauds[] = {9600, 1500000};
+    const uLCD::uLCDBaud codes[] = {uLCD::BAUD_9600, uLCD::BAUD_1500000};
+    const TextAlign aligns[] = {TEXT_LEFT, TEXT_CENTER};
+    const char* alignNames[] = {"left", "center"};
+
+    for (int b = 0; 2 > b; b++) {
+        EmulatorFixture fixture(codes[b]);
+        GoldeloxEmulator& display = fixture.display;
+        uLCD& lcd = fixture.lcd;
+        TextBox screen = getScreenTextBox(1, 1);
+        char name[32];
+
+        for (int a = 0; 2 > a; a++) {
+            //A locate and a print for every line
+            lcd.cls();
+            lcd.setFontSize(1, 1);
+            lcd.fence();
+            int commands = display.getCommandCount();
+            double start = wallSeconds();
+            count = layoutText(paragraph, screen, aligns[a], lines, ULCD_TEXT_MAX_LINES);
+            for (int i = 0; count > i; i++) {
+                char text[ULCD_SCREEN_SIZE / ULCD_CHAR_WIDTH + 1];
+                std::memcpy(text, lines[i].text, lines[i].length);
+                text[lines[i].length] = 0;
+                lcd.locate(lines[i].column, lines[i].row);
+                lcd.print(text);
+            }
+            lcd.fence();
+            std::snprintf(name, sizeof(name), "per_line_%s_%d", alignNames[a], bauds[b]);
+            report("layout", name, "ms", (wallSeconds() - start) * 1000);
+            report("layout", name, "commands", display.getCommandCount() - commands);
+            uint32_t perLine = display.getChecksum();
+
+            lcd.cls();
+            lcd.setFontSize(1, 1);
+            lcd.fence();
+            commands = display.getCommandCount();
+            start = wallSeconds();
+            drawText(lcd, paragraph, screen, aligns[a]);
+            lcd.fence();
+            std::snprintf(name, sizeof(name), "draw_text_%s_%d", alignNames[a], bauds[b]);
+            report("layout", name, "ms", (wallSeconds() - start) * 1000);
+            report("layout", name, "commands", display.getCommandCount() - commands);
+            check("layout", name, "matches_per_line", display.getChecksum() == perLine);
+        }
+    }
+}
+
+/**
+ * Sends every command of a trace again, each with the pixels its BLIT header was followed by
+ * @return the number of commands sent
+ */
+static int replayTrace(uLCD& lcd, const uint8_t* data, int size) {
+    uLCDTrace::Record record;
+    uLCDTrace::Record next;
+    int commands = 0;
+    int offset = uLCDTrace::readRecord(data, size, ULCD_TRACE_HEADER_SIZE, record);
+    while (offset > 0) {
+        int following = uLCDTrace::readRecord(data, size, offset, next);
+        if (record.type == ULCD_TRACE_COMMAND) {
+            int dataSize = 0;
+            while (following > 0 && next.type == ULCD_TRACE_DATA) {
+                dataSize += next.size;
+                following = uLCDTrace::readRecord(data, size, following, next);
+            }
+            lcd.sendEncoded(record.bytes, record.size, record.extraBytes, dataSize);
+            commands++;
+        }
+        record = next;
+        offset = following;
+    }
+    return commands;
+}
+
+/**
+ * Records a countdown with text and a black BLIT into a trace, reporting what recording costs
+ * and how compact the trace is, then replays the trace into a second display, which must end
+ * up with the same screen.
+ */
+static void benchTrace() {
+    static uint8_t buffer[32768];
+    uLCDTrace trace(buffer, sizeof(buffer));
+
+    //Recording alone, a locate sized command at a time
+    const int records = 100000;
+    uint8_t command[6] = {0xFF, 0xE4, 0x00, 0x03, 0x00, 0x05};
+    double start = wallSeconds();
+    for (int i = 0; records > i; i++) {
+        if (trace.getDroppedRecords()) {
+            trace.clear();
+        }
+        trace.recordCommand(command, sizeof(command), 0);
+    }
+    report("trace", "record", "ns_per_command", (wallSeconds() - start) * 1e9 / records);
+    trace.clear();
+
+    uint32_t recordedScreen;
+    int commandBytes = 0;
+    int pixelBytes = 0;
+    {
+        EmulatorFixture recording(uLCD::BAUD_1500000);
+        uLCD& lcd = recording.lcd;
+        lcd.setTrace(&trace);
+
+        lcd.cls();
+        lcd.setTextColor(0x07E0);
+        TextBox title = {0, 0, getTextColumns(1), 2, 1, 1};
+        drawText(lcd, "Trace replay", title, TEXT_CENTER);
+        uint16_t* image = (uint16_t*) malloc_safe(16 * 16 * 2);
+        std::memset(image, 0, 16 * 16 * 2);
+        lcd.BLIT(100, 100, 16, 16, image, true);
+        lcd.traceFrame();
+
+        uLCDDigits digits(lcd, 10, 40, "88:88:88", 14, 24, 2, 0xFFFF);
+        char text[16];
+        for (int tick = 0; 30 > tick; tick++) {
+            clockText(3600 + 5 - tick, text, sizeof(text));
+            digits.setText(text);
+            digits.update();
+            lcd.traceFrame();
+        }
+        lcd.fence();
+        lcd.setTrace(nullptr);
+        recordedScreen = recording.display.getChecksum();
+
+        uLCDTrace::Record record;
+        int offset = ULCD_TRACE_HEADER_SIZE;
+        while ((offset = uLCDTrace::readRecord(trace.getData(), trace.getSize(), offset, record)) > 0) {
+            commandBytes += record.type == ULCD_TRACE_COMMAND ? record.size : 0;
+            pixelBytes += record.type == ULCD_TRACE_DATA ? record.size : 0;
+        }
+    }
+
+    EmulatorFixture replaying(uLCD::BAUD_1500000);
+    uLCD& lcd = replaying.lcd;
+    int commands = replayTrace(lcd, trace.getData(), trace.getSize());
+    lcd.fence();
+
+    report("trace", "countdown", "commands", commands);
+    report("trace", "countdown", "trace_bytes", trace.getSize());
+    report("trace", "countdown", "wire_bytes", commandBytes + pixelBytes);
+    report("trace", "countdown", "overhead_bytes_per_command", (double) (trace.getSize() - commandBytes) / commands);
+    checkEqual("trace", "countdown", "dropped", trace.getDroppedRecords(), 0);
+    checkEqual("trace", "countdown", "replay_naks", lcd.getNakCount(), 0);
+    check("trace", "countdown", "replay_matches", replaying.display.getChecksum() == recordedScreen);
+}
+
+struct Suite {
+    const char* name;
+    void (*run)();
+};
+
+static const Suite suites[] = {
+    {"framing", benchFraming},
+    {"pools", benchPools},
+    {"serial", benchSerial},
+    {"text", benchText},
+    {"cost", benchCost},
+    {"frame", benchFrame},
+    {"raster", benchRaster},
+    {"convert", benchConvert},
+    {"stream", benchStream},
+    {"sprite", benchSprite},
+    {"media", benchMedia},
+    {"async", benchAsync},
+    {"startup", benchStartup},
+    {"digits", benchDigits},
+    {"layout", benchLayout},
+    {"trace", benchTrace},
+};
+
+int main(int argc, char** argv) {
+    std::srand(1);
+
+    for (const Suite& suite : suites) {
+        bool selected = argc < 2;
+        for (int i = 1; argc > i; i++) {
+            selected = selected || !std::strcmp(argv[i], suite.name);
+        }
+
+        if (selected) {
+            suite.run();
+        }
+    }
+
+    if (failedChecks) {
+        std::fprintf(stderr, "%d checks failed\n", failedChecks);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Goldelox Render
+ *
+ * Plays a captured uLCD byte stream through the host Goldelox emulator and
+ * saves the resulting screen, for checking what a program drew without the
+ * panel. The image format follows the extension, .png or anything else for PPM.
+ * The screen's checksum is printed so runs can be compared. Build from the
+ * repository root:
+ *     g++ -O2 -std=gnu++14 -I. -Ihost tools/goldeloxRender.cpp host/goldeloxEmulator.cpp \
+ *         host/mbedHost.cpp crc.cpp tileRaster.cpp uLCD.cpp host/serialAsyncHost.cpp \
+ *         blockPool.cpp uLCDTrace.cpp -pthread -o goldeloxRender
+ *
+ * Usage: ./goldeloxRender capture.bin screen.png [card.img]
+ *
+ * A card image from tools/mediaPack is read by the media commands.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mbed.h"
+#include "host/goldeloxEmulator.hpp"
+
+int main(int argc, char** argv) {
+    if (argc != 3 && argc != 4) {
+        std::fprintf(stderr, "usage: %s capture.bin screen.png|screen.ppm [card.img]\n", argv[0]);
+        return 2;
+    }
+
+    FILE* capture = std::fopen(argv[1], "rb");
+    if (!capture) {
+        std::perror(argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> stream;
+    uint8_t chunk[4096];
+    size_t count;
+    while ((count = std::fread(chunk, 1, sizeof(chunk), capture)) > 0) {
+        stream.insert(stream.end(), chunk, chunk + count);
+    }
+    std::fclose(capture);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        std::perror("socketpair");
+        return 1;
+    }
+
+    //Rendering as fast as possible, the timing only matters when a uLCD is waiting
+    GoldeloxEmulator::Timing timing = GoldeloxEmulator::defaultTiming();
+    timing.command_us = 0;
+    timing.pixel_ns = 0;
+    timing.char_us = 0;
+    GoldeloxEmulator display(fds[1], timing);
+    if (argc == 4 && !display.loadCard(argv[3])) {
+        std::perror(argv[3]);
+        return 1;
+    }
+
+    //Responses are drained so the emulator never blocks on a full socket
+    std::thread drain([&]() {
+        uint8_t responses[256];
+        while (::read(fds[0], responses, sizeof(responses)) > 0);
+    });
+
+    for (size_t offset = 0; stream.size() > offset;) {
+        ssize_t written = ::write(fds[0], &stream[offset], stream.size() - offset);
+        if (written <= 0) {
+            std::perror("write");
+            return 1;
+        }
+        offset += written;
+    }
+    shutdown(fds[0], SHUT_WR);
+    display.join();
+    shutdown(fds[0], SHUT_RD);
+    drain.join();
+    close(fds[0]);
+
+    int length = std::strlen(argv[2]);
+    bool png = length >= 4 && !std::strcmp(&argv[2][length - 4], ".png");
+    if (!(png ? display.writePNG(argv[2]) : display.writePPM(argv[2]))) {
+        std::perror(argv[2]);
+        return 1;
+    }
+
+    std::printf("commands %d, naks %d, busy %lld us, checksum %08X\n", display.getCommandCount(),
+        display.getNakCount(), (long long) display.getBusyTime(), display.getChecksum());
+    return display.getNakCount() ? 1 : 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Media Pack
+ *
+ * Packs images and videos into a raw microSD card image for the Goldelox
+ * media commands, and writes a header with the sector of each asset so
+ * showing one takes two small commands:
+ *     lcd.mediaSetSector(splash_sector);
+ *     lcd.mediaImage(0, 0);
+ * Write the card image to the card with e.g. dd, it replaces any file system.
+ *
+ * Card layout, every number big-endian:
+ *     Sector 0 on: the index, "ULCDIDX1", the entry count (2 bytes), 6 zero bytes, then
+ *         32 bytes per entry: name (20, zero padded), sector (4), width (2), height (2),
+ *         frames (2, 0 for an image), frame delay in ms (1), zero (1)
+ *     Each asset starts on its own sector:
+ *         Image: width (2), height (2), 0x10, 0x00, then the pixels
+ *         Video: width (2), height (2), 0x10, frame delay in ms (1), frames (2), then every frame
+ *     Pixels are RGB565, most significant byte first, row by row.
+ *
+ * Build from the repository root:
+ *     g++ -O2 -std=gnu++14 -I. -Ihost tools/mediaPack.cpp pixelConvert.cpp -o mediaPack
+ *
+ * Usage: ./mediaPack [--dither] card.img media.hpp name=image.ppm name=frame1.ppm,frame2.ppm[@delay_ms] ...
+ *
+ * (c) Daniel Cooper
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pixelConvert.hpp"
+#include "tools/ppm.hpp"
+
+#define MEDIA_SECTOR 512
+#define MEDIA_ENTRY_SIZE 32
+#define MEDIA_NAME_SIZE 20
+#define MEDIA_DEFAULT_DELAY_MS 40
+
+struct Asset {
+    std::string name;
+    std::vector<std::string> frames;
+    int delay_ms;
+    bool video;
+    uint32_t sector;
+    int width;
+    int height;
+};
+
+static void putBigEndian(std::vector<uint8_t>& out, uint32_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        out.push_back(value >> (i * 8));
+    }
+}
+
+static void padToSector(std::vector<uint8_t>& out) {
+    out.resize((out.size() + MEDIA_SECTOR - 1) / MEDIA_SECTOR * MEDIA_SECTOR, 0);
+}
+
+/**
+ * Parses name=file[,file...][@delay]
+ */
+static bool parseAsset(const char* argument, Asset& asset) {
+    std::string text = argument;
+    size_t equals = text.find('=');
+    if (equals == std::string::npos || equals == 0 || equals > MEDIA_NAME_SIZE - 1) {
+        std::fprintf(stderr, "%s: expected name=file.ppm with a name of at most %d characters\n", argument, MEDIA_NAME_SIZE - 1);
+        return false;
+    }
+    asset.name = text.substr(0, equals);
+    std::string files = text.substr(equals + 1);
+
+    asset.delay_ms = MEDIA_DEFAULT_DELAY_MS;
+    size_t at = files.rfind('@');
+    if (at != std::string::npos) {
+        asset.delay_ms = std::atoi(files.c_str() + at + 1);
+        files = files.substr(0, at);
+        if (asset.delay_ms < 0 || asset.delay_ms > 255) {
+            std::fprintf(stderr, "%s: the frame delay must be 0 to 255 ms\n", argument);
+            return false;
+        }
+    }
+
+    size_t start = 0;
+    while (start <= files.size()) {
+        size_t comma = files.find(',', start);
+        if (comma == std::string::npos) {
+            comma = files.size();
+        }
+        asset.frames.push_back(files.substr(start, comma - start));
+        start = comma + 1;
+    }
+    asset.video = asset.frames.size() > 1;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    bool dither = false;
+    int first = 1;
+    if (argc > 1 && !std::strcmp(argv[1], "--dither")) {
+        dither = true;
+        first++;
+    }
+    if (argc - first < 3) {
+        std::fprintf(stderr, "usage: %s [--dither] card.img media.hpp name=image.ppm name=frame1.ppm,frame2.ppm[@delay_ms] ...\n", argv[0]);
+        return 2;
+    }
+
+    const char* cardPath = argv[first];
+    const char* headerPath = argv[first + 1];
+    std::vector<Asset> assets;
+    for (int i = first + 2; argc > i; i++) {
+        Asset asset;
+        if (!parseAsset(argv[i], asset)) {
+            return 1;
+        }
+        assets.push_back(asset);
+    }
+
+    //The index comes first, so the assets start after however many sectors it takes
+    int indexBytes = 16 + (int) assets.size() * MEDIA_ENTRY_SIZE;
+    std::vector<uint8_t> card((indexBytes + MEDIA_SECTOR - 1) / MEDIA_SECTOR * MEDIA_SECTOR, 0);
+
+    for (Asset& asset : assets) {
+        asset.sector = card.size() / MEDIA_SECTOR;
+
+        for (size_t f = 0; asset.frames.size() > f; f++) {
+            int width, height;
+            std::vector<uint8_t> rgb;
+            if (!readPPM(asset.frames[f].c_str(), width, height, rgb)) {
+                return 1;
+            }
+            if (width > 128 || height > 128) {
+                std::fprintf(stderr, "%s: %dx%d is larger than the screen\n", asset.frames[f].c_str(), width, height);
+                return 1;
+            }
+
+            if (!f) {
+                asset.width = width;
+                asset.height = height;
+                putBigEndian(card, width, 2);
+                putBigEndian(card, height, 2);
+                card.push_back(0x10); //16 bit color
+                card.push_back(asset.video ? asset.delay_ms : 0);
+                if (asset.video) {
+                    putBigEndian(card, (uint32_t) asset.frames.size(), 2);
+                }
+            } else if (width != asset.width || height != asset.height) {
+                std::fprintf(stderr, "%s: every frame of %s must be %dx%d\n", asset.frames[f].c_str(),
+                    asset.name.c_str(), asset.width, asset.height);
+                return 1;
+            }
+
+            //4DGL colors in memory are already most significant byte first on a little-endian host
+            std::vector<uint16_t> pixels(width * height);
+            convertImageTo4DGL(rgb.data(), pixels.data(), width, height, width * 3, PIXEL_RGB888, dither);
+            for (uint16_t pixel : pixels) {
+                card.push_back(pixel);
+                card.push_back(pixel >> 8);
+            }
+        }
+
+        padToSector(card);
+    }
+
+    std::vector<uint8_t> index = {'U', 'L', 'C', 'D', 'I', 'D', 'X', '1'};
+    putBigEndian(index, (uint32_t) assets.size(), 2);
+    index.resize(16, 0);
+    for (const Asset& asset : assets) {
+        size_t start = index.size();
+        index.insert(index.end(), asset.name.begin(), asset.name.end());
+        index.resize(start + MEDIA_NAME_SIZE, 0);
+        putBigEndian(index, asset.sector, 4);
+        putBigEndian(index, asset.width, 2);
+        putBigEndian(index, asset.height, 2);
+        putBigEndian(index, asset.video ? (uint32_t) asset.frames.size() : 0, 2);
+        index.push_back(asset.video ? asset.delay_ms : 0);
+        index.push_back(0);
+    }
+    std::memcpy(card.data(), index.data(), index.size());
+
+    FILE* file = std::fopen(cardPath, "wb");
+    if (!file || std::fwrite(card.data(), 1, card.size(), file) != card.size() || std::fclose(file)) {
+        std::perror(cardPath);
+        return 1;
+    }
+
+    file = std::fopen(headerPath, "w");
+    if (!file) {
+        std::perror(headerPath);
+        return 1;
+    }
+    std::fprintf(file, "//Generated by tools/mediaPack for %s, the sector of each asset for uLCD::mediaSetSector()\n\n", cardPath);
+    std::fprintf(file, "#include <stdint.h>\n\n");
+    for (const Asset& asset : assets) {
+        if (asset.video) {
+            std::fprintf(file, "constexpr uint32_t %s_sector = %u; //%dx%d video, %d frames\n", asset.name.c_str(),
+                (unsigned) asset.sector, asset.width, asset.height, (int) asset.frames.size());
+        } else {
+            std::fprintf(file, "constexpr uint32_t %s_sector = %u; //%dx%d image\n", asset.name.c_str(),
+                (unsigned) asset.sector, asset.width, asset.height);
+        }
+    }
+    if (std::fclose(file)) {
+        std::perror(headerPath);
+        return 1;
+    }
+
+    std::fprintf(stderr, "%s: %d assets in %d sectors\n", cardPath, (int) assets.size(), (int)(card.size() / MEDIA_SECTOR));
+    return 0;
+}
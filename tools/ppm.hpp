@@ -0,0 +1,74 @@
+/*
+ * PPM Reader
+ *
+ * Reads binary PPM images (P6, 8 bits per channel), which any image editor
+ * can export, for the asset tools. Host only.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_TOOLS_PPM_INCLUDED
+#define COLLECTION_TOOLS_PPM_INCLUDED
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Reads the next number of a PPM header, skipping whitespace and comments
+ */
+inline bool readPPMNumber(FILE* file, int& value) {
+    int c = std::fgetc(file);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) {
+                c = std::fgetc(file);
+            }
+        }
+        c = std::fgetc(file);
+    }
+
+    if (c < '0' || c > '9') {
+        return false;
+    }
+    value = 0;
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + c - '0';
+        c = std::fgetc(file);
+    }
+    return true; //The single whitespace after the number is consumed
+}
+
+/**
+ * Reads a PPM image, printing the reason to stderr on failure
+ * @param path The file
+ * @param width Set to the width in pixels
+ * @param height Set to the height in pixels
+ * @param rgb Filled with width * height pixels of three bytes, row by row
+ * @return false if the file can't be read or isn't an 8 bit binary PPM
+ */
+inline bool readPPM(const char* path, int& width, int& height, std::vector<uint8_t>& rgb) {
+    FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        std::perror(path);
+        return false;
+    }
+
+    int maximum;
+    if (std::fgetc(file) != 'P' || std::fgetc(file) != '6' || !readPPMNumber(file, width) ||
+        !readPPMNumber(file, height) || !readPPMNumber(file, maximum) || maximum != 255 || width < 1 || height < 1) {
+        std::fprintf(stderr, "%s: not an 8 bit binary PPM\n", path);
+        std::fclose(file);
+        return false;
+    }
+
+    rgb.resize(width * height * 3);
+    bool complete = std::fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+    std::fclose(file);
+    if (!complete) {
+        std::fprintf(stderr, "%s: truncated\n", path);
+    }
+    return complete;
+}
+
+#endif // COLLECTION_TOOLS_PPM_INCLUDED
@@ -0,0 +1,81 @@
+/*
+ * Sprite Converter
+ *
+ * Turns a binary PPM image (P6, 8 bits per channel, up to 128x128, at most 16
+ * colors) into a header of constexpr arrays holding a uLCDSprite. Any image
+ * editor can export PPM; reduce the colors first if there are too many.
+ * Build from the repository root:
+ *     g++ -O2 -std=gnu++14 -I. -Ihost tools/spriteConvert.cpp -o spriteConvert
+ *
+ * Usage: ./spriteConvert image.ppm name [transparent RRGGBB] > name.hpp
+ *
+ * The compression ratio is printed to stderr.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "tools/ppm.hpp"
+#include "tools/spriteEncoder.hpp"
+
+int main(int argc, char** argv) {
+    if (argc != 3 && argc != 4) {
+        std::fprintf(stderr, "usage: %s image.ppm name [transparent RRGGBB]\n", argv[0]);
+        return 2;
+    }
+
+    int width, height;
+    std::vector<uint8_t> rgb;
+    if (!readPPM(argv[1], width, height, rgb)) {
+        return 1;
+    }
+    if (width > 128 || height > 128) {
+        std::fprintf(stderr, "%s: %dx%d is larger than the screen\n", argv[1], width, height);
+        return 1;
+    }
+
+    std::vector<uint16_t> pixels(width * height);
+    for (int i = 0; width * height > i; i++) {
+        pixels[i] = uLCD::get4DGLColor((uint32_t)(rgb[i * 3] << 16 | rgb[i * 3 + 1] << 8 | rgb[i * 3 + 2]));
+    }
+
+    uint16_t transparent = 0;
+    if (argc == 4) {
+        transparent = uLCD::get4DGLColor(argv[3]);
+    }
+
+    EncodedSprite encoded;
+    if (!encodeSprite(pixels.data(), width, height, argc == 4 ? &transparent : nullptr, encoded)) {
+        std::fprintf(stderr, "%s: more than %d colors after conversion to 16 bit\n", argv[1], SPRITE_MAX_COLORS);
+        return 1;
+    }
+
+    const char* name = argv[2];
+    std::printf("//Generated by tools/spriteConvert from %s\n\n", argv[1]);
+    std::printf("#include \"uLCDSprite.hpp\"\n\n");
+
+    std::printf("constexpr uint16_t %s_palette[] = {", name);
+    for (size_t i = 0; encoded.palette.size() > i; i++) {
+        std::printf("%s0x%04X", i ? ", " : "", encoded.palette[i]);
+    }
+    std::printf("};\n\n");
+
+    std::printf("constexpr uint8_t %s_data[] = {", name);
+    for (size_t i = 0; encoded.data.size() > i; i++) {
+        std::printf("%s0x%02X", i % 16 ? ", " : i ? ",\n    " : "\n    ", encoded.data[i]);
+    }
+    std::printf("\n};\n\n");
+
+    std::printf("constexpr uLCDSprite %s = {%d, %d, %d, %s_palette, %s_data, sizeof(%s_data)};\n",
+        name, width, height, encoded.transparent, name, name, name);
+
+    int raw = width * height * 2;
+    int compressed = (int)(encoded.data.size() + encoded.palette.size() * 2);
+    std::fprintf(stderr, "%s: %dx%d, %d colors, %d bytes from %d, ratio %.1f:1\n", name, width, height,
+        (int) encoded.palette.size(), compressed, raw, (double) raw / compressed);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Sprite Encoder
+ *
+ * Builds the palette and runs of a uLCDSprite from 4DGL pixels, for the
+ * converter and the benchmarks. Host only.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_TOOLS_SPRITE_ENCODER_INCLUDED
+#define COLLECTION_TOOLS_SPRITE_ENCODER_INCLUDED
+
+#include <algorithm>
+#include <vector>
+
+#include "uLCDSprite.hpp"
+
+/**
+ * The arrays behind an encoded sprite
+ */
+struct EncodedSprite {
+    std::vector<uint16_t> palette;
+    std::vector<uint8_t> data;
+    int width;
+    int height;
+    int transparent;
+
+    /** A sprite pointing into the arrays, valid while they are */
+    uLCDSprite sprite() const {
+        uLCDSprite s = {(uint8_t) this->width, (uint8_t) this->height, (int8_t) this->transparent,
+            this->palette.data(), this->data.data(), (uint16_t) this->data.size()};
+        return s;
+    }
+};
+
+/**
+ * Encodes pixels as a sprite
+ * @param pixels The 4DGL colors, row by row
+ * @param width The width, up to 128
+ * @param height The height, up to 128
+ * @param transparent Pointer to the 4DGL color that is never drawn, nullptr for none
+ * @param out The encoded sprite
+ * @return false if the image has more than SPRITE_MAX_COLORS colors
+ */
+inline bool encodeSprite(const uint16_t* pixels, int width, int height, const uint16_t* transparent, EncodedSprite& out) {
+    out.palette.clear();
+    out.data.clear();
+    out.width = width;
+    out.height = height;
+    out.transparent = SPRITE_NO_TRANSPARENCY;
+
+    if (transparent) {
+        out.palette.push_back(*transparent);
+        out.transparent = 0;
+    }
+
+    int count = width * height;
+    for (int i = 0; count > i;) {
+        uint16_t color = pixels[i];
+        int length = 1;
+        while (i + length < count && pixels[i + length] == color && length < 271) {
+            length++;
+        }
+        i += length;
+
+        auto found = std::find(out.palette.begin(), out.palette.end(), color);
+        int index = (int)(found - out.palette.begin());
+        if (found == out.palette.end()) {
+            if (out.palette.size() == SPRITE_MAX_COLORS) {
+                return false;
+            }
+            out.palette.push_back(color);
+        }
+
+        if (length < 16) {
+            out.data.push_back(index << 4 | (length - 1));
+        } else {
+            out.data.push_back(index << 4 | 0xF);
+            out.data.push_back(length - 16);
+        }
+    }
+
+    return true;
+}
+
+#endif // COLLECTION_TOOLS_SPRITE_ENCODER_INCLUDED
@@ -0,0 +1,311 @@
+/*
+ * Trace Replay
+ *
+ * Replays a trace recorded by uLCDTrace, frame after frame with nothing in
+ * between, so the drawing of a run can be timed again without the button
+ * waits it was recorded with. For each baud rate it reports the projected
+ * time per frame from the uLCD cost model, then replays the trace through a
+ * uLCD into the host Goldelox emulator and reports the measured time per frame
+ * and the checksum of the final screen, which is the same on every replay.
+ * With --pty the replay goes to a pseudo-terminal instead, for a stand-in
+ * display connected to it.
+ *
+ * The trace is read either as the binary trace or as a console log with the
+ * lines printed by uLCDTrace::dump() in it. Pixels aren't kept in traces, so
+ * BLITs draw black.
+ *
+ * Build from the repository root:
+ *     g++ -O2 -std=gnu++14 -I. -Ihost tools/traceReplay.cpp uLCD.cpp uLCDTrace.cpp \
+ *         host/goldeloxEmulator.cpp host/mbedHost.cpp host/serialAsyncHost.cpp crc.cpp \
+ *         tileRaster.cpp blockPool.cpp -pthread -o traceReplay
+ *
+ * Usage: ./traceReplay [--pty] [--card card.img] [--overhead us] trace.bin|console.log [baud ...]
+ *
+ * (c) Daniel Cooper
+ */
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "mbed.h"
+#include "uLCD.hpp"
+#include "uLCDTrace.hpp"
+#include "host/goldeloxEmulator.hpp"
+#include "host/hostSerial.hpp"
+
+struct TracedCommand {
+    std::vector<uint8_t> bytes;
+    int extraBytes;
+    int dataSize; //Pixels after a BLIT header
+};
+
+struct TracedFrame {
+    std::vector<TracedCommand> commands;
+    int64_t recorded_us; //From the end of the previous frame to the end of this one
+};
+
+struct Trace {
+    std::vector<TracedFrame> frames;
+    int recordedBaud;
+};
+
+static const uLCD::uLCDBaud baudCodes[] = {
+    uLCD::BAUD_9600, uLCD::BAUD_56000, uLCD::BAUD_115200, uLCD::BAUD_128000,
+    uLCD::BAUD_300000, uLCD::BAUD_600000, uLCD::BAUD_1000000, uLCD::BAUD_1500000
+};
+
+static bool readFile(const char* path, std::vector<uint8_t>& contents) {
+    FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        std::perror(path);
+        return false;
+    }
+    uint8_t chunk[4096];
+    size_t count;
+    while ((count = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        contents.insert(contents.end(), chunk, chunk + count);
+    }
+    std::fclose(file);
+    return true;
+}
+
+/** Collects the hex after every "ULCDTRACE " in a log, starting over at each trace header */
+static void readDump(const std::vector<uint8_t>& log, std::vector<uint8_t>& data) {
+    std::string text(log.begin(), log.end());
+    const char* marker = "ULCDTRACE ";
+    for (size_t found = text.find(marker); found != std::string::npos; found = text.find(marker, found)) {
+        found += std::strlen(marker);
+        if (!text.compare(found, 8, "554C5452")) {
+            data.clear();
+        }
+
+        for (; found + 1 < text.size() && isxdigit(text[found]) && isxdigit(text[found + 1]); found += 2) {
+            data.push_back((uint8_t) std::strtol(text.substr(found, 2).c_str(), nullptr, 16));
+        }
+    }
+}
+
+static bool parseTrace(const std::vector<uint8_t>& data, Trace& trace) {
+    if (!uLCDTrace::isTrace(data.data(), data.size())) {
+        std::fprintf(stderr, "not a version %d uLCD trace\n", ULCD_TRACE_VERSION);
+        return false;
+    }
+
+    trace.frames.assign(1, TracedFrame());
+    trace.frames.back().recorded_us = 0;
+    trace.recordedBaud = 0;
+
+    uLCDTrace::Record record;
+    int offset = ULCD_TRACE_HEADER_SIZE;
+    while ((offset = uLCDTrace::readRecord(data.data(), data.size(), offset, record)) > 0) {
+        TracedFrame& frame = trace.frames.back();
+        frame.recorded_us += record.delta_us;
+
+        if (record.type == ULCD_TRACE_COMMAND) {
+            TracedCommand command;
+            command.bytes.assign(record.bytes, record.bytes + record.size);
+            command.extraBytes = record.extraBytes;
+            command.dataSize = 0;
+            frame.commands.push_back(command);
+        } else if (record.type == ULCD_TRACE_DATA) {
+            if (!frame.commands.empty()) {
+                frame.commands.back().dataSize += record.size;
+            }
+        } else if (record.type == ULCD_TRACE_FRAME) {
+            trace.frames.push_back(TracedFrame());
+            trace.frames.back().recorded_us = 0;
+        } else if (record.type == ULCD_TRACE_BAUD) {
+            trace.recordedBaud = record.baud;
+        }
+    }
+
+    if (offset < 0) {
+        std::fprintf(stderr, "trace cut off or corrupt, replaying what came before\n");
+    }
+
+    //Anything drawn after the last mark is a frame too, but a mark at the very end isn't followed by one
+    if (trace.frames.back().commands.empty()) {
+        trace.frames.pop_back();
+    }
+    return true;
+}
+
+/** Returns whether a command changes the baud, which the replay sets itself */
+static bool isBaudCommand(const TracedCommand& command) {
+    return command.bytes.size() >= 2 && command.bytes[0] == 0x00 && command.bytes[1] == 0x0B;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    bool pty = false;
+    const char* cardPath = nullptr;
+    int overhead_us = ULCD_DEFAULT_OVERHEAD_US;
+    int first = 1;
+    for (; argc > first; first++) {
+        if (!std::strcmp(argv[first], "--pty")) {
+            pty = true;
+        } else if (!std::strcmp(argv[first], "--card") && argc > first + 1) {
+            cardPath = argv[++first];
+        } else if (!std::strcmp(argv[first], "--overhead") && argc > first + 1) {
+            overhead_us = std::atoi(argv[++first]);
+        } else {
+            break;
+        }
+    }
+    if (argc <= first) {
+        std::fprintf(stderr, "usage: %s [--pty] [--card card.img] [--overhead us] trace.bin|console.log [baud ...]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> contents;
+    if (!readFile(argv[first], contents)) {
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    if (uLCDTrace::isTrace(contents.data(), contents.size())) {
+        data = contents;
+    } else {
+        readDump(contents, data);
+    }
+
+    Trace trace;
+    if (!parseTrace(data, trace)) {
+        return 1;
+    }
+
+    std::vector<uLCD::uLCDBaud> bauds;
+    for (int i = first + 1; argc > i; i++) {
+        int value = std::atoi(argv[i]);
+        bool known = false;
+        for (uLCD::uLCDBaud code : baudCodes) {
+            if (uLCD::getBaudValue(code) == value) {
+                bauds.push_back(code);
+                known = true;
+            }
+        }
+        if (!known) {
+            std::fprintf(stderr, "%s is not a baud rate the display supports\n", argv[i]);
+            return 2;
+        }
+    }
+    if (bauds.empty()) {
+        bauds.assign(baudCodes, baudCodes + sizeof(baudCodes) / sizeof(baudCodes[0]));
+    }
+
+    //Every command is one round trip, answered with an ACK and its extra bytes
+    int commands = 0;
+    int64_t commandBytes = 0;
+    int64_t pixelBytes = 0;
+    int64_t responseBytes = 0;
+    int64_t recorded_us = 0;
+    for (const TracedFrame& frame : trace.frames) {
+        for (const TracedCommand& command : frame.commands) {
+            if (isBaudCommand(command)) {
+                continue;
+            }
+            commands++;
+            commandBytes += command.bytes.size();
+            pixelBytes += command.dataSize;
+            responseBytes += 1 + command.extraBytes;
+        }
+        recorded_us += frame.recorded_us;
+    }
+    int frames = (int) trace.frames.size();
+
+    std::printf("%d frames, recorded over %.1f ms at %d baud\n", frames, recorded_us / 1000.0, trace.recordedBaud);
+    std::printf("wire bytes %lld (commands %lld, pixels %lld), round trips %d, response bytes %lld\n",
+        (long long) (commandBytes + pixelBytes), (long long) commandBytes, (long long) pixelBytes, commands,
+        (long long) responseBytes);
+    if (!frames) {
+        return 0;
+    }
+
+    std::printf("%8s %12s %12s %12s %12s %6s %9s\n", "baud", "projected", "max", "replayed", "max", "naks", "checksum");
+
+    hostSerialEmulateBaud(true);
+
+    int failed = 0;
+    for (uLCD::uLCDBaud code : bauds) {
+        int baud = uLCD::getBaudValue(code);
+
+        //The same model as uLCD::estimateCost(), with the BLIT header delays added
+        double projectedTotal = 0;
+        double projectedMax = 0;
+        for (const TracedFrame& frame : trace.frames) {
+            int64_t wireBytes = 0;
+            int count = 0;
+            int blits = 0;
+            for (const TracedCommand& command : frame.commands) {
+                if (isBaudCommand(command)) {
+                    continue;
+                }
+                wireBytes += command.bytes.size() + command.dataSize;
+                count++;
+                blits += command.dataSize ? 1 : 0;
+            }
+            double projected = (wireBytes * 10 * 1000000.0 / baud + count * overhead_us + blits * ULCD_BLIT_DELAY_US) / 1000;
+            projectedTotal += projected;
+            projectedMax = projected > projectedMax ? projected : projectedMax;
+        }
+
+        GoldeloxEmulator* display = nullptr;
+        if (!pty) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+                std::perror("socketpair");
+                return 1;
+            }
+            hostSerialBind(p9, fds[0]);
+            display = new GoldeloxEmulator(fds[1]);
+            if (cardPath && !display->loadCard(cardPath)) {
+                std::perror(cardPath);
+                return 1;
+            }
+        }
+
+        //Each frame ends once the display has answered all of it
+        double replayedTotal = 0;
+        double replayedMax = 0;
+        int naks;
+        {
+            uLCD lcd(p9, p10, p11, code);
+            lcd.fence();
+            naks = lcd.getNakCount();
+            for (const TracedFrame& frame : trace.frames) {
+                auto start = std::chrono::steady_clock::now();
+                for (const TracedCommand& command : frame.commands) {
+                    if (!isBaudCommand(command)) {
+                        lcd.sendEncoded(command.bytes.data(), command.bytes.size(), command.extraBytes, command.dataSize);
+                    }
+                }
+                lcd.fence();
+                double replayed = elapsedMs(start);
+                replayedTotal += replayed;
+                replayedMax = replayed > replayedMax ? replayed : replayedMax;
+            }
+            naks = lcd.getNakCount() - naks;
+        }
+
+        char checksum[16] = "-";
+        if (display) {
+            std::snprintf(checksum, sizeof(checksum), "%08X", display->getChecksum());
+            delete display;
+        }
+
+        std::printf("%8d %12.3f %12.3f %12.3f %12.3f %6d %9s\n", baud, projectedTotal / frames, projectedMax,
+            replayedTotal / frames, replayedMax, naks, checksum);
+        failed += naks ? 1 : 0;
+    }
+
+    return failed ? 1 : 0;
+}
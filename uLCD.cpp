@@ -15,72 +15,181 @@
 #include <chrono>
 #include <cstdio>
 #include <cstring>
-#include <sstream>
 
 #include "collectionCommon.hpp"
+#include "uLCDTrace.hpp"
 
 /*
      * With the baud rate, the library will always use 9600 for initial communication with the uLCD
      * It sets the new baud rate after starting initial communication.
      */
-    uLCD::uLCD(PinName tx, PinName rx, PinName reset, uLCDBaud baud) : serial(tx, rx, 9600), resetSignal(reset), waitFunction(nullptr) {
+    uLCD::uLCD(PinName tx, PinName rx, PinName reset, uLCDBaud baud) : serial(tx, rx, 9600, SerialAsync::DMA_ON_DEMAND), resetSignal(reset), waitFunction(nullptr) {
         
         this->resetSignal.write(true);
         this->delayedWritePending = false;
+        this->pendingHead = 0;
+        this->pendingCount = 0;
+        this->responseSkip = 0;
+        this->responseValue = 0;
+        this->pipelineDepth = ULCD_DEFAULT_PIPELINE;
+        this->nakCount = 0;
+        this->naksReported = 0;
+        this->probing = false;
+        this->lastNak = 0;
+        this->shadowValid = 0;
+        this->shadowNaks = 0;
+        this->elidedCommands = 0;
+        this->baudRate = 9600;
+        this->displayVersion = 0;
+        this->startupTime_us = 0;
+        this->textPacing = false;
+        this->commandOverhead = ULCD_DEFAULT_OVERHEAD_US;
+        this->trace = nullptr;
+        this->traceExtraBytes = 0;
+
+        //Responses land in a small ring and are matched to commands as each byte arrives
+        this->serial.setReceiveBuffer(this->receiveBuffer, sizeof(this->receiveBuffer));
+        this->serial.setReceiveEvents(1, 0, -1);
+        this->serial.attachReceive(callback(this, &uLCD::responseReceived));
+
+        //Timing the whole startup, for getStartupTime()
+        Timer startup;
+        startup.start();
+        this->probing = true;
 
         this->reset();
         
         //Clearing the screen
         this->cls();
 
-        this->awaitResponse();
-        
-        //Set baud
+        //Every response must arrive at the old baud before it is changed
+        this->fence();
+
+        if (baud == BAUD_AUTO) {
+            //Fastest first, stepping down from wherever the last try left the display
+            static const uLCDBaud candidates[] = {BAUD_1500000, BAUD_1000000, BAUD_600000, BAUD_300000,
+                BAUD_128000, BAUD_115200, BAUD_56000};
+            bool found = false;
+            for (uLCDBaud candidate : candidates) {
+                this->switchBaud(candidate);
+                if (this->verifyLink()) {
+                    found = true;
+                    break;
+                }
+            }
 
-        char buf[4];
-        buf[0] = 0x0;
-        buf[1] = 0xB;
-        this->addIntToBuf(&buf[2], (int)baud);
+            //Nothing worked, so the display may be at any rate and only a reset brings it back to 9600
+            if (!found) {
+                this->reset();
+            }
+        } else if (baud != BAUD_9600) {
+            this->switchBaud(baud);
+        }
+        this->fence();
+        this->probing = false;
 
-        this->serial.checkBufferFree();
-        this->serial.write(buf, 4);
+        //cls will await for the response before advancing since all commands are asynchonous
+        this->cls(); //Just to send a command post-baud change
 
-        int baudv = 9600;
+        this->setTextColor(0xFFFF); //making text foreground white
+
+        this->fence();
+        this->startupTime_us = startup.read_us();
+    }
+
+    int uLCD::getBaudValue(uLCDBaud baud) {
         switch (baud) {
         case BAUD_9600:
-            baudv = 9600;
-            break;
+            return 9600;
         case BAUD_56000:
-            baudv = 56000;
-            break;
+            return 56000;
         case BAUD_115200:
-            baudv = 115200;
-            break;
+            return 115200;
         case BAUD_128000:
-            baudv = 128000;
-            break;
+            return 128000;
         case BAUD_300000:
-            baudv = 300000;
-            break;
+            return 300000;
         case BAUD_600000:
-            baudv = 600000;
-            break;
+            return 600000;
         case BAUD_1000000:
-            baudv = 1000000;
-            break;
+            return 1000000;
         case BAUD_1500000:
-            baudv = 1500000;
-            break;
+            return 1500000;
+        default:
+            return 0;
         }
+    }
+
+    void uLCD::switchBaud(int code) {
+        this->awaitResponse(0x000B, 0);
+
+        char buf[4];
+        buf[0] = 0x0;
+        buf[1] = 0xB;
+        this->addIntToBuf(&buf[2], code);
 
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, 4);
+        this->serial.write(buf, 4);
         this->serial.sync();
 
+        int baudv = getBaudValue((uLCDBaud) code);
         this->serial.setBaud(baudv);
+        this->baudRate = baudv;
+        if (this->trace) {
+            this->trace->recordBaud(baudv);
+        }
 
-        //cls will await for the response before advancing since all commands are asynchonous
-        this->cls(); //Just to send a command post-baud change
+        //The string gap depends on the baud, so it is worked out again for the next string
+        this->textPacing = false;
+        this->serial.setPacing(0, 0);
+    }
 
-        this->setTextColor(0xFFFF); //making text foreground white
+    bool uLCD::probe() {
+        //Counted before sending, a quick NAK could otherwise arrive before the count
+        int naks = this->nakCount;
+        this->awaitResponse(0x0008, 2);
+
+        char buf[2];
+        buf[0] = 0x0;
+        buf[1] = 0x8;
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, 2);
+        this->serial.write(buf, 2);
+        this->serial.sync();
+
+        return this->fence(ULCD_PROBE_TIMEOUT_MS) && this->nakCount == naks;
+    }
+
+    void uLCD::settle() {
+        //Answers still on their way, late ones or one to a pad byte, would be taken for the next command's
+        wait_us(ULCD_SETTLE_MS * 1000);
+        this->discardPending();
+    }
+
+    bool uLCD::verifyLink() {
+        //The baud command is answered at the new rate, so its ACK is the first test
+        int naks = this->nakCount;
+        if (!this->fence(ULCD_PROBE_TIMEOUT_MS) || this->nakCount != naks) {
+            this->settle();
+            return false;
+        }
+
+        for (int i = 0; ULCD_BAUD_PROBES > i; i++) {
+            if (!this->probe() || this->responseValue != this->displayVersion) {
+                this->settle();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int uLCD::getBaudRate() {
+        return this->baudRate;
+    }
+
+    int uLCD::getStartupTime() {
+        return this->startupTime_us;
     }
 
     void uLCD::addIntToBuf(char* buf, int v) {
@@ -91,46 +200,298 @@
 
     //General functions
 
-    void uLCD::awaitResponse() {
-        if (this->bypassAwait) {
-            this->bypassAwait = false;
+    void uLCD::awaitResponse(uint16_t command, int extraBytes) {
+        while (delayedWritePending);
+
+        //Only strings are long enough to outrun the display
+        this->setTextPacing(command == 0x0006);
+
+        this->reportNaks();
+
+        //Waiting for a free slot rather than for the previous response, so the link keeps busy
+        while (this->pendingCount >= this->pipelineDepth) {
+            this->responseFlags.wait_any(ULCD_RESPONSE_FLAG);
+        }
+
+        core_util_critical_section_enter();
+        int slot = (this->pendingHead + this->pendingCount) % ULCD_MAX_PIPELINE;
+        this->pending[slot].command = command;
+        this->pending[slot].extraBytes = extraBytes;
+        this->pendingCount++;
+        core_util_critical_section_exit();
+
+        this->traceExtraBytes = extraBytes;
+    }
+
+    void uLCD::responseReceived(int events) {
+        (void) events;
+
+        char resp;
+        while (this->serial.read(&resp, sizeof(char))) {
+            if (!this->pendingCount) {
+                continue; //Nothing was expected, e.g. noise while the baud changes
+            }
+
+            if (this->responseSkip) {
+                //Data the display returns after the ACK, like the previous text color
+                this->responseValue = (this->responseValue << 8) | (uint8_t) resp;
+                if (!--this->responseSkip) {
+                    this->completeCommand();
+                }
+                continue;
+            }
+
+            if (resp != 0x6) {
+                //A NAK carries no data, so the next byte answers the next command
+                this->nakCount++;
+                this->lastNak = this->pending[this->pendingHead].command;
+                this->completeCommand();
+                continue;
+            }
+
+            this->responseSkip = this->pending[this->pendingHead].extraBytes;
+            if (this->responseSkip) {
+                this->responseValue = 0;
+            } else {
+                this->completeCommand();
+            }
+        }
+    }
+
+    void uLCD::completeCommand() {
+        this->pendingHead = (this->pendingHead + 1) % ULCD_MAX_PIPELINE;
+        this->pendingCount--;
+        this->responseFlags.set(ULCD_RESPONSE_FLAG);
+    }
+
+    void uLCD::reportNaks() {
+        int naks = this->nakCount;
+        if (this->probing) {
+            this->naksReported = naks;
+        }
+        if (naks != this->naksReported) {
+            std::printf("Display did not respond with Status OK to command 0x%04X (%d total).\n", this->lastNak, naks);
+            this->naksReported = naks;
+        }
+    }
+
+    void uLCD::setTextPacing(bool enable) {
+        if (enable == this->textPacing) {
             return;
         }
+        this->textPacing = enable;
+
+        int gap = enable ? getTextGap(this->baudRate) : 0;
+        this->serial.setPacing(gap ? ULCD_TEXT_CHUNK : 0, gap);
+    }
+
+    int uLCD::getTextGap(int baud) {
+        //The display renders a chunk while the next one would be on the wire, so only the difference is waited
+        int wire_us = ULCD_TEXT_CHUNK * 10 * 1000000 / baud;
+        int render_us = ULCD_TEXT_CHUNK * ULCD_TEXT_CHAR_US;
+        return render_us > wire_us ? render_us - wire_us : 0;
+    }
+
+    void uLCD::setPipelineDepth(int depth) {
+        if (depth < 1) {
+            depth = 1;
+        }
+        if (depth > ULCD_MAX_PIPELINE) {
+            depth = ULCD_MAX_PIPELINE;
+        }
+        this->pipelineDepth = depth;
+    }
 
+    bool uLCD::fence(uint32_t timeout_ms) {
         while (delayedWritePending);
 
-        this->serial.sync();
+        Timer timer;
+        timer.start();
 
-        char resp = 0;
-        while(!resp) {
-            this->serial.read(&resp, sizeof(char));
+        while (this->pendingCount) {
+            uint32_t waited = timer.read_us() / 1000;
+            if (timeout_ms != osWaitForever && waited >= timeout_ms) {
+                return false;
+            }
+            this->responseFlags.wait_any(ULCD_RESPONSE_FLAG, timeout_ms == osWaitForever ? osWaitForever : timeout_ms - waited);
         }
 
-        if (resp != 0x6) {
-            printf("Display did not respond with Status OK.\n");
+        this->reportNaks();
+        return true;
+    }
+
+    bool uLCD::shadowHas(ShadowField field, int value) {
+        //A rejected command may have left the display in another state than the shadow
+        int naks = this->nakCount;
+        if (naks != this->shadowNaks) {
+            this->shadowNaks = naks;
+            this->shadowValid = 0;
         }
 
-        this->serial.flushReceiving();
+        return (this->shadowValid & (1u << field)) && this->shadow[field] == value;
+    }
+
+    void uLCD::shadowSet(ShadowField field, int value) {
+        this->shadow[field] = value;
+        this->shadowValid |= 1u << field;
+    }
+
+    bool uLCD::stateUnchanged(ShadowField field, int value) {
+        if (this->shadowHas(field, value)) {
+            this->elidedCommands++;
+            return true;
+        }
+
+        this->shadowSet(field, value);
+        return false;
+    }
+
+    void uLCD::textPrinted() {
+        //Text attributes only last for one print
+        this->shadowSet(SHADOW_BOLD, 0);
+        this->shadowSet(SHADOW_ITALIC, 0);
+        this->shadowSet(SHADOW_INVERTED, 0);
+        this->shadowSet(SHADOW_UNDERLINE, 0);
+    }
+
+    int uLCD::getElidedCommands() {
+        return this->elidedCommands;
+    }
+
+    int uLCD::getNakCount() {
+        return this->nakCount;
+    }
+
+    uint16_t uLCD::getLastNak() {
+        return this->lastNak;
     }
 
     /** Clear the screen and fills the screen with the set background color. Defaults to black (0x0)*/
     void uLCD::cls() {
-        this->awaitResponse();
+        this->awaitResponse(0xFFD7, 0);
         char* buf = (char*) malloc_safe(2);
         printMalloc(buf);
         buf[0] = 0xFF;
         buf[1] = 0xD7;
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 2);
         this->serial.writeAndFree(buf, 2);
     }
 
-    /** Resets the screen, blocks for 3 seconds */
-    void uLCD::reset() {
+    /**
+     * Resets the screen and probes it at 9600 baud until two probes in a row return the same
+     * version, blocking until then or for at most ULCD_BOOT_TIMEOUT_MS
+     * @return false if the display didn't answer in time, the link is then left at 9600
+     */
+    bool uLCD::reset() {
         this->resetSignal.write(false);
         wait_us(50);
         this->resetSignal.write(true);
-        wait_us(3000000);
-        this->bypassAwait = true;
+
+        //The display comes back at 9600 with its defaults, which aren't assumed
+        this->serial.sync();
+        this->serial.setBaud(9600);
+        this->baudRate = 9600;
+        if (this->trace) {
+            this->trace->recordBaud(9600);
+        }
+        this->textPacing = false;
+        this->serial.setPacing(0, 0);
+        this->shadowValid = 0;
+
+        //Commands sent before the reset will never be answered
+        this->discardPending();
+
+        //Probing until the display answers instead of always waiting for the slowest boot
+        bool wasProbing = this->probing;
+        this->probing = true;
+        Timer timer;
+        timer.start();
+        bool ready = false;
+        while (!ready && timer.read_us() / 1000 < ULCD_BOOT_TIMEOUT_MS) {
+            int naks = this->nakCount;
+
+            //A second answer that agrees shows the first was to a probe and not left over from an earlier one
+            if (this->probe()) {
+                uint16_t version = this->responseValue;
+                if (this->probe() && this->responseValue == version) {
+                    this->displayVersion = version;
+                    ready = true;
+                    break;
+                }
+            }
+
+            //A display that woke up in the middle of a probe holds its second byte and pairs it with the
+            //next command, which it rejects. Only then is a pad byte sent, pairing up the byte it holds.
+            //A timeout is a display still booting or slow to answer, and a pad would put it out of step
+            if (this->nakCount != naks) {
+                char pad = 0x0;
+                this->serial.checkBufferFree();
+                this->serial.write(&pad, 1);
+                this->serial.sync();
+            }
+            this->settle();
+        }
+
+        this->probing = wasProbing;
+        return ready;
+    }
+
+    void uLCD::traceCommand(const void* buf, int size) {
+        if (this->trace) {
+            this->trace->recordCommand(buf, size, this->traceExtraBytes);
+        }
+    }
+
+    void uLCD::setTrace(uLCDTrace* trace) {
+        this->trace = trace;
+        if (trace) {
+            trace->recordBaud(this->baudRate);
+        }
+    }
+
+    void uLCD::traceFrame() {
+        if (this->trace) {
+            this->trace->markFrame();
+        }
+    }
+
+    void uLCD::sendEncoded(const uint8_t* bytes, int size, int extraBytes, int dataSize) {
+        if (size < 2) {
+            return;
+        }
+
+        //The command could change any of the display state
+        this->shadowValid = 0;
+
+        this->awaitResponse((bytes[0] << 8) | bytes[1], extraBytes);
+        char* buf = (char*) malloc_safe(size);
+        printMalloc(buf);
+        memcpy(buf, bytes, size);
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, size);
+        this->serial.writeAndFree(buf, size);
+
+        if (dataSize > 0) {
+            //Traces don't keep pixels, black stands in for them
+            uint8_t* pixels = (uint8_t*) malloc_safe(dataSize);
+            printMalloc(pixels);
+            memset(pixels, 0, dataSize);
+            this->serial.sync();
+            if (this->trace) {
+                this->trace->recordData(dataSize);
+            }
+            this->waitToWrite(pixels, dataSize, ULCD_BLIT_DELAY_US, true);
+        }
+    }
+
+    void uLCD::discardPending() {
+        core_util_critical_section_enter();
+        this->pendingCount = 0;
+        this->responseSkip = 0;
+        core_util_critical_section_exit();
+        this->serial.flushReceiving();
+        this->responseFlags.set(ULCD_RESPONSE_FLAG);
     }
 
     void uLCD::writeBack() {
@@ -161,7 +522,11 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The 4DGL color to set the text foreground color
      */
     void uLCD::setTextColor(uint16_t color) {
-        this->awaitResponse();
+        if (this->stateUnchanged(SHADOW_TEXT_COLOR, color)) {
+            return;
+        }
+
+        this->awaitResponse(0xFF7F, 2);
         char* buf = (char*) malloc_safe(4);
         printMalloc(buf);
         buf[0] = 0xFF;
@@ -172,6 +537,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[3] = color >> 8;
 
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 4);
         this->serial.writeAndFree(buf, 4);
     }
 
@@ -180,7 +546,11 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The 4DGL color to set the text background color
      */
     void uLCD::setTextBackground(uint16_t color) {
-        this->awaitResponse();
+        if (this->stateUnchanged(SHADOW_TEXT_BACKGROUND, color)) {
+            return;
+        }
+
+        this->awaitResponse(0xFF7E, 2);
         char* buf = (char*) malloc_safe(4);
         printMalloc(buf);
         buf[0] = 0xFF;
@@ -191,6 +561,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[3] = color >> 8;
 
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 4);
         this->serial.writeAndFree(buf, 4);
     }
 
@@ -200,24 +571,32 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param height The height scalar for the font
      */
     void uLCD::setFontSize(int width, int height) {
-        //sending two separate commands
-        this->awaitResponse();
+        //sending two separate commands, each only if it changes something
+        if (!this->stateUnchanged(SHADOW_FONT_WIDTH, width)) {
+            this->awaitResponse(0xFF7C, 2);
 
-        char* buf = (char*) malloc_safe(4);
-        printMalloc(buf);
-        buf[0] = 0xFF;
-        buf[1] = 0x7C;
-        this->addIntToBuf(&buf[2], width);
-        this->serial.checkBufferFree();
-        this->serial.write(buf, 4);
+            char* buf = (char*) malloc_safe(4);
+            printMalloc(buf);
+            buf[0] = 0xFF;
+            buf[1] = 0x7C;
+            this->addIntToBuf(&buf[2], width);
+            this->serial.checkBufferFree();
+            this->traceCommand(buf, 4);
+            this->serial.writeAndFree(buf, 4);
+        }
 
-        this->awaitResponse();
+        if (!this->stateUnchanged(SHADOW_FONT_HEIGHT, height)) {
+            this->awaitResponse(0xFF7B, 2);
 
-        buf[0] = 0xFF;
-        buf[1] = 0x7B;
-        this->addIntToBuf(&buf[2], height);
-        this->serial.checkBufferFree();
-        this->serial.writeAndFree(buf, 4);
+            char* buf = (char*) malloc_safe(4);
+            printMalloc(buf);
+            buf[0] = 0xFF;
+            buf[1] = 0x7B;
+            this->addIntToBuf(&buf[2], height);
+            this->serial.checkBufferFree();
+            this->traceCommand(buf, 4);
+            this->serial.writeAndFree(buf, 4);
+        }
     }
 
     /**
@@ -226,7 +605,11 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param bold True to bold next text, false to reset manually
      */
     void uLCD::setTextBold(bool bold) {
-        this->awaitResponse();
+        if (this->stateUnchanged(SHADOW_BOLD, bold)) {
+            return;
+        }
+
+        this->awaitResponse(0xFF76, 2);
         char* buf = (char*) malloc_safe(4);
         printMalloc(buf);
         buf[0] = 0xFF;
@@ -235,6 +618,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[3] = bold;
 
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 4);
         this->serial.writeAndFree(buf, 4);
     }
 
@@ -244,7 +628,11 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param italic True to italicize next text, false to reset manually
      */
     void uLCD::setTextItalic(bool italic) {
-        this->awaitResponse();
+        if (this->stateUnchanged(SHADOW_ITALIC, italic)) {
+            return;
+        }
+
+        this->awaitResponse(0xFF75, 2);
         char* buf = (char*) malloc_safe(4);
         printMalloc(buf);
         buf[0] = 0xFF;
@@ -253,6 +641,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[3] = italic;
 
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 4);
         this->serial.writeAndFree(buf, 4);
     }
 
@@ -262,7 +651,11 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param invert True to invert colors for next text, false to reset manually
      */
     void uLCD::setTextInverted(bool invert) {
-        this->awaitResponse();
+        if (this->stateUnchanged(SHADOW_INVERTED, invert)) {
+            return;
+        }
+
+        this->awaitResponse(0xFF74, 2);
         char* buf = (char*) malloc_safe(4);
         printMalloc(buf);
         buf[0] = 0xFF;
@@ -271,6 +664,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[3] = invert;
 
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 4);
         this->serial.writeAndFree(buf, 4);
     }
 
@@ -280,7 +674,11 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param underline True to underline next text, false to reset manually
      */
     void uLCD::setTextUnderline(bool underline) {
-        this->awaitResponse();
+        if (this->stateUnchanged(SHADOW_UNDERLINE, underline)) {
+            return;
+        }
+
+        this->awaitResponse(0xFF73, 2);
         char* buf = (char*) malloc_safe(4);
         printMalloc(buf);
         buf[0] = 0xFF;
@@ -289,6 +687,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[3] = underline;
 
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 4);
         this->serial.writeAndFree(buf, 4);
     }
 
@@ -297,7 +696,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param c The character to print
      */
     void uLCD::print(char c) {
-        this->awaitResponse();
+        this->awaitResponse(0xFFFE, 0);
         char* buf = (char*) malloc_safe(4);
         printMalloc(buf);
         buf[0] = 0xFF;
@@ -306,7 +705,10 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[3] = c;
 
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 4);
         this->serial.writeAndFree(buf, 4);
+
+        this->textPrinted();
     }
 
     /**
@@ -315,30 +717,21 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param str The null-terminated string to print
      */
     void uLCD::print(char* str) {
-        this->awaitResponse();
-        char buf[2];
+        this->awaitResponse(0x0006, 2);
+
+        //The command, the string and its terminator go out as one transfer, paced by setTextPacing
+        int length = strlen(str);
+        char* buf = (char*) malloc_safe(length + 3);
+        printMalloc(buf);
         buf[0] = 0x0;
         buf[1] = 0x6;
+        memcpy(&buf[2], str, length + 1);
 
         this->serial.checkBufferFree();
-        this->serial.write(buf, 2);
-        this->serial.sync();
-
-        wait_us(25); //delay to process the command header
-
-        //getting string length
-        char length = strlen(str);
-
-        //This is a very expensive operation for the display, so will have to slow down by
-        //sending only one byte at a time
+        this->traceCommand(buf, length + 3);
+        this->serial.writeAndFree(buf, length + 3);
 
-        char* bufP = str;
-
-        for (int i = 0; length + 1 > i; i++) {
-            this->serial.write(bufP++, 1);
-            this->serial.sync();
-            if (length > 16) wait_us(40);
-        }
+        this->textPrinted();
     }
 
     /**
@@ -350,28 +743,33 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         va_list args;
         va_start(args, str);
 
-        this->awaitResponse();
-
-        char buf[258];
-        buf[0] = 0x0;
-        buf[1] = 0x6;
-
         //Generating final string
-        int length = std::vsnprintf(&buf[2], 256, str, args);
+        char text[256];
+        int length = std::vsnprintf(text, sizeof(text), str, args);
+        va_end(args);
 
-        //This is a very expensive operation for the display, so will have to slow down by
-        //sending only one byte at a time
+        if (length < 0) {
+            return;
+        }
+        if (length > (int) sizeof(text) - 1) {
+            length = sizeof(text) - 1;
+        }
 
-        char* bufP = buf;
+        this->awaitResponse(0x0006, 2);
 
-        this->serial.checkBufferFree();
+        //The command, the string and its terminator go out as one transfer, paced by setTextPacing
+        char* buf = (char*) malloc_safe(length + 3);
+        printMalloc(buf);
+        buf[0] = 0x0;
+        buf[1] = 0x6;
+        memcpy(&buf[2], text, length);
+        buf[length + 2] = 0x0;
 
-        for (int i = 0; length + 3 > i; i++) {
-            this->serial.write(bufP++, 1);
-            if (length > 14) wait_us(40);
-        }
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, length + 3);
+        this->serial.writeAndFree(buf, length + 3);
 
-        va_end(args);
+        this->textPrinted();
     }
 
     /**
@@ -381,7 +779,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param y The y text coordinate
      */
     void uLCD::locate(int x, int y) {
-        this->awaitResponse();
+        this->awaitResponse(0xFFE4, 0);
 
         char* buf = (char*) malloc_safe(6);
         printMalloc(buf);
@@ -390,6 +788,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         this->addIntToBuf(&buf[2], y);
         this->addIntToBuf(&buf[4], x);
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 6);
         this->serial.writeAndFree(buf, 6);
     }
 
@@ -403,7 +802,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The 4DGL color for the circle's outline
      */
     void uLCD::drawCircle(int x, int y, int radius, uint16_t color) {
-        this->awaitResponse();
+        this->awaitResponse(0xFFCD, 0);
 
         char* buf = (char*) malloc_safe(10);
         printMalloc(buf);
@@ -415,6 +814,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[8] = color;
         buf[9] = color >> 8;
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 10);
         this->serial.writeAndFree(buf, 10);
     }
 
@@ -426,7 +826,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The 4DGL color for the circle's fill
      */
     void uLCD::drawCircleFilled(int x, int y, int radius, uint16_t color) {
-        this->awaitResponse();
+        this->awaitResponse(0xFFCC, 0);
 
         char* buf = (char*) malloc_safe(10);
         printMalloc(buf);
@@ -438,6 +838,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[8] = color;
         buf[9] = color >> 8;
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 10);
         this->serial.writeAndFree(buf, 10);
     }
 
@@ -452,7 +853,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The 4DGL color for the triangle's outline
      */
     void uLCD::drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3, uint16_t color) {
-        this->awaitResponse();
+        this->awaitResponse(0xFFC9, 0);
 
         char* buf = (char*) malloc_safe(16);
         printMalloc(buf);
@@ -467,6 +868,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[14] = color;
         buf[15] = color >> 8;
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 16);
         this->serial.writeAndFree(buf, 16);
     }
 
@@ -479,7 +881,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The 4DGL color for the line
      */
     void uLCD::drawLine(int x1, int y1, int x2, int y2, uint16_t color) {
-        this->awaitResponse();
+        this->awaitResponse(0xFFD2, 0);
 
         char* buf = (char*) malloc_safe(12);
         printMalloc(buf);
@@ -492,6 +894,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[10] = color;
         buf[11] = color >> 8;
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 12);
         this->serial.writeAndFree(buf, 12);
     }
 
@@ -504,7 +907,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The 4DGL color for the rectangle's outline
      */
     void uLCD::drawRectangle(int x1, int y1, int x2, int y2, uint16_t color) {
-        this->awaitResponse();
+        this->awaitResponse(0xFFCF, 0);
 
         char* buf = (char*) malloc_safe(12);
         printMalloc(buf);
@@ -517,6 +920,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[10] = color;
         buf[11] = color >> 8;
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 12);
         this->serial.writeAndFree(buf, 12);
     }
 
@@ -529,7 +933,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The 4DGL color for the rectangle's fill
      */
     void uLCD::drawRectangleFilled(int x1, int y1, int x2, int y2, uint16_t color) {
-        this->awaitResponse();
+        this->awaitResponse(0xFFCE, 0);
 
         char* buf = (char*) malloc_safe(12);
         printMalloc(buf);
@@ -542,6 +946,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[10] = color;
         buf[11] = color >> 8;
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 12);
         this->serial.writeAndFree(buf, 12);
     }
 
@@ -552,7 +957,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The 4DGL color for the pixel
      */
     void uLCD::setPixel(int x, int y, uint16_t color) {
-        this->awaitResponse();
+        this->awaitResponse(0xFFCB, 0);
 
         char* buf = (char*) malloc_safe(8);
         printMalloc(buf);
@@ -563,6 +968,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[6] = color;
         buf[7] = color >> 8;
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 8);
         this->serial.writeAndFree(buf, 8);
     }
 
@@ -584,7 +990,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
             return;
         }
 
-        this->awaitResponse();
+        this->awaitResponse(0x000A, 0);
 
         char buf[10];
         printMalloc(buf);
@@ -595,10 +1001,190 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         this->addIntToBuf(&buf[6], width);
         this->addIntToBuf(&buf[8], height);
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 10);
         this->serial.write(buf, 10);
         this->serial.sync();
 
-        this->waitToWrite(image, width * height * 2, 2500, freeable);
+        if (this->trace) {
+            this->trace->recordData(width * height * 2);
+        }
+        this->waitToWrite(image, width * height * 2, ULCD_BLIT_DELAY_US, freeable);
+    }
+
+    bool uLCD::BLITStream(int x, int y, int width, int height, RowSource source, int chunkRows) {
+        if (width <= 0 || height <= 0) {
+            return true;
+        }
+
+        if (chunkRows <= 0) {
+            chunkRows = ULCD_STREAM_CHUNK_BYTES / (width * 2);
+        }
+        if (chunkRows < 1) {
+            chunkRows = 1;
+        }
+        if (chunkRows > height) {
+            chunkRows = height;
+        }
+
+        uint16_t* buffers[2];
+        buffers[0] = (uint16_t*) malloc_safe(width * chunkRows * 2);
+        printMalloc(buffers[0]);
+        buffers[1] = (uint16_t*) malloc_safe(width * chunkRows * 2);
+        printMalloc(buffers[1]);
+        if (!buffers[0] || !buffers[1]) {
+            free_safe(buffers[0]);
+            printFree(buffers[0]);
+            free_safe(buffers[1]);
+            printFree(buffers[1]);
+            return false;
+        }
+
+        this->awaitResponse(0x000A, 0);
+
+        char buf[10];
+        buf[0] = 0x0;
+        buf[1] = 0xA;
+        this->addIntToBuf(&buf[2], x);
+        this->addIntToBuf(&buf[4], y);
+        this->addIntToBuf(&buf[6], width);
+        this->addIntToBuf(&buf[8], height);
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, 10);
+        this->serial.write(buf, 10);
+        this->serial.sync();
+
+        //The first chunk is produced while the display gets ready instead of after
+        Timer headerDelay;
+        headerDelay.start();
+        int rows = chunkRows;
+        source(0, rows, buffers[0]);
+        int remaining = ULCD_BLIT_DELAY_US - headerDelay.read_us();
+        if (remaining > 0) {
+            wait_us(remaining);
+        }
+
+        int current = 0;
+        for (int row = 0; height > row;) {
+            //The uart is done with the other buffer once the previous chunk is out
+            this->serial.checkBufferFree();
+            if (this->trace) {
+                this->trace->recordData(width * rows * 2);
+            }
+            this->serial.write(buffers[current], width * rows * 2);
+
+            row += rows;
+            if (row >= height) {
+                break;
+            }
+
+            rows = height - row < chunkRows ? height - row : chunkRows;
+            current ^= 1;
+            source(row, rows, buffers[current]);
+        }
+
+        this->serial.sync();
+        free_safe(buffers[0]);
+        printFree(buffers[0]);
+        free_safe(buffers[1]);
+        printFree(buffers[1]);
+        return true;
+    }
+
+    int uLCD::drawPixels(const Point* points, int count, uint16_t color, uint16_t background) {
+        int total = 0;
+        int bandRows = ULCD_BAND_BYTES / (128 * 2);
+
+        for (int top = 0; 128 > top; top += bandRows) {
+            int bottom = top + bandRows - 1;
+
+            //Bounding box of the band's pixels
+            int inBand = 0;
+            int x1 = 127, y1 = 127, x2 = 0, y2 = 0;
+            for (int i = 0; count > i; i++) {
+                const Point& p = points[i];
+                if (p.y < top || p.y > bottom || p.x > 127) {
+                    continue;
+                }
+                inBand++;
+                x1 = p.x < x1 ? p.x : x1;
+                x2 = p.x > x2 ? p.x : x2;
+                y1 = p.y < y1 ? p.y : y1;
+                y2 = p.y > y2 ? p.y : y2;
+            }
+
+            if (!inBand) {
+                continue;
+            }
+
+            int width = x2 - x1 + 1;
+            int height = y2 - y1 + 1;
+            int pixelCost = this->estimateCost(inBand * 8, inBand);
+            int blitCost = this->estimateBLITCost(width, height);
+
+            if (pixelCost <= blitCost) {
+                for (int i = 0; count > i; i++) {
+                    const Point& p = points[i];
+                    if (p.y >= top && p.y <= bottom && p.x <= 127) {
+                        this->setPixel(p.x, p.y, color);
+                    }
+                }
+                total += pixelCost;
+                continue;
+            }
+
+            uint16_t* image = (uint16_t*) malloc_safe(width * height * 2);
+            printMalloc(image);
+            for (int i = 0; width * height > i; i++) {
+                image[i] = background;
+            }
+            for (int i = 0; count > i; i++) {
+                const Point& p = points[i];
+                if (p.y >= top && p.y <= bottom && p.x <= 127) {
+                    image[(p.y - y1) * width + (p.x - x1)] = color;
+                }
+            }
+            this->BLIT(x1, y1, width, height, image, true);
+            total += blitCost;
+        }
+
+        return total;
+    }
+
+    int uLCD::estimateCost(int wireBytes, int commands) {
+        //Ten bits a byte with one start and one stop bit
+        int64_t wire_us = (int64_t) wireBytes * 10 * 1000000 / this->baudRate;
+        return (int) wire_us + commands * this->commandOverhead;
+    }
+
+    int uLCD::estimateBLITCost(int width, int height) {
+        return this->estimateCost(10 + width * height * 2, 1) + ULCD_BLIT_DELAY_US;
+    }
+
+    int uLCD::calibrate(int samples, uint16_t color) {
+        if (samples < 1) {
+            samples = 1;
+        }
+
+        this->fence();
+
+        Timer timer;
+        timer.start();
+        for (int i = 0; samples > i; i++) {
+            this->setPixel(0, 0, color);
+        }
+        this->fence();
+        int elapsed = timer.read_us();
+
+        //Whatever isn't wire time is overhead: the display's processing and the ACK turnaround
+        int wire_us = (int)((int64_t) samples * 8 * 10 * 1000000 / this->baudRate);
+        int overhead = (elapsed - wire_us) / samples;
+        this->commandOverhead = overhead > 0 ? overhead : 0;
+
+        return this->commandOverhead;
+    }
+
+    int uLCD::getCommandOverhead() {
+        return this->commandOverhead;
     }
 
     /**
@@ -606,7 +1192,11 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param color The color for the outline, zero disables outlines
      */
     void uLCD::setOutlineColor(uint16_t color) {
-        this->awaitResponse();
+        if (this->stateUnchanged(SHADOW_OUTLINE, color)) {
+            return;
+        }
+
+        this->awaitResponse(0xFF67, 2);
 
         char* buf = (char*) malloc_safe(4);
         printMalloc(buf);
@@ -615,6 +1205,7 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         buf[2] = color;
         buf[3] = color >> 8;
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 4);
         this->serial.writeAndFree(buf, 4);
     }
 
@@ -626,37 +1217,27 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
      * @param height The height of the clipping window
      */
     void uLCD::setClippingWindow(int x, int y, int width, int height) {
-        this->awaitResponse();    
-        if (!x && !y && !width && !height) {
-            //disable clipping
-            char buf[4];
+        bool enable = x || y || width || height;
+
+        if (!this->stateUnchanged(SHADOW_CLIPPING, enable)) {
+            this->awaitResponse(0xFF6C, 0);
+
+            char* buf = (char*) malloc_safe(4);
+            printMalloc(buf);
             buf[0] = 0xFF;
             buf[1] = 0x6C;
             buf[2] = 0x0;
-            buf[3] = 0x0;
+            buf[3] = enable;
 
             this->serial.checkBufferFree();
-            this->serial.write(buf, 4);
-
-            this->awaitResponse();
+            this->traceCommand(buf, 4);
+            this->serial.writeAndFree(buf, 4);
+        }
 
+        if (!enable) {
             return;
         }
 
-        char* buf = (char*) malloc_safe(10);
-        printMalloc(buf);
-
-        //enable clipping
-        buf[0] = 0xFF;
-        buf[1] = 0x6C;
-        buf[2] = 0x0;
-        buf[3] = 0x1;
-
-        this->serial.checkBufferFree();
-        this->serial.write(buf, 4);
-
-        this->awaitResponse();
-
         //making sure clipping coordinates are contained to the screen area
         int x1 = x + width - 1;
         int y1 = y + height - 1;
@@ -685,8 +1266,22 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
             y1 = 127;
         }
 
+        if (this->shadowHas(SHADOW_CLIP_X, x) && this->shadowHas(SHADOW_CLIP_Y, y) &&
+            this->shadowHas(SHADOW_CLIP_X1, x1) && this->shadowHas(SHADOW_CLIP_Y1, y1)) {
+            this->elidedCommands++;
+            return;
+        }
+        this->shadowSet(SHADOW_CLIP_X, x);
+        this->shadowSet(SHADOW_CLIP_Y, y);
+        this->shadowSet(SHADOW_CLIP_X1, x1);
+        this->shadowSet(SHADOW_CLIP_Y1, y1);
+
         //set clipping region
 
+        this->awaitResponse(0xFFBF, 0);
+
+        char* buf = (char*) malloc_safe(10);
+        printMalloc(buf);
         buf[0] = 0xFF;
         buf[1] = 0xBF;
         this->addIntToBuf(&buf[2], x);
@@ -694,30 +1289,96 @@ delay.attach(callback(this, &uLCD::writeBack), delay_us / 1000000.0f); // µs to
         this->addIntToBuf(&buf[6], x1);
         this->addIntToBuf(&buf[8], y1);
         this->serial.checkBufferFree();
+        this->traceCommand(buf, 10);
         this->serial.writeAndFree(buf, 10);
-     }
+    }
+
+    //Media Functions
+
+    bool uLCD::mediaInit() {
+        this->awaitResponse(0xFFB1, 2);
+
+        char* buf = (char*) malloc_safe(2);
+        printMalloc(buf);
+        buf[0] = 0xFF;
+        buf[1] = 0xB1;
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, 2);
+        this->serial.writeAndFree(buf, 2);
 
-uint16_t uLCD::get4DGLColor(const char* color) {
-    if (color[0] == '#') {
-        color++; // just ignore the character
+        //The answer is the card status, so it has to be waited for
+        int naks = this->nakCount;
+        this->fence();
+        return this->nakCount == naks && this->responseValue;
     }
 
-    uint32_t normalColor = 0;
-    std::stringstream ss;
-    ss << std::hex << color;
-    ss >> normalColor;
+    void uLCD::mediaSetSector(uint32_t sector) {
+        this->awaitResponse(0xFFB8, 0);
 
-    uint16_t red = (normalColor >> 19) & 0x1F;
-    uint16_t green = (normalColor >> 10) & 0x3F;
-    uint16_t blue = (normalColor >> 3) & 0x1F;
+        char* buf = (char*) malloc_safe(6);
+        printMalloc(buf);
+        buf[0] = 0xFF;
+        buf[1] = 0xB8;
+        this->addIntToBuf(&buf[2], sector >> 16);
+        this->addIntToBuf(&buf[4], sector);
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, 6);
+        this->serial.writeAndFree(buf, 6);
+    }
+
+    void uLCD::mediaSetAddress(uint32_t address) {
+        this->awaitResponse(0xFFB9, 0);
+
+        char* buf = (char*) malloc_safe(6);
+        printMalloc(buf);
+        buf[0] = 0xFF;
+        buf[1] = 0xB9;
+        this->addIntToBuf(&buf[2], address >> 16);
+        this->addIntToBuf(&buf[4], address);
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, 6);
+        this->serial.writeAndFree(buf, 6);
+    }
+
+    void uLCD::mediaImage(int x, int y) {
+        this->awaitResponse(0xFFB3, 0);
+
+        char* buf = (char*) malloc_safe(6);
+        printMalloc(buf);
+        buf[0] = 0xFF;
+        buf[1] = 0xB3;
+        this->addIntToBuf(&buf[2], x);
+        this->addIntToBuf(&buf[4], y);
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, 6);
+        this->serial.writeAndFree(buf, 6);
+    }
 
-    return (red << 3) + (green >> 3) + (green << 13) + (blue << 8);
-}
+    void uLCD::mediaVideo(int x, int y) {
+        this->awaitResponse(0xFFBB, 0);
+
+        char* buf = (char*) malloc_safe(6);
+        printMalloc(buf);
+        buf[0] = 0xFF;
+        buf[1] = 0xBB;
+        this->addIntToBuf(&buf[2], x);
+        this->addIntToBuf(&buf[4], y);
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, 6);
+        this->serial.writeAndFree(buf, 6);
+    }
 
-uint16_t uLCD::get4DGLColor(uint32_t normalColor) {
-    uint16_t red = (normalColor >> 19) & 0x1F;
-    uint16_t green = (normalColor >> 10) & 0x3F;
-    uint16_t blue = (normalColor >> 3) & 0x1F;
+    void uLCD::mediaVideoFrame(int x, int y, int frame) {
+        this->awaitResponse(0xFFBA, 0);
 
-    return (red << 3) + (green >> 3) + (green << 13) + (blue << 8);
-}
\ No newline at end of file
+        char* buf = (char*) malloc_safe(8);
+        printMalloc(buf);
+        buf[0] = 0xFF;
+        buf[1] = 0xBA;
+        this->addIntToBuf(&buf[2], x);
+        this->addIntToBuf(&buf[4], y);
+        this->addIntToBuf(&buf[6], frame);
+        this->serial.checkBufferFree();
+        this->traceCommand(buf, 8);
+        this->serial.writeAndFree(buf, 8);
+    }
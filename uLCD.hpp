@@ -17,17 +17,101 @@
 #include "mbed.h"
 #include <cstdint>
 #include "serialAsync.hpp"
+#include "uLCDTrace.hpp"
 
 //us is the minimum length of the delay
 typedef void (*WaitFunction)(int us);
 
+//Most commands that may be sent before their responses arrive
+#define ULCD_MAX_PIPELINE 8
+#define ULCD_DEFAULT_PIPELINE 4
+#define ULCD_RESPONSE_FLAG 0x1
+
+//The Goldelox buffers this many characters of a string and renders one every ULCD_TEXT_CHAR_US
+#define ULCD_TEXT_CHUNK 16
+#define ULCD_TEXT_CHAR_US 40
+
+//Time the display needs between a BLIT header and its pixels
+#define ULCD_BLIT_DELAY_US 2500
+
+//Largest pixel buffer drawPixels() allocates for one BLIT band
+#define ULCD_BAND_BYTES 2048
+
+//Size of each of the two buffers BLITStream() fills by default
+#define ULCD_STREAM_CHUNK_BYTES 1024
+
+//Size of a text cell of the system font at a font size of 1, and of the screen, in pixels
+#define ULCD_CHAR_WIDTH 7
+#define ULCD_CHAR_HEIGHT 8
+#define ULCD_SCREEN_SIZE 128
+
+//Per command time beyond the wire bytes until calibrate() measures it
+#define ULCD_DEFAULT_OVERHEAD_US 200
+
+//Longest a reset waits for the display to answer, and how long each probe waits for its answer
+#define ULCD_BOOT_TIMEOUT_MS 5000
+#define ULCD_PROBE_TIMEOUT_MS 50
+
+//How long a failed probe waits for stray answers to arrive before they are discarded
+#define ULCD_SETTLE_MS 10
+
+//Probes that must all round-trip before BAUD_AUTO keeps a baud
+#define ULCD_BAUD_PROBES 4
+
 class uLCD {
     private:
 
     SerialAsync serial;
+    char receiveBuffer[32];
     DigitalOut resetSignal;
     WaitFunction waitFunction;
-    bool bypassAwait;
+
+    //Commands sent but not yet answered, oldest first. Matched to responses from the receive callback
+    struct PendingCommand {
+        uint16_t command;
+        uint8_t extraBytes; //Bytes the display sends after the ACK
+    };
+    PendingCommand pending[ULCD_MAX_PIPELINE];
+    volatile int pendingHead;
+    volatile int pendingCount;
+    volatile int responseSkip; //Bytes of the current response still to be skipped
+    volatile uint16_t responseValue; //Data after the ACK of the last response that had any
+    int pipelineDepth;
+    EventFlags responseFlags;
+    volatile int nakCount;
+    volatile uint16_t lastNak;
+    int naksReported;
+    bool probing; //NAKs are expected while the link is tested, so they aren't reported
+
+    //Last value sent for each piece of display state, so commands that change nothing can be dropped
+    enum ShadowField {
+        SHADOW_TEXT_COLOR,
+        SHADOW_TEXT_BACKGROUND,
+        SHADOW_FONT_WIDTH,
+        SHADOW_FONT_HEIGHT,
+        SHADOW_BOLD,
+        SHADOW_ITALIC,
+        SHADOW_INVERTED,
+        SHADOW_UNDERLINE,
+        SHADOW_OUTLINE,
+        SHADOW_CLIPPING,
+        SHADOW_CLIP_X,
+        SHADOW_CLIP_Y,
+        SHADOW_CLIP_X1,
+        SHADOW_CLIP_Y1,
+        SHADOW_FIELDS
+    };
+    int shadow[SHADOW_FIELDS];
+    uint32_t shadowValid; //Bit per field, set once the display is known to hold the shadow value
+    int shadowNaks; //nakCount when the shadow was last checked
+    int elidedCommands;
+    int baudRate;
+    uint16_t displayVersion; //Answer to the probe, compared by every later probe
+    int startupTime_us;
+    bool textPacing; //Whether the serial is currently paced for strings
+    int commandOverhead; //Microseconds each command costs beyond its wire bytes, from calibrate()
+    uLCDTrace* trace;
+    int traceExtraBytes; //Response data of the command being sent, from awaitResponse()
     volatile bool delayedWritePending;
     Timeout delay;
     void* delayBuffer;
@@ -36,7 +120,55 @@ class uLCD {
 
     void addIntToBuf(char* buf, int v);
 
-    void awaitResponse();
+    /** Forgets every command still waiting for its response, e.g. after the display missed them */
+    void discardPending();
+
+    /**
+     * Asks the display for its version and waits for the answer
+     * @return true if a valid answer arrived within ULCD_PROBE_TIMEOUT_MS. Otherwise the probe may
+     *     still be pending, and settle() is needed before the next command
+     */
+    bool probe();
+
+    /** Waits ULCD_SETTLE_MS for answers still on their way, then discards them and anything unanswered */
+    void settle();
+
+    /** Sends the baud command and switches the serial to match, the response arrives at the new baud */
+    void switchBaud(int code);
+
+    /** Returns true if ULCD_BAUD_PROBES probes in a row round-trip at the current baud */
+    bool verifyLink();
+
+    /**
+     * Waits until fewer than the pipeline depth of commands are unanswered, then records
+     * that the command about to be sent expects a response.
+     * @param command The command word, e.g. 0xFFD7 for cls
+     * @param extraBytes The number of bytes the display returns after the ACK
+     */
+    void awaitResponse(uint16_t command, int extraBytes);
+
+    void responseReceived(int events);
+
+    /** Records a command in the trace, if one is attached, just before it is written */
+    void traceCommand(const void* buf, int size);
+
+    void completeCommand();
+
+    void reportNaks();
+
+    bool shadowHas(ShadowField field, int value);
+
+    void shadowSet(ShadowField field, int value);
+
+    /**
+     * Checks the shadow before a state command is sent, recording the new value if it differs.
+     * @return true if the display already holds the value and the command can be dropped
+     */
+    bool stateUnchanged(ShadowField field, int value);
+
+    void textPrinted();
+
+    void setTextPacing(bool enable);
 
     void writeBack();
 
@@ -52,12 +184,17 @@ class uLCD {
         BAUD_300000 = 10,
         BAUD_600000 = 4,
         BAUD_1000000 = 2,
-        BAUD_1500000 = 1
+        BAUD_1500000 = 1,
+        BAUD_AUTO = -1 //The fastest baud that round-trips reliably
     };
 
+    /** Returns the baud rate in bits per second of a baud code, 0 for BAUD_AUTO */
+    static int getBaudValue(uLCDBaud baud);
+
     /*
      * With the baud rate, the library will always use 9600 for initial communication with the uLCD
-     * It sets the new baud rate after starting initial communication.
+     * It sets the new baud rate after starting initial communication. BAUD_AUTO tries every
+     * rate from the fastest down and keeps the first that round-trips reliably.
      */
     uLCD(PinName tx, PinName rx, PinName reset, uLCDBaud baud);
 
@@ -66,8 +203,70 @@ class uLCD {
     /** Clear the screen and fills the screen with the set background color. Defaults to black (0x0)*/
     void cls();
 
-    /** Resets the screen, blocks for 3 seconds */
-    void reset();
+    /**
+     * Resets the screen and probes it at 9600 baud until two probes in a row return the same
+     * version, instead of waiting out the longest boot time. Blocks until then or for at most
+     * ULCD_BOOT_TIMEOUT_MS. Later probes, like those after a baud change, check against that version
+     * @return false if the display didn't answer in time, the link is then left at 9600
+     */
+    bool reset();
+
+    /** Returns the current baud rate in bits per second */
+    int getBaudRate();
+
+    /** Returns the time the constructor took to reset, set the baud and clear the screen, in us */
+    int getStartupTime();
+
+    /**
+     * Sets how many commands may be sent before their responses arrive. The link then stays
+     * busy instead of idling for a round trip after every command. Defaults to ULCD_DEFAULT_PIPELINE.
+     * @param depth The number of unanswered commands allowed, 1 waits for every response
+     */
+    void setPipelineDepth(int depth);
+
+    /**
+     * Waits until the display has answered every command sent so far.
+     * @param timeout_ms The maximum time to wait in milliseconds
+     * @return true if every response arrived, false on timeout
+     */
+    bool fence(uint32_t timeout_ms = osWaitForever);
+
+    /**
+     * Returns the gap needed after every ULCD_TEXT_CHUNK characters of a string so the display
+     * keeps up at the given baud rate. Zero when the wire is slower than the display.
+     * @param baud The baud rate in bits per second
+     * @return The gap in microseconds
+     */
+    static int getTextGap(int baud);
+
+    /** Returns the number of state commands dropped because they would not have changed anything */
+    int getElidedCommands();
+
+    /** Returns the number of commands the display has not acknowledged since construction */
+    int getNakCount();
+
+    /** Returns the command word of the last command the display did not acknowledge, 0 if none */
+    uint16_t getLastNak();
+
+    /**
+     * Records every command sent from now on into a trace, for replaying on the host
+     * with tools/traceReplay. Commands must then be sent from one thread at a time.
+     * @param trace The trace to record into, nullptr to stop recording
+     */
+    void setTrace(uLCDTrace* trace);
+
+    /** Marks the end of a frame in the trace, does nothing without one */
+    void traceFrame();
+
+    /**
+     * Sends a command already encoded, as recorded in a trace. The shadowed display state is
+     * forgotten, since the command may change it.
+     * @param bytes The command, starting with the command word
+     * @param size The number of bytes
+     * @param extraBytes The bytes the display returns after the ACK
+     * @param dataSize The pixel bytes that follow a BLIT header, sent as black after its delay
+     */
+    void sendEncoded(const uint8_t* bytes, int size, int extraBytes, int dataSize = 0);
 
     //Text Functions
 
@@ -226,6 +425,78 @@ class uLCD {
      */
     void BLIT(int x, int y, int width, int height, uint16_t* image, bool freeable);
 
+    /**
+     * Fills pixels with rows of an image for BLITStream()
+     * @param row The index of the first row wanted, from the top of the image
+     * @param count The number of rows wanted
+     * @param pixels Filled with count full rows of 4DGL colors
+     */
+    typedef Callback<void(int row, int count, uint16_t* pixels)> RowSource;
+
+    /**
+     * Draws a bitmap that is pulled a few rows at a time from a source, so the whole image
+     * never has to be in RAM. Two chunk buffers are used in turn: one is filled while the
+     * other is transmitted. The first is filled during the display's BLIT header delay.
+     * IMPORTANT: Blocks until the last chunk has been handed to the uart
+     * @param x The x coordinate of the top left corner
+     * @param y The y coordinate of the top left corner
+     * @param width The width of the bitmap
+     * @param height The height of the bitmap
+     * @param source Called from this thread for each chunk of rows, in order
+     * @param chunkRows The rows per chunk, 0 for as many as fit ULCD_STREAM_CHUNK_BYTES
+     * @return false if the chunk buffers couldn't be allocated, nothing is sent then
+     */
+    bool BLITStream(int x, int y, int width, int height, RowSource source, int chunkRows = 0);
+
+    /**
+     * A pixel coordinate for drawPixels()
+     */
+    struct Point {
+        uint8_t x;
+        uint8_t y;
+    };
+
+    /**
+     * Sets many pixels to one color, choosing the cheapest way to send them. The screen is
+     * split into bands of rows, and each band is sent either as setPixel commands or as one
+     * BLIT of the band's bounding box, whichever estimateCost() predicts to be faster.
+     * IMPORTANT: BLIT bands repaint every other pixel in their box with the background color
+     * @param points The pixels to set
+     * @param count The number of pixels
+     * @param color The 4DGL color for the pixels
+     * @param background The 4DGL color already behind the pixels
+     * @return The estimated time in microseconds to send everything
+     */
+    int drawPixels(const Point* points, int count, uint16_t color, uint16_t background);
+
+    //Cost model
+
+    /**
+     * Estimates how long commands take to send and be acknowledged at the current baud rate
+     * @param wireBytes The total bytes sent
+     * @param commands The number of commands the bytes are split into
+     * @return The estimated time in microseconds
+     */
+    int estimateCost(int wireBytes, int commands);
+
+    /**
+     * Estimates how long a BLIT of the given size takes, including its header delay
+     * @return The estimated time in microseconds
+     */
+    int estimateBLITCost(int width, int height);
+
+    /**
+     * Measures the per command overhead of the estimates by timing setPixel commands
+     * on the top left pixel, which is restored afterwards to the given color.
+     * @param samples The number of commands to time
+     * @param color The 4DGL color of the top left pixel
+     * @return The measured overhead per command in microseconds
+     */
+    int calibrate(int samples = 32, uint16_t color = 0x0);
+
+    /** Returns the per command overhead used by the estimates, in microseconds */
+    int getCommandOverhead();
+
     /**
      * Sets the outline color for applicable shapes.
      * @param color The color for the outline, zero disables outlines
@@ -241,19 +512,128 @@ class uLCD {
      */
      void setClippingWindow(int x, int y, int width, int height);
 
+    //Media functions, for images stored on the display's microSD card
+
+    /**
+     * Initializes the display's microSD card. Blocks until the display answers.
+     * @return true if a card was found
+     */
+    bool mediaInit();
+
+    /**
+     * Sets the card's read position to the start of a sector, for the image and video commands
+     * @param sector The 512 byte sector index
+     */
+    void mediaSetSector(uint32_t sector);
+
+    /**
+     * Sets the card's read position to a byte address
+     * @param address The byte address
+     */
+    void mediaSetAddress(uint32_t address);
+
     /**
-     * Static function for converting hex codes to 4DGL colors
-     * @param color The hex code string to convert
+     * Draws the image at the card's read position, see tools/mediaPack
+     * @param x The x coordinate of the top left corner
+     * @param y The y coordinate of the top left corner
+     */
+    void mediaImage(int x, int y);
+
+    /**
+     * Plays every frame of the video at the card's read position.
+     * IMPORTANT: The display answers once the last frame is shown, so later commands wait for it
+     * @param x The x coordinate of the top left corner
+     * @param y The y coordinate of the top left corner
+     */
+    void mediaVideo(int x, int y);
+
+    /**
+     * Draws one frame of the video at the card's read position
+     * @param x The x coordinate of the top left corner
+     * @param y The y coordinate of the top left corner
+     * @param frame The index of the frame
+     */
+    void mediaVideoFrame(int x, int y, int frame);
+
+    /**
+     * Static function for converting hex codes to 4DGL colors. Evaluated by the compiler
+     * when the code is a literal and the result initializes a constexpr.
+     * @param color The hex code string to convert, optionally starting with # or 0x
      * @returns The 4DGL color
      */
-    static uint16_t get4DGLColor(const char* color);
+    static constexpr uint16_t get4DGLColor(const char* color) {
+        if (color[0] == '#') {
+            color++; // just ignore the character
+        } else if (color[0] == '0' && (color[1] == 'x' || color[1] == 'X')) {
+            color += 2;
+        }
+
+        //Parsing stops at the first character that isn't a hex digit
+        uint32_t normalColor = 0;
+        for (; ; color++) {
+            char c = *color;
+            if (c >= '0' && c <= '9') {
+                normalColor = (normalColor << 4) | (c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                normalColor = (normalColor << 4) | (c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                normalColor = (normalColor << 4) | (c - 'A' + 10);
+            } else {
+                break;
+            }
+        }
+
+        return get4DGLColor(normalColor);
+    }
 
     /**
      * Static function for converting 32 bit integer colors to 4DGL colors
      * @param color The ARGB packed color as a 32-bit integer
      * @returns The 4DGL color
      */
-    static uint16_t get4DGLColor(uint32_t color);
+    static constexpr uint16_t get4DGLColor(uint32_t normalColor) {
+        //RGB565 with its bytes swapped, so the low byte goes out first
+        return (uint16_t)((((normalColor >> 19) & 0x1F) << 3) + (((normalColor >> 10) & 0x3F) >> 3) +
+            (((normalColor >> 10) & 0x3F) << 13) + (((normalColor >> 3) & 0x1F) << 8));
+    }
 };
 
+/**
+ * 4DGL color literal from a packed RGB hex code, e.g. 0xA020F0_4dgl, computed at compile time
+ */
+constexpr uint16_t operator"" _4dgl(unsigned long long color) {
+    return uLCD::get4DGLColor((uint32_t) color);
+}
+
+/**
+ * A fixed set of 4DGL colors built at compile time, so a constexpr palette takes no
+ * startup time and lives in flash.
+ *     constexpr auto palette = makePalette(0xFF0000, 0x00FF00, 0x0000FF);
+ *     lcd.setTextColor(palette[1]);
+ */
+template <int N>
+struct uLCDPalette {
+    uint16_t colors[N];
+
+    /** Returns the 4DGL color at an index */
+    constexpr uint16_t operator[](int index) const {
+        return this->colors[index];
+    }
+
+    /** Returns the number of colors */
+    static constexpr int size() {
+        return N;
+    }
+};
+
+/**
+ * Builds a palette from packed RGB hex codes
+ * @param rgb The colors, in the order they are indexed
+ * @return the palette of 4DGL colors
+ */
+template <typename... Colors>
+constexpr uLCDPalette<sizeof...(Colors)> makePalette(Colors... rgb) {
+    return uLCDPalette<sizeof...(Colors)>{{uLCD::get4DGLColor((uint32_t) rgb)...}};
+}
+
 #endif //ULCD_INCLUDED
\ No newline at end of file
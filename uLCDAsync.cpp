@@ -0,0 +1,490 @@
+/*
+ * uLCD Async Class
+ *
+ * A thread-safe front end for a uLCD that queues commands in a lock-free
+ * queue and sends them from a dedicated display thread.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "uLCDAsync.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+uLCDAsync::uLCDAsync(uLCD& lcd, osPriority priority) : lcd(lcd), thread(priority, ULCD_ASYNC_STACK_SIZE) {
+    this->started = false;
+
+    //Every slot starts free for its first position
+    for (int i = 0; ULCD_ASYNC_QUEUE > i; i++) {
+        this->slots[i].sequence = i;
+    }
+    this->enqueuePosition = 0;
+    this->dequeuePosition = 0;
+    this->spaceWaiters = 0;
+    this->fencesIssued = 0;
+    this->fencesCompleted = 0;
+
+    this->commandsQueued = 0;
+    this->resetCounters();
+
+    this->clock.start();
+}
+
+void uLCDAsync::start() {
+    if (!this->started) {
+        this->started = true;
+        this->thread.start(callback(this, &uLCDAsync::run));
+    }
+}
+
+void uLCDAsync::stop() {
+    if (this->started) {
+        this->enqueue(OP_STOP, 0, nullptr);
+        this->thread.join();
+        this->started = false;
+    }
+}
+
+int64_t uLCDAsync::reserve(int count) {
+    uint32_t position = core_util_atomic_load_u32(&this->enqueuePosition);
+    bool stalled = false;
+
+    while (true) {
+        //The display thread frees slots in order, so if the last slot is free the others are too
+        uint32_t last = position + count - 1;
+        int32_t difference = (int32_t)(core_util_atomic_load_u32(&this->slots[last % ULCD_ASYNC_QUEUE].sequence) - last);
+
+        if (!difference) {
+            //Another producer claiming first fails the swap and reloads the position
+            if (core_util_atomic_cas_u32(&this->enqueuePosition, &position, position + count)) {
+                break;
+            }
+        } else if (difference < 0) {
+            //Full, an ISR can't wait for the display thread
+            if (core_util_is_isr_active()) {
+                core_util_atomic_incr_u32(&this->drops, count);
+                return -1;
+            }
+            if (!stalled) {
+                stalled = true;
+                core_util_atomic_incr_u32(&this->stalls, 1);
+            }
+
+            //The timeout covers a slot freed between the check and the wait
+            core_util_atomic_incr_u32(&this->spaceWaiters, 1);
+            this->flags.wait_any(ULCD_ASYNC_SPACE_FLAG, 1);
+            core_util_atomic_decr_u32(&this->spaceWaiters, 1);
+            position = core_util_atomic_load_u32(&this->enqueuePosition);
+        } else {
+            //Another producer already took this position
+            position = core_util_atomic_load_u32(&this->enqueuePosition);
+        }
+    }
+
+    core_util_atomic_incr_u32(&this->commandsQueued, count);
+    uint32_t depth = position + count - core_util_atomic_load_u32(&this->dequeuePosition);
+    uint32_t peak = core_util_atomic_load_u32(&this->depthHighWater);
+    while (depth > peak && !core_util_atomic_cas_u32(&this->depthHighWater, &peak, depth));
+
+    return position;
+}
+
+void uLCDAsync::publish(uint32_t position, Command& command) {
+    Slot& slot = this->slots[position % ULCD_ASYNC_QUEUE];
+    slot.command = command;
+    core_util_atomic_store_u32(&slot.sequence, position + 1);
+}
+
+void uLCDAsync::enqueue(Opcode opcode, int argc, const int* args) {
+    Command command;
+    command.opcode = opcode;
+    command.length = 0;
+    for (int i = 0; argc > i; i++) {
+        command.args[i] = args[i];
+    }
+
+    int64_t position = this->reserve(1);
+    if (position < 0) {
+        return;
+    }
+    command.queued_us = this->clock.read_us();
+    this->publish(position, command);
+    this->flags.set(ULCD_ASYNC_WORK_FLAG);
+}
+
+void uLCDAsync::enqueueValue(Opcode opcode, uint32_t value) {
+    Command command;
+    command.opcode = opcode;
+    command.length = 0;
+    command.value = value;
+
+    int64_t position = this->reserve(1);
+    if (position < 0) {
+        return;
+    }
+    command.queued_us = this->clock.read_us();
+    this->publish(position, command);
+    this->flags.set(ULCD_ASYNC_WORK_FLAG);
+}
+
+void uLCDAsync::enqueueText(const char* text, int length) {
+    Command command;
+    command.opcode = OP_PRINT;
+
+    do {
+        //As many slots as the text needs, claimed together so the pieces stay in order
+        int slots = (length + ULCD_ASYNC_TEXT - 1) / ULCD_ASYNC_TEXT;
+        if (slots < 1) {
+            slots = 1;
+        }
+        if (slots > ULCD_ASYNC_QUEUE) {
+            slots = ULCD_ASYNC_QUEUE;
+        }
+
+        int64_t position = this->reserve(slots);
+        if (position < 0) {
+            return;
+        }
+        command.queued_us = this->clock.read_us();
+
+        for (int i = 0; slots > i; i++) {
+            int n = length < ULCD_ASYNC_TEXT ? length : ULCD_ASYNC_TEXT;
+            memcpy(command.text, text, n);
+            command.text[n] = 0;
+            command.length = n;
+            this->publish(position + i, command);
+            text += n;
+            length -= n;
+        }
+        this->flags.set(ULCD_ASYNC_WORK_FLAG);
+    } while (length > 0);
+}
+
+bool uLCDAsync::dequeue(Command& command) {
+    uint32_t position = this->dequeuePosition;
+    Slot& slot = this->slots[position % ULCD_ASYNC_QUEUE];
+    if (core_util_atomic_load_u32(&slot.sequence) != position + 1) {
+        return false;
+    }
+
+    command = slot.command;
+    core_util_atomic_store_u32(&slot.sequence, position + ULCD_ASYNC_QUEUE);
+    core_util_atomic_store_u32(&this->dequeuePosition, position + 1);
+
+    if (core_util_atomic_load_u32(&this->spaceWaiters)) {
+        this->flags.set(ULCD_ASYNC_SPACE_FLAG);
+    }
+    return true;
+}
+
+void uLCDAsync::execute(Command& command) {
+    int16_t* a = command.args;
+
+    switch (command.opcode) {
+        case OP_CLS:
+            this->lcd.cls();
+            break;
+        case OP_TEXT_COLOR:
+            this->lcd.setTextColor(a[0]);
+            break;
+        case OP_TEXT_BACKGROUND:
+            this->lcd.setTextBackground(a[0]);
+            break;
+        case OP_FONT_SIZE:
+            this->lcd.setFontSize(a[0], a[1]);
+            break;
+        case OP_TEXT_BOLD:
+            this->lcd.setTextBold(a[0]);
+            break;
+        case OP_TEXT_ITALIC:
+            this->lcd.setTextItalic(a[0]);
+            break;
+        case OP_TEXT_INVERTED:
+            this->lcd.setTextInverted(a[0]);
+            break;
+        case OP_TEXT_UNDERLINE:
+            this->lcd.setTextUnderline(a[0]);
+            break;
+        case OP_PRINT:
+            this->lcd.print(command.text);
+            break;
+        case OP_LOCATE:
+            this->lcd.locate(a[0], a[1]);
+            break;
+        case OP_CIRCLE:
+            this->lcd.drawCircle(a[0], a[1], a[2], a[3]);
+            break;
+        case OP_CIRCLE_FILLED:
+            this->lcd.drawCircleFilled(a[0], a[1], a[2], a[3]);
+            break;
+        case OP_TRIANGLE:
+            this->lcd.drawTriangle(a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+            break;
+        case OP_LINE:
+            this->lcd.drawLine(a[0], a[1], a[2], a[3], a[4]);
+            break;
+        case OP_RECTANGLE:
+            this->lcd.drawRectangle(a[0], a[1], a[2], a[3], a[4]);
+            break;
+        case OP_RECTANGLE_FILLED:
+            this->lcd.drawRectangleFilled(a[0], a[1], a[2], a[3], a[4]);
+            break;
+        case OP_PIXEL:
+            this->lcd.setPixel(a[0], a[1], a[2]);
+            break;
+        case OP_OUTLINE_COLOR:
+            this->lcd.setOutlineColor(a[0]);
+            break;
+        case OP_CLIPPING_WINDOW:
+            this->lcd.setClippingWindow(a[0], a[1], a[2], a[3]);
+            break;
+        case OP_MEDIA_SECTOR:
+            this->lcd.mediaSetSector(command.value);
+            break;
+        case OP_MEDIA_IMAGE:
+            this->lcd.mediaImage(a[0], a[1]);
+            break;
+        case OP_CALL:
+            command.function(this->lcd);
+            break;
+        case OP_FENCE:
+            this->lcd.fence();
+            core_util_atomic_store_u32(&this->fencesCompleted, command.value);
+            this->flags.set(ULCD_ASYNC_FENCE_FLAG);
+            break;
+    }
+}
+
+void uLCDAsync::run() {
+    Command command;
+
+    while (true) {
+        if (!this->dequeue(command)) {
+            //Flags stay set, so a command published since the check still wakes the thread
+            this->flags.wait_any(ULCD_ASYNC_WORK_FLAG);
+            continue;
+        }
+
+        if (command.opcode == OP_STOP) {
+            this->lcd.fence();
+            return;
+        }
+
+        this->execute(command);
+
+        uint32_t latency = this->clock.read_us() - command.queued_us;
+        this->lastLatency_us = latency;
+        if (latency > this->maxLatency_us) {
+            this->maxLatency_us = latency;
+        }
+        this->totalLatency_us += latency;
+        this->commandsSent++;
+    }
+}
+
+bool uLCDAsync::fence(uint32_t timeout_ms) {
+    //One fence in flight at a time, so fences complete in ticket order
+    this->fenceLock.lock();
+
+    uint32_t ticket = this->fencesIssued + 1;
+    this->fencesIssued = ticket;
+    this->enqueueValue(OP_FENCE, ticket);
+
+    Timer timer;
+    timer.start();
+
+    bool done = true;
+    while ((int32_t)(core_util_atomic_load_u32(&this->fencesCompleted) - ticket) < 0) {
+        uint32_t waited = timer.read_us() / 1000;
+        if (timeout_ms != osWaitForever && waited >= timeout_ms) {
+            done = false;
+            break;
+        }
+        this->flags.wait_any(ULCD_ASYNC_FENCE_FLAG, timeout_ms == osWaitForever ? osWaitForever : timeout_ms - waited);
+    }
+
+    this->fenceLock.unlock();
+    return done;
+}
+
+void uLCDAsync::call(DisplayFunction function) {
+    Command command;
+    command.opcode = OP_CALL;
+    command.length = 0;
+    command.function = function;
+
+    int64_t position = this->reserve(1);
+    if (position < 0) {
+        return;
+    }
+    command.queued_us = this->clock.read_us();
+    this->publish(position, command);
+    this->flags.set(ULCD_ASYNC_WORK_FLAG);
+}
+
+void uLCDAsync::cls() {
+    this->enqueue(OP_CLS, 0, nullptr);
+}
+
+void uLCDAsync::setTextColor(uint16_t color) {
+    int args[] = {color};
+    this->enqueue(OP_TEXT_COLOR, 1, args);
+}
+
+void uLCDAsync::setTextBackground(uint16_t color) {
+    int args[] = {color};
+    this->enqueue(OP_TEXT_BACKGROUND, 1, args);
+}
+
+void uLCDAsync::setFontSize(int width, int height) {
+    int args[] = {width, height};
+    this->enqueue(OP_FONT_SIZE, 2, args);
+}
+
+void uLCDAsync::setTextBold(bool bold) {
+    int args[] = {bold};
+    this->enqueue(OP_TEXT_BOLD, 1, args);
+}
+
+void uLCDAsync::setTextItalic(bool italic) {
+    int args[] = {italic};
+    this->enqueue(OP_TEXT_ITALIC, 1, args);
+}
+
+void uLCDAsync::setTextInverted(bool invert) {
+    int args[] = {invert};
+    this->enqueue(OP_TEXT_INVERTED, 1, args);
+}
+
+void uLCDAsync::setTextUnderline(bool underline) {
+    int args[] = {underline};
+    this->enqueue(OP_TEXT_UNDERLINE, 1, args);
+}
+
+void uLCDAsync::print(char c) {
+    this->enqueueText(&c, 1);
+}
+
+void uLCDAsync::print(const char* str) {
+    this->enqueueText(str, strlen(str));
+}
+
+void uLCDAsync::printf(const char* str, ...) {
+    va_list args;
+    va_start(args, str);
+
+    char text[256];
+    int length = std::vsnprintf(text, sizeof(text), str, args);
+    va_end(args);
+
+    if (length < 0) {
+        return;
+    }
+    if (length > (int) sizeof(text) - 1) {
+        length = sizeof(text) - 1;
+    }
+
+    this->enqueueText(text, length);
+}
+
+void uLCDAsync::locate(int x, int y) {
+    int args[] = {x, y};
+    this->enqueue(OP_LOCATE, 2, args);
+}
+
+void uLCDAsync::drawCircle(int x, int y, int radius, uint16_t color) {
+    int args[] = {x, y, radius, color};
+    this->enqueue(OP_CIRCLE, 4, args);
+}
+
+void uLCDAsync::drawCircleFilled(int x, int y, int radius, uint16_t color) {
+    int args[] = {x, y, radius, color};
+    this->enqueue(OP_CIRCLE_FILLED, 4, args);
+}
+
+void uLCDAsync::drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3, uint16_t color) {
+    int args[] = {x1, y1, x2, y2, x3, y3, color};
+    this->enqueue(OP_TRIANGLE, 7, args);
+}
+
+void uLCDAsync::drawLine(int x1, int y1, int x2, int y2, uint16_t color) {
+    int args[] = {x1, y1, x2, y2, color};
+    this->enqueue(OP_LINE, 5, args);
+}
+
+void uLCDAsync::drawRectangle(int x1, int y1, int x2, int y2, uint16_t color) {
+    int args[] = {x1, y1, x2, y2, color};
+    this->enqueue(OP_RECTANGLE, 5, args);
+}
+
+void uLCDAsync::drawRectangleFilled(int x1, int y1, int x2, int y2, uint16_t color) {
+    int args[] = {x1, y1, x2, y2, color};
+    this->enqueue(OP_RECTANGLE_FILLED, 5, args);
+}
+
+void uLCDAsync::setPixel(int x, int y, uint16_t color) {
+    int args[] = {x, y, color};
+    this->enqueue(OP_PIXEL, 3, args);
+}
+
+void uLCDAsync::setOutlineColor(uint16_t color) {
+    int args[] = {color};
+    this->enqueue(OP_OUTLINE_COLOR, 1, args);
+}
+
+void uLCDAsync::setClippingWindow(int x, int y, int width, int height) {
+    int args[] = {x, y, width, height};
+    this->enqueue(OP_CLIPPING_WINDOW, 4, args);
+}
+
+void uLCDAsync::mediaSetSector(uint32_t sector) {
+    this->enqueueValue(OP_MEDIA_SECTOR, sector);
+}
+
+void uLCDAsync::mediaImage(int x, int y) {
+    int args[] = {x, y};
+    this->enqueue(OP_MEDIA_IMAGE, 2, args);
+}
+
+int uLCDAsync::getQueueDepth() {
+    return core_util_atomic_load_u32(&this->enqueuePosition) - core_util_atomic_load_u32(&this->dequeuePosition);
+}
+
+int uLCDAsync::getMaxQueueDepth() {
+    return this->depthHighWater;
+}
+
+int uLCDAsync::getCommandCount() {
+    return this->commandsQueued;
+}
+
+int uLCDAsync::getStallCount() {
+    return this->stalls;
+}
+
+int uLCDAsync::getDropCount() {
+    return this->drops;
+}
+
+int uLCDAsync::getLastLatency() {
+    return this->lastLatency_us;
+}
+
+int uLCDAsync::getMaxLatency() {
+    return this->maxLatency_us;
+}
+
+int uLCDAsync::getAverageLatency() {
+    return this->commandsSent ? (int)(this->totalLatency_us / this->commandsSent) : 0;
+}
+
+void uLCDAsync::resetCounters() {
+    this->depthHighWater = 0;
+    this->stalls = 0;
+    this->drops = 0;
+    this->commandsSent = 0;
+    this->lastLatency_us = 0;
+    this->maxLatency_us = 0;
+    this->totalLatency_us = 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * uLCD Async Class
+ *
+ * A thread-safe front end for a uLCD. Commands from any thread, or an ISR,
+ * are encoded into fixed size records in a lock-free queue and sent by one
+ * display thread, so callers return as soon as the command is queued instead
+ * of waiting for the display's ACK. Only fence() blocks.
+ *
+ * The queue is a ring of slots with a sequence number each. Producers claim
+ * slots by swapping the enqueue position, write them and then publish them
+ * through the sequence number; the display thread is the only consumer.
+ * Commands from one caller are sent in the order they were queued, commands
+ * from different callers may interleave, so anything that must stay together
+ * (a scene update, a BLIT) belongs in call().
+ *
+ * While commands are queued the display thread owns the uLCD, fence() before
+ * using it directly again. A thread terminated between claiming a slot and
+ * publishing it stalls the queue, so stop producers at a fence instead.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_ULCD_ASYNC_INCLUDED
+#define COLLECTION_ULCD_ASYNC_INCLUDED
+
+#include "mbed.h"
+#include "uLCD.hpp"
+
+//Slots in the queue, a power of two
+#define ULCD_ASYNC_QUEUE 16
+
+//Characters of text per slot, longer strings take consecutive slots
+#define ULCD_ASYNC_TEXT 23
+
+#define ULCD_ASYNC_WORK_FLAG 0x1
+#define ULCD_ASYNC_FENCE_FLAG 0x2
+#define ULCD_ASYNC_SPACE_FLAG 0x4
+
+#define ULCD_ASYNC_STACK_SIZE 2048
+
+class uLCDAsync {
+    public:
+
+    typedef Callback<void(uLCD& lcd)> DisplayFunction;
+
+    private:
+
+    enum Opcode {
+        OP_CLS,
+        OP_TEXT_COLOR,
+        OP_TEXT_BACKGROUND,
+        OP_FONT_SIZE,
+        OP_TEXT_BOLD,
+        OP_TEXT_ITALIC,
+        OP_TEXT_INVERTED,
+        OP_TEXT_UNDERLINE,
+        OP_PRINT,
+        OP_LOCATE,
+        OP_CIRCLE,
+        OP_CIRCLE_FILLED,
+        OP_TRIANGLE,
+        OP_LINE,
+        OP_RECTANGLE,
+        OP_RECTANGLE_FILLED,
+        OP_PIXEL,
+        OP_OUTLINE_COLOR,
+        OP_CLIPPING_WINDOW,
+        OP_MEDIA_SECTOR,
+        OP_MEDIA_IMAGE,
+        OP_CALL,
+        OP_FENCE,
+        OP_STOP
+    };
+
+    struct Command {
+        uint8_t opcode;
+        uint8_t length; //Characters in text
+        uint32_t queued_us;
+        union {
+            int16_t args[8];
+            uint32_t value; //Sector or fence ticket
+            char text[ULCD_ASYNC_TEXT + 1];
+        };
+        DisplayFunction function;
+    };
+
+    struct Slot {
+        volatile uint32_t sequence; //Position + 1 once written, position + ULCD_ASYNC_QUEUE once free again
+        Command command;
+    };
+
+    uLCD& lcd;
+    Thread thread;
+    EventFlags flags;
+    Timer clock;
+    Mutex fenceLock;
+    bool started;
+
+    Slot slots[ULCD_ASYNC_QUEUE];
+    volatile uint32_t enqueuePosition;
+    volatile uint32_t dequeuePosition; //Only the display thread changes it
+    volatile uint32_t spaceWaiters;
+    volatile uint32_t fencesIssued;
+    volatile uint32_t fencesCompleted;
+
+    //Counters
+    volatile uint32_t depthHighWater;
+    volatile uint32_t commandsQueued;
+    volatile uint32_t stalls;
+    volatile uint32_t drops;
+    uint32_t commandsSent;
+    uint32_t lastLatency_us;
+    uint32_t maxLatency_us;
+    uint64_t totalLatency_us;
+
+    /**
+     * Claims consecutive slots, waiting for the display thread to free them if the queue is full
+     * @param count The number of slots, up to ULCD_ASYNC_QUEUE
+     * @return the position of the first slot, or -1 from an ISR when the queue is full
+     */
+    int64_t reserve(int count);
+
+    /**
+     * Writes one command into a claimed slot and hands it to the display thread
+     */
+    void publish(uint32_t position, Command& command);
+
+    /** Queues a command with up to 8 arguments */
+    void enqueue(Opcode opcode, int argc, const int* args);
+
+    /** Queues a command with one 32 bit argument */
+    void enqueueValue(Opcode opcode, uint32_t value);
+
+    /** Queues a string, split across as many slots as it takes */
+    void enqueueText(const char* text, int length);
+
+    /**
+     * Takes the oldest published command
+     * @return false if there is none yet
+     */
+    bool dequeue(Command& command);
+
+    void execute(Command& command);
+
+    void run();
+
+    public:
+
+    /**
+     * @param lcd The display, used only by the display thread once start() is called
+     * @param priority Priority of the display thread, above the producers so the queue stays short
+     */
+    uLCDAsync(uLCD& lcd, osPriority priority = osPriorityAboveNormal);
+
+    /**
+     * Starts the display thread. Commands queued before are kept, but a full queue
+     * before the thread starts blocks the caller until it does.
+     */
+    void start();
+
+    /**
+     * Sends everything queued, then ends the display thread
+     */
+    void stop();
+
+    /**
+     * Waits until every command queued before the call has been sent and answered by the
+     * display. Not for use from an ISR.
+     * @param timeout_ms Longest time to wait
+     * @return false if the timeout passed first
+     */
+    bool fence(uint32_t timeout_ms = osWaitForever);
+
+    /**
+     * Runs a function on the display thread, in order with the other commands. Nothing
+     * else is sent while it runs, so it suits sequences that must not interleave.
+     * @param function Called with the display
+     */
+    void call(DisplayFunction function);
+
+    void cls();
+
+    void setTextColor(uint16_t color);
+
+    void setTextBackground(uint16_t color);
+
+    void setFontSize(int width, int height);
+
+    void setTextBold(bool bold);
+
+    void setTextItalic(bool italic);
+
+    void setTextInverted(bool invert);
+
+    void setTextUnderline(bool underline);
+
+    void print(char c);
+
+    void print(const char* str);
+
+    /**
+     * Formats on the calling thread, up to 255 characters. The slots of one call are
+     * consecutive, so other callers can't split the text.
+     */
+    void printf(const char* str, ...);
+
+    void locate(int x, int y);
+
+    void drawCircle(int x, int y, int radius, uint16_t color);
+
+    void drawCircleFilled(int x, int y, int radius, uint16_t color);
+
+    void drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3, uint16_t color);
+
+    void drawLine(int x1, int y1, int x2, int y2, uint16_t color);
+
+    void drawRectangle(int x1, int y1, int x2, int y2, uint16_t color);
+
+    void drawRectangleFilled(int x1, int y1, int x2, int y2, uint16_t color);
+
+    void setPixel(int x, int y, uint16_t color);
+
+    void setOutlineColor(uint16_t color);
+
+    void setClippingWindow(int x, int y, int width, int height);
+
+    void mediaSetSector(uint32_t sector);
+
+    void mediaImage(int x, int y);
+
+    /** Returns the number of commands queued and not yet taken by the display thread */
+    int getQueueDepth();
+
+    /** Returns the most commands that have been queued at once */
+    int getMaxQueueDepth();
+
+    /** Returns the number of commands queued, text counts once per slot */
+    int getCommandCount();
+
+    /** Returns the number of times a caller had to wait for room in the queue */
+    int getStallCount();
+
+    /** Returns the number of commands dropped because an ISR found the queue full */
+    int getDropCount();
+
+    /** Returns the time from queueing to sent of the last command, in us */
+    int getLastLatency();
+
+    /** Returns the longest time from queueing to sent, in us */
+    int getMaxLatency();
+
+    /** Returns the average time from queueing to sent, in us */
+    int getAverageLatency();
+
+    /** Clears the high water mark, the stall and drop counts and the latencies */
+    void resetCounters();
+};
+
+#endif // COLLECTION_ULCD_ASYNC_INCLUDED
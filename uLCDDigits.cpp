@@ -0,0 +1,359 @@
+/*
+ * uLCD Digits Class
+ *
+ * A seven-segment display that only redraws the segments that changed.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "uLCDDigits.hpp"
+#include <cstdarg>
+#include <cstdio>
+
+//Segments a to g of 0-9
+static const uint8_t digitSegments[10] = {0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F};
+
+//The segments that light each block of a digit cell, row by row
+static const uint8_t blockSegments[15] = {
+    0x21, 0x01, 0x03,
+    0x20, 0x00, 0x02,
+    0x70, 0x40, 0x46,
+    0x10, 0x00, 0x04,
+    0x18, 0x08, 0x0C
+};
+
+#define ULCD_DIGITS_ALL_BLOCKS 0x7FFF
+
+//Wire bytes of the commands the two ways of drawing are costed with
+#define ULCD_DIGITS_RECTANGLE_BYTES 12
+#define ULCD_DIGITS_LOCATE_BYTES 6
+#define ULCD_DIGITS_CHARACTER_BYTES 4
+#define ULCD_DIGITS_STYLE_BYTES 4 //Each of the font width, font height, text color and text background
+
+uLCDDigits::uLCDDigits(uLCD& lcd, int x, int y, const char* pattern, int digitWidth, int digitHeight, int thickness,
+    uint16_t color, uint16_t background, bool glyphs) : lcd(lcd) {
+    this->x = x;
+    this->y = y;
+    this->digitWidth = digitWidth;
+    this->digitHeight = digitHeight;
+    this->thickness = thickness;
+    this->color = color;
+    this->background = background;
+    this->cellCount = 0;
+    this->invalid = false;
+    this->restyled = false;
+    this->textStyled = false;
+    this->rectanglesSent = 0;
+
+    //A character cell is 7 by 8 font pixels, so a cell and its gap must be a whole character
+    int pitch = digitWidth + thickness;
+    this->glyphs = glyphs && pitch % 7 == 0 && digitHeight % 8 == 0 && x % pitch == 0 && y % digitHeight == 0;
+    this->fontWidth = pitch / 7;
+    this->fontHeight = digitHeight / 8;
+
+    //Cells are separated by one segment thickness
+    int position = 0;
+    for (; pattern[this->cellCount] && ULCD_DIGITS_MAX_CELLS > this->cellCount; this->cellCount++) {
+        Cell& cell = this->cells[this->cellCount];
+        cell.x = position;
+        cell.colon = pattern[this->cellCount] == ':';
+        cell.width = cell.colon && !this->glyphs ? thickness * 3 : digitWidth;
+        cell.segments = cell.colon ? ULCD_SEGMENT_COLON : 0;
+        cell.character = cell.colon ? ':' : ' ';
+        cell.drawnBlocks = 0;
+        cell.glyph = false;
+        position += cell.width + thickness;
+    }
+    this->width = position > 0 ? position - thickness : 0;
+}
+
+uint8_t uLCDDigits::getSegments(char c) {
+    if (c >= '0' && c <= '9') {
+        return digitSegments[c - '0'];
+    }
+    if (c == '-') {
+        return 0x40;
+    }
+    return 0;
+}
+
+void uLCDDigits::setText(const char* text) {
+    for (int i = 0; this->cellCount > i; i++) {
+        Cell& cell = this->cells[i];
+        if (cell.colon) {
+            continue;
+        }
+
+        while (*text == ':') {
+            text++;
+        }
+        cell.segments = getSegments(*text);
+        cell.character = cell.segments ? *text : ' ';
+        if (*text) {
+            text++;
+        }
+    }
+}
+
+void uLCDDigits::setTextf(const char* format, ...) {
+    char text[ULCD_DIGITS_MAX_CELLS * 2 + 1];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    this->setText(text);
+}
+
+void uLCDDigits::setColor(uint16_t color, uint16_t background) {
+    if (background != this->background) {
+        this->invalid = true;
+    } else if (color != this->color) {
+        this->restyled = true;
+    }
+    this->textStyled = false;
+    this->color = color;
+    this->background = background;
+}
+
+uint16_t uLCDDigits::getBlocks(uint8_t segments, bool colon) {
+    if (colon) {
+        return segments ? 1 : 0;
+    }
+
+    uint16_t blocks = 0;
+    for (int i = 0; 15 > i; i++) {
+        if (segments & blockSegments[i]) {
+            blocks |= 1 << i;
+        }
+    }
+    return blocks;
+}
+
+int uLCDDigits::coverBlocks(const Cell& cell, uint16_t blocks, uint16_t allowed, uint16_t color, bool draw) {
+    int t = this->thickness;
+    int mid = (this->digitHeight - t) / 2; //Top of g
+
+    //Block edges, block n spans from edge n to one pixel before edge n + 1
+    const int columns[4] = {0, t, this->digitWidth - t, this->digitWidth};
+    const int rows[6] = {0, t, mid, mid + t, this->digitHeight - t, this->digitHeight};
+
+    int rectangles = 0;
+    while (blocks) {
+        int best[4] = {0, 0, 0, 0};
+        uint16_t bestMask = 0;
+        int bestCount = 0;
+
+        //Every rectangle of whole blocks, 90 of them
+        for (int r1 = 0; 5 > r1; r1++) {
+            for (int r2 = r1; 5 > r2; r2++) {
+                uint16_t rowMask = ((1 << ((r2 - r1 + 1) * 3)) - 1) << (r1 * 3);
+                for (int c1 = 0; 3 > c1; c1++) {
+                    for (int c2 = c1; 3 > c2; c2++) {
+                        uint16_t mask = rowMask & ((((1 << (c2 - c1 + 1)) - 1) << c1) * 0x1249);
+                        if (mask & ~allowed) {
+                            continue;
+                        }
+                        int count = __builtin_popcount(mask & blocks);
+                        if (count > bestCount) {
+                            bestCount = count;
+                            bestMask = mask;
+                            best[0] = c1;
+                            best[1] = r1;
+                            best[2] = c2;
+                            best[3] = r2;
+                        }
+                    }
+                }
+            }
+        }
+
+        //Only possible if blocks wasn't a subset of allowed
+        if (!bestCount) {
+            break;
+        }
+
+        if (draw) {
+            int left = this->x + cell.x;
+            this->lcd.drawRectangleFilled(left + columns[best[0]], this->y + rows[best[1]],
+                left + columns[best[2] + 1] - 1, this->y + rows[best[3] + 1] - 1, color);
+            this->rectanglesSent++;
+        }
+        rectangles++;
+        blocks &= ~bestMask;
+    }
+    return rectangles;
+}
+
+void uLCDDigits::drawColon(const Cell& cell, uint16_t color) {
+    //Two dots, a third and two thirds of the way down
+    int t = this->thickness;
+    int left = this->x + cell.x + (cell.width - t) / 2;
+    for (int i = 1; 2 >= i; i++) {
+        int top = this->y + i * this->digitHeight / 3 - t / 2;
+        this->lcd.drawRectangleFilled(left, top, left + t - 1, top + t - 1, color);
+        this->rectanglesSent++;
+    }
+}
+
+int uLCDDigits::drawSegments(bool draw) {
+    int rectangles = 0;
+
+    if (this->invalid) {
+        //One rectangle clears everything, then only lit blocks are left to draw. Printed cells
+        //also cover the gap after the last cell.
+        if (draw) {
+            int right = this->x + this->width + (this->glyphs ? this->thickness : 0) - 1;
+            this->lcd.drawRectangleFilled(this->x, this->y, right, this->y + this->digitHeight - 1, this->background);
+            this->rectanglesSent++;
+        }
+        rectangles++;
+    }
+
+    for (int i = 0; this->cellCount > i; i++) {
+        Cell& cell = this->cells[i];
+        uint16_t blocks = getBlocks(cell.segments, cell.colon);
+        uint16_t drawn = this->invalid ? 0 : cell.drawnBlocks;
+
+        if (drawn && cell.glyph) {
+            //A character covers its whole cell and gap, so it is cleared before drawing blocks
+            if (draw) {
+                int left = this->x + cell.x;
+                this->lcd.drawRectangleFilled(left, this->y, left + cell.width + this->thickness - 1,
+                    this->y + this->digitHeight - 1, this->background);
+                this->rectanglesSent++;
+            }
+            rectangles++;
+            drawn = 0;
+        }
+        uint16_t changed = blocks ^ drawn;
+
+        if (cell.colon) {
+            if (changed || (this->restyled && blocks)) {
+                if (draw) {
+                    this->drawColon(cell, blocks ? this->color : this->background);
+                }
+                rectangles += 2;
+            }
+        } else if (changed || this->restyled) {
+            uint16_t lit = this->restyled ? blocks : changed & blocks;
+            uint16_t unlit = ULCD_DIGITS_ALL_BLOCKS & ~blocks;
+
+            //Just the changes, starting from a cleared cell, or starting from a lit cell
+            int changes = this->coverBlocks(cell, changed & ~blocks, unlit, this->background, false) +
+                this->coverBlocks(cell, lit, blocks, this->color, false);
+            int fromClear = 1 + this->coverBlocks(cell, blocks, blocks, this->color, false);
+            int fromLit = 1 + this->coverBlocks(cell, unlit, unlit, this->background, false);
+
+            if (!draw) {
+                rectangles += changes < fromClear ? (changes < fromLit ? changes : fromLit) :
+                    (fromClear < fromLit ? fromClear : fromLit);
+            } else if (changes <= fromClear && changes <= fromLit) {
+                rectangles += this->coverBlocks(cell, changed & ~blocks, unlit, this->background, true);
+                rectangles += this->coverBlocks(cell, lit, blocks, this->color, true);
+            } else if (fromClear <= fromLit) {
+                rectangles += this->coverBlocks(cell, ULCD_DIGITS_ALL_BLOCKS, ULCD_DIGITS_ALL_BLOCKS, this->background, true);
+                rectangles += this->coverBlocks(cell, blocks, blocks, this->color, true);
+            } else {
+                rectangles += this->coverBlocks(cell, ULCD_DIGITS_ALL_BLOCKS, ULCD_DIGITS_ALL_BLOCKS, this->color, true);
+                rectangles += this->coverBlocks(cell, unlit, unlit, this->background, true);
+            }
+        }
+
+        if (draw) {
+            cell.drawnBlocks = blocks;
+            cell.glyph = false;
+        }
+    }
+    return rectangles;
+}
+
+int uLCDDigits::printGlyphs(bool draw) {
+    int bytes = 0;
+    int commands = 0;
+
+    //The display remembers the style, so it is only counted when something else may have changed it
+    if (!this->textStyled) {
+        bytes += 4 * ULCD_DIGITS_STYLE_BYTES;
+        commands += 4;
+    }
+    if (draw) {
+        this->lcd.setFontSize(this->fontWidth, this->fontHeight);
+        this->lcd.setTextColor(this->color);
+        this->lcd.setTextBackground(this->background);
+        this->textStyled = true;
+    }
+
+    //Characters are printed opaque over their whole cell, so nothing needs clearing first
+    int column = this->x / (7 * this->fontWidth);
+    int row = this->y / (8 * this->fontHeight);
+    bool located = false; //The cursor is already on this cell
+    for (int i = 0; this->cellCount > i; i++) {
+        Cell& cell = this->cells[i];
+        uint16_t blocks = getBlocks(cell.segments, cell.colon);
+        uint16_t drawn = this->invalid ? 0 : cell.drawnBlocks;
+
+        bool reprint = this->invalid || blocks != drawn || (this->restyled && blocks) || (drawn && !cell.glyph);
+        if (!reprint) {
+            located = false;
+            continue;
+        }
+
+        if (!located) {
+            if (draw) {
+                this->lcd.locate(column + i, row);
+            }
+            bytes += ULCD_DIGITS_LOCATE_BYTES;
+            commands++;
+        }
+        if (draw) {
+            this->lcd.print(cell.character);
+            cell.drawnBlocks = blocks;
+            cell.glyph = true;
+        }
+        bytes += ULCD_DIGITS_CHARACTER_BYTES;
+        commands++;
+        located = true;
+    }
+    return this->lcd.estimateCost(bytes, commands);
+}
+
+int uLCDDigits::update() {
+    int sent = this->rectanglesSent;
+
+    //Both ways redraw cells left the other way, so the widget never shows a mix of the two
+    bool print = false;
+    if (this->glyphs) {
+        int rectangles = this->drawSegments(false);
+        int cost = this->lcd.estimateCost(rectangles * ULCD_DIGITS_RECTANGLE_BYTES, rectangles);
+        print = this->printGlyphs(false) < cost;
+    }
+
+    if (print) {
+        this->printGlyphs(true);
+    } else {
+        this->drawSegments(true);
+    }
+
+    this->invalid = false;
+    this->restyled = false;
+    return this->rectanglesSent - sent;
+}
+
+void uLCDDigits::invalidate() {
+    this->invalid = true;
+    this->textStyled = false;
+}
+
+int uLCDDigits::getWidth() {
+    return this->width;
+}
+
+int uLCDDigits::getRectanglesSent() {
+    return this->rectanglesSent;
+}
+
+bool uLCDDigits::hasGlyphs() {
+    return this->glyphs;
+}
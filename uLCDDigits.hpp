@@ -0,0 +1,155 @@
+/*
+ * uLCD Digits Class
+ *
+ * A seven-segment display drawn with filled rectangles. The widget remembers
+ * what is lit on the panel, so update() only redraws the cells that changed,
+ * and within a cell covers the changed parts with as few rectangles as it
+ * can: 8 to 7 is a single rectangle over d, e, f and g.
+ *
+ * Cells are laid out once from a pattern, where ':' is a narrow colon cell
+ * and any other character a digit cell. Digit cells show 0-9, '-' and ' '.
+ *
+ * A widget laid out on the text grid can also print its cells as font
+ * characters. update() then costs both with the display's cost model and
+ * sends the cheaper one. A clock tick is usually cheaper printed, as a
+ * locate and a character are fewer bytes than the rectangles of a digit.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_ULCD_DIGITS_INCLUDED
+#define COLLECTION_ULCD_DIGITS_INCLUDED
+
+#include "mbed.h"
+#include "uLCD.hpp"
+
+#define ULCD_DIGITS_MAX_CELLS 12
+
+//Segment bits, a at the top clockwise to f, g in the middle, then the colon dots
+#define ULCD_SEGMENT_COLON 0x80
+
+class uLCDDigits {
+    private:
+
+    //A digit cell is a grid of 3 columns by 5 rows of blocks: the outer columns and the top,
+    //middle and bottom rows are segments, the corners are lit along with any segment they join
+    struct Cell {
+        int x;
+        int width;
+        bool colon;
+        uint8_t segments; //Lit in the current text
+        char character; //The current text as a font character
+        uint16_t drawnBlocks; //Lit on the panel, a bit per block row by row
+        bool glyph; //Printed as a font character rather than drawn as blocks
+    };
+
+    uLCD& lcd;
+    int x;
+    int y;
+    int digitWidth;
+    int digitHeight;
+    int thickness;
+    uint16_t color;
+    uint16_t background;
+    Cell cells[ULCD_DIGITS_MAX_CELLS];
+    int cellCount;
+    int width;
+    bool invalid; //What is on the panel is unknown, set by invalidate() and background changes
+    bool restyled; //The lit color changed, so every lit segment is redrawn
+    bool glyphs; //Cells sit on the text grid and can be printed
+    int fontWidth;
+    int fontHeight;
+    bool textStyled; //The font size and colors are likely still set from the last print
+    int rectanglesSent;
+
+    /** Returns the blocks lit by a set of segments, or bit 0 for a lit colon */
+    static uint16_t getBlocks(uint8_t segments, bool colon);
+
+    /**
+     * Covers blocks with rectangles of one color, picking the rectangle that covers the most
+     * blocks still to draw each time
+     * @param blocks The blocks that must change to the color
+     * @param allowed The blocks that may be drawn in the color, those already in it included
+     * @param draw False to only count the rectangles
+     * @return the number of rectangles
+     */
+    int coverBlocks(const Cell& cell, uint16_t blocks, uint16_t allowed, uint16_t color, bool draw);
+
+    void drawColon(const Cell& cell, uint16_t color);
+
+    /**
+     * Draws the changes as rectangles, clearing cells that were printed as characters first
+     * @param draw False to only count the rectangles
+     * @return the number of rectangles
+     */
+    int drawSegments(bool draw);
+
+    /**
+     * Prints the changed cells as font characters, along with cells that were drawn as blocks
+     * @param draw False to only estimate the cost
+     * @return the estimated time in microseconds
+     */
+    int printGlyphs(bool draw);
+
+    public:
+
+    /** Returns the segments lit for a character, 0 for characters a digit can't show */
+    static uint8_t getSegments(char c);
+
+    /**
+     * Lays out a row of cells. The panel is assumed to be filled with the background color,
+     * call invalidate() if it isn't.
+     * @param lcd The display to draw on
+     * @param x Left edge in pixels
+     * @param y Top edge in pixels
+     * @param pattern One character per cell, ':' for a colon cell, e.g. "88:88:88"
+     * @param digitWidth Width of a digit cell in pixels, colon cells are three segments thick
+     * @param digitHeight Height of every cell in pixels
+     * @param thickness Thickness of a segment in pixels, also the gap between cells
+     * @param color The 4DGL color of lit segments
+     * @param background The 4DGL color of unlit segments
+     * @param glyphs True to let update() print cells as font characters when that is cheaper.
+     *        Every cell, colons included, is then digitWidth wide. Only used when the cells
+     *        fall on the text grid: digitWidth + thickness a multiple of 7 that divides x, and
+     *        digitHeight a multiple of 8 that divides y
+     */
+    uLCDDigits(uLCD& lcd, int x, int y, const char* pattern, int digitWidth, int digitHeight, int thickness,
+        uint16_t color, uint16_t background = 0x0, bool glyphs = false);
+
+    /**
+     * Sets the characters of the digit cells, in order, skipping the colon cells. A ':' in the
+     * text is skipped too, so the pattern itself can be passed.
+     * @param text The null-terminated string, missing cells are blank
+     */
+    void setText(const char* text);
+
+    /**
+     * Sets the text from a format string, e.g. "%02d:%02d:%02d"
+     * @param format A string with the appropriate formatting codes
+     */
+    void setTextf(const char* format, ...);
+
+    /** Changes the segment colors. Lit segments are redrawn on the next update, a new background clears the widget */
+    void setColor(uint16_t color, uint16_t background);
+
+    /**
+     * Draws the segments that changed since the last update, or prints the changed cells if
+     * glyphs are allowed and estimateCost() predicts that to be faster
+     * @return the number of rectangles sent, 0 when the changes were printed
+     */
+    int update();
+
+    /** Forgets what is on the panel, so the next update clears the widget and redraws every segment */
+    void invalidate();
+
+    /** Returns the width of the widget in pixels */
+    int getWidth();
+
+    /** Returns the number of rectangles sent by updates, for measuring the savings */
+    int getRectanglesSent();
+
+    /** Returns true if the cells can be printed as font characters */
+    bool hasGlyphs();
+};
+
+#endif // COLLECTION_ULCD_DIGITS_INCLUDED
@@ -0,0 +1,311 @@
+/*
+ * uLCD Scene Class
+ *
+ * A retained-mode layer over uLCD that only redraws what changed.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "uLCDScene.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+uLCDScene::uLCDScene(uLCD& lcd, uint16_t background) : lcd(lcd) {
+    this->background = background;
+    this->nodeCount = 0;
+    this->dirtyCount = 0;
+    this->fullRedraw = false;
+    this->primitivesSent = 0;
+}
+
+int uLCDScene::addNode(NodeType type) {
+    if (this->nodeCount >= ULCD_SCENE_MAX_NODES) {
+        return -1;
+    }
+
+    Node& node = this->nodes[this->nodeCount];
+    memset(&node, 0, sizeof(Node));
+    node.type = type;
+    node.visible = true;
+    node.restyled = true;
+    node.drawn = false;
+
+    return this->nodeCount++;
+}
+
+int uLCDScene::addRectangle(int x1, int y1, int x2, int y2, uint16_t color) {
+    int id = this->addNode(NODE_RECTANGLE);
+    if (id >= 0) {
+        this->setRectangle(id, x1, y1, x2, y2, color);
+    }
+    return id;
+}
+
+int uLCDScene::addCircle(int x, int y, int radius, uint16_t color) {
+    int id = this->addNode(NODE_CIRCLE);
+    if (id >= 0) {
+        this->setCircle(id, x, y, radius, color);
+    }
+    return id;
+}
+
+int uLCDScene::addText(int column, int row, int fontWidth, int fontHeight, uint16_t color, uint16_t background) {
+    int id = this->addNode(NODE_TEXT);
+    if (id < 0) {
+        return id;
+    }
+
+    Node& node = this->nodes[id];
+    node.column = column;
+    node.row = row;
+    node.fontWidth = fontWidth < 1 ? 1 : fontWidth;
+    node.fontHeight = fontHeight < 1 ? 1 : fontHeight;
+    node.color = color;
+    node.background = background;
+    this->updateTextBounds(node);
+
+    return id;
+}
+
+void uLCDScene::setRectangle(int id, int x1, int y1, int x2, int y2, uint16_t color) {
+    Node& node = this->nodes[id];
+
+    //Vertices may be given in any order
+    Region bounds;
+    bounds.x1 = x1 < x2 ? x1 : x2;
+    bounds.x2 = x1 < x2 ? x2 : x1;
+    bounds.y1 = y1 < y2 ? y1 : y2;
+    bounds.y2 = y1 < y2 ? y2 : y1;
+
+    if (memcmp(&bounds, &node.bounds, sizeof(Region)) || color != node.color) {
+        node.bounds = bounds;
+        node.color = color;
+        node.restyled = true;
+    }
+}
+
+void uLCDScene::setCircle(int id, int x, int y, int radius, uint16_t color) {
+    this->setRectangle(id, x - radius, y - radius, x + radius, y + radius, color);
+}
+
+void uLCDScene::setText(int id, const char* text) {
+    Node& node = this->nodes[id];
+    strncpy(node.text, text, ULCD_SCENE_MAX_TEXT);
+    node.text[ULCD_SCENE_MAX_TEXT] = '\0';
+    this->updateTextBounds(node);
+}
+
+void uLCDScene::setTextf(int id, const char* format, ...) {
+    Node& node = this->nodes[id];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(node.text, sizeof(node.text), format, args);
+    va_end(args);
+
+    this->updateTextBounds(node);
+}
+
+void uLCDScene::setTextColor(int id, uint16_t color, uint16_t background) {
+    Node& node = this->nodes[id];
+    if (color != node.color || background != node.background) {
+        node.color = color;
+        node.background = background;
+        node.restyled = true;
+    }
+}
+
+void uLCDScene::setVisible(int id, bool visible) {
+    Node& node = this->nodes[id];
+    if (visible != node.visible) {
+        node.visible = visible;
+        node.restyled = true;
+    }
+}
+
+void uLCDScene::updateTextBounds(Node& node) {
+    int length = strlen(node.text);
+    node.bounds = this->cellRegion(node, 0, length - 1); //Empty when there is no text
+}
+
+uLCDScene::Region uLCDScene::cellRegion(const Node& node, int first, int last) {
+    int width = ULCD_CHAR_WIDTH * node.fontWidth;
+    int height = ULCD_CHAR_HEIGHT * node.fontHeight;
+
+    Region region;
+    region.x1 = (node.column + first) * width;
+    region.x2 = (node.column + last + 1) * width - 1;
+    region.y1 = node.row * height;
+    region.y2 = region.y1 + height - 1;
+    return region;
+}
+
+bool uLCDScene::intersects(const Region& a, const Region& b) {
+    return a.x1 <= a.x2 && a.y1 <= a.y2 && b.x1 <= b.x2 && b.y1 <= b.y2 &&
+        a.x1 <= b.x2 && b.x1 <= a.x2 && a.y1 <= b.y2 && b.y1 <= a.y2;
+}
+
+void uLCDScene::addDirty(Region region) {
+    //Only the panel can be dirty
+    region.x1 = region.x1 < 0 ? 0 : region.x1;
+    region.y1 = region.y1 < 0 ? 0 : region.y1;
+    region.x2 = region.x2 > 127 ? 127 : region.x2;
+    region.y2 = region.y2 > 127 ? 127 : region.y2;
+    if (region.x1 > region.x2 || region.y1 > region.y2) {
+        return;
+    }
+
+    //Overlapping regions are merged so nothing is drawn twice
+    for (int i = 0; this->dirtyCount > i; i++) {
+        if (intersects(region, this->dirty[i]) || this->dirtyCount == ULCD_SCENE_MAX_DIRTY) {
+            Region& other = this->dirty[i];
+            region.x1 = other.x1 < region.x1 ? other.x1 : region.x1;
+            region.y1 = other.y1 < region.y1 ? other.y1 : region.y1;
+            region.x2 = other.x2 > region.x2 ? other.x2 : region.x2;
+            region.y2 = other.y2 > region.y2 ? other.y2 : region.y2;
+
+            this->dirty[i] = this->dirty[--this->dirtyCount];
+            i = -1; //The grown region may now overlap ones already passed
+        }
+    }
+
+    this->dirty[this->dirtyCount++] = region;
+}
+
+void uLCDScene::drawNode(Node& node, const Region& region) {
+    switch (node.type) {
+    case NODE_RECTANGLE:
+        this->lcd.drawRectangleFilled(region.x1, region.y1, region.x2, region.y2, node.color);
+        this->primitivesSent++;
+        break;
+
+    case NODE_CIRCLE: {
+        //Only the part inside the region may be touched
+        this->lcd.setClippingWindow(region.x1, region.y1, region.x2 - region.x1 + 1, region.y2 - region.y1 + 1);
+        int radius = (node.bounds.x2 - node.bounds.x1) / 2;
+        this->lcd.drawCircleFilled(node.bounds.x1 + radius, node.bounds.y1 + radius, radius, node.color);
+        this->lcd.setClippingWindow(0, 0, 0, 0);
+        this->primitivesSent += 3;
+        break;
+    }
+
+    case NODE_TEXT: {
+        int width = ULCD_CHAR_WIDTH * node.fontWidth;
+        int first = (region.x1 - node.bounds.x1) / width;
+        int last = (region.x2 - node.bounds.x1) / width;
+
+        char run[ULCD_SCENE_MAX_TEXT + 1];
+        int length = last - first + 1;
+        memcpy(run, &node.text[first], length);
+        run[length] = '\0';
+
+        //Text is drawn over its own background, so the panel's text opacity doesn't matter
+        this->lcd.drawRectangleFilled(region.x1, region.y1, region.x2, region.y2, node.background);
+        this->lcd.setFontSize(node.fontWidth, node.fontHeight);
+        this->lcd.setTextColor(node.color);
+        this->lcd.setTextBackground(node.background);
+        this->lcd.locate(node.column + first, node.row);
+        this->lcd.print(run);
+        this->primitivesSent += 3; //The font and colors are usually elided by uLCD
+        break;
+    }
+    }
+}
+
+void uLCDScene::update() {
+    this->dirtyCount = 0;
+
+    if (this->fullRedraw) {
+        this->fullRedraw = false;
+        this->lcd.drawRectangleFilled(0, 0, 127, 127, this->background);
+        this->primitivesSent++;
+
+        for (int i = 0; this->nodeCount > i; i++) {
+            this->nodes[i].drawn = false;
+            this->nodes[i].restyled = true;
+        }
+    }
+
+    //Finding what changed
+    for (int i = 0; this->nodeCount > i; i++) {
+        Node& node = this->nodes[i];
+
+        if (node.restyled) {
+            if (node.drawn) {
+                this->addDirty(node.drawnBounds);
+            }
+            if (node.visible) {
+                this->addDirty(node.bounds);
+            }
+        } else if (node.type == NODE_TEXT && node.visible) {
+            //Only the cells whose character changed, in runs
+            int length = strlen(node.text);
+            int drawnLength = strlen(node.drawnText);
+            int cells = length > drawnLength ? length : drawnLength;
+            int runStart = -1;
+
+            for (int c = 0; cells >= c; c++) {
+                bool changed = c < cells && (c >= length || c >= drawnLength || node.text[c] != node.drawnText[c]);
+                if (changed && runStart < 0) {
+                    runStart = c;
+                } else if (!changed && runStart >= 0) {
+                    this->addDirty(this->cellRegion(node, runStart, c - 1));
+                    runStart = -1;
+                }
+            }
+        }
+    }
+
+    //Erasing what no node will paint over
+    for (int d = 0; this->dirtyCount > d; d++) {
+        const Region& region = this->dirty[d];
+        bool covered = false;
+
+        for (int i = 0; this->nodeCount > i && !covered; i++) {
+            const Node& node = this->nodes[i];
+            covered = node.visible && node.type != NODE_CIRCLE &&
+                node.bounds.x1 <= region.x1 && node.bounds.y1 <= region.y1 &&
+                node.bounds.x2 >= region.x2 && node.bounds.y2 >= region.y2;
+        }
+
+        if (!covered) {
+            this->lcd.drawRectangleFilled(region.x1, region.y1, region.x2, region.y2, this->background);
+            this->primitivesSent++;
+        }
+    }
+
+    //Redrawing every node that touches a dirty region, bottom to top
+    for (int i = 0; this->nodeCount > i; i++) {
+        Node& node = this->nodes[i];
+
+        if (node.visible) {
+            for (int d = 0; this->dirtyCount > d; d++) {
+                const Region& region = this->dirty[d];
+                if (!intersects(node.bounds, region)) {
+                    continue;
+                }
+
+                Region part;
+                part.x1 = node.bounds.x1 > region.x1 ? node.bounds.x1 : region.x1;
+                part.y1 = node.bounds.y1 > region.y1 ? node.bounds.y1 : region.y1;
+                part.x2 = node.bounds.x2 < region.x2 ? node.bounds.x2 : region.x2;
+                part.y2 = node.bounds.y2 < region.y2 ? node.bounds.y2 : region.y2;
+                this->drawNode(node, part);
+            }
+        }
+
+        memcpy(node.drawnText, node.text, sizeof(node.text));
+        node.drawnBounds = node.bounds;
+        node.drawn = node.visible;
+        node.restyled = false;
+    }
+}
+
+void uLCDScene::invalidate() {
+    this->fullRedraw = true;
+}
+
+int uLCDScene::getPrimitivesSent() {
+    return this->primitivesSent;
+}
@@ -0,0 +1,152 @@
+/*
+ * uLCD Scene Class
+ *
+ * A retained-mode layer over uLCD. Rectangles, circles and text labels are
+ * added once and then changed; update() compares them with a shadow of what
+ * is already on the panel and only redraws the regions that changed. Text is
+ * compared per character, so a clock tick redraws the digits that moved
+ * instead of clearing and reprinting the whole screen.
+ *
+ * Nodes are drawn in the order they were added, later nodes on top.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_ULCD_SCENE_INCLUDED
+#define COLLECTION_ULCD_SCENE_INCLUDED
+
+#include "mbed.h"
+#include "uLCD.hpp"
+
+#define ULCD_SCENE_MAX_NODES 16
+#define ULCD_SCENE_MAX_TEXT 21 //Characters per label, a full row of the smallest font
+#define ULCD_SCENE_MAX_DIRTY 8 //Regions tracked per update before they are merged
+
+class uLCDScene {
+    private:
+
+    //Inclusive pixel bounds
+    struct Region {
+        int x1;
+        int y1;
+        int x2;
+        int y2;
+    };
+
+    enum NodeType {
+        NODE_RECTANGLE,
+        NODE_CIRCLE,
+        NODE_TEXT
+    };
+
+    struct Node {
+        uint8_t type;
+        bool visible;
+        bool restyled; //Anything but the text changed since the last update
+        bool drawn; //Whether the node is on the panel, in drawnBounds
+        Region bounds;
+        Region drawnBounds;
+        uint16_t color;
+        uint16_t background;
+
+        //Text only
+        int column;
+        int row;
+        int fontWidth;
+        int fontHeight;
+        char text[ULCD_SCENE_MAX_TEXT + 1];
+        char drawnText[ULCD_SCENE_MAX_TEXT + 1];
+    };
+
+    uLCD& lcd;
+    uint16_t background;
+    Node nodes[ULCD_SCENE_MAX_NODES];
+    int nodeCount;
+    Region dirty[ULCD_SCENE_MAX_DIRTY];
+    int dirtyCount;
+    bool fullRedraw;
+    int primitivesSent;
+
+    int addNode(NodeType type);
+
+    void updateTextBounds(Node& node);
+
+    Region cellRegion(const Node& node, int first, int last);
+
+    void addDirty(Region region);
+
+    void drawNode(Node& node, const Region& region);
+
+    static bool intersects(const Region& a, const Region& b);
+
+    public:
+
+    /**
+     * Creates an empty scene. The panel is assumed to be filled with the background color,
+     * call invalidate() if it isn't.
+     * @param lcd The display to draw on
+     * @param background The 4DGL color behind every node
+     */
+    uLCDScene(uLCD& lcd, uint16_t background = 0x0);
+
+    /**
+     * Adds a filled rectangle between two vertices
+     * @return the node id, -1 if the scene is full
+     */
+    int addRectangle(int x1, int y1, int x2, int y2, uint16_t color);
+
+    /**
+     * Adds a filled circle centered at (x, y)
+     * @return the node id, -1 if the scene is full
+     */
+    int addCircle(int x, int y, int radius, uint16_t color);
+
+    /**
+     * Adds a text label at the given text coordinates, which are in cells of the given font size
+     * like uLCD::locate(). Labels are drawn on their background color.
+     * @return the node id, -1 if the scene is full
+     */
+    int addText(int column, int row, int fontWidth, int fontHeight, uint16_t color, uint16_t background);
+
+    /** Moves or recolors a rectangle node */
+    void setRectangle(int id, int x1, int y1, int x2, int y2, uint16_t color);
+
+    /** Moves or recolors a circle node */
+    void setCircle(int id, int x, int y, int radius, uint16_t color);
+
+    /**
+     * Sets the string of a text node, cut to ULCD_SCENE_MAX_TEXT characters
+     * @param id The text node
+     * @param text The null-terminated string
+     */
+    void setText(int id, const char* text);
+
+    /**
+     * Sets the string of a text node from a format string
+     * @param id The text node
+     * @param format A string with the appropriate formatting codes
+     */
+    void setTextf(int id, const char* format, ...);
+
+    /** Changes the colors of a text node */
+    void setTextColor(int id, uint16_t color, uint16_t background);
+
+    /** Shows or hides a node, hidden nodes are erased on the next update */
+    void setVisible(int id, bool visible);
+
+    /**
+     * Sends the commands needed to make the panel match the scene. Only regions that changed
+     * since the last update are erased and redrawn.
+     */
+    void update();
+
+    /**
+     * Forgets what is on the panel, so the next update clears it and redraws every node.
+     */
+    void invalidate();
+
+    /** Returns the number of drawing commands sent by updates, for measuring the savings */
+    int getPrimitivesSent();
+};
+
+#endif // COLLECTION_ULCD_SCENE_INCLUDED
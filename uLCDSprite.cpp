@@ -0,0 +1,148 @@
+/*
+ * uLCD Sprite Functions
+ *
+ * Decoding and drawing of run-length encoded palette sprites.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "uLCDSprite.hpp"
+
+SpriteDecoder::SpriteDecoder(const uLCDSprite& sprite) : sprite(sprite) {
+    this->offset = 0;
+    this->runLength = 0;
+    this->runIndex = 0;
+}
+
+bool SpriteDecoder::nextRun(int& length, int& index) {
+    if (this->offset >= this->sprite.size) {
+        return false;
+    }
+
+    uint8_t run = this->sprite.data[this->offset++];
+    index = run >> 4;
+    length = (run & 0xF) + 1;
+    if (length == 16 && this->offset < this->sprite.size) {
+        length += this->sprite.data[this->offset++];
+    }
+    return true;
+}
+
+void SpriteDecoder::decode(uint16_t* pixels, int count) {
+    while (count > 0) {
+        if (!this->runLength) {
+            int length;
+            int index;
+            if (!this->nextRun(length, index)) {
+                length = count;
+                index = 0;
+            }
+            this->runLength = length;
+            this->runIndex = index;
+        }
+
+        int n = this->runLength < count ? this->runLength : count;
+        uint16_t color = this->sprite.palette[this->runIndex];
+        for (int i = 0; n > i; i++) {
+            pixels[i] = color;
+        }
+
+        pixels += n;
+        count -= n;
+        this->runLength -= n;
+    }
+}
+
+void SpriteDecoder::decodeRows(int row, int count, uint16_t* pixels) {
+    (void) row;
+    this->decode(pixels, count * this->sprite.width);
+}
+
+/**
+ * Calls draw with every rectangle a sprite is drawn with, as inclusive bounds relative to its corner
+ */
+template <typename F>
+static int forEachRectangle(const uLCDSprite& sprite, F draw) {
+    SpriteDecoder decoder(sprite);
+    int width = sprite.width;
+    int position = 0;
+    int rectangles = 0;
+    int nextLength;
+    int nextIndex;
+    bool more = decoder.nextRun(nextLength, nextIndex);
+
+    while (more) {
+        //Runs longer than one byte can hold are joined back together first
+        int length = nextLength;
+        int index = nextIndex;
+        while ((more = decoder.nextRun(nextLength, nextIndex)) && nextIndex == index) {
+            length += nextLength;
+        }
+
+        int start = position;
+        position += length;
+        if (index == sprite.transparent) {
+            continue;
+        }
+
+        int column = start % width;
+        int row = start / width;
+
+        //The end of the first row
+        if (column) {
+            int n = width - column < length ? width - column : length;
+            draw(column, row, column + n - 1, row, index);
+            rectangles++;
+            length -= n;
+            row++;
+        }
+
+        //Every full row at once
+        if (length >= width) {
+            int rows = length / width;
+            draw(0, row, width - 1, row + rows - 1, index);
+            rectangles++;
+            length -= rows * width;
+            row += rows;
+        }
+
+        //The start of the last row
+        if (length > 0) {
+            draw(0, row, length - 1, row, index);
+            rectangles++;
+        }
+    }
+
+    return rectangles;
+}
+
+int countSpriteRectangles(const uLCDSprite& sprite) {
+    return forEachRectangle(sprite, [](int, int, int, int, int) {});
+}
+
+SpriteMode drawSprite(uLCD& lcd, const uLCDSprite& sprite, int x, int y, SpriteMode mode) {
+    if (mode == SPRITE_AUTO) {
+        //A BLIT can't leave pixels alone
+        if (sprite.transparent != SPRITE_NO_TRANSPARENCY) {
+            mode = SPRITE_RECTANGLES;
+        } else {
+            int rectangles = countSpriteRectangles(sprite);
+            int rectangleCost = lcd.estimateCost(rectangles * 12, rectangles);
+            mode = rectangleCost <= lcd.estimateBLITCost(sprite.width, sprite.height) ? SPRITE_RECTANGLES : SPRITE_BLIT;
+        }
+    }
+
+    if (mode == SPRITE_RECTANGLES) {
+        forEachRectangle(sprite, [&](int x1, int y1, int x2, int y2, int index) {
+            lcd.drawRectangleFilled(x + x1, y + y1, x + x2, y + y2, sprite.palette[index]);
+        });
+        return SPRITE_RECTANGLES;
+    }
+
+    SpriteDecoder decoder(sprite);
+    if (!lcd.BLITStream(x, y, sprite.width, sprite.height, callback(&decoder, &SpriteDecoder::decodeRows))) {
+        //Without room for the chunk buffers rectangles still work
+        return drawSprite(lcd, sprite, x, y, SPRITE_RECTANGLES);
+    }
+    return SPRITE_BLIT;
+}
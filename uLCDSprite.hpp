@@ -0,0 +1,93 @@
+/*
+ * uLCD Sprite Functions
+ *
+ * A compressed image format for uLCD, meant to live in flash as constexpr
+ * arrays made by tools/spriteConvert. Each sprite has a palette of up to 16
+ * 4DGL colors and its pixels are run-length encoded row by row, continuing
+ * across rows. Each run is one byte:
+ *     high nibble: palette index, low nibble: run length - 1
+ * A low nibble of 15 means a second byte follows with the run length - 16,
+ * so one run covers up to 271 pixels.
+ *
+ * drawSprite() either streams the decoded rows into a BLIT or draws the runs
+ * as filled rectangles, whichever the uLCD cost model predicts to be faster.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_ULCD_SPRITE_INCLUDED
+#define COLLECTION_ULCD_SPRITE_INCLUDED
+
+#include "mbed.h"
+#include "uLCD.hpp"
+
+#define SPRITE_MAX_COLORS 16
+#define SPRITE_NO_TRANSPARENCY -1
+
+struct uLCDSprite {
+    uint8_t width;
+    uint8_t height;
+    int8_t transparent; //Palette index that is never drawn, SPRITE_NO_TRANSPARENCY for none
+    const uint16_t* palette; //4DGL colors
+    const uint8_t* data; //The runs
+    uint16_t size; //Bytes of runs
+};
+
+/**
+ * Walks the runs of a sprite in order
+ */
+class SpriteDecoder {
+    private:
+
+    const uLCDSprite& sprite;
+    int offset;
+    int runLength; //Pixels left in the current run
+    uint8_t runIndex;
+
+    public:
+
+    SpriteDecoder(const uLCDSprite& sprite);
+
+    /**
+     * Returns the next run of the sprite
+     * @param length Set to the number of pixels in the run
+     * @param index Set to the palette index of the run
+     * @return false once every run has been returned
+     */
+    bool nextRun(int& length, int& index);
+
+    /**
+     * Decodes the next pixels into 4DGL colors. Transparent pixels get their palette color.
+     * @param pixels Filled with count colors, past the end of the sprite with the first palette color
+     * @param count The number of pixels
+     */
+    void decode(uint16_t* pixels, int count);
+
+    /** Decodes the next rows, the row index is ignored, for use as a uLCD::RowSource */
+    void decodeRows(int row, int count, uint16_t* pixels);
+};
+
+enum SpriteMode {
+    SPRITE_AUTO, //The cheapest, always rectangles for sprites with transparency
+    SPRITE_BLIT, //Transparent pixels are painted with their palette color
+    SPRITE_RECTANGLES
+};
+
+/**
+ * Counts the filled rectangles a sprite is drawn with in SPRITE_RECTANGLES mode.
+ * Every run becomes at most three: the end of its first row, the full rows, and the start of its last row.
+ */
+int countSpriteRectangles(const uLCDSprite& sprite);
+
+/**
+ * Draws a sprite
+ * @param lcd The display to draw on
+ * @param sprite The sprite
+ * @param x The x coordinate of the top left corner
+ * @param y The y coordinate of the top left corner
+ * @param mode How to send the pixels
+ * @return the mode used, SPRITE_BLIT or SPRITE_RECTANGLES
+ */
+SpriteMode drawSprite(uLCD& lcd, const uLCDSprite& sprite, int x, int y, SpriteMode mode = SPRITE_AUTO);
+
+#endif // COLLECTION_ULCD_SPRITE_INCLUDED
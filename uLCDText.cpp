@@ -0,0 +1,244 @@
+/*
+ * uLCD Text Layout
+ *
+ * Word wrapping, alignment and clipping from the system font metrics.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "uLCDText.hpp"
+#include <cstring>
+
+//Wire bytes of a locate and of a print around its text
+#define ULCD_LOCATE_BYTES 6
+#define ULCD_PRINT_BYTES 3
+
+int getTextColumns(int fontWidth) {
+    return fontWidth > 0 ? ULCD_SCREEN_SIZE / (ULCD_CHAR_WIDTH * fontWidth) : 0;
+}
+
+int getTextRows(int fontHeight) {
+    return fontHeight > 0 ? ULCD_SCREEN_SIZE / (ULCD_CHAR_HEIGHT * fontHeight) : 0;
+}
+
+TextBox getScreenTextBox(int fontWidth, int fontHeight) {
+    TextBox box = {0, 0, getTextColumns(fontWidth), getTextRows(fontHeight), fontWidth, fontHeight};
+    return box;
+}
+
+/**
+ * Returns the part of a box that is on the screen
+ */
+static TextBox clipBox(const TextBox& box) {
+    TextBox area = box;
+    if (area.column < 0) {
+        area.columns += area.column;
+        area.column = 0;
+    }
+    if (area.row < 0) {
+        area.rows += area.row;
+        area.row = 0;
+    }
+
+    int columns = getTextColumns(box.fontWidth) - area.column;
+    int rows = getTextRows(box.fontHeight) - area.row;
+    if (area.columns > columns) {
+        area.columns = columns;
+    }
+    if (area.rows > rows) {
+        area.rows = rows;
+    }
+    if (area.columns < 0) {
+        area.columns = 0;
+    }
+    if (area.rows < 0) {
+        area.rows = 0;
+    }
+    return area;
+}
+
+void measureText(const char* text, int fontWidth, int fontHeight, int* width, int* height) {
+    int longest = 0;
+    int lines = *text ? 1 : 0;
+    int length = 0;
+
+    for (; *text; text++) {
+        if (*text == '\n') {
+            //A newline at the very end starts no line of its own
+            if (text[1]) {
+                lines++;
+            }
+            length = 0;
+            continue;
+        }
+        length++;
+        if (length > longest) {
+            longest = length;
+        }
+    }
+
+    *width = longest * ULCD_CHAR_WIDTH * fontWidth;
+    *height = lines * ULCD_CHAR_HEIGHT * fontHeight;
+}
+
+int layoutText(const char* text, const TextBox& box, TextAlign align, TextLine* lines, int maxLines, bool* clipped) {
+    TextBox area = clipBox(box);
+    int limit = area.rows < maxLines ? area.rows : maxLines;
+    int count = 0;
+    bool cut = false;
+
+    while (*text) {
+        if (count >= limit || !area.columns) {
+            cut = true;
+            break;
+        }
+
+        int length = 0;
+        int lastSpace = 0;
+        bool wrapped = false;
+        const char* next;
+
+        for (int i = 0;; i++) {
+            char c = text[i];
+            if (!c || c == '\n') {
+                length = i;
+                next = c ? &text[i + 1] : &text[i];
+                break;
+            }
+
+            if (i == area.columns) {
+                wrapped = true;
+                if (c == ' ') {
+                    //Fits exactly
+                    length = i;
+                    next = &text[i];
+                } else if (lastSpace > 0) {
+                    length = lastSpace;
+                    next = &text[lastSpace];
+                } else {
+                    //A word wider than the box is split
+                    length = i;
+                    next = &text[i];
+                }
+                break;
+            }
+
+            if (c == ' ') {
+                lastSpace = i;
+            }
+        }
+
+        //Spaces at a break would only push the line off center or start the next one indented
+        while (length > 0 && text[length - 1] == ' ') {
+            length--;
+        }
+        if (wrapped) {
+            while (*next == ' ') {
+                next++;
+            }
+            //The break already ended the line
+            if (*next == '\n') {
+                next++;
+            }
+        }
+
+        TextLine& line = lines[count];
+        line.text = text;
+        line.length = length;
+        line.row = area.row + count;
+        line.column = area.column;
+        if (align == TEXT_CENTER) {
+            line.column += (area.columns - length) / 2;
+        } else if (align == TEXT_RIGHT) {
+            line.column += area.columns - length;
+        }
+
+        count++;
+        text = next;
+    }
+
+    if (clipped) {
+        *clipped = cut;
+    }
+    return count;
+}
+
+static void appendChars(char* buffer, int& length, char c, int count) {
+    for (int i = 0; count > i; i++) {
+        buffer[length++] = c;
+    }
+}
+
+bool drawText(uLCD& lcd, const char* text, const TextBox& box, TextAlign align, bool fill) {
+    TextLine lines[ULCD_TEXT_MAX_LINES];
+    bool clipped;
+    int count = layoutText(text, box, align, lines, ULCD_TEXT_MAX_LINES, &clipped);
+    TextBox area = clipBox(box);
+
+    lcd.setFontSize(box.fontWidth, box.fontHeight);
+
+    //The print being built, which may span several rows
+    char buffer[ULCD_TEXT_MAX_LINES * (ULCD_SCREEN_SIZE / ULCD_CHAR_WIDTH + 1) + 1];
+    int length = 0;
+    int cursorRow = 0;
+
+    //Reaching a line with a locate means another print after it
+    int locateCost = lcd.estimateCost(ULCD_LOCATE_BYTES + ULCD_PRINT_BYTES, 2);
+
+    int segments = fill ? (area.rows < ULCD_TEXT_MAX_LINES ? area.rows : ULCD_TEXT_MAX_LINES) : count;
+    for (int i = 0; segments > i; i++) {
+        const TextLine* line = count > i ? &lines[i] : nullptr;
+        int row;
+        int column;
+        int padLeft = 0;
+        int padRight = 0;
+
+        if (fill) {
+            row = area.row + i;
+            column = area.column;
+            padLeft = line ? line->column - area.column : area.columns;
+            padRight = area.columns - padLeft - (line ? line->length : 0);
+        } else {
+            if (!line->length) {
+                continue;
+            }
+            row = line->row;
+            column = line->column;
+        }
+
+        //Newlines and spaces only cover cells of the box when it starts on the left edge
+        bool joined = false;
+        if (length && !area.column) {
+            int newlines = row - cursorRow;
+            joined = lcd.estimateCost(newlines + column, 0) + column * ULCD_TEXT_CHAR_US <= locateCost;
+            if (joined) {
+                appendChars(buffer, length, '\n', newlines);
+                appendChars(buffer, length, ' ', column);
+            }
+        }
+
+        if (!joined) {
+            if (length) {
+                buffer[length] = 0;
+                lcd.print(buffer);
+                length = 0;
+            }
+            lcd.locate(column, row);
+        }
+
+        appendChars(buffer, length, ' ', padLeft);
+        if (line) {
+            memcpy(&buffer[length], line->text, line->length);
+            length += line->length;
+        }
+        appendChars(buffer, length, ' ', padRight);
+        cursorRow = row;
+    }
+
+    if (length) {
+        buffer[length] = 0;
+        lcd.print(buffer);
+    }
+
+    return !clipped;
+}
@@ -0,0 +1,88 @@
+/*
+ * uLCD Text Layout
+ *
+ * Word wrapping, alignment and clipping of text, worked out locally from
+ * the metrics of the Goldelox system font so nothing has to be tried on the
+ * panel. Text is laid out in a box of character cells at the current font
+ * size, the same cells uLCD::locate() addresses. Layout is plain computation
+ * with no display involved, drawText() then sends the lines with as few
+ * locate and print commands as it can.
+ *
+ * Breaks go at spaces and '\n'. A word wider than the box is split, spaces
+ * at a break are dropped, and lines below the box are cut.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_ULCD_TEXT_INCLUDED
+#define COLLECTION_ULCD_TEXT_INCLUDED
+
+#include "mbed.h"
+#include "uLCD.hpp"
+
+//Most lines drawText() lays out at once
+#define ULCD_TEXT_MAX_LINES 16
+
+enum TextAlign {
+    TEXT_LEFT,
+    TEXT_CENTER,
+    TEXT_RIGHT
+};
+
+//A rectangle of text cells at one font size
+struct TextBox {
+    int column;
+    int row;
+    int columns;
+    int rows;
+    int fontWidth;
+    int fontHeight;
+};
+
+//One laid out line, pointing into the source text
+struct TextLine {
+    const char* text;
+    int length;
+    int column;
+    int row;
+};
+
+/** Returns how many text columns fit across the screen at a font width */
+int getTextColumns(int fontWidth);
+
+/** Returns how many text rows fit down the screen at a font height */
+int getTextRows(int fontHeight);
+
+/** Returns a box covering the whole screen at a font size */
+TextBox getScreenTextBox(int fontWidth, int fontHeight);
+
+/**
+ * Measures text as print() would draw it, with lines only broken at '\n'
+ * @param width Set to the width of the longest line in pixels
+ * @param height Set to the height of all lines in pixels
+ */
+void measureText(const char* text, int fontWidth, int fontHeight, int* width, int* height);
+
+/**
+ * Wraps, aligns and clips text into a box, itself clipped to the screen
+ * @param text The null-terminated string
+ * @param box Where the text goes
+ * @param align How each line sits between the sides of the box
+ * @param lines Set to the lines, top to bottom, blank lines included
+ * @param maxLines Size of lines
+ * @param clipped If not null, set to whether text was cut off at the bottom of the box or at maxLines
+ * @return the number of lines
+ */
+int layoutText(const char* text, const TextBox& box, TextAlign align, TextLine* lines, int maxLines, bool* clipped = nullptr);
+
+/**
+ * Lays out text and prints it in the box's font size with the current colors. Where reaching
+ * the next line with '\n' and a few spaces is cheaper than a locate, it is added to the same
+ * print, so a paragraph on the left edge of the screen is one locate and one print.
+ * @param fill Pad every line and row of the box with spaces, which clears text left by a
+ *     previous layout in the same box
+ * @return false if text was cut off
+ */
+bool drawText(uLCD& lcd, const char* text, const TextBox& box, TextAlign align, bool fill = false);
+
+#endif // COLLECTION_ULCD_TEXT_INCLUDED
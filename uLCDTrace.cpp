@@ -0,0 +1,173 @@
+/*
+ * uLCD Trace Class
+ *
+ * Compact recording of the commands a uLCD sends.
+ *
+ * (c) Daniel Cooper
+ */
+
+#include "uLCDTrace.hpp"
+#include <cstring>
+
+//A varint of a 32 bit value
+#define ULCD_TRACE_VARINT_BYTES 5
+
+uLCDTrace::uLCDTrace(uint8_t* buffer, int capacity) {
+    this->buffer = buffer;
+    this->capacity = capacity;
+    this->timer.start();
+    this->clear();
+}
+
+void uLCDTrace::clear() {
+    this->size = 0;
+    this->droppedRecords = 0;
+    this->timer.reset();
+    this->last_us = 0;
+
+    if (this->capacity >= ULCD_TRACE_HEADER_SIZE) {
+        memcpy(this->buffer, "ULTR", 4);
+        this->buffer[4] = ULCD_TRACE_VERSION;
+        this->size = ULCD_TRACE_HEADER_SIZE;
+    }
+}
+
+void uLCDTrace::putVarint(uint32_t value) {
+    while (value >= 0x80) {
+        this->buffer[this->size++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    this->buffer[this->size++] = (uint8_t) value;
+}
+
+bool uLCDTrace::beginRecord(uLCDTraceRecord type, int maxBytes) {
+    //Keeping later records after a dropped one would replay a run that never happened
+    if (this->droppedRecords || this->capacity - this->size < 1 + ULCD_TRACE_VARINT_BYTES + maxBytes) {
+        this->droppedRecords++;
+        return false;
+    }
+
+    uint32_t now_us = this->timer.read_us();
+    this->buffer[this->size++] = type;
+    this->putVarint(now_us - this->last_us);
+    this->last_us = now_us;
+    return true;
+}
+
+void uLCDTrace::recordCommand(const void* bytes, int size, int extraBytes) {
+    if (!this->beginRecord(ULCD_TRACE_COMMAND, 1 + ULCD_TRACE_VARINT_BYTES + size)) {
+        return;
+    }
+
+    this->buffer[this->size++] = (uint8_t) extraBytes;
+    this->putVarint(size);
+    memcpy(&this->buffer[this->size], bytes, size);
+    this->size += size;
+}
+
+void uLCDTrace::recordData(int size) {
+    if (this->beginRecord(ULCD_TRACE_DATA, ULCD_TRACE_VARINT_BYTES)) {
+        this->putVarint(size);
+    }
+}
+
+void uLCDTrace::markFrame() {
+    this->beginRecord(ULCD_TRACE_FRAME, 0);
+}
+
+void uLCDTrace::recordBaud(int baud) {
+    if (this->beginRecord(ULCD_TRACE_BAUD, ULCD_TRACE_VARINT_BYTES)) {
+        this->putVarint(baud);
+    }
+}
+
+const uint8_t* uLCDTrace::getData() {
+    return this->buffer;
+}
+
+int uLCDTrace::getSize() {
+    return this->size;
+}
+
+int uLCDTrace::getDroppedRecords() {
+    return this->droppedRecords;
+}
+
+bool uLCDTrace::isTrace(const uint8_t* data, int size) {
+    return size >= ULCD_TRACE_HEADER_SIZE && !memcmp(data, "ULTR", 4) && data[4] == ULCD_TRACE_VERSION;
+}
+
+/**
+ * Reads a varint, moving offset past it
+ * @return false if the trace ends first
+ */
+static bool getVarint(const uint8_t* data, int size, int& offset, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; ULCD_TRACE_VARINT_BYTES * 7 > shift; shift += 7) {
+        if (offset >= size) {
+            return false;
+        }
+        uint8_t byte = data[offset++];
+        value |= (uint32_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int uLCDTrace::readRecord(const uint8_t* data, int size, int offset, Record& record) {
+    if (offset >= size) {
+        return 0;
+    }
+
+    record.type = (uLCDTraceRecord) data[offset++];
+    record.extraBytes = 0;
+    record.bytes = nullptr;
+    record.size = 0;
+    record.baud = 0;
+    if (!getVarint(data, size, offset, record.delta_us)) {
+        return -1;
+    }
+
+    uint32_t value;
+    switch (record.type) {
+    case ULCD_TRACE_COMMAND:
+        if (offset >= size) {
+            return -1;
+        }
+        record.extraBytes = data[offset++];
+        if (!getVarint(data, size, offset, value) || (uint32_t) (size - offset) < value) {
+            return -1;
+        }
+        record.bytes = &data[offset];
+        record.size = value;
+        return offset + value;
+    case ULCD_TRACE_DATA:
+        if (!getVarint(data, size, offset, value)) {
+            return -1;
+        }
+        record.size = value;
+        return offset;
+    case ULCD_TRACE_FRAME:
+        return offset;
+    case ULCD_TRACE_BAUD:
+        if (!getVarint(data, size, offset, value)) {
+            return -1;
+        }
+        record.baud = value;
+        return offset;
+    default:
+        return -1;
+    }
+}
+
+void uLCDTrace::dump(FILE* file) {
+    for (int offset = 0; this->size > offset; offset += ULCD_TRACE_LINE_BYTES) {
+        fputs("ULCDTRACE ", file);
+        for (int i = offset; this->size > i && offset + ULCD_TRACE_LINE_BYTES > i; i++) {
+            fprintf(file, "%02X", this->buffer[i]);
+        }
+        fputc('\n', file);
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ * uLCD Trace Class
+ *
+ * Records the commands a uLCD sends into a compact binary trace in a caller
+ * supplied buffer, so the drawing of a run can be taken off the board and
+ * replayed on the host without the button waits between frames, see
+ * tools/traceReplay. Attach it with uLCD::setTrace() and mark the end of each
+ * frame with uLCD::traceFrame().
+ *
+ * Trace layout, every number an unsigned LEB128 varint unless noted:
+ *     "ULTR", the version (1 byte)
+ *     Then records, each a type byte and the microseconds since the previous record:
+ *         ULCD_TRACE_COMMAND: extra response bytes (1 byte), size, the encoded command
+ *         ULCD_TRACE_DATA: size of the pixels sent after the last BLIT header, not kept
+ *         ULCD_TRACE_FRAME: nothing, the end of a frame
+ *         ULCD_TRACE_BAUD: the new baud rate in bits per second
+ *
+ * Once the buffer is full every later record is dropped, so a trace is always
+ * a complete prefix of the run.
+ *
+ * (c) Daniel Cooper
+ */
+
+#ifndef COLLECTION_ULCD_TRACE_INCLUDED
+#define COLLECTION_ULCD_TRACE_INCLUDED
+
+#include "mbed.h"
+#include <cstdio>
+
+#define ULCD_TRACE_VERSION 1
+#define ULCD_TRACE_HEADER_SIZE 5
+
+//Bytes of trace printed on each line by dump()
+#define ULCD_TRACE_LINE_BYTES 32
+
+enum uLCDTraceRecord {
+    ULCD_TRACE_COMMAND = 1,
+    ULCD_TRACE_DATA = 2,
+    ULCD_TRACE_FRAME = 3,
+    ULCD_TRACE_BAUD = 4
+};
+
+class uLCDTrace {
+    public:
+
+    //A record read back by readRecord()
+    struct Record {
+        uLCDTraceRecord type;
+        uint32_t delta_us;
+        int extraBytes; //Of a command
+        const uint8_t* bytes; //Of a command, pointing into the trace
+        int size; //Bytes of a command or of data
+        int baud;
+    };
+
+    private:
+
+    uint8_t* buffer;
+    int capacity;
+    int size;
+    int droppedRecords;
+    Timer timer;
+    uint32_t last_us;
+
+    /**
+     * Starts a record if the buffer has room for it
+     * @param maxBytes The most bytes the record takes after its type and time
+     * @return false if the record was dropped
+     */
+    bool beginRecord(uLCDTraceRecord type, int maxBytes);
+
+    void putVarint(uint32_t value);
+
+    public:
+
+    /**
+     * @param buffer Where the trace is kept, e.g. a static array
+     * @param capacity Size of buffer in bytes
+     */
+    uLCDTrace(uint8_t* buffer, int capacity);
+
+    /** Empties the trace and restarts its clock */
+    void clear();
+
+    /**
+     * Records a command as it goes on the wire
+     * @param bytes The encoded command, starting with the command word
+     * @param size The number of bytes
+     * @param extraBytes The bytes the display returns after the ACK
+     */
+    void recordCommand(const void* bytes, int size, int extraBytes);
+
+    /** Records pixels sent after a BLIT header, only their number is kept */
+    void recordData(int size);
+
+    /** Records the end of a frame */
+    void markFrame();
+
+    /** Records a change of baud rate */
+    void recordBaud(int baud);
+
+    /** Returns the trace */
+    const uint8_t* getData();
+
+    /** Returns the size of the trace in bytes */
+    int getSize();
+
+    /** Returns the number of records dropped since the buffer filled up */
+    int getDroppedRecords();
+
+    /** Returns whether data starts with a trace header of this version */
+    static bool isTrace(const uint8_t* data, int size);
+
+    /**
+     * Reads one record of a trace
+     * @param data The trace, header included
+     * @param size The size of the trace
+     * @param offset Where the record starts, ULCD_TRACE_HEADER_SIZE for the first
+     * @param record Set to the record
+     * @return where the next record starts, 0 at the end of the trace, -1 if the record is cut off or unknown
+     */
+    static int readRecord(const uint8_t* data, int size, int offset, Record& record);
+
+    /**
+     * Prints the trace as hex, ULCD_TRACE_LINE_BYTES bytes to a line starting with "ULCDTRACE ",
+     * so it can be copied out of a console log that has other output in it
+     * @param file Where to print, e.g. stdout
+     */
+    void dump(FILE* file);
+};
+
+#endif // COLLECTION_ULCD_TRACE_INCLUDED